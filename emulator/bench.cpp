@@ -0,0 +1,300 @@
+/**
+ * @file bench.cpp
+ * @brief End-to-end UDF call benchmark against the Excel emulator
+ * @author mwmi
+ * @date 2025
+ *
+ * Loads the add-in through DllMain and xlAutoOpen, then calls the worksheet functions of functions.cpp the way
+ * Excel does: arguments converted for the registered type text, result copied and released through xlAutoFree12.
+ * For every case it reports calls per second, p50/p99 latency, heap allocations made by the add-in per call and
+ * Excel callbacks per call. The codec cases encode and decode RTD array values with xllType::serialize and with the
+ * earlier text codec (xllSerialize), reporting the time, encoded length, allocations and cells restored exactly.
+ *
+ * Usage: `xllbench [iterations]` (100000 by default, range cases run a fraction of it)
+ */
+#include "xllEmulator.h"
+#include "xllRangeCache.h"
+#include "xllTools.h"
+#include "xllType.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief Heap allocations made on this thread outside of emulator code
+static thread_local uint64_t allocations = 0;
+
+// The replacements are a matching set kept out of line: once inlined, GCC would see free() called on a pointer
+// returned by operator new and report -Wmismatched-new-delete
+[[gnu::noinline]] void* operator new(size_t n) {
+    if (!xllEmulator::excel_side()) allocations++;
+    void* p = std::malloc(n ? n : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+[[gnu::noinline]] void* operator new[](size_t n) {
+    return ::operator new(n);
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p) noexcept {
+    ::operator delete(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p, size_t) noexcept {
+    ::operator delete(p);
+}
+
+/// @brief One benchmark case
+struct Case {
+    const wchar_t* label;
+    const wchar_t* function;
+    std::vector<xllEmuValue> args;
+    /// @brief Divides the iteration count, for cases reading large ranges
+    int scale = 1;
+    /// @brief Share coerced ranges between calls, ending a recalculation every 100 calls
+    bool range_cache = false;
+};
+
+static void run(xllEmulator& excel, const Case& c, int iterations) {
+    int n = std::max(1, iterations / c.scale);
+    if (c.range_cache) xllRangeCache::instance().enable();
+    xllEmuCall call = excel.prepare(c.function, c.args);
+    xllEmuValue result;
+    call.invoke(&result);
+    std::wstring text = result.to_string();
+    if (text.size() > 24) text = text.substr(0, 21) + L"...";
+
+    // Warm up caches and per-thread return slots
+    for (int i = 0; i < n / 100; i++) call.invoke();
+
+    std::vector<double> latency(n);
+    xllRangeCacheStats cache = xllRangeCache::instance().stats();
+    uint64_t callbacks = excel.callbacks();
+    uint64_t allocs = allocations;
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        if (c.range_cache && i % 100 == 0) excel.calculation_ended();
+        auto t0 = std::chrono::steady_clock::now();
+        call.invoke();
+        auto t1 = std::chrono::steady_clock::now();
+        latency[i] = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        total += latency[i];
+    }
+    allocs = allocations - allocs;
+    callbacks = excel.callbacks() - callbacks;
+    xllRangeCacheStats cached = xllRangeCache::instance().stats();
+    if (c.range_cache) xllRangeCache::instance().disable();
+
+    std::sort(latency.begin(), latency.end());
+    double p50 = latency[n / 2], p99 = latency[std::min(n - 1, n * 99 / 100)];
+    std::printf("%-34ls %12.0f %10.0f %10.0f %8.2f %8.2f  %ls\n", c.label, n / (total * 1e-9), p50, p99,
+                double(allocs) / n, double(callbacks) / n, text.c_str());
+    if (c.range_cache) {
+        std::printf("%-34s %llu hits, %llu misses\n", "", (unsigned long long)(cached.hits - cache.hits),
+                    (unsigned long long)(cached.misses - cache.misses));
+    }
+}
+
+/// @brief Text codec of earlier versions: numbers with 6 decimals, booleans and errors as empty text
+static std::wstring text_encode(xllType& x) {
+    std::vector<std::vector<std::wstring>> data(x.get_rows());
+    int cols = x.get_cols(), i = 0;
+    for (auto cell : x) {
+        std::wstring t;
+        if (cell->is_num()) {
+            t = std::to_wstring(cell->get_num());
+            t.erase(t.find_last_not_of('0') + 1, std::wstring::npos);
+            if (!t.empty() && t.back() == '.') t.pop_back();
+        } else if (cell->is_str()) {
+            t = cell->get_str();
+        }
+        data[i++ / cols].push_back(std::move(t));
+    }
+    std::wstring out;
+    xllSerialize(data, out);
+    return out;
+}
+
+/// @brief Cells of the source the decoded value reproduces with their type and value
+static int exact_cells(xllType& src, xllType& decoded) {
+    if (!decoded.is_array() || decoded.size() != src.size()) return 0;
+    int exact = 0;
+    for (int i = 0; i < src.size(); i++) {
+        auto a = src.at(i), b = decoded.at(i);
+        if (a->type() != b->type()) continue;
+        if (a->is_num() ? a->get_num() == b->get_num() : a->is_str() ? a->get_str_view() == b->get_str_view()
+                                                                      : a->get_err() == b->get_err()) exact++;
+    }
+    return exact;
+}
+
+/// @brief Text decode to cells: strings only, numbers read back with wcstod
+static xllType text_decode(const std::wstring& s) {
+    std::vector<std::vector<std::wstring>> data;
+    xllDeserialize(s, data);
+    xllmartix m;
+    m.reserve(data.size());
+    for (auto& row : data) {
+        xlllist r;
+        r.reserve(row.size());
+        for (auto& t : row) {
+            wchar_t* end = nullptr;
+            double v = std::wcstod(t.c_str(), &end);
+            if (!t.empty() && *end == 0) r.emplace_back(v);
+            else r.emplace_back(t);
+        }
+        m.push_back(std::move(r));
+    }
+    return xllType(std::move(m));
+}
+
+/// @brief Encode and decode an array with the text codec and with xllType::serialize/deserialize
+static void codec(const char* label, const xllType& src, int iterations) {
+    int n = std::max(1, iterations / std::max(1, src.size() / 10));
+    for (int binary = 0; binary < 2; binary++) {
+        xllType value = src;
+        std::wstring encoded = binary ? std::wstring(xllType(src).serialize()->get_str()) : text_encode(value);
+        xllType decoded = binary ? xllType(encoded) : text_decode(encoded);
+        if (binary) decoded.deserialize();
+        int exact = exact_cells(value, decoded);
+
+        double encode = 0, decode = 0;
+        uint64_t allocs = allocations;
+        for (int i = 0; i < n; i++) {
+            xllType x = src;
+            auto t0 = std::chrono::steady_clock::now();
+            std::wstring e = binary ? std::wstring(x.serialize()->get_str()) : text_encode(x);
+            auto t1 = std::chrono::steady_clock::now();
+            xllType d = binary ? xllType(e) : text_decode(e);
+            if (binary) d.deserialize();
+            auto t2 = std::chrono::steady_clock::now();
+            encode += std::chrono::duration<double, std::nano>(t1 - t0).count();
+            decode += std::chrono::duration<double, std::nano>(t2 - t1).count();
+        }
+        allocs = allocations - allocs;
+        std::printf("%-22s %-7s %12.0f %12.0f %8zu %10.1f %6d/%d\n", label, binary ? "binary" : "text", encode / n,
+                    decode / n, encoded.size(), double(allocs) / n, exact, src.size());
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 100000;
+    if (iterations <= 0) iterations = 100000;
+
+    xllEmulator& excel = xllEmulator::instance();
+    int opened = excel.open();
+    std::printf("xlAutoOpen returned %d, %llu callbacks during load\n", opened, (unsigned long long)excel.callbacks());
+
+    // Sheet1: A1 = 2, B1 = 3, D1:D1000 numbers, E1:E1000 text; Data!A1:A1000 numbers
+    const int rows = 1000;
+    excel.set_cell(1, 0, 0, 2.0);
+    excel.set_cell(1, 0, 1, 3.0);
+    IDSHEET data = excel.add_sheet(L"Data");
+    for (int i = 0; i < rows; i++) {
+        excel.set_cell(1, i, 3, double(i + 1));
+        excel.set_cell(1, i, 4, L"s" + std::to_wstring(i % 10));
+        excel.set_cell(data, i, 0, double(i + 1));
+    }
+
+    // P1:Y20000 alternates number and text columns (200k cells), Large!A1:J100000 holds 1M numbers.
+    // The last cell is set first, so each grid is sized once.
+    const int mixed_rows = 20000, large_rows = 100000, wide = 10;
+    excel.set_cell(1, mixed_rows - 1, 15 + wide - 1, L"");
+    for (int i = 0; i < mixed_rows; i++) {
+        for (int j = 0; j < wide; j++) {
+            if (j % 2 == 0) excel.set_cell(1, i, 15 + j, i * 0.5 + j);
+            else excel.set_cell(1, i, 15 + j, L"t" + std::to_wstring(i % 100));
+        }
+    }
+    IDSHEET large = excel.add_sheet(L"Large");
+    excel.set_cell(large, large_rows - 1, wide - 1, 0.0);
+    for (int i = 0; i < large_rows; i++) {
+        for (int j = 0; j < wide; j++) excel.set_cell(large, i, j, i + j * 0.25);
+    }
+
+    std::vector<Case> cases = {
+        {L"HelloWorld()", L"HelloWorld", {}},
+        {L"Add(2, 3)", L"Add", {2.0, 3.0}},
+        {L"Add(A1, B1)", L"Add", {xllEmuValue::sref(0, 0, 0, 0), xllEmuValue::sref(0, 1, 0, 1)}},
+        {L"AddNum(2, 3) [BBB]", L"AddNum", {2.0, 3.0}},
+        {L"Repeat(\"ab\", 3) [D%D%J]", L"Repeat", {L"ab", 3.0}},
+        {L"Concat2(\"a\", \"b\")", L"Concat2", {L"a", L"b"}},
+        {L"RetArray() copies", L"RetArray", {}},
+        {L"RetArrayMove() moves", L"RetArrayMove", {}},
+        {L"MySum(D1:D1000)", L"MySum", {xllEmuValue::sref(0, 3, rows - 1, 3)}, 10},
+        {L"MyConcat(E1:E1000)", L"MyConcat", {xllEmuValue::sref(0, 4, rows - 1, 4)}, 10},
+        {L"FPTranspose(D1:D1000) [K%]", L"FPTranspose", {xllEmuValue::sref(0, 3, rows - 1, 3)}, 10},
+        {L"MySum(Data!A1:A1000)", L"MySum", {xllEmuValue::reference(data, 0, 0, rows - 1, 0)}, 10},
+        {L"MySum(Data!A1:A1000) range cache", L"MySum", {xllEmuValue::reference(data, 0, 0, rows - 1, 0)}, 10, true},
+        {L"MySum(D1:D1000) range cache", L"MySum", {xllEmuValue::sref(0, 3, rows - 1, 3)}, 10, true},
+        {L"ArrayEcho(P1:Y20000)", L"ArrayEcho", {xllEmuValue::sref(0, 15, mixed_rows - 1, 15 + wide - 1)}, 2000},
+        {L"UEcho(Large!A1:J100000) [U]", L"UEcho", {xllEmuValue::reference(large, 0, 0, large_rows - 1, wide - 1)},
+         10000},
+        {L"FPEcho(Large!A1:J100000) [K%]", L"FPEcho",
+         {xllEmuValue::reference(large, 0, 0, large_rows - 1, wide - 1)}, 10000},
+    };
+
+    std::printf("\n%-34s %12s %10s %10s %8s %8s  %s\n", "case", "calls/s", "p50 ns", "p99 ns", "allocs", "xlcalls", "result");
+    for (const Case& c : cases) {
+        if (!excel.registered(c.function)) {
+            std::printf("%-34ls not registered\n", c.label);
+            continue;
+        }
+        run(excel, c, iterations);
+    }
+
+    // Array codec of RTD values and arguments: a mixed table, prices and names
+    xllmartix mixed(10, xlllist(10));
+    for (int r = 0; r < 10; r++) {
+        for (int c = 0; c < 10; c++) {
+            xloper12 x;
+            switch (c % 5) {
+            case 0: mixed[r][c] = 100 + r / 3.0 + c; break;
+            case 1: mixed[r][c] = L"s" + std::to_wstring(r * 10 + c) + L", |\\"; break;
+            case 2: x.xltype = xltypeBool; x.val.xbool = r % 2; mixed[r][c] = x; break;
+            case 3: x.xltype = xltypeErr; x.val.err = xlerrNA; mixed[r][c] = x; break;
+            default: break;
+            }
+        }
+    }
+    std::mt19937_64 rng(7);
+    std::uniform_real_distribution<double> price(50, 150);
+    xlllist prices, names;
+    for (int i = 0; i < 1000; i++) prices.emplace_back(price(rng));
+    for (int i = 0; i < 1000; i++) names.emplace_back(L"Instrument " + std::to_wstring(i));
+    std::printf("\n%-22s %-7s %12s %12s %8s %10s %s\n", "array", "codec", "encode ns", "decode ns", "chars",
+                "allocs", "exact");
+    codec("10x10 mixed", xllType(mixed), iterations);
+    codec("1x1000 prices", xllType(prices), iterations);
+    codec("1x1000 names", xllType(names), iterations);
+
+    // RTD: time from connecting a topic until the server notifies Excel, then the cost of a connected call
+    auto t0 = std::chrono::steady_clock::now();
+    xllEmuValue first = excel.call(L"RTDHelloWorld", {});
+    while (!excel.rtd_pending() && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(5)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double update_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    long topics = excel.refresh_rtd();
+    run(excel, {L"RTDHelloWorld() connected", L"RTDHelloWorld", {}}, iterations);
+    std::printf("\nRTD first update after %.1f ms (%ld topic refreshed, initial value %ls)\n", update_ms, topics,
+                first.to_string().c_str());
+
+    excel.close();
+    std::printf("Excel values not released with xlFree: %lld\n", (long long)excel.outstanding());
+    return 0;
+}
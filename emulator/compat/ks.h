@@ -0,0 +1,3 @@
+#pragma once
+// Kernel streaming declarations are not used by the xll sources
+#include <windows.h>
@@ -0,0 +1,3 @@
+#pragma once
+// Win32 OLE declarations live in the emulator windows.h
+#include <windows.h>
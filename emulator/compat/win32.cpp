@@ -0,0 +1,662 @@
+#include <windows.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <cerrno>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const GUID IID_NULL = {0x00000000, 0x0000, 0x0000, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
+const GUID IID_IUnknown = {0x00000000, 0x0000, 0x0000, {0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}};
+const GUID IID_IDispatch = {0x00020400, 0x0000, 0x0000, {0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}};
+const GUID IID_IClassFactory = {0x00000001, 0x0000, 0x0000, {0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}};
+
+static thread_local DWORD last_error = 0;
+
+/// @brief Kernel object behind a HANDLE, released when the last reference is closed
+struct Win32Object {
+    std::atomic<int> refs = 1;
+    std::mutex m;
+    std::condition_variable cv;
+    /// @brief Signaled state, set once a thread has exited or while an event is set
+    bool signaled = false;
+    virtual ~Win32Object() = default;
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+};
+
+struct Win32Thread : Win32Object {
+    pthread_t thread{};
+    LPTHREAD_START_ROUTINE proc = nullptr;
+    LPVOID param = nullptr;
+};
+
+struct Win32Event : Win32Object {
+    bool manual_reset = false;
+};
+
+// ==================== Threads and synchronization ====================
+
+DWORD GetCurrentThreadId() {
+    static std::atomic<DWORD> next_id = 1;
+    static thread_local DWORD id = next_id.fetch_add(1);
+    return id;
+}
+
+DWORD GetCurrentProcessId() {
+    return static_cast<DWORD>(getpid());
+}
+
+DWORD GetLastError() {
+    return last_error;
+}
+
+/// @brief Marks the thread object signaled when the thread procedure returns or the thread is canceled
+struct Win32ThreadExit {
+    Win32Thread* t;
+    ~Win32ThreadExit() {
+        {
+            std::lock_guard<std::mutex> lock(t->m);
+            t->signaled = true;
+        }
+        t->cv.notify_all();
+        t->release();
+    }
+};
+
+static void* thread_start(void* p) {
+    Win32Thread* t = static_cast<Win32Thread*>(p);
+    Win32ThreadExit exit{t};
+    t->proc(t->param);
+    return nullptr;
+}
+
+HANDLE CreateThread(void*, size_t, LPTHREAD_START_ROUTINE lpStartAddress, LPVOID lpParameter, DWORD, DWORD* lpThreadId) {
+    Win32Thread* t = new Win32Thread();
+    t->proc = lpStartAddress;
+    t->param = lpParameter;
+    // One reference for the handle, one for the running thread
+    t->refs = 2;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int r = pthread_create(&t->thread, &attr, thread_start, t);
+    pthread_attr_destroy(&attr);
+    if (r != 0) {
+        delete t;
+        last_error = r;
+        return nullptr;
+    }
+    if (lpThreadId) *lpThreadId = static_cast<DWORD>(reinterpret_cast<uintptr_t>(t) & 0x7FFFFFFF);
+    return t;
+}
+
+BOOL TerminateThread(HANDLE hThread, DWORD) {
+    Win32Thread* t = dynamic_cast<Win32Thread*>(static_cast<Win32Object*>(hThread));
+    if (t == nullptr) return FALSE;
+    {
+        std::lock_guard<std::mutex> lock(t->m);
+        if (t->signaled) return TRUE;
+        // Cancellation unwinds the thread at its next blocking call (Sleep, waits), which is where the
+        // add-in threads spend their time. Unlike Windows, destructors on the thread's stack do run.
+        if (pthread_cancel(t->thread) != 0) return FALSE;
+    }
+    // Callers free what the thread works on right after this returns, give the unwinding a bounded wait
+    return WaitForSingleObject(hThread, 1000) == WAIT_OBJECT_0;
+}
+
+HANDLE CreateEventW(void*, BOOL bManualReset, BOOL bInitialState, LPCWSTR) {
+    Win32Event* e = new Win32Event();
+    e->manual_reset = bManualReset;
+    e->signaled = bInitialState;
+    return e;
+}
+
+BOOL SetEvent(HANDLE hEvent) {
+    Win32Event* e = dynamic_cast<Win32Event*>(static_cast<Win32Object*>(hEvent));
+    if (e == nullptr) return FALSE;
+    {
+        std::lock_guard<std::mutex> lock(e->m);
+        e->signaled = true;
+    }
+    if (e->manual_reset) {
+        e->cv.notify_all();
+    } else {
+        e->cv.notify_one();
+    }
+    return TRUE;
+}
+
+BOOL ResetEvent(HANDLE hEvent) {
+    Win32Event* e = dynamic_cast<Win32Event*>(static_cast<Win32Object*>(hEvent));
+    if (e == nullptr) return FALSE;
+    std::lock_guard<std::mutex> lock(e->m);
+    e->signaled = false;
+    return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds) {
+    Win32Object* o = static_cast<Win32Object*>(hHandle);
+    if (o == nullptr) return WAIT_FAILED;
+    std::unique_lock<std::mutex> lock(o->m);
+    auto ready = [o]() { return o->signaled; };
+    if (dwMilliseconds == INFINITE) {
+        o->cv.wait(lock, ready);
+    } else if (!o->cv.wait_for(lock, std::chrono::milliseconds(dwMilliseconds), ready)) {
+        return WAIT_TIMEOUT;
+    }
+    Win32Event* e = dynamic_cast<Win32Event*>(o);
+    if (e && !e->manual_reset) e->signaled = false;
+    return WAIT_OBJECT_0;
+}
+
+BOOL CloseHandle(HANDLE hObject) {
+    if (hObject == nullptr) return FALSE;
+    static_cast<Win32Object*>(hObject)->release();
+    return TRUE;
+}
+
+void Sleep(DWORD dwMilliseconds) {
+    // nanosleep is a cancellation point, so TerminateThread reaches sleeping threads
+    timespec ts{static_cast<time_t>(dwMilliseconds / 1000), static_cast<long>(dwMilliseconds % 1000) * 1000000L};
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+}
+
+DWORD GetTickCount() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+}
+
+void GetLocalTime(SYSTEMTIME* st) {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    tm t;
+    localtime_r(&ts.tv_sec, &t);
+    st->wYear = WORD(t.tm_year + 1900);
+    st->wMonth = WORD(t.tm_mon + 1);
+    st->wDayOfWeek = WORD(t.tm_wday);
+    st->wDay = WORD(t.tm_mday);
+    st->wHour = WORD(t.tm_hour);
+    st->wMinute = WORD(t.tm_min);
+    st->wSecond = WORD(t.tm_sec);
+    st->wMilliseconds = WORD(ts.tv_nsec / 1000000);
+}
+
+// ==================== Modules ====================
+
+HMODULE GetModuleHandleW(LPCWSTR lpModuleName) {
+    // Only the host executable is known, the emulator exports its callback entry point from there
+    if (lpModuleName != nullptr) return nullptr;
+    return dlopen(nullptr, RTLD_LAZY);
+}
+
+FARPROC GetProcAddress(HMODULE hModule, const char* lpProcName) {
+    if (hModule == nullptr) return nullptr;
+    return reinterpret_cast<FARPROC>(dlsym(hModule, lpProcName));
+}
+
+/// @brief Decode UTF-8 into wide characters @return Characters written (or needed when out is null)
+static size_t utf8_decode(const char* s, size_t n, wchar_t* out) {
+    size_t count = 0;
+    for (size_t i = 0; i < n;) {
+        unsigned char c = s[i];
+        uint32_t cp = c;
+        int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+        if (extra) cp = c & (0x3F >> extra);
+        i++;
+        for (int k = 0; k < extra && i < n; k++, i++) cp = (cp << 6) | (s[i] & 0x3F);
+        if (out) out[count] = static_cast<wchar_t>(cp);
+        count++;
+    }
+    return count;
+}
+
+/// @brief Encode wide characters as UTF-8
+static std::string utf8_encode(const wchar_t* s) {
+    std::string ret;
+    for (; s && *s; s++) {
+        uint32_t cp = static_cast<uint32_t>(*s);
+        if (cp < 0x80) {
+            ret += char(cp);
+        } else if (cp < 0x800) {
+            ret += char(0xC0 | (cp >> 6));
+            ret += char(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            ret += char(0xE0 | (cp >> 12));
+            ret += char(0x80 | ((cp >> 6) & 0x3F));
+            ret += char(0x80 | (cp & 0x3F));
+        } else {
+            ret += char(0xF0 | (cp >> 18));
+            ret += char(0x80 | ((cp >> 12) & 0x3F));
+            ret += char(0x80 | ((cp >> 6) & 0x3F));
+            ret += char(0x80 | (cp & 0x3F));
+        }
+    }
+    return ret;
+}
+
+DWORD GetModuleFileNameW(HMODULE, LPWSTR lpFilename, DWORD nSize) {
+    char path[1024];
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (n <= 0 || nSize == 0) return 0;
+    size_t len = utf8_decode(path, size_t(n), nullptr);
+    if (len >= nSize) return 0;
+    utf8_decode(path, size_t(n), lpFilename);
+    lpFilename[len] = L'\0';
+    return static_cast<DWORD>(len);
+}
+
+// ==================== Strings and UI ====================
+
+int MultiByteToWideChar(UINT, DWORD, const char* lpMultiByteStr, int cbMultiByte, LPWSTR lpWideCharStr, int cchWideChar) {
+    // A length of -1 includes the terminating null in the conversion, as on Windows
+    size_t n = cbMultiByte < 0 ? std::strlen(lpMultiByteStr) + 1 : size_t(cbMultiByte);
+    size_t len = utf8_decode(lpMultiByteStr, n, nullptr);
+    if (cchWideChar == 0) return static_cast<int>(len);
+    if (len > size_t(cchWideChar)) return 0;
+    utf8_decode(lpMultiByteStr, n, lpWideCharStr);
+    return static_cast<int>(len);
+}
+
+int lstrlenW(LPCWSTR lpString) {
+    return lpString ? static_cast<int>(std::wcslen(lpString)) : 0;
+}
+
+int MessageBoxW(HWND, LPCWSTR lpText, LPCWSTR lpCaption, UINT) {
+    std::fprintf(stderr, "[%s] %s\n", utf8_encode(lpCaption).c_str(), utf8_encode(lpText).c_str());
+    return 1;
+}
+
+BOOL EnumWindows(WNDENUMPROC, LPARAM) {
+    return TRUE;
+}
+
+DWORD GetWindowThreadProcessId(HWND, DWORD* lpdwProcessId) {
+    if (lpdwProcessId) *lpdwProcessId = 0;
+    return 0;
+}
+
+int GetClassNameW(HWND, LPWSTR lpClassName, int nMaxCount) {
+    if (nMaxCount > 0) lpClassName[0] = L'\0';
+    return 0;
+}
+
+// ==================== Registry ====================
+
+/// @brief Open registry key, the handle owns its full path
+struct Win32RegKey {
+    std::wstring path;
+};
+
+static std::mutex registry_mutex;
+static std::map<std::wstring, std::map<std::wstring, std::wstring>> registry;
+
+static std::wstring reg_path(HKEY hKey, LPCWSTR lpSubKey) {
+    std::wstring path;
+    if (hKey == HKEY_CURRENT_USER) {
+        path = L"HKCU";
+    } else if (hKey == HKEY_LOCAL_MACHINE) {
+        path = L"HKLM";
+    } else {
+        path = static_cast<Win32RegKey*>(hKey)->path;
+    }
+    if (lpSubKey && *lpSubKey) path += std::wstring(L"\\") + lpSubKey;
+    return path;
+}
+
+LONG RegCreateKeyW(HKEY hKey, LPCWSTR lpSubKey, HKEY* phkResult) {
+    // The emulated user has no administrator rights, HKEY_LOCAL_MACHINE is read-only
+    if (hKey == HKEY_LOCAL_MACHINE) return 5;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::wstring path = reg_path(hKey, lpSubKey);
+    registry[path];
+    *phkResult = new Win32RegKey{path};
+    return ERROR_SUCCESS;
+}
+
+LONG RegOpenKeyExW(HKEY hKey, LPCWSTR lpSubKey, DWORD, DWORD samDesired, HKEY* phkResult) {
+    if (hKey == HKEY_LOCAL_MACHINE && (samDesired & KEY_WRITE) == KEY_WRITE) return 5;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::wstring path = reg_path(hKey, lpSubKey);
+    if (registry.find(path) == registry.end()) return ERROR_FILE_NOT_FOUND;
+    *phkResult = new Win32RegKey{path};
+    return ERROR_SUCCESS;
+}
+
+LONG RegSetValueExW(HKEY hKey, LPCWSTR lpValueName, DWORD, DWORD, const BYTE* lpData, DWORD cbData) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::wstring value(reinterpret_cast<const wchar_t*>(lpData), cbData / sizeof(wchar_t));
+    if (!value.empty() && value.back() == L'\0') value.pop_back();
+    registry[static_cast<Win32RegKey*>(hKey)->path][lpValueName ? lpValueName : L""] = value;
+    return ERROR_SUCCESS;
+}
+
+LONG RegQueryValueExW(HKEY hKey, LPCWSTR lpValueName, DWORD*, DWORD* lpType, LPBYTE lpData, DWORD* lpcbData) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto& values = registry[static_cast<Win32RegKey*>(hKey)->path];
+    auto it = values.find(lpValueName ? lpValueName : L"");
+    if (it == values.end()) return ERROR_FILE_NOT_FOUND;
+    DWORD bytes = static_cast<DWORD>((it->second.size() + 1) * sizeof(wchar_t));
+    if (lpType) *lpType = REG_SZ;
+    if (lpData && lpcbData && *lpcbData >= bytes) std::memcpy(lpData, it->second.c_str(), bytes);
+    if (lpcbData) *lpcbData = bytes;
+    return ERROR_SUCCESS;
+}
+
+LONG RegDeleteKeyW(HKEY hKey, LPCWSTR lpSubKey) {
+    if (hKey == HKEY_LOCAL_MACHINE) return 5;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    return registry.erase(reg_path(hKey, lpSubKey)) ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND;
+}
+
+LONG RegCloseKey(HKEY hKey) {
+    if (hKey != HKEY_CURRENT_USER && hKey != HKEY_LOCAL_MACHINE) delete static_cast<Win32RegKey*>(hKey);
+    return ERROR_SUCCESS;
+}
+
+// ==================== Shared memory ====================
+
+/// @brief Named mapping, the shm object's name is removed by the handle that created it
+struct Win32Mapping : Win32Object {
+    int fd = -1;
+    bool writable = true;
+    bool owner = false;
+    std::string name;
+    ~Win32Mapping() override {
+        if (fd >= 0) close(fd);
+        if (owner) shm_unlink(name.c_str());
+    }
+};
+
+/// @brief Lengths of the mapped views, for UnmapViewOfFile
+static std::mutex views_mutex;
+static std::map<const void*, size_t> views;
+
+/// @brief shm object name for a kernel object name, `Local\feed` becomes `/Local_feed`
+static std::string shm_name(LPCWSTR lpName) {
+    // Appended rather than concatenated, GCC 12 reports a false -Wrestrict on "/" + std::string at -O3
+    std::string name = "/";
+    name.append(utf8_encode(lpName));
+    for (size_t i = 1; i < name.size(); i++) {
+        if (name[i] == '/' || name[i] == '\\') name[i] = '_';
+    }
+    return name;
+}
+
+HANDLE CreateFileMappingW(HANDLE hFile, void*, DWORD, DWORD dwMaximumSizeHigh, DWORD dwMaximumSizeLow, LPCWSTR lpName) {
+    // Only named mappings backed by the paging file are used
+    if (hFile != INVALID_HANDLE_VALUE || lpName == nullptr) {
+        last_error = 87; // ERROR_INVALID_PARAMETER
+        return nullptr;
+    }
+    Win32Mapping* m = new Win32Mapping();
+    m->name = shm_name(lpName);
+    bool existed = false;
+    m->fd = shm_open(m->name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (m->fd < 0 && errno == EEXIST) {
+        existed = true;
+        m->fd = shm_open(m->name.c_str(), O_RDWR, 0600);
+    }
+    if (m->fd < 0) {
+        last_error = errno;
+        delete m;
+        return nullptr;
+    }
+    if (!existed) {
+        // New objects are empty, and zero filled once sized like a fresh Windows mapping
+        m->owner = true;
+        off_t size = static_cast<off_t>((uint64_t(dwMaximumSizeHigh) << 32) | dwMaximumSizeLow);
+        if (ftruncate(m->fd, size) != 0) {
+            last_error = errno;
+            delete m;
+            return nullptr;
+        }
+    }
+    last_error = existed ? ERROR_ALREADY_EXISTS : ERROR_SUCCESS;
+    return m;
+}
+
+HANDLE OpenFileMappingW(DWORD dwDesiredAccess, BOOL, LPCWSTR lpName) {
+    if (lpName == nullptr) {
+        last_error = 87; // ERROR_INVALID_PARAMETER
+        return nullptr;
+    }
+    Win32Mapping* m = new Win32Mapping();
+    m->name = shm_name(lpName);
+    m->writable = (dwDesiredAccess & FILE_MAP_WRITE) != 0;
+    m->fd = shm_open(m->name.c_str(), m->writable ? O_RDWR : O_RDONLY, 0600);
+    if (m->fd < 0) {
+        last_error = ERROR_FILE_NOT_FOUND;
+        delete m;
+        return nullptr;
+    }
+    return m;
+}
+
+LPVOID MapViewOfFile(HANDLE hFileMappingObject, DWORD dwDesiredAccess, DWORD dwFileOffsetHigh, DWORD dwFileOffsetLow,
+                     size_t dwNumberOfBytesToMap) {
+    Win32Mapping* m = dynamic_cast<Win32Mapping*>(static_cast<Win32Object*>(hFileMappingObject));
+    if (m == nullptr) return nullptr;
+    bool write = (dwDesiredAccess & FILE_MAP_WRITE) != 0;
+    if (write && !m->writable) {
+        last_error = 5; // ERROR_ACCESS_DENIED
+        return nullptr;
+    }
+    off_t offset = static_cast<off_t>((uint64_t(dwFileOffsetHigh) << 32) | dwFileOffsetLow);
+    size_t length = dwNumberOfBytesToMap;
+    if (length == 0) {
+        // The whole mapping from the offset, as on Windows
+        struct stat st;
+        if (fstat(m->fd, &st) != 0 || st.st_size <= offset) {
+            last_error = errno;
+            return nullptr;
+        }
+        length = static_cast<size_t>(st.st_size - offset);
+    }
+    void* view = mmap(nullptr, length, PROT_READ | (write ? PROT_WRITE : 0), MAP_SHARED, m->fd, offset);
+    if (view == MAP_FAILED) {
+        last_error = errno;
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(views_mutex);
+    views[view] = length;
+    return view;
+}
+
+BOOL UnmapViewOfFile(const void* lpBaseAddress) {
+    size_t length = 0;
+    {
+        std::lock_guard<std::mutex> lock(views_mutex);
+        auto it = views.find(lpBaseAddress);
+        if (it == views.end()) return FALSE;
+        length = it->second;
+        views.erase(it);
+    }
+    return munmap(const_cast<void*>(lpBaseAddress), length) == 0;
+}
+
+// ==================== Automation ====================
+
+/// @brief BSTR header, the byte length sits right before the characters
+struct BstrHeader {
+    uint32_t reserved;
+    uint32_t bytes;
+};
+
+BSTR SysAllocStringLen(const wchar_t* strIn, UINT ui) {
+    BstrHeader* h = static_cast<BstrHeader*>(std::malloc(sizeof(BstrHeader) + (size_t(ui) + 1) * sizeof(wchar_t)));
+    if (h == nullptr) return nullptr;
+    h->bytes = ui * sizeof(wchar_t);
+    BSTR s = reinterpret_cast<BSTR>(h + 1);
+    if (strIn) std::memcpy(s, strIn, ui * sizeof(wchar_t));
+    s[ui] = L'\0';
+    return s;
+}
+
+BSTR SysAllocString(const wchar_t* psz) {
+    return psz ? SysAllocStringLen(psz, static_cast<UINT>(std::wcslen(psz))) : nullptr;
+}
+
+void SysFreeString(BSTR bstrString) {
+    if (bstrString) std::free(reinterpret_cast<BstrHeader*>(bstrString) - 1);
+}
+
+UINT SysStringLen(BSTR pbstr) {
+    return pbstr ? (reinterpret_cast<BstrHeader*>(pbstr) - 1)->bytes / sizeof(wchar_t) : 0;
+}
+
+void VariantInit(VARIANT* pvarg) {
+    std::memset(pvarg, 0, sizeof(VARIANT));
+    pvarg->vt = VT_EMPTY;
+}
+
+HRESULT VariantClear(VARIANT* pvarg) {
+    if (pvarg->vt == VT_BSTR) SysFreeString(pvarg->bstrVal);
+    VariantInit(pvarg);
+    return S_OK;
+}
+
+HRESULT VariantCopy(VARIANT* pvargDest, const VARIANT* pvargSrc) {
+    if (pvargDest == pvargSrc) return S_OK;
+    VariantClear(pvargDest);
+    *pvargDest = *pvargSrc;
+    if (pvargSrc->vt == VT_BSTR && pvargSrc->bstrVal) {
+        pvargDest->bstrVal = SysAllocStringLen(pvargSrc->bstrVal, SysStringLen(pvargSrc->bstrVal));
+        if (pvargDest->bstrVal == nullptr) return E_OUTOFMEMORY;
+    }
+    return S_OK;
+}
+
+constexpr unsigned short FADF_BSTR = 0x0100;
+constexpr unsigned short FADF_VARIANT = 0x0800;
+
+SAFEARRAY* SafeArrayCreate(VARTYPE vt, UINT cDims, SAFEARRAYBOUND* rgsabound) {
+    if (cDims == 0) return nullptr;
+    ULONG element;
+    unsigned short features = 0;
+    switch (vt) {
+    case VT_VARIANT: element = sizeof(VARIANT), features = FADF_VARIANT; break;
+    case VT_BSTR: element = sizeof(BSTR), features = FADF_BSTR; break;
+    case VT_R8: element = sizeof(double); break;
+    case VT_I4: element = sizeof(LONG); break;
+    default: return nullptr;
+    }
+    size_t n = 1;
+    for (UINT k = 0; k < cDims; k++) n *= rgsabound[k].cElements;
+    SAFEARRAY* psa = static_cast<SAFEARRAY*>(std::calloc(1, sizeof(SAFEARRAY) + (cDims - 1) * sizeof(SAFEARRAYBOUND)));
+    if (psa == nullptr) return nullptr;
+    psa->cDims = static_cast<unsigned short>(cDims);
+    psa->fFeatures = features;
+    psa->cbElements = element;
+    for (UINT k = 0; k < cDims; k++) psa->rgsabound[cDims - 1 - k] = rgsabound[k];
+    // Zeroed memory is VT_EMPTY for VARIANT elements and a null BSTR for BSTR elements
+    psa->pvData = std::calloc(n ? n : 1, element);
+    if (psa->pvData == nullptr) {
+        std::free(psa);
+        return nullptr;
+    }
+    return psa;
+}
+
+/// @brief Element count of a SAFEARRAY
+static size_t safearray_count(const SAFEARRAY* psa) {
+    size_t n = 1;
+    for (unsigned k = 0; k < psa->cDims; k++) n *= psa->rgsabound[k].cElements;
+    return n;
+}
+
+/// @brief Address of an element, the leftmost index varies fastest @return nullptr when out of bounds
+static void* safearray_element(SAFEARRAY* psa, const LONG* rgIndices) {
+    size_t offset = 0, stride = 1;
+    for (unsigned k = 0; k < psa->cDims; k++) {
+        const SAFEARRAYBOUND& b = psa->rgsabound[psa->cDims - 1 - k];
+        LONG i = rgIndices[k] - b.lLbound;
+        if (i < 0 || ULONG(i) >= b.cElements) return nullptr;
+        offset += size_t(i) * stride;
+        stride *= b.cElements;
+    }
+    return static_cast<char*>(psa->pvData) + offset * psa->cbElements;
+}
+
+HRESULT SafeArrayDestroy(SAFEARRAY* psa) {
+    if (psa == nullptr) return S_OK;
+    size_t n = safearray_count(psa);
+    if (psa->fFeatures & FADF_VARIANT) {
+        VARIANT* v = static_cast<VARIANT*>(psa->pvData);
+        for (size_t i = 0; i < n; i++) VariantClear(&v[i]);
+    } else if (psa->fFeatures & FADF_BSTR) {
+        BSTR* s = static_cast<BSTR*>(psa->pvData);
+        for (size_t i = 0; i < n; i++) SysFreeString(s[i]);
+    }
+    std::free(psa->pvData);
+    std::free(psa);
+    return S_OK;
+}
+
+HRESULT SafeArrayPutElement(SAFEARRAY* psa, LONG* rgIndices, void* pv) {
+    if (psa == nullptr || rgIndices == nullptr) return E_INVALIDARG;
+    void* p = safearray_element(psa, rgIndices);
+    if (p == nullptr) return DISP_E_BADINDEX;
+    if (psa->fFeatures & FADF_VARIANT) return VariantCopy(static_cast<VARIANT*>(p), static_cast<const VARIANT*>(pv));
+    if (psa->fFeatures & FADF_BSTR) {
+        BSTR* s = static_cast<BSTR*>(p);
+        SysFreeString(*s);
+        *s = SysAllocString(static_cast<const wchar_t*>(pv));
+        return S_OK;
+    }
+    std::memcpy(p, pv, psa->cbElements);
+    return S_OK;
+}
+
+HRESULT SafeArrayGetElement(SAFEARRAY* psa, LONG* rgIndices, void* pv) {
+    if (psa == nullptr || rgIndices == nullptr) return E_INVALIDARG;
+    void* p = safearray_element(psa, rgIndices);
+    if (p == nullptr) return DISP_E_BADINDEX;
+    if (psa->fFeatures & FADF_VARIANT) {
+        VariantInit(static_cast<VARIANT*>(pv));
+        return VariantCopy(static_cast<VARIANT*>(pv), static_cast<const VARIANT*>(p));
+    }
+    if (psa->fFeatures & FADF_BSTR) {
+        BSTR s = *static_cast<BSTR*>(p);
+        *static_cast<BSTR*>(pv) = s ? SysAllocStringLen(s, SysStringLen(s)) : nullptr;
+        return S_OK;
+    }
+    std::memcpy(pv, p, psa->cbElements);
+    return S_OK;
+}
+
+HRESULT SafeArrayAccessData(SAFEARRAY* psa, void** ppvData) {
+    if (psa == nullptr || ppvData == nullptr) return E_INVALIDARG;
+    psa->cLocks++;
+    *ppvData = psa->pvData;
+    return S_OK;
+}
+
+HRESULT SafeArrayUnaccessData(SAFEARRAY* psa) {
+    if (psa == nullptr || psa->cLocks == 0) return E_INVALIDARG;
+    psa->cLocks--;
+    return S_OK;
+}
+
+HRESULT LoadRegTypeLib(REFGUID, WORD, WORD, LCID, ITypeLib** pptlib) {
+    // No type libraries outside Windows, IDispatch late binding is not available
+    *pptlib = nullptr;
+    return E_FAIL;
+}
+
+HRESULT LoadTypeLib(LPCWSTR, ITypeLib** pptlib) {
+    *pptlib = nullptr;
+    return E_FAIL;
+}
@@ -0,0 +1,316 @@
+/**
+ * @file windows.h
+ * @brief Win32 and COM subset used by the xll sources, for building them outside Windows
+ * @author mwmi
+ * @date 2025
+ *
+ * Only the emulator build puts this directory on the include path. Types keep their Windows names and layouts
+ * where the sources depend on them (BSTR length prefix, SAFEARRAY bounds, VARIANT tags), calling conventions and
+ * export attributes expand to nothing or to default visibility. The functions are implemented in win32.cpp.
+ *
+ * @note This is not a general Win32 layer, declarations are added only when the xll sources use them
+ */
+#pragma once
+#ifndef _WINDOWS_
+#define _WINDOWS_
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+
+// Calling conventions and attributes
+#define __declspec(x) __attribute__((visibility("default")))
+#define __stdcall
+#define __cdecl
+#define _cdecl
+#define pascal
+#define PASCAL
+#define CALLBACK
+#define WINAPI
+#define APIENTRY
+#define STDMETHODCALLTYPE
+#define STDMETHODIMP HRESULT
+#define STDAPI extern "C" HRESULT
+#define __forceinline inline
+#define __T(x) L##x
+#define _T(x) __T(x)
+#define TEXT(x) __T(x)
+
+// Basic types, DWORD and HRESULT keep their 32-bit Windows width (FAILED() tests the sign)
+typedef int INT32;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+typedef uintptr_t DWORD_PTR;
+typedef wchar_t WCHAR;
+typedef int BOOL;
+typedef void VOID;
+typedef long LONG;
+typedef unsigned long ULONG;
+typedef unsigned int UINT;
+typedef int HRESULT;
+typedef int SCODE;
+typedef DWORD LCID;
+typedef long DISPID;
+typedef short VARIANT_BOOL;
+typedef unsigned short VARTYPE;
+typedef wchar_t* BSTR;
+typedef wchar_t* LPOLESTR;
+typedef wchar_t* LPWSTR;
+typedef const wchar_t* LPCWSTR;
+typedef char* LPSTR;
+typedef BYTE* LPBYTE;
+typedef void* LPVOID;
+typedef void* HANDLE;
+typedef void* HMODULE;
+typedef void* HINSTANCE;
+typedef void* HWND;
+typedef void* HKEY;
+typedef intptr_t LPARAM;
+typedef void (*FARPROC)();
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID);
+typedef BOOL (*WNDENUMPROC)(HWND, LPARAM);
+
+struct POINT {
+    LONG x;
+    LONG y;
+};
+
+struct SYSTEMTIME {
+    WORD wYear;
+    WORD wMonth;
+    WORD wDayOfWeek;
+    WORD wDay;
+    WORD wHour;
+    WORD wMinute;
+    WORD wSecond;
+    WORD wMilliseconds;
+};
+
+// Constants
+#define TRUE 1
+#define FALSE 0
+#define NOERROR 0
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_NOINTERFACE ((HRESULT)0x80004002L)
+#define E_POINTER ((HRESULT)0x80004003L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+#define DISP_E_PARAMNOTFOUND ((HRESULT)0x80020004L)
+#define DISP_E_BADINDEX ((HRESULT)0x8002000BL)
+#define CLASS_E_NOAGGREGATION ((HRESULT)0x80040110L)
+#define CLASS_E_CLASSNOTAVAILABLE ((HRESULT)0x80040111L)
+#define SELFREG_E_CLASS ((HRESULT)0x80040201L)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define HRESULT_FROM_WIN32(x) ((HRESULT)(x) <= 0 ? ((HRESULT)(x)) : ((HRESULT)(((x) & 0x0000FFFF) | 0x80070000)))
+#define ERROR_SUCCESS 0L
+#define ERROR_FILE_NOT_FOUND 2L
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED 0xFFFFFFFF
+#define CP_UTF8 65001
+#define MB_OK 0
+#define DLL_PROCESS_DETACH 0
+#define DLL_PROCESS_ATTACH 1
+#define HKEY_CURRENT_USER ((HKEY)(uintptr_t)0x80000001)
+#define HKEY_LOCAL_MACHINE ((HKEY)(uintptr_t)0x80000002)
+#define KEY_READ 0x20019
+#define KEY_WRITE 0x20006
+#define REG_SZ 1
+#define ERROR_ALREADY_EXISTS 183L
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define PAGE_READWRITE 0x04
+#define FILE_MAP_WRITE 0x0002
+#define FILE_MAP_READ 0x0004
+#define FILE_MAP_ALL_ACCESS 0xF001F
+
+// GUID
+struct GUID {
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+};
+typedef GUID IID;
+typedef GUID CLSID;
+typedef const GUID& REFGUID;
+typedef const GUID& REFIID;
+typedef const GUID& REFCLSID;
+inline bool operator==(const GUID& a, const GUID& b) { return std::memcmp(&a, &b, sizeof(GUID)) == 0; }
+inline bool operator!=(const GUID& a, const GUID& b) { return !(a == b); }
+
+#ifdef INITGUID
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    extern const GUID name = {l, w1, w2, {b1, b2, b3, b4, b5, b6, b7, b8}}
+#else
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) extern const GUID name
+#endif
+
+extern const GUID IID_NULL;
+extern const GUID IID_IUnknown;
+extern const GUID IID_IDispatch;
+extern const GUID IID_IClassFactory;
+
+// Automation types
+#define VT_EMPTY 0
+#define VT_NULL 1
+#define VT_I4 3
+#define VT_R8 5
+#define VT_BSTR 8
+#define VT_ERROR 10
+#define VT_BOOL 11
+#define VT_VARIANT 12
+#define VARIANT_TRUE ((VARIANT_BOOL)-1)
+#define VARIANT_FALSE ((VARIANT_BOOL)0)
+
+struct SAFEARRAYBOUND {
+    ULONG cElements;
+    LONG lLbound;
+};
+
+/// @brief Bounds are stored in reverse order of the dimensions, like Windows does
+struct SAFEARRAY {
+    unsigned short cDims;
+    unsigned short fFeatures;
+    ULONG cbElements;
+    ULONG cLocks;
+    void* pvData;
+    SAFEARRAYBOUND rgsabound[1];
+};
+
+struct VARIANT {
+    VARTYPE vt;
+    WORD wReserved1;
+    WORD wReserved2;
+    WORD wReserved3;
+    union {
+        LONG lVal;
+        double dblVal;
+        VARIANT_BOOL boolVal;
+        SCODE scode;
+        BSTR bstrVal;
+        SAFEARRAY* parray;
+        void* byref;
+    };
+};
+
+struct DISPPARAMS;
+struct EXCEPINFO;
+
+// COM interfaces, same virtual method order as the Windows SDK
+struct IUnknown {
+    virtual HRESULT QueryInterface(REFIID riid, void** ppvObject) = 0;
+    virtual ULONG AddRef() = 0;
+    virtual ULONG Release() = 0;
+};
+
+struct ITypeInfo : IUnknown {
+    virtual HRESULT GetIDsOfNames(LPOLESTR* rgszNames, UINT cNames, DISPID* pMemId) = 0;
+    virtual HRESULT Invoke(void* pvInstance, DISPID memid, WORD wFlags, DISPPARAMS* pDispParams, VARIANT* pVarResult,
+                           EXCEPINFO* pExcepInfo, UINT* puArgErr) = 0;
+};
+
+struct ITypeLib : IUnknown {
+    virtual HRESULT GetTypeInfoOfGuid(REFGUID guid, ITypeInfo** ppTInfo) = 0;
+};
+typedef ITypeLib* LPTYPELIB;
+typedef ITypeInfo* LPTYPEINFO;
+
+struct IDispatch : IUnknown {
+    virtual HRESULT GetTypeInfoCount(UINT* pctinfo) = 0;
+    virtual HRESULT GetTypeInfo(UINT iTInfo, LCID lcid, ITypeInfo** ppTInfo) = 0;
+    virtual HRESULT GetIDsOfNames(REFIID riid, LPOLESTR* rgszNames, UINT cNames, LCID lcid, DISPID* rgDispId) = 0;
+    virtual HRESULT Invoke(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS* pDispParams,
+                           VARIANT* pVarResult, EXCEPINFO* pExcepInfo, UINT* puArgErr) = 0;
+};
+
+struct IClassFactory : IUnknown {
+    virtual HRESULT CreateInstance(IUnknown* pUnkOuter, REFIID riid, void** ppvObject) = 0;
+    virtual HRESULT LockServer(BOOL fLock) = 0;
+};
+
+// Threads and synchronization
+HANDLE CreateThread(void* lpThreadAttributes, size_t dwStackSize, LPTHREAD_START_ROUTINE lpStartAddress,
+                    LPVOID lpParameter, DWORD dwCreationFlags, DWORD* lpThreadId);
+BOOL TerminateThread(HANDLE hThread, DWORD dwExitCode);
+HANDLE CreateEventW(void* lpEventAttributes, BOOL bManualReset, BOOL bInitialState, LPCWSTR lpName);
+#define CreateEvent CreateEventW
+BOOL SetEvent(HANDLE hEvent);
+BOOL ResetEvent(HANDLE hEvent);
+DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds);
+BOOL CloseHandle(HANDLE hObject);
+void Sleep(DWORD dwMilliseconds);
+DWORD GetTickCount();
+DWORD GetCurrentThreadId();
+DWORD GetCurrentProcessId();
+DWORD GetLastError();
+void GetLocalTime(SYSTEMTIME* lpSystemTime);
+
+// Modules
+HMODULE GetModuleHandleW(LPCWSTR lpModuleName);
+#define GetModuleHandle GetModuleHandleW
+FARPROC GetProcAddress(HMODULE hModule, const char* lpProcName);
+DWORD GetModuleFileNameW(HMODULE hModule, LPWSTR lpFilename, DWORD nSize);
+#define GetModuleFileName GetModuleFileNameW
+
+// Strings and UI
+int MultiByteToWideChar(UINT CodePage, DWORD dwFlags, const char* lpMultiByteStr, int cbMultiByte,
+                        LPWSTR lpWideCharStr, int cchWideChar);
+int lstrlenW(LPCWSTR lpString);
+#define lstrlen lstrlenW
+int MessageBoxW(HWND hWnd, LPCWSTR lpText, LPCWSTR lpCaption, UINT uType);
+// There are no windows, EnumWindows calls nothing
+BOOL EnumWindows(WNDENUMPROC lpEnumFunc, LPARAM lParam);
+DWORD GetWindowThreadProcessId(HWND hWnd, DWORD* lpdwProcessId);
+int GetClassNameW(HWND hWnd, LPWSTR lpClassName, int nMaxCount);
+#define GetClassName GetClassNameW
+
+// Registry, backed by an in-process key store
+LONG RegCreateKeyW(HKEY hKey, LPCWSTR lpSubKey, HKEY* phkResult);
+#define RegCreateKey RegCreateKeyW
+LONG RegOpenKeyExW(HKEY hKey, LPCWSTR lpSubKey, DWORD ulOptions, DWORD samDesired, HKEY* phkResult);
+#define RegOpenKeyEx RegOpenKeyExW
+LONG RegSetValueExW(HKEY hKey, LPCWSTR lpValueName, DWORD Reserved, DWORD dwType, const BYTE* lpData, DWORD cbData);
+#define RegSetValueEx RegSetValueExW
+LONG RegQueryValueExW(HKEY hKey, LPCWSTR lpValueName, DWORD* lpReserved, DWORD* lpType, LPBYTE lpData,
+                      DWORD* lpcbData);
+#define RegQueryValueEx RegQueryValueExW
+LONG RegDeleteKeyW(HKEY hKey, LPCWSTR lpSubKey);
+#define RegDeleteKey RegDeleteKeyW
+LONG RegCloseKey(HKEY hKey);
+
+// Shared memory, named mappings backed by POSIX shm objects. The name is removed when the handle that created it
+// is closed, views already mapped stay valid
+HANDLE CreateFileMappingW(HANDLE hFile, void* lpFileMappingAttributes, DWORD flProtect, DWORD dwMaximumSizeHigh,
+                          DWORD dwMaximumSizeLow, LPCWSTR lpName);
+#define CreateFileMapping CreateFileMappingW
+HANDLE OpenFileMappingW(DWORD dwDesiredAccess, BOOL bInheritHandle, LPCWSTR lpName);
+#define OpenFileMapping OpenFileMappingW
+LPVOID MapViewOfFile(HANDLE hFileMappingObject, DWORD dwDesiredAccess, DWORD dwFileOffsetHigh,
+                     DWORD dwFileOffsetLow, size_t dwNumberOfBytesToMap);
+BOOL UnmapViewOfFile(const void* lpBaseAddress);
+
+// Automation
+BSTR SysAllocString(const wchar_t* psz);
+BSTR SysAllocStringLen(const wchar_t* strIn, UINT ui);
+void SysFreeString(BSTR bstrString);
+UINT SysStringLen(BSTR pbstr);
+void VariantInit(VARIANT* pvarg);
+HRESULT VariantClear(VARIANT* pvarg);
+HRESULT VariantCopy(VARIANT* pvargDest, const VARIANT* pvargSrc);
+SAFEARRAY* SafeArrayCreate(VARTYPE vt, UINT cDims, SAFEARRAYBOUND* rgsabound);
+HRESULT SafeArrayDestroy(SAFEARRAY* psa);
+HRESULT SafeArrayPutElement(SAFEARRAY* psa, LONG* rgIndices, void* pv);
+HRESULT SafeArrayGetElement(SAFEARRAY* psa, LONG* rgIndices, void* pv);
+HRESULT SafeArrayAccessData(SAFEARRAY* psa, void** ppvData);
+HRESULT SafeArrayUnaccessData(SAFEARRAY* psa);
+HRESULT LoadRegTypeLib(REFGUID rguid, WORD wVerMajor, WORD wVerMinor, LCID lcid, ITypeLib** pptlib);
+HRESULT LoadTypeLib(LPCWSTR szFile, ITypeLib** pptlib);
+
+#endif
@@ -0,0 +1,889 @@
+/**
+ * @file rtdbench.cpp
+ * @brief RTD notification latency benchmark, without Excel or COM
+ * @author mwmi
+ * @date 2025
+ *
+ * Drives RtdServer directly the way Excel does: ServerStart with an IRTDUpdateEvent, ConnectData per topic, and
+ * RefreshData after every UpdateNotify. The update event is a plain object recording when UpdateNotify arrives.
+ * For each notify window it reports the latency from Topic::setValue to UpdateNotify, and how many notifications
+ * a burst of updates to different topics produces. The churn cases then connect 100k topics, change 1% of them
+ * between refreshes to text or to numbers, and report the cost of RefreshData. The fill cases compare writing 20k
+ * rows into the compat SAFEARRAY element by element with SafeArrayPutElement against writing them in place. The
+ * producer cases set text values from 1 and 4 threads as fast as they can while Excel refreshes back to back. The
+ * pubsub cases publish numbers by key through RTDRegister, one at a time and in batches, to keys of which none,
+ * 1% or all are shown by a cell. The pool cases run 5,000 clock-style asynchronous topics that reschedule
+ * themselves, and one-shot tasks with and without a per- function concurrency limit, reporting the executor's
+ * queue depth and job latency. The loop cases run the same clocks as coroutines sleeping on the event loop's
+ * timer wheel, reporting their tick rate and how late they wake, and 1,000 coroutines waiting on an event set
+ * every millisecond. The shared cases connect 10,000 clock cells over all distinct and over 10 distinct argument
+ * lists, where cells with equal arguments share one producer. The contention case connects and then disconnects
+ * 40,000 ticking clock cells one by one while another thread refreshes every millisecond. The throttle cases
+ * publish values at full speed while Excel refreshes every millisecond, and count the values Excel saw, and those
+ * conflated, suppressed and throttled under several RTDPolicy settings. The teardown cases time a DisconnectData
+ * storm and ServerTerminate with tasks that poll their stop token, and with one that ignores it, pooled or
+ * synchronous. The ring cases spawn a producer process writing timestamped numbers to a shared-memory ring, flat out
+ * and at 100,000 a second, read by RTDRingFeed, and report throughput, drops and the latency to RefreshData.
+ *
+ * Usage: `rtdbench [samples]` (2000 by default, windowed cases run a tenth of it)
+ */
+#include "xllManager.h"
+#include "RTDRingFeed.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <vector>
+
+extern char** environ;
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief Stand-in for Excel's IRTDUpdateEvent, records UpdateNotify calls
+class UpdateEvents : public IRTDUpdateEvent {
+public:
+    std::atomic<uint64_t> notifies = 0;
+    std::atomic<int64_t> notified_at = 0;
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+        if (riid == IID_IUnknown || riid == IID_IDispatch || riid == IID_IRTDUpdateEvent) {
+            *ppv = this;
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+    ULONG STDMETHODCALLTYPE Release() override { return 1; }
+    HRESULT STDMETHODCALLTYPE GetTypeInfoCount(UINT* pctinfo) override {
+        *pctinfo = 0;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT, LCID, ITypeInfo**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetIDsOfNames(REFIID, LPOLESTR*, UINT, LCID, DISPID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE Invoke(DISPID, REFIID, LCID, WORD, DISPPARAMS*, VARIANT*, EXCEPINFO*, UINT*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE UpdateNotify() override {
+        notified_at = Clock::now().time_since_epoch().count();
+        notifies++;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE get_HeartbeatInterval(long* plRetVal) override {
+        *plRetVal = 15000;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE put_HeartbeatInterval(long) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE Disconnect() override { return S_OK; }
+};
+
+/// @brief Topics connected to the server under test, filled in by their task
+static std::unique_ptr<std::atomic<Topic*>[]> feeds;
+static long feed_count = 0;
+
+/// @brief Topic strings as Excel passes them to ConnectData: the function name and one argument
+static SAFEARRAY* topic_strings(const wchar_t* function, long arg) {
+    SAFEARRAYBOUND bound = {2, 0};
+    SAFEARRAY* strings = SafeArrayCreate(VT_VARIANT, 1, &bound);
+    VARIANT v = createVariant(std::wstring(function));
+    LONG i = 0;
+    SafeArrayPutElement(strings, &i, &v);
+    VariantClear(&v);
+    v = createVariant(std::to_wstring(arg));
+    i = 1;
+    SafeArrayPutElement(strings, &i, &v);
+    VariantClear(&v);
+    return strings;
+}
+
+/// @brief Excel's reaction to UpdateNotify @return Number of topics refreshed
+static long refresh(RtdServer* server) {
+    long count = 0;
+    SAFEARRAY* values = nullptr;
+    server->RefreshData(&count, &values);
+    if (values != nullptr) SafeArrayDestroy(values);
+    return count;
+}
+
+/// @brief Wait until UpdateNotify was called more than `seen` times @return false on timeout
+static bool wait_notify(UpdateEvents& events, uint64_t seen) {
+    auto deadline = Clock::now() + std::chrono::seconds(5);
+    while (events.notifies.load() <= seen) {
+        if (Clock::now() > deadline) return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+/// @brief Start a server with the given notify window @return The server, one reference held
+static RtdServer* start(UpdateEvents& events, DWORD window) {
+    xll::rtdNotifyWindow = window;
+    RtdServer* server = new RtdServer();
+    server->AddRef();
+    long res = 0;
+    server->ServerStart(&events, &res);
+    return server;
+}
+
+/// @brief Connect topics `first` to `first + count - 1` calling the RTD function `function`, with argument
+/// `id % distinct` so that topics with equal arguments share a producer (0 for all distinct)
+static void connect(RtdServer* server, long first, long count, const wchar_t* function, long distinct = 0) {
+    for (long id = first; id < first + count; id++) {
+        SAFEARRAY* strings = topic_strings(function, distinct > 0 ? id % distinct : id);
+        VARIANT_BOOL get_new = VARIANT_TRUE;
+        VARIANT initial;
+        server->ConnectData(id, &strings, &get_new, &initial);
+        VariantClear(&initial);
+        SafeArrayDestroy(strings);
+    }
+}
+
+/// @brief Start a server with `topics` BenchFeed topics, whose task hands each Topic over to the benchmark
+static RtdServer* start(UpdateEvents& events, DWORD window, long topics) {
+    RtdServer* server = start(events, window);
+    feeds.reset(new std::atomic<Topic*>[topics]());
+    feed_count = topics;
+    connect(server, 0, topics, L"BenchFeed");
+    for (long id = 0; id < topics; id++) {
+        while (feeds[id].load() == nullptr) std::this_thread::yield();
+    }
+    return server;
+}
+
+static void stop(RtdServer* server) {
+    server->ServerTerminate();
+    server->Release();
+    feeds.reset();
+    feed_count = 0;
+}
+
+/// @brief setValue to UpdateNotify latency, and notifications per burst of updates
+static void notify_latency(DWORD window, int samples) {
+    UpdateEvents events;
+    RtdServer* server = start(events, window, 100);
+
+    // Single update: setValue to UpdateNotify
+    std::vector<double> latency;
+    for (int i = 0; i < samples; i++) {
+        uint64_t seen = events.notifies;
+        auto t0 = Clock::now();
+        feeds[i % feed_count].load()->setValue(std::to_wstring(i));
+        if (!wait_notify(events, seen)) break;
+        Clock::duration elapsed(events.notified_at.load() - t0.time_since_epoch().count());
+        latency.push_back(std::chrono::duration<double, std::micro>(elapsed).count());
+        refresh(server);
+    }
+
+    // Burst: one update to every topic back to back
+    int bursts = std::max(1, samples / 100);
+    uint64_t notifies = events.notifies;
+    long refreshed = 0;
+    for (int b = 0; b < bursts; b++) {
+        uint64_t seen = events.notifies;
+        for (long i = 0; i < feed_count; i++) feeds[i].load()->setValue(L"burst " + std::to_wstring(b));
+        if (!wait_notify(events, seen)) break;
+        refreshed += refresh(server);
+        // A change racing the first notification is delivered with a second one
+        std::this_thread::sleep_for(std::chrono::milliseconds(window + 5));
+        if (events.notifies > seen + 1) refreshed += refresh(server);
+    }
+    notifies = events.notifies - notifies;
+    stop(server);
+
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    if (n == 0) {
+        std::printf("%6lu ms  no UpdateNotify received\n", (unsigned long)window);
+        return;
+    }
+    std::printf("%6lu ms %8zu %12.1f %12.1f %12.2f %12.1f\n", (unsigned long)window, n, latency[n / 2],
+                latency[std::min(n - 1, n * 99 / 100)], double(notifies) / bursts, double(refreshed) / bursts);
+}
+
+/// @brief Cost of RefreshData with `topics` connected and `changes` of them set between refreshes, to text or
+/// to numbers
+static void refresh_churn(long topics, long changes, int rounds, bool numeric = false) {
+    UpdateEvents events;
+    RtdServer* server = start(events, 10, topics);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<long> pick(0, topics - 1);
+
+    std::vector<double> cost;
+    double set_total = 0;
+    long refreshed = 0;
+    refresh(server);
+    for (int r = 0; r < rounds; r++) {
+        std::wstring value = L"round " + std::to_wstring(r);
+        auto t0 = Clock::now();
+        for (long i = 0; i < changes; i++) {
+            if (numeric) {
+                feeds[pick(rng)].load()->setValue(r + 0.5);
+            } else {
+                feeds[pick(rng)].load()->setValue(value);
+            }
+        }
+        auto t1 = Clock::now();
+        refreshed += refresh(server);
+        auto t2 = Clock::now();
+        set_total += std::chrono::duration<double, std::micro>(t1 - t0).count();
+        cost.push_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+    }
+    stop(server);
+
+    std::sort(cost.begin(), cost.end());
+    size_t n = cost.size();
+    std::printf("%8ld %8ld %8s %12.1f %12.1f %12.3f %12.1f\n", topics, changes, numeric ? "number" : "text",
+                cost[n / 2], cost[std::min(n - 1, n * 99 / 100)], set_total / (double(rounds) * changes),
+                double(refreshed) / rounds);
+}
+
+/// @brief Fill a 2 x `rows` RefreshData array as Topic::update did, one SafeArrayPutElement per element, and in place
+/// with SafeArrayAccessData, taking over each value's BSTR
+static void fill(long rows, bool numeric, int rounds) {
+    std::vector<RTDValue> values;
+    for (long i = 0; i < rows; i++) {
+        values.push_back(numeric ? RTDValue(i + 0.5) : RTDValue(L"value " + std::to_wstring(i)));
+    }
+    SAFEARRAYBOUND bounds[2] = {{2, 0}, {static_cast<ULONG>(rows), 0}};
+    std::vector<double> put_cost, direct_cost;
+    for (int r = 0; r < rounds; r++) {
+        SAFEARRAY* sa = SafeArrayCreate(VT_VARIANT, 2, bounds);
+        auto t0 = Clock::now();
+        for (long i = 0; i < rows; i++) {
+            VARIANT id = createVariant(static_cast<int>(i));
+            VARIANT val = values[i].toVariant();
+            LONG index[2] = {0, i};
+            SafeArrayPutElement(sa, index, &id);
+            index[0] = 1;
+            SafeArrayPutElement(sa, index, &val);
+            VariantClear(&id);
+            VariantClear(&val);
+        }
+        put_cost.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+        SafeArrayDestroy(sa);
+
+        sa = SafeArrayCreate(VT_VARIANT, 2, bounds);
+        t0 = Clock::now();
+        VARIANT* data = nullptr;
+        SafeArrayAccessData(sa, reinterpret_cast<void**>(&data));
+        for (long i = 0; i < rows; i++) {
+            data[2 * i].vt = VT_I4;
+            data[2 * i].lVal = i;
+            data[2 * i + 1] = values[i].toVariant();
+        }
+        SafeArrayUnaccessData(sa);
+        direct_cost.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+        SafeArrayDestroy(sa);
+    }
+    std::sort(put_cost.begin(), put_cost.end());
+    std::sort(direct_cost.begin(), direct_cost.end());
+    double put = put_cost[put_cost.size() / 2], direct = direct_cost[direct_cost.size() / 2];
+    std::printf("%8ld %8s %12.1f %12.1f %10.2fx\n", rows, numeric ? "number" : "text", put, direct, put / direct);
+}
+
+/// @brief `producers` threads setting text values as fast as they can on their share of `topics` topics for
+/// `seconds`, while Excel refreshes back to back
+static void producers(long topics, int producers, double seconds) {
+    UpdateEvents events;
+    RtdServer* server = start(events, 0, topics);
+    std::atomic<bool> running = true;
+    std::atomic<uint64_t> sets = 0;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p]() {
+            uint64_t n = 0;
+            std::wstring value = L"tick ";
+            for (long i = p; running; i += producers) {
+                value.resize(5);
+                value += std::to_wstring(n++);
+                feeds[i % topics].load()->setValue(value);
+            }
+            sets += n;
+        });
+    }
+    std::vector<double> cost;
+    long refreshed = 0;
+    auto t0 = Clock::now();
+    while (Clock::now() - t0 < std::chrono::duration<double>(seconds)) {
+        auto t = Clock::now();
+        refreshed += refresh(server);
+        cost.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t).count());
+    }
+    running = false;
+    for (std::thread& thread : threads) thread.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    stop(server);
+
+    std::sort(cost.begin(), cost.end());
+    size_t n = cost.size();
+    std::printf("%8ld %9d %12.0f %12.0f %12.1f %12.1f\n", topics, producers, sets / elapsed, refreshed / elapsed,
+                cost[n / 2], cost[std::min(n - 1, n * 99 / 100)]);
+}
+
+/// @brief One thread publishing numbers through RTDRegister to `keys` BenchQuote keys, of which the first
+/// `subscribed` are shown by a cell, one at a time or in batches of `batch`, for `seconds` while Excel refreshes
+/// back to back
+static void pubsub(long keys, long subscribed, size_t batch, double seconds) {
+    UpdateEvents events;
+    RtdServer* server = start(events, 0);
+    connect(server, 0, subscribed, L"BenchQuote");
+
+    // Keys are built once, as a feed handler would per instrument; batches draw them at random
+    std::vector<std::wstring> names(keys);
+    for (long k = 0; k < keys; k++) names[k] = Topic::makeKey(L"BenchQuote", {std::to_wstring(k)});
+    std::mt19937 rng(7);
+    std::vector<long> picks(1 << 16);
+    for (long& pick : picks) pick = static_cast<long>(rng() % keys);
+    std::vector<std::vector<RTDUpdate>> batches(16);
+    for (auto& updates : batches) {
+        updates.resize(batch);
+        for (RTDUpdate& update : updates) update.key = names[rng() % keys];
+    }
+
+    std::atomic<bool> running = true;
+    uint64_t published = 0, routed = 0;
+    std::thread publisher([&]() {
+        RTDRegister& rtd = RTDRegister::instance();
+        double price = 100;
+        for (size_t n = 0; running; n++) {
+            if (batch <= 1) {
+                routed += rtd.publish(names[picks[n & (picks.size() - 1)]], price += 0.01);
+                published++;
+            } else {
+                std::vector<RTDUpdate>& updates = batches[n % batches.size()];
+                for (RTDUpdate& update : updates) update.value = price += 0.01;
+                routed += rtd.publishMany(updates);
+                published += updates.size();
+            }
+        }
+    });
+    long refreshed = 0;
+    auto t0 = Clock::now();
+    while (Clock::now() - t0 < std::chrono::duration<double>(seconds)) {
+        refreshed += refresh(server);
+        if (subscribed == 0) Sleep(1);
+    }
+    running = false;
+    publisher.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    stop(server);
+
+    std::printf("%8ld %10ld %8zu %12.0f %12.0f %12.0f\n", keys, subscribed, batch, published / elapsed,
+                routed / elapsed, refreshed / elapsed);
+}
+
+/// @brief Percentile of unsorted samples, sorting them
+static double percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) return 0;
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, static_cast<size_t>(samples.size() * p))];
+}
+
+/// @brief Producer process of the ring cases: writes `records` numbers over `keys` keys to the ring `name`, each
+/// the steady clock time it is written at, `rate` a second or as fast as the reader frees slots for 0
+static int produce(const char* name, long records, long keys, long rate) {
+    RTDRing ring;
+    if (!ring.open(std::wstring(name, name + std::strlen(name)))) return 1;
+    char key[24];
+    auto t0 = Clock::now();
+    for (long i = 0; i < records;) {
+        // Paced in 1 ms steps, each record still carries the time it was written at
+        long due = rate > 0 ? std::min<long>(records, std::chrono::duration<double>(Clock::now() - t0).count() * rate + 1)
+                            : records;
+        for (; i < due; i++) {
+            int len = std::snprintf(key, sizeof(key), "%ld", i % keys);
+            if (rate == 0) {
+                while (ring.full()) std::this_thread::yield();
+            }
+            ring.write(std::string_view(key, len), double(Clock::now().time_since_epoch().count()));
+        }
+        if (rate > 0) Sleep(1);
+    }
+    return 0;
+}
+
+/// @brief RefreshData, taking the age of every value read as a producer timestamp @return Number of topics refreshed
+static long refresh_stamps(RtdServer* server, std::vector<double>& latency) {
+    long count = 0;
+    SAFEARRAY* values = nullptr;
+    server->RefreshData(&count, &values);
+    if (values == nullptr) return count;
+    VARIANT* data = nullptr;
+    SafeArrayAccessData(values, reinterpret_cast<void**>(&data));
+    double now = double(Clock::now().time_since_epoch().count());
+    for (long i = 0; i < count; i++) {
+        if (data[2 * i + 1].vt == VT_R8) {
+            latency.push_back(std::chrono::duration<double, std::micro>(
+                Clock::duration(Clock::rep(now - data[2 * i + 1].dblVal))).count());
+        }
+    }
+    SafeArrayUnaccessData(values);
+    SafeArrayDestroy(values);
+    return count;
+}
+
+/// @brief A producer process writing `records` values to a shared-memory ring, `rate` a second or as fast as
+/// possible for 0, read by RTDRingFeed into `keys` BenchRing topics while Excel refreshes back to back; reports
+/// the feed's throughput and the latency from the write of each value Excel read to RefreshData
+static void ring_feed(long keys, long records, long rate) {
+    UpdateEvents events;
+    RtdServer* server = start(events, 0);
+    connect(server, 0, keys, L"BenchRing");
+    RTDRing ring;
+    ring.create(L"rtdbench_ring", 65536);
+    RTDRingFeed feed(L"rtdbench_ring", L"BenchRing");
+    feed.start();
+
+    std::string args[] = {"rtdbench", "--produce", "rtdbench_ring", std::to_string(records), std::to_string(keys),
+                          std::to_string(rate)};
+    char* argv[] = {args[0].data(), args[1].data(), args[2].data(), args[3].data(), args[4].data(), args[5].data(),
+                    nullptr};
+    pid_t pid = 0;
+    auto t0 = Clock::now();
+    if (posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr, argv, environ) != 0) {
+        std::printf("%8ld %9ld %9ld  producer process not started\n", keys, records, rate);
+        feed.stop();
+        stop(server);
+        return;
+    }
+    std::vector<double> latency;
+    bool exited = false;
+    RTDRingFeed::Metrics m;
+    while (Clock::now() - t0 < std::chrono::seconds(60)) {
+        refresh_stamps(server, latency);
+        int status = 0;
+        if (!exited && waitpid(pid, &status, WNOHANG) == pid) exited = true;
+        m = feed.metrics();
+        if (exited && m.records + m.dropped >= uint64_t(records)) break;
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    if (!exited) waitpid(pid, nullptr, 0);
+    feed.stop();
+    ring.close();
+    stop(server);
+
+    double p50 = percentile(latency, 0.5), p99 = percentile(latency, 0.99);
+    std::printf("%8ld %9ld %9ld %12.0f %12.0f %10llu %10.1f %10.1f\n", keys, records, rate, m.records / elapsed,
+                m.routed / elapsed, static_cast<unsigned long long>(m.dropped), p50, p99);
+}
+
+/// @brief Ticks of BenchClock, and BenchLimited tasks running now and at most
+static std::atomic<uint64_t> ticks = 0;
+static std::atomic<int> limited_running = 0;
+static std::atomic<int> limited_peak = 0;
+static DWORD clock_tick_ms = 500;
+
+/// @brief Clock-style topics on the pool: `topics` tasks each ticking every `tick_ms` for `seconds`
+static void pool_clock(long topics, DWORD tick_ms, double seconds) {
+    UpdateEvents events;
+    RtdServer* server = start(events, 10);
+    ticks = 0;
+    auto t0 = Clock::now();
+    connect(server, 0, topics, L"BenchClock");
+    long refreshed = 0;
+    while (Clock::now() - t0 < std::chrono::duration<double>(seconds)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        refreshed += refresh(server);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    RTDExecutor::Metrics m = server->getExecutor().metrics();
+    stop(server);
+
+    std::printf("%8ld %6lu ms %8u %10.0f %10.0f %10zu %10.1f %10.1f %10.1f\n", topics, (unsigned long)tick_ms, m.workers,
+                ticks / elapsed, refreshed / elapsed, m.max_queued, m.avg_wait_us, m.max_wait_us, m.avg_run_us);
+}
+
+/// @brief One-shot tasks of a function limited to `limit` concurrent runs
+static void pool_limited(long topics, int limit) {
+    RTDRegister::instance().registerRTDFunction(L"BenchLimited", [](xllptrlist, Topic* topic) {
+        int running = ++limited_running;
+        int peak = limited_peak.load();
+        while (peak < running && !limited_peak.compare_exchange_weak(peak, running)) {
+        }
+        Sleep(1);
+        topic->setValue(L"done");
+        limited_running--;
+        return 0;
+    }, true, limit);
+
+    UpdateEvents events;
+    RtdServer* server = start(events, 10);
+    limited_peak = 0;
+    auto t0 = Clock::now();
+    connect(server, 0, topics, L"BenchLimited");
+    while (server->getExecutor().metrics().completed < uint64_t(topics) && Clock::now() - t0 < std::chrono::seconds(30)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    RTDExecutor::Metrics m = server->getExecutor().metrics();
+    stop(server);
+
+    std::printf("%8ld tasks of 1 ms, limit %d: %u workers, peak %d running, %.1f ms, max queue %zu\n", topics, limit,
+                m.workers, limited_peak.load(), elapsed, m.max_queued);
+}
+
+/// @brief Lateness of coroutine clock ticks behind their due time
+static std::atomic<uint64_t> late_us = 0;
+static std::atomic<uint64_t> max_late_us = 0;
+
+/// @brief Coroutine clock topics on the event loop: `topics` coroutines each ticking every `tick_ms` for `seconds`
+static void loop_clock(long topics, DWORD tick_ms, double seconds) {
+    UpdateEvents events;
+    RtdServer* server = start(events, 10);
+    ticks = 0;
+    late_us = 0;
+    max_late_us = 0;
+    auto t0 = Clock::now();
+    connect(server, 0, topics, L"BenchCoClock");
+    double connect_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    long refreshed = 0;
+    while (Clock::now() - t0 < std::chrono::duration<double>(seconds)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        refreshed += refresh(server);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    RTDEventLoop::Metrics m = server->getLoop().metrics();
+    auto t1 = Clock::now();
+    stop(server);
+    double stop_ms = std::chrono::duration<double, std::milli>(Clock::now() - t1).count();
+
+    std::printf("%8ld %6lu ms %8u %10.0f %10.0f %10.1f %10.2f %10.2f %10.1f\n", topics, (unsigned long)tick_ms,
+                m.threads, ticks / elapsed, refreshed / elapsed, connect_ms, ticks ? late_us / 1000.0 / ticks : 0.0,
+                max_late_us / 1000.0, stop_ms);
+}
+
+/// @brief Event set by a feed thread, waited on by BenchCoFeed coroutines
+static RTDEvent feed_event;
+
+/// @brief `topics` coroutines waiting on one event that a feed thread sets every millisecond for `seconds`
+static void loop_event(long topics, double seconds) {
+    UpdateEvents events;
+    RtdServer* server = start(events, 10);
+    ticks = 0;
+    connect(server, 0, topics, L"BenchCoFeed");
+    std::atomic<bool> feeding = true;
+    std::atomic<long> sets = 0;
+    std::thread feed([&]() {
+        while (feeding) {
+            feed_event.set();
+            sets++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    auto t0 = Clock::now();
+    long refreshed = 0;
+    while (Clock::now() - t0 < std::chrono::duration<double>(seconds)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        refreshed += refresh(server);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    feeding = false;
+    feed.join();
+    stop(server);
+
+    std::printf("%8ld topics waiting on one event set %ld times/s: %.0f wakes/s, %.0f updates/s\n", topics,
+                static_cast<long>(sets / elapsed), ticks / elapsed, refreshed / elapsed);
+}
+
+/// @brief `cells` clock topics over `distinct` argument lists, cells with the same arguments sharing a producer
+static void shared_clock(long cells, long distinct, double seconds) {
+    UpdateEvents events;
+    RtdServer* server = start(events, 10);
+    ticks = 0;
+    auto t0 = Clock::now();
+    connect(server, 0, cells, L"BenchClock", distinct);
+    double connect_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    long refreshed = 0;
+    while (Clock::now() - t0 < std::chrono::duration<double>(seconds)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        refreshed += refresh(server);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    stop(server);
+
+    std::printf("%8ld %8ld %10.1f %10.0f %10.0f\n", cells, distinct, connect_ms, ticks / elapsed, refreshed / elapsed);
+}
+
+/// @brief Raise an atomic maximum
+static void raise_max(std::atomic<uint64_t>& maximum, uint64_t value) {
+    uint64_t seen = maximum.load();
+    while (seen < value && !maximum.compare_exchange_weak(seen, value)) {
+    }
+}
+
+/// @brief Connect then disconnect `cells` ticking clock topics one by one while another thread refreshes every
+/// millisecond, timing each ConnectData and DisconnectData
+static void contention(long cells) {
+    UpdateEvents events;
+    RtdServer* server = start(events, 0);
+    std::atomic<bool> refreshing = true;
+    std::atomic<long> refreshed = 0;
+    std::thread excel([&]() {
+        while (refreshing) {
+            refreshed += refresh(server);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    std::vector<double> connect_us, disconnect_us;
+    connect_us.reserve(cells);
+    disconnect_us.reserve(cells);
+    auto t0 = Clock::now();
+    for (long id = 0; id < cells; id++) {
+        auto t = Clock::now();
+        connect(server, id, 1, L"BenchClock");
+        connect_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t).count());
+    }
+    double connect_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    t0 = Clock::now();
+    for (long id = 0; id < cells; id++) {
+        auto t = Clock::now();
+        server->DisconnectData(id);
+        disconnect_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t).count());
+    }
+    double disconnect_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    refreshing = false;
+    excel.join();
+    stop(server);
+
+    std::printf("%8ld %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10ld\n", cells, connect_ms,
+                percentile(connect_us, 0.5), percentile(connect_us, 0.99), disconnect_ms,
+                percentile(disconnect_us, 0.5), percentile(disconnect_us, 0.99), refreshed.load());
+}
+
+/// @brief Values set by BenchFast tasks
+static std::atomic<uint64_t> fast_sets = 0;
+
+/// @brief `topics` feeds publishing a random walk at full speed, Excel refreshing every millisecond, under a policy
+static void throttle(long topics, const RTDPolicy& policy, double seconds) {
+    RTDRegister::instance().registerRTDFunction(L"BenchFast", [](xllptrlist, Topic* topic) {
+        std::mt19937 rng(static_cast<unsigned>(topic->getID()));
+        std::uniform_int_distribution<int> step(-1, 1);
+        double price = 100;
+        while (topic->wait(1)) {
+            for (int i = 0; i < 100; i++) {
+                price += step(rng) * 0.001;
+                topic->setValue(std::to_wstring(price));
+            }
+            fast_sets += 100;
+        }
+        return 0;
+    }, true, 0, policy);
+
+    UpdateEvents events;
+    RtdServer* server = start(events, 0);
+    fast_sets = 0;
+    auto t0 = Clock::now();
+    connect(server, 0, topics, L"BenchFast");
+    long refreshed = 0;
+    while (Clock::now() - t0 < std::chrono::duration<double>(seconds)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        refreshed += refresh(server);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    RTDUpdateStats st = server->getUpdateStats();
+    uint64_t sets = fast_sets;
+    stop(server);
+
+    std::printf("%8ld %8lu ms %8.3f %10.0f %10.0f %10.0f %10.0f %10.0f\n", topics, (unsigned long)policy.min_interval_ms,
+                policy.min_change, sets / elapsed, refreshed / elapsed, st.conflated / elapsed, st.suppressed / elapsed,
+                st.throttled / elapsed);
+}
+
+/// @brief BenchLoop tasks currently inside their loop
+static std::atomic<int> loops_running = 0;
+static std::atomic<int> stubborn_running = 0;
+
+/// @brief Disconnect storm and server shutdown with clock topics, looping tasks and optionally one that ignores
+/// the stop request, run on the pool (BenchStubborn) or on the server's worker thread (BenchStubbornSync)
+static void teardown(long clocks, long loops, bool stubborn, const wchar_t* stubborn_function = L"BenchStubborn") {
+    UpdateEvents events;
+    RtdServer* server = start(events, 10);
+    connect(server, 0, clocks, L"BenchClock");
+    connect(server, clocks, loops, L"BenchLoop");
+    if (stubborn) connect(server, clocks + loops, 1, stubborn_function);
+    auto t0 = Clock::now();
+    while ((loops_running < loops || (stubborn && stubborn_running == 0)) &&
+           Clock::now() - t0 < std::chrono::seconds(5)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // Excel disconnects every cell, then terminates the server
+    double disconnect_ms = 0, loops_ms = 0, terminate_ms = 0;
+    t0 = Clock::now();
+    if (!stubborn) {
+        for (long id = 0; id < clocks + loops; id++) server->DisconnectData(id);
+        disconnect_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+        while (loops_running > 0 && Clock::now() - t0 < std::chrono::seconds(5)) std::this_thread::yield();
+        loops_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    }
+    auto t1 = Clock::now();
+    server->ServerTerminate();
+    terminate_ms = std::chrono::duration<double, std::milli>(Clock::now() - t1).count();
+    RTDExecutor::Metrics m = server->getExecutor().metrics();
+    unsigned workers = server->getAbandonedWorkers();
+    server->Release();
+
+    if (stubborn) {
+        std::printf("%8ld clocks, %ld loops, 1 %ls ignoring stop: ServerTerminate %.1f ms, %u pool worker and %u "
+                    "server worker abandoned\n",
+                    clocks, loops, stubborn_function, terminate_ms, m.abandoned, workers);
+    } else {
+        std::printf("%8ld clocks, %ld loops: DisconnectData x%ld %.1f ms, loops returned after %.1f ms, "
+                    "ServerTerminate %.1f ms, %u abandoned\n",
+                    clocks, loops, clocks + loops, disconnect_ms, loops_ms, terminate_ms, m.abandoned);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 6 && std::strcmp(argv[1], "--produce") == 0) {
+        return produce(argv[2], std::atol(argv[3]), std::atol(argv[4]), std::atol(argv[5]));
+    }
+    int samples = argc > 1 ? std::atoi(argv[1]) : 2000;
+    if (samples <= 0) samples = 2000;
+
+    RTDRegister::instance().registerRTDFunction(L"BenchFeed", [](xllptrlist, Topic* topic) {
+        long id = std::wcstol(topic->getArg(1).c_str(), nullptr, 10);
+        if (id < feed_count) feeds[id] = topic;
+        return 0;
+    }, false);
+
+    std::printf("%9s %8s %12s %12s %12s %12s\n", "window", "samples", "p50 us", "p99 us", "notify/burst",
+                "topics/burst");
+    notify_latency(0, samples);
+    notify_latency(1, samples / 10);
+    notify_latency(10, samples / 10);
+
+    std::printf("\n%8s %8s %8s %12s %12s %12s %12s\n", "topics", "changes", "values", "refresh p50", "refresh p99",
+                "setValue us", "topics/ref");
+    refresh_churn(1000, 10, std::max(10, samples / 10));
+    refresh_churn(100000, 1000, std::max(10, samples / 20));
+    refresh_churn(100000, 1000, std::max(10, samples / 20), true);
+
+    std::printf("\n%8s %8s %12s %12s %11s\n", "rows", "values", "put us", "in place us", "speedup");
+    fill(20000, false, std::max(10, samples / 20));
+    fill(20000, true, std::max(10, samples / 20));
+
+    // Producers at full speed against back to back refreshes
+    std::printf("\n%8s %9s %12s %12s %12s %12s\n", "topics", "producers", "sets/s", "rows/s", "refresh p50",
+                "refresh p99");
+    producers(100, 1, 1.0);
+    producers(100, 4, 1.0);
+
+    // Values pushed by key to the topics of a function without a task
+    RTDRegister::instance().registerRTDFunction(L"BenchQuote", L"");
+    std::printf("\n%8s %10s %8s %12s %12s %12s\n", "keys", "subscribed", "batch", "publishes/s", "routed/s",
+                "rows/s");
+    pubsub(100000, 0, 1, 1.0);
+    pubsub(100000, 0, 1000, 1.0);
+    pubsub(100000, 1000, 1, 1.0);
+    pubsub(100000, 1000, 1000, 1.0);
+    pubsub(10000, 10000, 1, 1.0);
+    pubsub(10000, 10000, 1000, 1.0);
+
+    // Values written by another process to a shared-memory ring
+    RTDRegister::instance().registerRTDFunction(L"BenchRing", L"");
+    std::printf("\n%8s %9s %9s %12s %12s %10s %10s %10s\n", "keys", "records", "rate", "records/s", "routed/s",
+                "dropped", "p50 us", "p99 us");
+    ring_feed(1000, 2000000, 0);
+    ring_feed(1000, 200000, 100000);
+
+    RTDRegister::instance().registerRTDFunction(L"BenchClock", [](xllptrlist, Topic* topic) {
+        topic->setValue(std::to_wstring(++ticks));
+        topic->reschedule(clock_tick_ms);
+        return 0;
+    }, true);
+    // A fixed pool size keeps results comparable between machines
+    xll::rtdWorkerThreads = 4;
+    std::printf("\n%8s %9s %8s %10s %10s %10s %10s %10s %10s\n", "topics", "tick", "workers", "ticks/s", "updates/s",
+                "max queue", "wait us", "max wait", "run us");
+    clock_tick_ms = 500;
+    pool_clock(5000, clock_tick_ms, 2.0);
+    clock_tick_ms = 10;
+    pool_clock(5000, clock_tick_ms, 2.0);
+    std::printf("\n");
+    pool_limited(200, 0);
+    pool_limited(200, 2);
+
+    // The same clocks as coroutines on the event loop's timer wheel
+    RTDRegister::instance().registerRTDFunction(L"BenchCoClock", [](xllptrlist, Topic*) -> RTDCoroutine {
+        while (true) {
+            co_yield std::to_wstring(++ticks);
+            auto due = Clock::now() + std::chrono::milliseconds(clock_tick_ms);
+            co_await RTDSleep(clock_tick_ms);
+            uint64_t late = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count());
+            late_us += late;
+            raise_max(max_late_us, late);
+        }
+    });
+    std::printf("\n%8s %9s %8s %10s %10s %10s %10s %10s %10s\n", "topics", "tick", "threads", "ticks/s", "updates/s",
+                "connect ms", "late ms", "max late", "stop ms");
+    clock_tick_ms = 500;
+    loop_clock(5000, clock_tick_ms, 2.0);
+    loop_clock(50000, clock_tick_ms, 2.0);
+    clock_tick_ms = 10;
+    loop_clock(5000, clock_tick_ms, 2.0);
+    RTDRegister::instance().registerRTDFunction(L"BenchCoFeed", [](xllptrlist, Topic*) -> RTDCoroutine {
+        while (true) {
+            co_await feed_event;
+            co_yield std::to_wstring(++ticks);
+        }
+    });
+    std::printf("\n");
+    loop_event(1000, 1.0);
+
+    // Many cells showing few distinct topics
+    std::printf("\n%8s %8s %10s %10s %10s\n", "cells", "distinct", "connect ms", "ticks/s", "updates/s");
+    clock_tick_ms = 100;
+    shared_clock(10000, 10000, 2.0);
+    shared_clock(10000, 10, 2.0);
+
+    // Opening and closing a large workbook while its clocks tick and Excel refreshes
+    std::printf("\n%8s %10s %10s %10s %10s %10s %10s %10s\n", "cells", "connect ms", "p50 us", "p99 us", "disc ms",
+                "p50 us", "p99 us", "refreshed");
+    clock_tick_ms = 500;
+    contention(40000);
+
+    // Feeds publishing faster than Excel reads, per second
+    std::printf("\n%8s %11s %8s %10s %10s %10s %10s %10s\n", "topics", "interval", "change", "sets", "to Excel",
+                "conflated", "suppressed", "throttled");
+    throttle(4, RTDPolicy(), 1.0);
+    throttle(4, RTDPolicy{100, 0}, 1.0);
+    throttle(4, RTDPolicy{100, 0.005}, 1.0);
+
+    // Long-running tasks polling their stop token, and one that does not
+    RTDRegister::instance().registerRTDFunction(L"BenchLoop", [](xllptrlist, Topic* topic) {
+        loops_running++;
+        long n = 0;
+        while (topic->wait(5)) topic->setValue(std::to_wstring(++n));
+        loops_running--;
+        return 0;
+    }, true);
+    RTDRegister::instance().registerRTDFunction(L"BenchStubborn", [](xllptrlist, Topic*) {
+        stubborn_running++;
+        Sleep(2000);
+        stubborn_running--;
+        return 0;
+    }, true);
+    RTDRegister::instance().registerRTDFunction(L"BenchStubbornSync", [](xllptrlist, Topic*) {
+        stubborn_running++;
+        Sleep(2000);
+        stubborn_running--;
+        return 0;
+    }, false);
+    std::printf("\n");
+    clock_tick_ms = 10;
+    teardown(5000, 2, false);
+    teardown(5000, 2, true);
+    teardown(5000, 2, true, L"BenchStubbornSync");
+    // The abandoned task still uses the registered functions
+    while (stubborn_running > 0) Sleep(10);
+    return 0;
+}
@@ -0,0 +1,485 @@
+/**
+ * @file test.cpp
+ * @brief xllType checks against the Excel emulator, run by ctest
+ * @author mwmi
+ * @date 2025
+ *
+ * Each check prints a line when it fails; the process exits non-zero if any check failed.
+ *
+ * Usage: `xlltest`
+ */
+#include "xllEmulator.h"
+#include "xllRangeCache.h"
+#include "xllTools.h"
+#include "xllType.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <limits>
+#include <string>
+#include <utility>
+
+extern "C" void xlAutoFree12(LPXLOPER12 pxFree);
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    std::printf("FAILED: %s\n", what);
+    failures++;
+}
+
+/// @brief Single-cell reference on the caller's sheet (0-based row and column)
+static xloper12 cell_ref(RW row, COL col) {
+    xloper12 x;
+    x.xltype = xltypeSRef;
+    x.val.sref.count = 1;
+    x.val.sref.ref.rwFirst = x.val.sref.ref.rwLast = row;
+    x.val.sref.ref.colFirst = x.val.sref.ref.colLast = col;
+    return x;
+}
+
+/// @brief A numeric reference reads as the same text through get_str() and get_c_str(), loaded eagerly, lazily or
+/// as an array element
+static void numeric_reference_text() {
+    xllEmulator& excel = xllEmulator::instance();
+    excel.set_cell(1, 0, 0, 2.5);
+    excel.set_cell(1, 1, 0, 1.0 / 3);
+    xloper12 a1 = cell_ref(0, 0), a2 = cell_ref(1, 0);
+
+    for (xllLoad mode : {xllLoad::eager, xllLoad::lazy}) {
+        xllType x(&a1, mode);
+        x.resolve();
+        check(x.get_str() == L"2.5", "get_str() of a numeric reference");
+        check(std::wcscmp(x.get_c_str(), L"2.5") == 0, "get_c_str() of a numeric reference");
+        check(x.is_num() && x.get_num() == 2.5, "numeric reference stays a number after formatting");
+
+        // C-string accessor first, before anything else has resolved the reference
+        xllType y(&a2, mode);
+        std::wstring text = y.resolve()->get_c_str();
+        check(text == L"0.333333333333333", "get_c_str() formats with 15 significant digits");
+        check(y.get_str() == text, "get_str() and get_c_str() agree");
+    }
+
+    // Array elements read as the same text as the scalar
+    xloper12 a1a2 = cell_ref(0, 0);
+    a1a2.val.sref.ref.rwLast = 1;
+    xllType arr(&a1a2);
+    check(arr[0].get_str() == L"2.5" && std::wcscmp(arr[0].get_c_str(), L"2.5") == 0, "numeric element as text");
+    check(arr[1].get_str() == L"0.333333333333333", "numeric element formats with 15 significant digits");
+    check(arr[0].get_str_view().empty(), "numeric element has no stored text");
+
+    // Setting a new number replaces the text
+    xllType z(&a1, xllLoad::lazy);
+    z.resolve()->get_c_str();
+    z.set_num(4);
+    check(std::wcscmp(z.get_c_str(), L"4") == 0, "get_c_str() after set_num()");
+}
+
+/// @brief The same same-sheet rectangle on two sheets is cached per calling sheet, not per active sheet
+static void range_cache_sheets() {
+    xllEmulator& excel = xllEmulator::instance();
+    IDSHEET other = excel.add_sheet(L"Sheet2");
+    for (RW r = 0; r < 3; r++) {
+        excel.set_cell(1, r, 5, double(r + 1));
+        excel.set_cell(other, r, 5, double(10 * (r + 1)));
+    }
+    xloper12 f1 = cell_ref(0, 5);
+    f1.val.sref.ref.rwLast = 2;
+
+    xllRangeCache& cache = xllRangeCache::instance();
+    check(cache.enable(), "range cache enabled");
+    cache.next_generation();
+    // Sheet1 stays active while both sheets are calculated
+    excel.set_active_sheet(1);
+    excel.set_caller(1, 1000, 100);
+    xllType a(&f1);
+    excel.set_caller(other, 1000, 100);
+    xllType b(&f1);
+    check(a.size() == 3 && a[2].get_num() == 3, "SRef range read on Sheet1");
+    check(b.size() == 3 && b[2].get_num() == 30, "same SRef range read on Sheet2, not from the Sheet1 snapshot");
+
+    // Within the generation each sheet's snapshot is reused
+    xllRangeCacheStats before = cache.stats();
+    xllType c(&f1);
+    check(c.size() == 3 && c[0].get_num() == 10, "cached SRef range of Sheet2");
+    check(cache.stats().hits == before.hits + 1, "second read of the Sheet2 range is a cache hit");
+    cache.disable();
+    excel.set_caller(1, 1000, 100);
+}
+
+/// @brief A range read by a command or VBA between calculations is not served to the next calculation
+static void range_cache_outside_calc() {
+    xllEmulator& excel = xllEmulator::instance();
+    for (RW r = 0; r < 3; r++) excel.set_cell(1, r, 10, double(r + 1));
+    // An xltypeRef names its sheet, so the cache needs no cell caller to key it
+    XLMREF12 mref;
+    mref.count = 1;
+    mref.reftbl[0] = XLREF12{0, 2, 10, 10};
+    xloper12 k1;
+    k1.xltype = xltypeRef;
+    k1.val.mref.lpmref = &mref;
+    k1.val.mref.idSheet = 1;
+
+    xllRangeCache& cache = xllRangeCache::instance();
+    check(cache.enable(), "range cache enabled");
+    cache.next_generation();
+    excel.set_command_caller(true);
+    xllRangeCacheStats before = cache.stats();
+    xllType a(&k1);
+    check(a.size() == 3 && a[2].get_num() == 3, "range read by a command");
+    xllRangeCacheStats after = cache.stats();
+    check(after.misses == before.misses && after.entries == before.entries, "command read bypasses the cache");
+    excel.set_command_caller(false);
+
+    // The user edits the range, then the next calculation reads it
+    excel.set_cell(1, 2, 10, 30.0);
+    xllType b(&k1);
+    check(b.size() == 3 && b[2].get_num() == 30, "calculation reads the edited range");
+    xllType c(&k1);
+    check(c[2].get_num() == 30 && cache.stats().hits == after.hits + 1, "calculation reuses its own snapshot");
+    cache.disable();
+}
+
+/// @brief A lazily loaded range appended to an array is flattened into its cells
+static void lazy_range_append() {
+    xllEmulator& excel = xllEmulator::instance();
+    excel.set_cell(1, 0, 7, 1.0);
+    excel.set_cell(1, 1, 7, L"two");
+    excel.set_cell(1, 2, 7, 3.0);
+    xloper12 h1 = cell_ref(0, 7);
+    h1.val.sref.ref.rwLast = 2;
+
+    xllType a;
+    a.push_back(0.0);
+    a.push_back(xllType(&h1, xllLoad::lazy));
+    check(a.size() == 4, "push_back of a lazy range appends every cell");
+    check(a[2].get_str() == L"two" && a[3].get_num() == 3, "cells of a lazy range pushed by copy");
+
+    xllType lazy(&h1, xllLoad::lazy);
+    xllType b;
+    b.push_back(lazy);
+    check(b.size() == 3 && b[1].get_str() == L"two", "push_back of a named lazy range");
+    check(lazy.is_sref() && lazy.get_rows() == 3 && lazy.size() == 0, "source range is still an unresolved reference");
+    check(lazy.resolve()->size() == 3, "source range is readable after being appended");
+}
+
+/// @brief An array appended to itself doubles, an empty array appends nothing
+static void self_append() {
+    xllType a;
+    for (int i = 0; i < 3; i++) a.push_back(L"text " + std::to_wstring(i));
+    a.push_back(4.0);
+    a.push_back(a);
+    check(a.size() == 8, "self push_back doubles the array");
+    check(a[4].get_str() == L"text 0" && a[6].get_str() == L"text 2" && a[7].get_num() == 4, "cells of a self push_back");
+
+    xllType empty(xlllist{});
+    xllType b;
+    b.push_back(1.0);
+    b.push_back(empty);
+    check(b.size() == 1, "push_back of an empty array adds no cell");
+    empty.push_back(empty);
+    check(empty.size() == 0, "empty array appended to itself stays empty");
+}
+
+/// @brief Value accessors of a lazy reference coerce it once, is_sref() and size() leave it alone
+static void const_lazy_reference() {
+    xllEmulator& excel = xllEmulator::instance();
+    excel.set_cell(1, 0, 8, xllEmuValue::boolean(true));
+    excel.set_cell(1, 1, 8, xllEmuValue::error(xlerrNA));
+    excel.set_cell(1, 2, 8, 7.0);
+    xloper12 i1 = cell_ref(0, 8), i2 = cell_ref(1, 8), i3 = cell_ref(2, 8);
+
+    xllType b(&i1, xllLoad::lazy);
+    const xllType& cb = b;
+    check(cb.is_bool() && cb.get_bool() && !cb.is_num() && cb.get_num() == 0, "const access reads the lazy boolean");
+    check(cb.is_sref() && cb.size() == 0, "const access leaves the header a reference");
+    b.resolve();
+    check(cb.is_bool() && cb.get_bool() && !cb.is_num() && !cb.is_sref(), "resolved lazy boolean cell");
+    check(b.xltype == xltypeBool && b.val.xbool, "header holds the value after resolve()");
+    xllType e(&i2, xllLoad::lazy);
+    check(e.is_err() && e.get_err() == xlerrNA, "lazy error cell read without resolve()");
+    check(e.resolve()->is_err() && e.get_err() == xlerrNA, "resolved lazy error cell");
+
+    // A copy of an unresolved reference stays lazy, resolving one does not touch the other
+    xllType n(&i3, xllLoad::lazy);
+    xllType copy(n);
+    uint64_t coerced = excel.callbacks(xlCoerce);
+    check(copy.is_sref() && copy.get_num() == 7 && copy.is_num(), "copy of a lazy cell is lazy and reads the value");
+    check(copy.resolve()->get_num() == 7 && std::wcscmp(copy.get_c_str(), L"7") == 0, "resolved copy");
+    check(excel.callbacks(xlCoerce) == coerced + 1, "accessors and resolve() coerce the copy once");
+    check(n.is_sref() && n.resolve()->get_num() == 7, "source of the copy resolves on its own");
+    check(copy.resolve()->get_num() == 7, "second resolve() keeps the value");
+}
+
+/// @brief A slice of an SRef or Ref range is a plain array whose header no longer points at a reference
+static void slice_header() {
+    xllEmulator& excel = xllEmulator::instance();
+    for (RW r = 0; r < 4; r++) excel.set_cell(1, r, 9, double(r + 1));
+    xloper12 j1 = cell_ref(0, 9);
+    j1.val.sref.ref.rwLast = 3;
+    XLMREF12 mref;
+    mref.count = 1;
+    mref.reftbl[0] = j1.val.sref.ref;
+    xloper12 ref;
+    ref.xltype = xltypeRef;
+    ref.val.mref.lpmref = &mref;
+    ref.val.mref.idSheet = 1;
+
+    for (const xloper12* src : {&j1, &ref}) {
+        xllType data(src, xllLoad::lazy);
+        xllType page = data.slice(2, 3);
+        check(page.size() == 2 && page[0].get_num() == 2 && page[1].get_num() == 3, "cells of a slice");
+        check(page.xltype == xltypeMulti && page.val.array.lparray == nullptr && page.val.array.rows == 2 &&
+                  page.val.array.columns == 1,
+              "slice header is an array without a reference");
+        xloper12* ret = page.get_return();
+        check(ret->xltype == (xltypeMulti | xlbitDLLFree) && ret->val.array.rows == 2, "slice returned to Excel");
+        xlAutoFree12(ret);
+    }
+}
+
+/// @brief xlAutoFree12 tells makeReturn12 blocks from values a UDF built with new, whatever their layout
+static void return_blocks() {
+    xllType s(L"abc");
+    xloper12* block = s.get_return();
+    check(isReturn12(block), "get_return() string is a makeReturn12 block");
+    xloper12 copy = *block;
+    check(!isReturn12(&copy), "a copy of a block's header is not a block");
+    xlAutoFree12(block);
+    block = xllType(2.5).get_return();
+    check(isReturn12(block) && block->val.num == 2.5, "get_return() number is a makeReturn12 block");
+    xlAutoFree12(block);
+    xllType err;
+    err.set_err(xlerrDiv0);
+    block = err.get_return();
+    check(isReturn12(block) && block->val.err == xlerrDiv0, "get_return() error is a makeReturn12 block");
+    xlAutoFree12(block);
+
+    // Array elements keep the member of their type
+    xllType cells;
+    cells.push_back(1.5);
+    cells.push_back(xllType(err));
+    xloper12 t;
+    t.xltype = xltypeBool;
+    t.val.xbool = TRUE;
+    cells.push_back(xllType(t));
+    block = cells.get_return();
+    const xloper12* p = block->val.array.lparray;
+    check(p[0].xltype == xltypeNum && p[0].val.num == 1.5, "number element of a returned array");
+    check(p[1].xltype == xltypeErr && p[1].val.err == xlerrDiv0, "error element of a returned array");
+    check(p[2].xltype == xltypeBool && p[2].val.xbool, "boolean element of a returned array");
+    xlAutoFree12(block);
+
+    // A reference header fills all of val, it is returned as a plain xloper12
+    xllType ref;
+    ref.xltype = xltypeSRef;
+    ref.val.sref = cell_ref(3, 10).val.sref;
+    block = ref.get_return();
+    check(!isReturn12(block) && block->xltype == (xltypeSRef | xlbitDLLFree) && block->val.sref.ref.colLast == 10,
+          "a reference result keeps its whole val");
+    xlAutoFree12(block);
+
+    xloper12* str = new xloper12;
+    str->xltype = xltypeStr | xlbitDLLFree;
+    str->val.str = makeStr12(L"abc");
+    check(!isReturn12(str), "hand-built string is not a block");
+    xlAutoFree12(str);
+
+    xloper12* multi = new xloper12;
+    multi->xltype = xltypeMulti | xlbitDLLFree;
+    multi->val.array.lparray = new xloper12[2];
+    multi->val.array.rows = 1;
+    multi->val.array.columns = 2;
+    multi->val.array.lparray[0].xltype = xltypeNum;
+    multi->val.array.lparray[0].val.num = 1;
+    multi->val.array.lparray[1].xltype = xltypeStr;
+    multi->val.array.lparray[1].val.str = makeStr12(L"b");
+    check(!isReturn12(multi), "hand-built array is not a block");
+    xlAutoFree12(multi);
+}
+
+/// @brief An array assigned to an element is stored as #VALUE!, not as its (empty) string
+static void array_into_cell() {
+    xllType a(xlllist{xllType(L"one"), xllType(2.0), xllType(L"three")});
+    xllType inner(xlllist{xllType(L"x"), xllType(4.0)});
+    a[0] = inner;
+    a[1] = inner;
+    check(a[0].is_err() && a[0].get_err() == xlerrValue, "array over a string cell is #VALUE!");
+    check(a[1].is_err() && a[1].get_err() == xlerrValue, "array over a numeric cell is #VALUE!");
+    check(a.size() == 3 && a[2].get_str() == L"three", "other cells are unchanged");
+    a[0] = xllType(L"back");
+    check(a[0].get_str() == L"back", "a scalar string can be assigned again");
+}
+
+/// @brief Overwritten strings are reused in place or reclaimed by compaction, the other cells keep their text
+static void string_pool_compaction() {
+    xllType a;
+    for (int i = 0; i < 4; i++) a.push_back(L"abcdef");
+    a.push_back(1.5);
+    check(a.get_pool_size() == 4 * 7, "pool holds each string and its terminator");
+
+    // Shorter text reuses the slot, longer text is appended and the old slot becomes dead
+    a[0] = L"xy";
+    a[1] = L"a much longer text";
+    check(a.get_pool_size() == 4 * 7 + 19, "shorter text in place, longer text appended");
+    check(a[0].get_str() == L"xy" && a[1].get_str() == L"a much longer text", "overwritten cells read back");
+    check(std::wcscmp(a[0].get_c_str(), L"xy") == 0, "shortened text is null-terminated");
+
+    // A cell copied from another cell of the same pool
+    a[2] = a[1].get_c_str();
+    a[4] = L"";
+    a.shrink_to_fit();
+    check(a.get_pool_size() == 3 + 19 + 19 + 7 + 1, "compaction keeps only live strings");
+    check(a[0].get_str() == L"xy" && a[1].get_str() == L"a much longer text" &&
+              a[2].get_str() == L"a much longer text" && a[3].get_str() == L"abcdef" && a[4].get_str().empty(),
+          "cell texts after compaction");
+
+    // Automatic compaction once most of the pool is dead
+    for (int i = 0; i < 50; i++) a[3] = std::wstring(10 + i, L'z');
+    check(a.get_pool_size() < 2 * (3 + 19 + 19 + 60 + 1), "repeated overwrites keep the pool bounded");
+    check(a[3].get_str() == std::wstring(59, L'z') && a[1].get_str() == L"a much longer text",
+          "cell texts after automatic compaction");
+}
+
+/// @brief Cells of two arrays are identical: same types, same number bits, same string units
+static bool same_cells(xllType& a, xllType& b) {
+    if (a.size() != b.size() || a.get_rows() != b.get_rows() || a.get_cols() != b.get_cols()) return false;
+    for (int i = 0; i < a.size(); i++) {
+        xllCellRef x = a[i], y = b[i];
+        if (x.type() != y.type()) return false;
+        double u = x.get_num(), v = y.get_num();
+        if (std::memcmp(&u, &v, sizeof(u)) != 0) return false;
+        if (x.get_str_view() != y.get_str_view() || x.get_bool() != y.get_bool() || x.get_err() != y.get_err()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief serialize() and deserialize() round-trip every cell exactly
+static void serialize_round_trip() {
+    xllType t, f, nil;
+    t.xltype = f.xltype = xltypeBool;
+    t.val.xbool = 1;
+    f.val.xbool = 0;
+    xllType na, div0;
+    na.set_err(xlerrNA);
+    div0.set_err(xlerrDiv0);
+    double nan_payload;
+    uint64_t bits = 0x7FF8000000012345ull;
+    std::memcpy(&nan_payload, &bits, sizeof(bits));
+    std::wstring tagged = std::wstring(1, xllArrayTag) + L"not an array";
+
+    xllmartix m = {
+        {xllType(1.0 / 3), xllType(std::numeric_limits<double>::quiet_NaN()), xllType(nan_payload)},
+        {xllType(std::numeric_limits<double>::denorm_min()), xllType(-0.0), xllType(-HUGE_VAL)},
+        {xllType(L""), xllType(std::wstring(L"a\0b\0", 4)), xllType(tagged)},
+        {t, f, nil},
+        {na, div0, xllType(std::wstring(1, L'\0'))},
+    };
+    xllType a(m);
+    xllType encoded(a);
+    encoded.serialize();
+    check(encoded.is_str() && !encoded.is_array() && encoded.get_str()[0] == xllArrayTag, "array serialized");
+
+    xllType b(encoded.get_str());
+    b.deserialize();
+    check(b.is_array() && b.get_rows() == 5 && b.get_cols() == 3, "shape after deserialize");
+    check(same_cells(a, b), "mixed array round-trips cell by cell");
+    check(b[5].get_num() == -HUGE_VAL && std::signbit(b[4].get_num()), "infinity and negative zero");
+    check(b[7].get_str_view() == std::wstring_view(L"a\0b\0", 4), "string with embedded NUL");
+    check(b[8].get_str() == tagged, "string starting with xllArrayTag");
+
+    // One row, one column and a single cell
+    for (xllType c : {xllType(xlllist{xllType(1.0), xllType(L"x")}), xllType(xllmartix{{xllType(2.0)}, {t}}),
+                      xllType(xlllist{xllType(L"")})}) {
+        xllType e(c);
+        e.serialize();
+        xllType d(e.get_str());
+        d.deserialize();
+        check(same_cells(c, d), "small array round-trips");
+    }
+
+    // Strings that only look like an encoding stay strings
+    for (std::wstring s : {tagged, std::wstring(1, xllArrayTag), encoded.get_str().substr(0, 10)}) {
+        xllType x(s);
+        x.deserialize();
+        check(x.is_str() && !x.is_array() && x.get_str() == s, "malformed encoding is left as a string");
+    }
+
+    // Text laid out like an encoding, but without the version unit and checksum, or with one unit changed
+    std::wstring full = encoded.get_str();
+    std::wstring unversioned = full.substr(0, 1) + full.substr(2, full.size() - 4);
+    std::wstring flipped = full;
+    flipped[full.size() / 2] ^= 1;
+    for (const std::wstring& s : {unversioned, flipped}) {
+        xllType value(s);
+        value.serialize();
+        xllType received(value.get_str());
+        received.deserialize();
+        check(received.is_str() && !received.is_array() && received.get_str() == s,
+              "published text starting with xllArrayTag round-trips as text");
+    }
+}
+
+/// @brief A moved-from xllType is empty and reusable, move assignment leaves the target's string pool consistent
+static void move_semantics() {
+    xllType s(L"some text");
+    xllType s2(std::move(s));
+    check(s.xltype == xltypeNil && !s.is_str() && !s.is_num() && s.get_str().empty(), "moved-from string is nil");
+    check(s2.get_str() == L"some text", "moved string");
+    s = 4.0;
+    check(s.get_num() == 4, "moved-from string reused as a number");
+
+    xllType a(xlllist{xllType(L"one"), xllType(2.0), xllType(L"three")});
+    a[0] = L"a longer first cell";
+    size_t pool = a.get_pool_size();
+    xllType b(std::move(a));
+    check(a.xltype == xltypeNil && a.size() == 0 && a.get_pool_size() == 0 && !a.is_array(), "moved-from array is nil");
+    check(b.size() == 3 && b.get_pool_size() == pool && b[2].get_str() == L"three", "moved array keeps its pool");
+    a.push_back(L"again");
+    a.push_back(5.0);
+    check(a.size() == 2 && a[0].get_str() == L"again" && a[1].get_num() == 5, "moved-from array reused");
+
+    // Move-assigning a string over an array drops the old cells and pool
+    xllType target(xlllist{xllType(L"old"), xllType(L"cells")});
+    target = std::move(s2);
+    check(target.is_str() && !target.is_array() && target.size() == 0 && target.get_pool_size() == 0,
+          "string moved over an array");
+    check(target.get_str() == L"some text", "string moved over an array reads back");
+
+    // Move-assigning an array over an array with dead pool characters takes over the source pool only
+    xllType dst(xlllist{xllType(L"first"), xllType(L"second")});
+    dst[0] = L"a replacement longer than first";
+    dst = std::move(b);
+    check(dst.size() == 3 && dst.get_pool_size() == pool, "array moved over an array takes its pool");
+    dst[1] = L"no longer a number";
+    dst[0] = L"short";
+    dst.shrink_to_fit();
+    check(dst[0].get_str() == L"short" && dst[1].get_str() == L"no longer a number" && dst[2].get_str() == L"three",
+          "moved array texts after edits and compaction");
+    check(dst.get_pool_size() == 6 + 19 + 6, "moved array pool after compaction");
+    check(b.xltype == xltypeNil && b.size() == 0 && b.get_pool_size() == 0, "source of a move assignment is nil");
+}
+
+int main() {
+    xllEmulator& excel = xllEmulator::instance();
+    excel.open();
+    numeric_reference_text();
+    range_cache_sheets();
+    range_cache_outside_calc();
+    lazy_range_append();
+    self_append();
+    const_lazy_reference();
+    slice_header();
+    return_blocks();
+    array_into_cell();
+    string_pool_compaction();
+    serialize_round_trip();
+    move_semantics();
+    excel.close();
+    if (failures == 0) std::printf("all checks passed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,944 @@
+#include "xllEmulator.h"
+#include "RtdServer.h"
+#include "dll.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cwctype>
+#include <dlfcn.h>
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+#error "xllEmulator passes UDF arguments by register class, only x86-64 and AArch64 are supported"
+#endif
+
+// Add-in entry points, linked into the same executable
+BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved);
+extern "C" int xlAutoOpen(void);
+extern "C" int xlAutoClose(void);
+extern "C" void xlAutoFree12(LPXLOPER12 pxFree);
+
+/// @brief Callback entry point looked up by XLCALL.CPP in the host executable, as in Excel.exe
+extern "C" __declspec(dllexport) int PASCAL MdCallBack12(int xlfn, int count, LPXLOPER12* opers, LPXLOPER12 res) {
+    return xllEmulator::instance().dispatch(xlfn, count, opers, res);
+}
+
+/// @brief Nesting depth of code running on behalf of Excel on this thread
+static thread_local int excel_depth = 0;
+
+/// @brief Marks the current thread as running Excel code for the lifetime of the object
+struct ExcelSide {
+    ExcelSide() { excel_depth++; }
+    ~ExcelSide() { excel_depth--; }
+};
+
+bool xllEmulator::excel_side() {
+    return excel_depth > 0;
+}
+
+// ==================== Values ====================
+
+xllEmuValue xllEmuValue::boolean(bool v) {
+    xllEmuValue ret;
+    ret.xltype = xltypeBool;
+    ret.xbool = v;
+    return ret;
+}
+
+xllEmuValue xllEmuValue::error(int e) {
+    xllEmuValue ret;
+    ret.xltype = xltypeErr;
+    ret.err = e;
+    return ret;
+}
+
+xllEmuValue xllEmuValue::multi(int rows, int cols, std::vector<xllEmuValue> cells) {
+    xllEmuValue ret;
+    ret.xltype = xltypeMulti;
+    ret.rows = rows;
+    ret.cols = cols;
+    ret.array = std::move(cells);
+    ret.array.resize(size_t(rows) * cols);
+    return ret;
+}
+
+xllEmuValue xllEmuValue::sref(RW rwFirst, COL colFirst, RW rwLast, COL colLast) {
+    xllEmuValue ret;
+    ret.xltype = xltypeSRef;
+    ret.ref = {rwFirst, rwLast, colFirst, colLast};
+    return ret;
+}
+
+xllEmuValue xllEmuValue::reference(IDSHEET sheet, RW rwFirst, COL colFirst, RW rwLast, COL colLast) {
+    xllEmuValue ret = sref(rwFirst, colFirst, rwLast, colLast);
+    ret.xltype = xltypeRef;
+    ret.sheet = sheet;
+    return ret;
+}
+
+/// @brief Excel's text for an error code
+static const wchar_t* error_text(int err) {
+    switch (err) {
+    case xlerrNull: return L"#NULL!";
+    case xlerrDiv0: return L"#DIV/0!";
+    case xlerrValue: return L"#VALUE!";
+    case xlerrRef: return L"#REF!";
+    case xlerrName: return L"#NAME?";
+    case xlerrNum: return L"#NUM!";
+    case xlerrNA: return L"#N/A";
+    case xlerrGettingData: return L"#GETTING_DATA";
+    default: return L"#ERROR";
+    }
+}
+
+/// @brief Number formatted the way xlCoerce formats it
+static std::wstring number_text(double v) {
+    wchar_t buffer[32];
+    std::swprintf(buffer, 32, L"%.15g", v);
+    return buffer;
+}
+
+std::wstring xllEmuValue::to_string() const {
+    switch (xltype) {
+    case xltypeNum:
+    case xltypeInt: return number_text(num);
+    case xltypeStr: return str;
+    case xltypeBool: return xbool ? L"TRUE" : L"FALSE";
+    case xltypeErr: return error_text(err);
+    case xltypeMulti: {
+        std::wstring ret = L"{";
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++) {
+                if (c > 0) ret += L',';
+                ret += array[size_t(r) * cols + c].to_string();
+            }
+            if (r + 1 < rows) ret += L';';
+        }
+        return ret + L"}";
+    }
+    case xltypeSRef:
+    case xltypeRef: return L"R" + std::to_wstring(ref.rwFirst + 1) + L"C" + std::to_wstring(ref.colFirst + 1) + L":R" +
+                           std::to_wstring(ref.rwLast + 1) + L"C" + std::to_wstring(ref.colLast + 1);
+    default: return L"";
+    }
+}
+
+/// @brief Value of an xloper12 that is not a reference, references keep their rectangle
+static xllEmuValue to_value(const xloper12& x) {
+    xllEmuValue v;
+    switch (x.xltype & ~(xlbitXLFree | xlbitDLLFree)) {
+    case xltypeNum: v = x.val.num; break;
+    case xltypeInt: v = x.val.w; break;
+    case xltypeStr: v = x.val.str ? std::wstring(x.val.str + 1, x.val.str[0]) : std::wstring(); break;
+    case xltypeBool: v = xllEmuValue::boolean(x.val.xbool); break;
+    case xltypeErr: v = xllEmuValue::error(x.val.err); break;
+    case xltypeMissing: v.xltype = xltypeMissing; break;
+    case xltypeSRef: v = xllEmuValue::sref(x.val.sref.ref.rwFirst, x.val.sref.ref.colFirst, x.val.sref.ref.rwLast, x.val.sref.ref.colLast); break;
+    case xltypeRef:
+        if (x.val.mref.lpmref && x.val.mref.lpmref->count > 0) {
+            const XLREF12& r = x.val.mref.lpmref->reftbl[0];
+            v = xllEmuValue::reference(x.val.mref.idSheet, r.rwFirst, r.colFirst, r.rwLast, r.colLast);
+        } else {
+            v = xllEmuValue::error(xlerrRef);
+        }
+        break;
+    case xltypeMulti: {
+        int rows = x.val.array.rows, cols = x.val.array.columns;
+        std::vector<xllEmuValue> cells;
+        cells.reserve(size_t(rows) * cols);
+        for (int i = 0; i < rows * cols; i++) cells.push_back(to_value(x.val.array.lparray[i]));
+        v = xllEmuValue::multi(rows, cols, std::move(cells));
+        break;
+    }
+    default: break;
+    }
+    return v;
+}
+
+/// @brief Bytes of the single block a value's pointers refer to when written as an xloper12
+static size_t block_size(const xllEmuValue& v) {
+    switch (v.xltype) {
+    case xltypeStr: return (v.str.size() + 2) * sizeof(XCHAR);
+    case xltypeRef: return sizeof(XLMREF12);
+    case xltypeMulti: {
+        size_t n = v.array.size() * sizeof(xloper12);
+        for (const xllEmuValue& e : v.array) {
+            if (e.xltype == xltypeStr) n += (e.str.size() + 2) * sizeof(XCHAR);
+        }
+        return n;
+    }
+    default: return 0;
+    }
+}
+
+/// @brief Write a counted string @return Position after the string
+static XCHAR* write_str(XCHAR* s, const std::wstring& str) {
+    s[0] = static_cast<XCHAR>(str.size());
+    std::wmemcpy(s + 1, str.data(), str.size());
+    s[str.size() + 1] = 0;
+    return s + str.size() + 2;
+}
+
+/// @brief Write a scalar value, strings go to s
+static void write_scalar(const xllEmuValue& v, xloper12& x, XCHAR*& s) {
+    x.xltype = v.xltype;
+    switch (v.xltype) {
+    case xltypeNum: x.val.num = v.num; break;
+    case xltypeInt: x.val.w = static_cast<int>(v.num); break;
+    case xltypeBool: x.val.xbool = v.xbool; break;
+    case xltypeErr: x.val.err = v.err; break;
+    case xltypeStr:
+        x.val.str = s;
+        s = write_str(s, v.str);
+        break;
+    case xltypeMulti:
+        // Nested arrays do not exist in Excel
+        x.xltype = xltypeErr;
+        x.val.err = xlerrValue;
+        break;
+    default: x.xltype = v.xltype == xltypeMissing ? xltypeMissing : xltypeNil; break;
+    }
+}
+
+/// @brief Write a value as an xloper12 whose pointers refer into mem (block_size(v) bytes)
+static void write_block(const xllEmuValue& v, xloper12& x, char* mem) {
+    if (v.xltype == xltypeMulti) {
+        xloper12* p = reinterpret_cast<xloper12*>(mem);
+        XCHAR* s = reinterpret_cast<XCHAR*>(p + v.array.size());
+        for (size_t i = 0; i < v.array.size(); i++) write_scalar(v.array[i], p[i], s);
+        x.xltype = xltypeMulti;
+        x.val.array.lparray = p;
+        x.val.array.rows = v.rows;
+        x.val.array.columns = v.cols;
+    } else if (v.xltype == xltypeSRef) {
+        x.xltype = xltypeSRef;
+        x.val.sref.count = 1;
+        x.val.sref.ref = v.ref;
+    } else if (v.xltype == xltypeRef) {
+        XLMREF12* m = reinterpret_cast<XLMREF12*>(mem);
+        m->count = 1;
+        m->reftbl[0] = v.ref;
+        x.xltype = xltypeRef;
+        x.val.mref.lpmref = m;
+        x.val.mref.idSheet = v.sheet;
+    } else {
+        XCHAR* s = reinterpret_cast<XCHAR*>(mem);
+        write_scalar(v, x, s);
+    }
+}
+
+// ==================== Emulator ====================
+
+xllEmulator& xllEmulator::instance() {
+    static xllEmulator excel;
+    return excel;
+}
+
+xllEmulator::xllEmulator() {
+    _sheets.push_back(Sheet{L"Sheet1", 0, 0, {}});
+    // Formulas are entered far away from the test data unless set_caller says otherwise
+    _caller = {1000, 1000, 100, 100};
+}
+
+IDSHEET xllEmulator::add_sheet(const std::wstring& name) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sheets.push_back(Sheet{name, 0, 0, {}});
+    return static_cast<IDSHEET>(_sheets.size());
+}
+
+void xllEmulator::set_cell(IDSHEET sheet, RW row, COL col, xllEmuValue value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (sheet == 0 || sheet > _sheets.size() || row < 0 || col < 0) return;
+    Sheet& s = _sheets[sheet - 1];
+    if (row >= s.rows || col >= s.cols) {
+        int rows = row >= s.rows ? row + 1 : s.rows, cols = col >= s.cols ? col + 1 : s.cols;
+        std::vector<xllEmuValue> cells(size_t(rows) * cols);
+        for (int r = 0; r < s.rows; r++) {
+            for (int c = 0; c < s.cols; c++) cells[size_t(r) * cols + c] = std::move(s.cells[size_t(r) * s.cols + c]);
+        }
+        s.cells = std::move(cells);
+        s.rows = rows;
+        s.cols = cols;
+    }
+    s.cells[size_t(row) * s.cols + col] = std::move(value);
+}
+
+const xllEmuValue& xllEmulator::cell(IDSHEET sheet, RW row, COL col) const {
+    static const xllEmuValue nil;
+    if (sheet == 0 || sheet > _sheets.size()) return nil;
+    const Sheet& s = _sheets[sheet - 1];
+    if (row < 0 || col < 0 || row >= s.rows || col >= s.cols) return nil;
+    return s.cells[size_t(row) * s.cols + col];
+}
+
+void xllEmulator::set_caller(IDSHEET sheet, RW row, COL col) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _caller_sheet = sheet;
+    _caller = {row, row, col, col};
+}
+
+void xllEmulator::set_command_caller(bool command) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _command_caller = command;
+}
+
+void xllEmulator::set_active_sheet(IDSHEET sheet) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _active_sheet = sheet;
+}
+
+int xllEmulator::open() {
+    if (!_attached) {
+        _attached = true;
+        DllMain(nullptr, DLL_PROCESS_ATTACH, nullptr);
+    }
+    return xlAutoOpen();
+}
+
+int xllEmulator::close() {
+    if (_rtd_server) {
+        for (const auto& topic : _rtd_topics) _rtd_server->DisconnectData(topic.second);
+        _rtd_server->ServerTerminate();
+        _rtd_server->Release();
+        _rtd_server = nullptr;
+        _rtd_topics.clear();
+        _rtd_values.clear();
+    }
+    return xlAutoClose();
+}
+
+bool xllEmulator::registered(const std::wstring& name) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _functions.find(name) != _functions.end();
+}
+
+std::wstring xllEmulator::type_text(const std::wstring& name) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _functions.find(name);
+    return it == _functions.end() ? L"" : it->second.type_text;
+}
+
+uint64_t xllEmulator::callbacks() const {
+    uint64_t n = 0;
+    for (const auto& c : _calls) n += c.load(std::memory_order_relaxed);
+    return n;
+}
+
+void xllEmulator::reset_counters() {
+    for (auto& c : _calls) c.store(0, std::memory_order_relaxed);
+}
+
+void xllEmulator::calculation_ended() {
+    std::vector<std::wstring> handlers;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        handlers = _events[xleventCalculationEnded];
+    }
+    for (const std::wstring& name : handlers) {
+        std::string proc(name.begin(), name.end());
+        auto fn = reinterpret_cast<int (*)()>(dlsym(RTLD_DEFAULT, proc.c_str()));
+        if (fn) fn();
+    }
+}
+
+// ==================== Callbacks ====================
+
+/// @brief Store a value without pointers in the result of a callback, if the caller asked for one
+static int set_result(LPXLOPER12 res, const xllEmuValue& v) {
+    if (res == nullptr) return xlretSuccess;
+    size_t bytes = block_size(v);
+    char* mem = bytes ? static_cast<char*>(std::malloc(bytes)) : nullptr;
+    write_block(v, *res, mem);
+    return xlretSuccess;
+}
+
+int xllEmulator::dispatch(int xlfn, int count, LPXLOPER12* opers, LPXLOPER12 res) {
+    ExcelSide guard;
+    _calls[xlfn & 0xFFFF].fetch_add(1, std::memory_order_relaxed);
+    switch (xlfn) {
+    case xlFree:
+        for (int i = 0; i < count; i++) this->free_value(opers[i]);
+        return xlretSuccess;
+    case xlCoerce: {
+        if (count < 1 || res == nullptr) return xlretInvCount;
+        DWORD mask = 0;
+        if (count > 1) {
+            xllEmuValue m = to_value(*opers[1]);
+            mask = static_cast<DWORD>(m.num);
+        }
+        return this->coerce(*opers[0], mask, res);
+    }
+    case xlfCaller:
+        if (res) {
+            // A worksheet function's caller is the calling cell as a single-area xltypeRef, with its sheet. Commands
+            // and VBA get #REF!
+            xllEmuValue caller = xllEmuValue::error(xlerrRef);
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_command_caller) {
+                    caller = xllEmuValue::reference(_caller_sheet, _caller.rwFirst, _caller.colFirst, _caller.rwLast,
+                                                    _caller.colLast);
+                }
+            }
+            this->write(caller, res);
+        }
+        return xlretSuccess;
+    case xlSheetId:
+        if (res) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            // Without an argument Excel returns the active sheet, which need not be the sheet being calculated
+            res->xltype = xltypeRef;
+            res->val.mref.lpmref = nullptr;
+            res->val.mref.idSheet = _active_sheet;
+        }
+        return xlretSuccess;
+    case xlGetName: {
+        WCHAR path[1024];
+        DWORD n = GetModuleFileName(nullptr, path, 1024);
+        if (res) this->write(std::wstring(path, n), res);
+        return xlretSuccess;
+    }
+    case xlGetHwnd:
+        if (res) {
+            res->xltype = xltypeInt;
+            res->val.w = 0;
+        }
+        return xlretSuccess;
+    case xlfRegister: return this->reg(count, opers, res);
+    case xlfUnregister: {
+        if (count < 1) return xlretInvCount;
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _register_ids.find(to_value(*opers[0]).num);
+        bool found = it != _register_ids.end();
+        if (found) {
+            _functions.erase(it->second);
+            for (auto& handlers : _events) std::erase(handlers.second, it->second);
+            _register_ids.erase(it);
+        }
+        return set_result(res, xllEmuValue::boolean(found));
+    }
+    case xlfSetName: return set_result(res, xllEmuValue::boolean(true));
+    case xlEventRegister: {
+        if (count < 2) return xlretInvCount;
+        std::lock_guard<std::mutex> lock(_mutex);
+        _events[static_cast<int>(to_value(*opers[1]).num)].push_back(to_value(*opers[0]).str);
+        return set_result(res, xllEmuValue::boolean(true));
+    }
+    case xlfEvaluate:
+        if (count < 1) return xlretInvCount;
+        return this->evaluate(*opers[0], res);
+    case xlfRtd: return this->rtd(count, opers, res);
+    case xlcAlert: {
+        if (count < 1) return xlretInvCount;
+        std::wstring msg = to_value(*opers[0]).to_string();
+        std::fprintf(stderr, "[alert] %ls\n", msg.c_str());
+        return set_result(res, xllEmuValue::boolean(true));
+    }
+    default: return xlretInvXlfn;
+    }
+}
+
+int xllEmulator::free_value(LPXLOPER12 x) {
+    if (x == nullptr) return xlretSuccess;
+    void* block = nullptr;
+    switch (x->xltype & ~(xlbitXLFree | xlbitDLLFree)) {
+    case xltypeStr: block = x->val.str; break;
+    case xltypeMulti: block = x->val.array.lparray; break;
+    case xltypeRef: block = x->val.mref.lpmref; break;
+    default: break;
+    }
+    if (block) {
+        std::free(block);
+        _outstanding--;
+    }
+    return xlretSuccess;
+}
+
+/// @brief Parse a number the way a cell entry is parsed @return false if the text is not a number
+static bool parse_number(const std::wstring& s, double& v) {
+    const wchar_t* begin = s.c_str();
+    while (std::iswspace(*begin)) begin++;
+    if (*begin == 0) return false;
+    wchar_t* end = nullptr;
+    v = std::wcstod(begin, &end);
+    while (std::iswspace(*end)) end++;
+    return *end == 0;
+}
+
+bool xllEmulator::convert(const xllEmuValue& v, DWORD mask, xllEmuValue& out) {
+    DWORD type = v.xltype == xltypeMissing ? xltypeNil : v.xltype;
+    if (type == xltypeInt) type = xltypeNum;
+    if (mask & type) {
+        out = v;
+        if (out.xltype == xltypeInt) out.xltype = xltypeNum;
+        return true;
+    }
+    if (type == xltypeErr) return false;
+    if (mask & (xltypeNum | xltypeInt)) {
+        double num = 0;
+        bool ok = true;
+        if (type == xltypeStr) {
+            ok = parse_number(v.str, num);
+        } else if (type == xltypeBool) {
+            num = v.xbool ? 1 : 0;
+        }
+        if (ok) {
+            out = num;
+            if (!(mask & xltypeNum)) out.xltype = xltypeInt;
+            return true;
+        }
+    }
+    if (mask & xltypeStr) {
+        if (type == xltypeNum) {
+            out = number_text(v.num);
+        } else if (type == xltypeBool) {
+            out = v.xbool ? L"TRUE" : L"FALSE";
+        } else {
+            out = L"";
+        }
+        return true;
+    }
+    if (mask & xltypeBool) {
+        if (type == xltypeNum || type == xltypeNil) {
+            out = xllEmuValue::boolean(type == xltypeNum && v.num != 0);
+            return true;
+        }
+        if (type == xltypeStr && (v.str == L"TRUE" || v.str == L"FALSE")) {
+            out = xllEmuValue::boolean(v.str == L"TRUE");
+            return true;
+        }
+    }
+    return false;
+}
+
+xllEmuValue xllEmulator::range(IDSHEET sheet, const XLREF12& ref) const {
+    int rows = ref.rwLast - ref.rwFirst + 1, cols = ref.colLast - ref.colFirst + 1;
+    if (rows <= 0 || cols <= 0) return xllEmuValue::error(xlerrRef);
+    if (rows == 1 && cols == 1) return this->cell(sheet, ref.rwFirst, ref.colFirst);
+    std::vector<xllEmuValue> cells;
+    cells.reserve(size_t(rows) * cols);
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) cells.push_back(this->cell(sheet, ref.rwFirst + r, ref.colFirst + c));
+    }
+    return xllEmuValue::multi(rows, cols, std::move(cells));
+}
+
+xllEmuValue xllEmulator::read(const xloper12& x, bool resolve) const {
+    xllEmuValue v = to_value(x);
+    if (!resolve) return v;
+    if (v.xltype == xltypeSRef) return this->range(_caller_sheet, v.ref);
+    if (v.xltype == xltypeRef) {
+        // Multiple-area references cannot be coerced to values
+        if (x.val.mref.lpmref->count != 1) return xllEmuValue::error(xlerrValue);
+        return this->range(v.sheet, v.ref);
+    }
+    return v;
+}
+
+void xllEmulator::write(const xllEmuValue& v, LPXLOPER12 res) {
+    size_t bytes = block_size(v);
+    char* mem = nullptr;
+    if (bytes) {
+        mem = static_cast<char*>(std::malloc(bytes));
+        _outstanding++;
+    }
+    write_block(v, *res, mem);
+}
+
+int xllEmulator::coerce(const xloper12& x, DWORD mask, LPXLOPER12 res) {
+    DWORD type = x.xltype & ~(xlbitXLFree | xlbitDLLFree);
+    if ((type == xltypeRef || type == xltypeSRef) && type == mask) {
+        this->write(to_value(x), res);
+        return xlretSuccess;
+    }
+    xllEmuValue v;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        v = this->read(x, true);
+    }
+    if (mask == 0) {
+        // Without a type the value keeps its own type, references become values
+        this->write(v, res);
+        return xlretSuccess;
+    }
+    if (mask & xltypeMulti) {
+        if (v.xltype != xltypeMulti) v = xllEmuValue::multi(1, 1, {v});
+        this->write(v, res);
+        return xlretSuccess;
+    }
+    // A range coerced to a scalar yields its top-left cell
+    if (v.xltype == xltypeMulti) v = v.array.empty() ? xllEmuValue() : xllEmuValue(v.array[0]);
+    xllEmuValue out;
+    if (!convert(v, mask, out)) return xlretFailed;
+    this->write(out, res);
+    return xlretSuccess;
+}
+
+int xllEmulator::reg(int count, LPXLOPER12* opers, LPXLOPER12 res) {
+    if (count < 3) return xlretInvCount;
+    Registration r;
+    r.procedure = to_value(*opers[1]).str;
+    r.type_text = to_value(*opers[2]).str;
+    r.function = count > 3 ? to_value(*opers[3]).str : L"";
+    if (count > 5) {
+        xllEmuValue macro;
+        if (convert(to_value(*opers[5]), xltypeNum, macro)) r.macro_type = static_cast<int>(macro.num);
+    }
+    if (r.procedure.empty()) return set_result(res, xllEmuValue::error(xlerrValue));
+    std::wstring name = r.function.empty() ? r.procedure : r.function;
+    std::lock_guard<std::mutex> lock(_mutex);
+    double id = _next_register_id++;
+    _functions[name] = r;
+    _register_ids[id] = name;
+    return set_result(res, id);
+}
+
+/// @brief Parse an A1 cell name @return false if the text is not a cell name
+static bool parse_a1(const std::wstring& s, size_t& i, RW& row, COL& col) {
+    size_t start = i;
+    col = 0;
+    while (i < s.size() && std::iswalpha(s[i])) col = col * 26 + (std::towupper(s[i++]) - L'A' + 1);
+    if (i == start || i - start > 3) return false;
+    start = i;
+    row = 0;
+    while (i < s.size() && std::iswdigit(s[i])) row = row * 10 + (s[i++] - L'0');
+    if (i == start || row == 0) return false;
+    row--;
+    col--;
+    return true;
+}
+
+int xllEmulator::evaluate(const xloper12& expr, LPXLOPER12 res) {
+    std::wstring s = to_value(expr).str;
+    if (!s.empty() && s[0] == L'=') s.erase(0, 1);
+    xllEmuValue v = xllEmuValue::error(xlerrName);
+    double num;
+    size_t i = 0;
+    RW r0, r1;
+    COL c0, c1;
+    if (parse_number(s, num)) {
+        v = num;
+    } else if (s.size() >= 2 && s.front() == L'"' && s.back() == L'"') {
+        v = s.substr(1, s.size() - 2);
+    } else if (s == L"TRUE" || s == L"FALSE") {
+        v = xllEmuValue::boolean(s == L"TRUE");
+    } else if (parse_a1(s, i, r0, c0)) {
+        r1 = r0;
+        c1 = c0;
+        bool ok = i == s.size() || (s[i++] == L':' && parse_a1(s, i, r1, c1) && i == s.size());
+        if (ok) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            v = this->range(_caller_sheet, XLREF12{r0, r1, c0, c1});
+        }
+    }
+    if (res) this->write(v, res);
+    return xlretSuccess;
+}
+
+// ==================== RTD ====================
+
+/// @brief Excel's side of the RTD connection, receives UpdateNotify from the server's worker thread
+class xllEmulator::RtdEvents : public IRTDUpdateEvent {
+public:
+    explicit RtdEvents(std::atomic<bool>& notified) : _notified(notified) {}
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+        if (riid == IID_IUnknown || riid == IID_IDispatch || riid == IID_IRTDUpdateEvent) {
+            *ppv = this;
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    // Owned by the emulator, the server only borrows it
+    ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+    ULONG STDMETHODCALLTYPE Release() override { return 1; }
+    HRESULT STDMETHODCALLTYPE GetTypeInfoCount(UINT* pctinfo) override {
+        *pctinfo = 0;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT, LCID, ITypeInfo**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetIDsOfNames(REFIID, LPOLESTR*, UINT, LCID, DISPID*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE Invoke(DISPID, REFIID, LCID, WORD, DISPPARAMS*, VARIANT*, EXCEPINFO*, UINT*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE UpdateNotify() override {
+        _notified = true;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE get_HeartbeatInterval(long* plRetVal) override {
+        *plRetVal = _heartbeat;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE put_HeartbeatInterval(long plRetVal) override {
+        _heartbeat = plRetVal;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE Disconnect() override { return S_OK; }
+
+private:
+    std::atomic<bool>& _notified;
+    long _heartbeat = 15000;
+};
+
+/// @brief Value of a VARIANT received from the RTD server
+static xllEmuValue from_variant(const VARIANT& v) {
+    switch (v.vt) {
+    case VT_BSTR: return std::wstring(v.bstrVal ? v.bstrVal : L"");
+    case VT_R8: return v.dblVal;
+    case VT_I4: return static_cast<double>(v.lVal);
+    case VT_BOOL: return xllEmuValue::boolean(v.boolVal != VARIANT_FALSE);
+    // CVErr values are the Excel error codes offset by 2000, with or without FACILITY_CONTROL
+    case VT_ERROR: {
+        int code = v.scode & 0xFFFF;
+        return xllEmuValue::error(code >= 2000 && code < 2100 ? code - 2000 : xlerrValue);
+    }
+    default: return xllEmuValue();
+    }
+}
+
+int xllEmulator::rtd(int count, LPXLOPER12* opers, LPXLOPER12 res) {
+    if (count < 3) return xlretInvCount;
+    if (_rtd_server == nullptr) {
+        // Excel creates the server through the class factory of the registered in-process server
+        IClassFactory* factory = nullptr;
+        if (FAILED(DllGetClassObject(CLSID_RtdServer, IID_IClassFactory, reinterpret_cast<void**>(&factory)))) {
+            return xlretFailed;
+        }
+        HRESULT hr = factory->CreateInstance(nullptr, IID_IRtdServer, reinterpret_cast<void**>(&_rtd_server));
+        factory->Release();
+        if (FAILED(hr)) return xlretFailed;
+        if (_rtd_events == nullptr) _rtd_events = new RtdEvents(_rtd_notified);
+        long started = 0;
+        _rtd_server->ServerStart(_rtd_events, &started);
+    }
+    std::vector<std::wstring> strings;
+    std::wstring key;
+    for (int i = 2; i < count; i++) {
+        strings.push_back(to_value(*opers[i]).to_string());
+        key += strings.back();
+        key += L'\x1f';
+    }
+    auto it = _rtd_topics.find(key);
+    long id;
+    if (it == _rtd_topics.end()) {
+        id = _next_topic++;
+        _rtd_topics.emplace(key, id);
+        SAFEARRAYBOUND bound{static_cast<ULONG>(strings.size()), 0};
+        SAFEARRAY* sa = SafeArrayCreate(VT_VARIANT, 1, &bound);
+        for (long i = 0; i < long(strings.size()); i++) {
+            VARIANT s;
+            VariantInit(&s);
+            s.vt = VT_BSTR;
+            s.bstrVal = SysAllocString(strings[i].c_str());
+            SafeArrayPutElement(sa, &i, &s);
+            VariantClear(&s);
+        }
+        VARIANT_BOOL get_new = VARIANT_TRUE;
+        VARIANT out;
+        VariantInit(&out);
+        if (SUCCEEDED(_rtd_server->ConnectData(id, &sa, &get_new, &out))) {
+            _rtd_values[id] = from_variant(out);
+        } else {
+            _rtd_values[id] = xllEmuValue::error(xlerrNA);
+        }
+        VariantClear(&out);
+        SafeArrayDestroy(sa);
+    } else {
+        id = it->second;
+    }
+    if (res) this->write(_rtd_values[id], res);
+    return xlretSuccess;
+}
+
+long xllEmulator::refresh_rtd() {
+    if (_rtd_server == nullptr) return 0;
+    ExcelSide guard;
+    _rtd_notified = false;
+    long count = 0;
+    SAFEARRAY* sa = nullptr;
+    if (FAILED(_rtd_server->RefreshData(&count, &sa)) || sa == nullptr) return 0;
+    for (long i = 0; i < count; i++) {
+        LONG index[2] = {0, i};
+        VARIANT id, value;
+        SafeArrayGetElement(sa, index, &id);
+        index[0] = 1;
+        SafeArrayGetElement(sa, index, &value);
+        xllEmuValue topic = from_variant(id);
+        _rtd_values[static_cast<long>(topic.num)] = from_variant(value);
+        VariantClear(&id);
+        VariantClear(&value);
+    }
+    SafeArrayDestroy(sa);
+    return count;
+}
+
+// ==================== UDF calls ====================
+
+/// @brief Split a type text into its type codes, the first one is the result type
+static std::vector<std::wstring> type_codes(const std::wstring& text) {
+    std::vector<std::wstring> codes;
+    for (size_t i = 0; i < text.size(); i++) {
+        wchar_t c = text[i];
+        // Volatile, thread-safe and macro-sheet-equivalent flags do not change how arguments are passed
+        if (c == L'!' || c == L'$' || c == L'#') continue;
+        if (i + 1 < text.size() && (text[i + 1] == L'%' || text[i + 1] == L'&')) {
+            codes.push_back(text.substr(i, 2));
+            i++;
+        } else {
+            codes.push_back(std::wstring(1, c));
+        }
+    }
+    return codes;
+}
+
+xllEmuCall xllEmulator::prepare(const std::wstring& name, const std::vector<xllEmuValue>& args) {
+    ExcelSide guard;
+    xllEmuCall call;
+    Registration r;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _functions.find(name);
+        if (it == _functions.end()) return call;
+        r = it->second;
+    }
+    std::string proc(r.procedure.begin(), r.procedure.end());
+    void* fn = dlsym(RTLD_DEFAULT, proc.c_str());
+    std::vector<std::wstring> codes = type_codes(r.type_text);
+    if (fn == nullptr || codes.empty()) return call;
+    call._ret = codes[0];
+    size_t ints = 0, nums = 0;
+    xllEmuValue missing;
+    missing.xltype = xltypeMissing;
+    for (size_t i = 1; i < codes.size(); i++) {
+        const std::wstring& code = codes[i];
+        const xllEmuValue& a = i - 1 < args.size() ? args[i - 1] : missing;
+        xllEmuValue v;
+        bool ok = true;
+        if (code == L"U") {
+            v = a;
+        } else {
+            // Every other type receives the value of a reference
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (a.xltype == xltypeSRef) {
+                v = this->range(_caller_sheet, a.ref);
+            } else if (a.xltype == xltypeRef) {
+                v = this->range(a.sheet, a.ref);
+            } else {
+                v = a;
+            }
+        }
+        if (code == L"B") {
+            xllEmuValue n;
+            ok = nums < call._nums.size() && convert(v, xltypeNum, n);
+            if (ok) call._nums[nums++] = n.num;
+            if (!ok) call._error = xlerrValue;
+            continue;
+        }
+        if (ints >= call._ints.size()) {
+            call._error = xlerrValue;
+            continue;
+        }
+        intptr_t& slot = call._ints[ints++];
+        if (code == L"U" || code == L"Q") {
+            size_t bytes = sizeof(xloper12) + block_size(v);
+            call._blocks.emplace_back(new char[bytes]);
+            char* mem = call._blocks.back().get();
+            write_block(v, *reinterpret_cast<xloper12*>(mem), mem + sizeof(xloper12));
+            slot = reinterpret_cast<intptr_t>(mem);
+        } else if (code == L"J" || code == L"I" || code == L"A") {
+            xllEmuValue n;
+            ok = convert(v, code == L"A" ? xltypeBool : xltypeNum, n);
+            slot = code == L"A" ? (n.xbool ? 1 : 0) : static_cast<intptr_t>(n.num);
+        } else if (code == L"C%" || code == L"D%") {
+            xllEmuValue s;
+            ok = convert(v, xltypeStr, s);
+            call._blocks.emplace_back(new char[(s.str.size() + 2) * sizeof(XCHAR)]);
+            XCHAR* p = reinterpret_cast<XCHAR*>(call._blocks.back().get());
+            write_str(p, s.str);
+            // C% is a null-terminated string, D% keeps the length prefix
+            slot = reinterpret_cast<intptr_t>(code == L"C%" ? p + 1 : p);
+        } else if (code == L"K%") {
+            if (v.xltype != xltypeMulti) v = xllEmuValue::multi(1, 1, {v});
+            size_t n = v.array.size();
+            call._blocks.emplace_back(new char[sizeof(FP12) + n * sizeof(double)]);
+            FP12* fp = reinterpret_cast<FP12*>(call._blocks.back().get());
+            fp->rows = v.rows;
+            fp->columns = v.cols;
+            slot = reinterpret_cast<intptr_t>(fp);
+            // Excel rejects arrays with anything but numbers before calling the function
+            for (size_t k = 0; k < n && ok; k++) {
+                xllEmuValue e;
+                ok = v.array[k].xltype != xltypeStr && convert(v.array[k], xltypeNum, e);
+                fp->array[k] = e.num;
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) call._error = xlerrValue;
+    }
+    call._proc = fn;
+    return call;
+}
+
+using IntProc = intptr_t (*)(intptr_t, intptr_t, intptr_t, intptr_t, intptr_t, intptr_t,
+                             double, double, double, double, double, double, double, double);
+using NumProc = double (*)(intptr_t, intptr_t, intptr_t, intptr_t, intptr_t, intptr_t,
+                           double, double, double, double, double, double, double, double);
+
+void xllEmuCall::invoke(xllEmuValue* result) {
+    if (_proc == nullptr || _error != 0) {
+        if (result) *result = xllEmuValue::error(_proc == nullptr ? xlerrName : _error);
+        return;
+    }
+    const auto& i = _ints;
+    const auto& d = _nums;
+    // Integer-class and floating point arguments occupy separate registers, so every UDF can be called through the
+    // same shape as long as each class is passed in declaration order
+    if (_ret == L"B") {
+        double r = reinterpret_cast<NumProc>(_proc)(i[0], i[1], i[2], i[3], i[4], i[5], d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]);
+        if (result) *result = r;
+        return;
+    }
+    intptr_t r = reinterpret_cast<IntProc>(_proc)(i[0], i[1], i[2], i[3], i[4], i[5], d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]);
+    if (_ret == L"U" || _ret == L"Q") {
+        LPXLOPER12 x = reinterpret_cast<LPXLOPER12>(r);
+        if (x == nullptr) {
+            if (result) *result = xllEmuValue::error(xlerrNum);
+            return;
+        }
+        if (result) {
+            ExcelSide guard;
+            *result = to_value(*x);
+        }
+        // Excel copies the result first, then hands it back to the add-in for release
+        if (x->xltype & xlbitDLLFree) xlAutoFree12(x);
+        return;
+    }
+    if (result == nullptr) return;
+    ExcelSide guard;
+    if (_ret == L"J") {
+        *result = static_cast<double>(static_cast<int32_t>(r));
+    } else if (_ret == L"I") {
+        *result = static_cast<double>(static_cast<short>(r));
+    } else if (_ret == L"A") {
+        *result = xllEmuValue::boolean(static_cast<short>(r) != 0);
+    } else if (_ret == L"C%") {
+        *result = r ? std::wstring(reinterpret_cast<const XCHAR*>(r)) : std::wstring();
+    } else if (_ret == L"D%") {
+        const XCHAR* s = reinterpret_cast<const XCHAR*>(r);
+        *result = s ? std::wstring(s + 1, s[0]) : std::wstring();
+    } else if (_ret == L"K%") {
+        const FP12* fp = reinterpret_cast<const FP12*>(r);
+        if (fp == nullptr) {
+            *result = xllEmuValue::error(xlerrNum);
+            return;
+        }
+        std::vector<xllEmuValue> cells(fp->array, fp->array + size_t(fp->rows) * fp->columns);
+        *result = xllEmuValue::multi(fp->rows, fp->columns, std::move(cells));
+    } else {
+        *result = xllEmuValue::error(xlerrValue);
+    }
+}
+
+xllEmuValue xllEmulator::call(const std::wstring& name, const std::vector<xllEmuValue>& args) {
+    xllEmuValue ret;
+    this->prepare(name, args).invoke(&ret);
+    return ret;
+}
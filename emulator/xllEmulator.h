@@ -0,0 +1,257 @@
+/**
+ * @file xllEmulator.h
+ * @brief In-process stand-in for the Excel C API, for running the add-in outside Excel
+ * @author mwmi
+ * @date 2025
+ *
+ * xllEmulator plays the Excel side of the XLL interface on Linux: it answers the Excel12 callbacks the framework
+ * uses (xlCoerce, xlFree, xlfCaller, xlGetName, xlSheetId, xlfRegister, xlfUnregister, xlfSetName, xlEventRegister,
+ * xlfEvaluate, xlfRtd, xlcAlert, xlGetHwnd), backs references with a simple sheet grid, and calls the registered
+ * UDFs with arguments converted the way Excel converts them for each type code. Results are copied and then
+ * released through xlAutoFree12, exactly like Excel does.
+ *
+ * The callback entry point is exported as `MdCallBack12` from the host executable, so the unmodified XLCALL.CPP
+ * finds it through GetModuleHandle/GetProcAddress. The executable must be linked with exported symbols
+ * (ENABLE_EXPORTS) for the UDFs and the entry point to be found.
+ *
+ * Usage example:
+ * ```cpp
+ * xllEmulator& excel = xllEmulator::instance();
+ * excel.open();                                   // DllMain + xlAutoOpen
+ * excel.set_cell(1, 0, 0, 2.0);                   // Sheet1!A1 = 2
+ * xllEmuValue v = excel.call(L"Add", {xllEmuValue::sref(0, 0, 0, 0), 3.0});
+ * excel.close();                                  // xlAutoClose
+ * ```
+ *
+ * @note Argument passing relies on the System V x86-64 and AArch64 calling conventions, where integer-class and
+ *       floating point arguments are assigned to separate register files. UDFs with more than 6 integer-class or
+ *       8 floating point parameters are not supported.
+ */
+#pragma once
+#include "XLCALL.H"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Owned Excel value: a cell content, a UDF argument or a UDF result
+ */
+struct xllEmuValue {
+    /// @brief xltypeNil, xltypeNum, xltypeStr, xltypeBool, xltypeErr, xltypeMulti, xltypeSRef or xltypeRef
+    DWORD xltype = xltypeNil;
+    double num = 0;
+    std::wstring str;
+    bool xbool = false;
+    int err = 0;
+    /// @brief Array shape and row-major elements of xltypeMulti
+    int rows = 0;
+    int cols = 0;
+    std::vector<xllEmuValue> array;
+    /// @brief Sheet (xltypeRef only) and rectangle of references
+    IDSHEET sheet = 0;
+    XLREF12 ref{};
+
+    xllEmuValue() = default;
+    xllEmuValue(double v) : xltype(xltypeNum), num(v) {}
+    xllEmuValue(int v) : xltype(xltypeNum), num(v) {}
+    xllEmuValue(const wchar_t* v) : xltype(xltypeStr), str(v) {}
+    xllEmuValue(std::wstring v) : xltype(xltypeStr), str(std::move(v)) {}
+
+    /// @brief Boolean value
+    static xllEmuValue boolean(bool v);
+    /// @brief Error value @param e xlerrNull .. xlerrGettingData
+    static xllEmuValue error(int e);
+    /// @brief Array value @param rows Row count @param cols Column count @param cells Row-major elements
+    static xllEmuValue multi(int rows, int cols, std::vector<xllEmuValue> cells);
+    /// @brief Reference on the caller's sheet (0-based rows and columns)
+    static xllEmuValue sref(RW rwFirst, COL colFirst, RW rwLast, COL colLast);
+    /// @brief Reference on a given sheet (0-based rows and columns)
+    static xllEmuValue reference(IDSHEET sheet, RW rwFirst, COL colFirst, RW rwLast, COL colLast);
+
+    /// @brief Text rendering, for printing results
+    std::wstring to_string() const;
+};
+
+/**
+ * @brief UDF call with arguments converted once, for calling the same function repeatedly
+ *
+ * invoke() performs what Excel does per call of a worksheet function: call the exported function, read the
+ * result and hand xlbitDLLFree results back to xlAutoFree12. Argument conversion happens in xllEmulator::prepare().
+ */
+class xllEmuCall {
+public:
+    /// @brief Check if the function was found and its arguments could be converted
+    bool valid() const { return _proc != nullptr && _error == 0; }
+
+    /**
+     * @brief Call the function once
+     * @param result Receives a copy of the result, may be null when only the call is measured
+     * @note If the arguments could not be converted the function is not called and the result is #VALUE!
+     */
+    void invoke(xllEmuValue* result = nullptr);
+
+private:
+    friend class xllEmulator;
+
+    void* _proc = nullptr;
+    /// @brief Error returned instead of calling the function, when an argument could not be converted
+    int _error = 0;
+    /// @brief Result type code (B, J, I, A, U, Q, C%, D% or K%)
+    std::wstring _ret;
+    /// @brief Integer-class and floating point arguments in declaration order of each class
+    std::array<intptr_t, 6> _ints{};
+    std::array<double, 8> _nums{};
+    /// @brief Storage the pointer arguments point into
+    std::vector<std::unique_ptr<char[]>> _blocks;
+};
+
+/**
+ * @brief Excel stand-in
+ */
+class xllEmulator {
+public:
+    /// @brief Get the emulator instance
+    static xllEmulator& instance();
+
+    // ==================== Workbook ====================
+
+    /// @brief Add a sheet @return Sheet ID, the first sheet "Sheet1" exists from the start with ID 1
+    IDSHEET add_sheet(const std::wstring& name);
+
+    /// @brief Set a cell value (0-based row and column)
+    void set_cell(IDSHEET sheet, RW row, COL col, xllEmuValue value);
+
+    /// @brief Get a cell value (0-based row and column), nil outside the used area
+    const xllEmuValue& cell(IDSHEET sheet, RW row, COL col) const;
+
+    /// @brief Set the cell xlfCaller returns, SRef arguments refer to this cell's sheet
+    void set_caller(IDSHEET sheet, RW row, COL col);
+
+    /// @brief Call as a command or VBA would: xlfCaller returns #REF!, SRef arguments keep the last caller's sheet
+    void set_command_caller(bool command);
+
+    /// @brief Set the sheet xlSheetId returns without an argument, Sheet1 by default
+    void set_active_sheet(IDSHEET sheet);
+
+    // ==================== Add-in ====================
+
+    /// @brief Load the add-in: DllMain(DLL_PROCESS_ATTACH) on first use, then xlAutoOpen @return xlAutoOpen result
+    int open();
+
+    /// @brief Unload the add-in: disconnect RTD topics, then xlAutoClose @return xlAutoClose result
+    int close();
+
+    /// @brief Check if a worksheet function is registered @param name Function name as used in formulas
+    bool registered(const std::wstring& name) const;
+
+    /// @brief Get the type text a function was registered with (without the length prefix)
+    std::wstring type_text(const std::wstring& name) const;
+
+    /**
+     * @brief Convert arguments for repeated calls of a registered function
+     * @param name Function name as used in formulas
+     * @param args Arguments, converted according to the registered type text
+     * @return Prepared call, not valid if the function is not registered or exported
+     */
+    xllEmuCall prepare(const std::wstring& name, const std::vector<xllEmuValue>& args);
+
+    /// @brief Call a registered function once @return Result, #NAME? if the function is unknown
+    xllEmuValue call(const std::wstring& name, const std::vector<xllEmuValue>& args);
+
+    /// @brief End a recalculation: run the commands registered for xleventCalculationEnded
+    void calculation_ended();
+
+    // ==================== RTD ====================
+
+    /// @brief Check if the RTD server asked for a refresh since the last refresh_rtd()
+    bool rtd_pending() const { return _rtd_notified.load(); }
+
+    /**
+     * @brief Pull changed topic values from the RTD server, as Excel does after UpdateNotify
+     * @return Number of topics updated
+     */
+    long refresh_rtd();
+
+    // ==================== Counters ====================
+
+    /// @brief Get the number of callbacks made with a function number
+    uint64_t callbacks(int xlfn) const { return _calls[xlfn & 0xFFFF].load(std::memory_order_relaxed); }
+
+    /// @brief Get the number of callbacks made with any function number
+    uint64_t callbacks() const;
+
+    /// @brief Reset the callback counters
+    void reset_counters();
+
+    /// @brief Get the number of values returned by Excel12 and not yet released with xlFree
+    int64_t outstanding() const { return _outstanding.load(); }
+
+    /// @brief Check if the calling thread is running emulator code on behalf of Excel (for allocation counters)
+    static bool excel_side();
+
+    /// @brief Handle a callback, called through the exported entry point
+    int dispatch(int xlfn, int count, LPXLOPER12* opers, LPXLOPER12 res);
+
+private:
+    struct Sheet {
+        std::wstring name;
+        int rows = 0;
+        int cols = 0;
+        std::vector<xllEmuValue> cells;
+    };
+
+    struct Registration {
+        std::wstring procedure;
+        std::wstring type_text;
+        std::wstring function;
+        int macro_type = 1;
+    };
+
+    class RtdEvents;
+
+    xllEmulator();
+
+    // Callbacks
+    int coerce(const xloper12& x, DWORD mask, LPXLOPER12 res);
+    int free_value(LPXLOPER12 x);
+    int reg(int count, LPXLOPER12* opers, LPXLOPER12 res);
+    int evaluate(const xloper12& expr, LPXLOPER12 res);
+    int rtd(int count, LPXLOPER12* opers, LPXLOPER12 res);
+
+    /// @brief Read an argument xloper12 into an owned value, resolving references when requested
+    xllEmuValue read(const xloper12& x, bool resolve) const;
+    /// @brief Write an owned value as an Excel-allocated xloper12 (released by xlFree)
+    void write(const xllEmuValue& v, LPXLOPER12 res);
+    /// @brief Convert an owned value to the type mask of xlCoerce @return false if it cannot be converted
+    static bool convert(const xllEmuValue& v, DWORD mask, xllEmuValue& out);
+    /// @brief Values of the cells of a reference
+    xllEmuValue range(IDSHEET sheet, const XLREF12& ref) const;
+
+    mutable std::mutex _mutex;
+    std::vector<Sheet> _sheets;
+    IDSHEET _caller_sheet = 1;
+    IDSHEET _active_sheet = 1;
+    XLREF12 _caller{};
+    bool _command_caller = false;
+    std::map<std::wstring, Registration> _functions;
+    std::map<double, std::wstring> _register_ids;
+    double _next_register_id = 1;
+    std::map<int, std::vector<std::wstring>> _events;
+    bool _attached = false;
+
+    std::array<std::atomic<uint64_t>, 0x10000> _calls{};
+    std::atomic<int64_t> _outstanding = 0;
+
+    // RTD state
+    struct IRtdServer* _rtd_server = nullptr;
+    RtdEvents* _rtd_events = nullptr;
+    std::atomic<bool> _rtd_notified = false;
+    std::map<std::wstring, long> _rtd_topics;
+    std::map<long, xllEmuValue> _rtd_values;
+    long _next_topic = 1;
+};
@@ -5,6 +5,7 @@
  * @copyright Copyright (c) 2025 by mwmi, All rights reserved.
  */
 #include "xllManager.h"
+#include "RTDRingFeed.h"
 
 UDF(HelloWorld, L"Test text") {
     xllType result;
@@ -27,6 +28,20 @@ UDF(Add, (
     return result.get_return();
 }
 
+// Test native parameters (registered as BBB), Excel converts the arguments before the call
+UDFR(double, AddNum, L"Test native addition", double a, double b) {
+    return a + b;
+}
+
+// Test counted string parameter and return (registered as D%D%J)
+UDFR(xllStr12, Repeat, L"Test native string repeat", xllStr12 s, int n) {
+    std::wstring ret;
+    for (int i = 0; i < n; ++i) {
+        ret += s.view();
+    }
+    return returnStr12(ret);
+}
+
 UDF(Concat2, L"Test string concatenation", Param a, Param b) {
     xllType result;
     xllType a_ = a;
@@ -68,13 +83,14 @@ UDF(MySum, L"Test cell reference", Param a) {
 
 UDF(MyConcat, L"Test text array", Param a) {
     xllType result;
-    xllType a_ = a;
+    // Read-only view: cells are read in place without copying the argument
+    xllView a_(a);
     std::wstring ret = L"";
     if (a_.is_array()) {
         // Traverse each element in the array and concatenate all string-type cells
         for (auto i : a_) {
-            if (i->is_str())
-                ret += i->get_str();
+            if (i.is_str())
+                ret += i.get_str_view();
         }
     }
     result = ret;
@@ -101,6 +117,57 @@ UDF(RetArray, L"Test return array") {
     return result.get_return();
 }
 
+// Same result as RetArray without copies: rows are moved into the matrix and the matrix into the result
+UDF(RetArrayMove, L"Test return array built by moving") {
+    xlllist row1, row2;
+    row1.reserve(2);
+    row1.emplace_back(L"String1");
+    row1.emplace_back(20);
+    row2.reserve(2);
+    row2.emplace_back(30);
+    row2.emplace_back(40);
+    xllmartix rows;
+    rows.reserve(2);
+    rows.push_back(std::move(row1));
+    rows.push_back(std::move(row2));
+    xllType result(std::move(rows));
+    return result.get_return();
+}
+
+// Test array round trip: load a range, read every cell and return it, Call: =ArrayEcho(A1:J20000)
+UDF(ArrayEcho, L"Return the cells of a range", Param a) {
+    xllType a_ = a;
+    int filled = 0;
+    for (auto i : a_) {
+        if (!i->is_nil()) filled++;
+    }
+    if (filled == 0) a_.set_err(xlerrNA);
+    return a_.get_return();
+}
+
+// Test numeric pass-through as xloper12 (U), compare with FPEcho, Call: =UEcho(A1:J100000)
+UDF(UEcho, L"Return a numeric range as xloper12", Param a) {
+    xllType a_ = a;
+    return a_.get_return();
+}
+
+// Test numeric pass-through as FP12 (K%), compare with UEcho, Call: =FPEcho(A1:J100000)
+UDFR(FP12*, FPEcho, L"Return a numeric range as FP12", FParam a) {
+    xllFP12 ret(a);
+    return ret.get_return();
+}
+
+// Test FP12 array parameter and return (registered as K%), Call: =FPTranspose(A1:C2)
+UDFR(FP12*, FPTranspose, L"Test FP12 array transpose", FParam a) {
+    xllFP12 ret(a->columns, a->rows);
+    for (int i = 0; i < a->rows; ++i) {
+        for (int j = 0; j < a->columns; ++j) {
+            ret(j, i) = a->array[i * a->columns + j];
+        }
+    }
+    return ret.get_return();
+}
+
 // Test Excel built-in function call
 UDF(Test, L"Test built-in function") {
     xllType ret;
@@ -133,16 +200,55 @@ RTD(RTDHelloWorld, L"RTD Hello World", ([](xllptrlist args, Topic* topic) {
 RTD(RTDClock, L"Display Clock", ([](xllptrlist args, Topic* topic) {
 
     SYSTEMTIME st;
+    GetLocalTime(&st);
+    wchar_t buffer[100];
+    swprintf(buffer, 100, L"【%d】🕒 %04d-%02d-%02d %02d:%02d:%02d", topic->getID(), st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+    topic->setValue(buffer);
+    // Run again in 500 ms, the pool thread is free meanwhile
+    topic->reschedule(500);
+    return 0;
+
+}, L"Ready to display", true)) {
+
+    xllType ret;
+    CALLRTD(ret);
+    return ret.get_return();
+
+}
+
+// RTD Counter Call: =RTDCounter()
+// Each run shows the next count and asks to run again in a second, no pool thread is held in between. Once every
+// cell showing the topic is cleared or the server terminates, stopRequested() is true: a task busy in a long loop
+// checks it between steps and returns, and no further run is asked for
+RTD(RTDCounter, L"Count the seconds since the cell was entered", ([](xllptrlist, Topic* topic) {
+
+    RTDValue last = topic->getTypedValue();
+    topic->setValue(last.kind == RTDValue::Kind::Number ? last.num + 1 : 0.0);
+    if (!topic->stopRequested()) topic->reschedule(1000);
+    return 0;
+
+}, L"Counting...", true)) {
+
+    xllType ret;
+    CALLRTD(ret);
+    return ret.get_return();
+
+}
+
+// RTD Display Clock (Coroutine) Call: =RTDCoClock()
+RTD(RTDCoClock, L"Display Clock, written as a coroutine", ([](xllptrlist, Topic*) -> RTDCoroutine {
+
+    wchar_t buffer[100];
     while (true) {
+        SYSTEMTIME st;
         GetLocalTime(&st);
-        wchar_t buffer[100];
-        swprintf(buffer, 100, L"【%d】🕒 %04d-%02d-%02d %02d:%02d:%02d", topic->getID(), st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
-        topic->setValue(buffer);
-        Sleep(500);
+        swprintf(buffer, 100, L"🕒 %02d:%02d:%02d", st.wHour, st.wMinute, st.wSecond);
+        co_yield buffer;
+        // Resumed by the RTD event loop in 500 ms, no thread waits meanwhile
+        co_await RTDSleep(500);
     }
-    return 0;
 
-}, L"Ready to display", true)) {
+}, L"Ready to display")) {
 
     xllType ret;
     CALLRTD(ret);
@@ -150,6 +256,25 @@ RTD(RTDClock, L"Display Clock", ([](xllptrlist args, Topic* topic) {
 
 }
 
+// RTD Values Pushed by a Feed Handler Call: =RTDQuote("AAPL")
+// The function has no task: any thread of the add-in publishes to the cells showing a symbol with
+// RTDRegister::instance().publish(L"RTDQuote", {L"AAPL"}, 189.5);
+RTD(RTDQuote, L"Show the values published for a symbol", (L"Waiting..."), Param symbol) {
+    xllType ret;
+    CALLRTD(ret, symbol);
+    return ret.get_return();
+}
+
+// RTD Values Written by Another Process Call: =RingQuote("AAPL")
+// A feed process writes to a shared-memory ring with RTDRing (RTDRing.h), RTDRingFeed routes it to these cells
+// once ringQuotes.start() in xll::open below is uncommented
+static RTDRingFeed ringQuotes(L"Local\\QuoteRing", L"RingQuote");
+RTD(RingQuote, L"Show the values a feed process writes for a symbol", (L"Waiting..."), Param symbol) {
+    xllType ret;
+    CALLRTD(ret, symbol);
+    return ret.get_return();
+}
+
 // Test RTD Array Call: =RTDArray()
 RTD(RTDArray, L"Return Array", ([](xllptrlist args, Topic* topic) {
     xllType a = 10.123123;
@@ -194,13 +319,20 @@ SET() {
     // xll::enableRTD = false;
 
     xll::open = []() {
+        // Share coerced ranges between the calls of one recalculation (at most 256 MB)
+        // xllRangeCache::instance().enable(size_t(256) << 20);
+
         // Set function information
         // UDFCONFIG(HelloWorld)->set_funchelp(L"Hello World!!!!");
         // xll::alert(L"Welcome to use XLL Loader");
+
+        // Read the feed process's ring into the RingQuote cells, attaching once the feed has created it
+        // ringQuotes.start();
         return 1;
     };
 
     xll::close = []() {
+        ringQuotes.stop();
         return 1;
     };
 
@@ -0,0 +1,209 @@
+/**
+ * @file RTDCoroutine.h
+ * @brief Coroutine RTD functions and the event loop resuming them
+ * @author mwmi
+ * @date 2025
+ *
+ * A streaming RTD function used to be a task that publishes a value and then either blocks its thread in
+ * `Sleep()` or calls Topic::reschedule() and returns, keeping its state in the topic between runs. An RTD function
+ * may instead be a coroutine returning RTDCoroutine, keeping its state in local variables:
+ * ```cpp
+ * RTD(CoClock, L"Clock", ([](xllptrlist args, Topic* topic) -> RTDCoroutine {
+ *     for (long n = 0;; n++) {
+ *         co_yield std::to_wstring(n);   // Topic::setValue, the coroutine goes on right away
+ *         co_await RTDSleep(500);        // Resumed in 500 ms, no thread is held meanwhile
+ *     }
+ * }, L"Starting...")) { ... }
+ * ```
+ * - `co_yield` publishes a value to the topic (any type Topic::setValue takes).
+ * - `co_await RTDSleep(ms)` suspends on the loop's timer wheel.
+ * - `co_await event` suspends until RTDEvent::set() is called from any thread, e.g. by an I/O callback.
+ *
+ * RtdServer owns one RTDEventLoop with xll::rtdLoopThreads threads. Each coroutine belongs to one loop thread and
+ * is only ever resumed there, so its state needs no locking. Every loop thread keeps its sleeping coroutines in a
+ * hashed timer wheel of 1 ms slots: a sleep is linked into the slot of its due tick without allocating (the node
+ * is the awaiter, inside the coroutine frame), and each tick visits one slot. Tens of thousands of periodic topics
+ * thus run on one or two threads.
+ *
+ * When the topic is disconnected its stop token triggers, and the loop destroys the suspended coroutine, running
+ * the destructors of its locals. Coroutines should not block: a loop thread runs all its coroutines in turn.
+ */
+#pragma once
+#include "RTDTopic.h"
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+/// @brief A coroutine spawned on the event loop, with its topic and stop callback
+struct RTDCoroutineJob;
+/// @brief One loop thread with its inbox and timer wheel
+struct RTDLoopThread;
+
+/// @brief Return type of coroutine RTD functions
+class RTDCoroutine {
+public:
+    struct promise_type {
+        Topic* topic = nullptr;
+        RTDCoroutineJob* job = nullptr; // Set when the loop takes the coroutine over
+
+        promise_type(xllptrlist&, Topic* topic) : topic(topic) {}
+        /// @brief Lambdas pass their closure first
+        template <typename Closure>
+        promise_type(Closure&, xllptrlist&, Topic* topic) : topic(topic) {}
+
+        RTDCoroutine get_return_object() { return RTDCoroutine(Handle::from_promise(*this)); }
+        /// @brief Started by the loop, not by the call
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        /// @brief Destroyed by the loop
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        /// @brief An exception ends the coroutine and shows #VALUE!
+        void unhandled_exception();
+
+        /// @brief Publish a value and continue
+        template <typename T>
+        std::suspend_never yield_value(T&& value) {
+            topic->setValue(std::forward<T>(value));
+            return {};
+        }
+    };
+    using Handle = std::coroutine_handle<promise_type>;
+
+    RTDCoroutine(RTDCoroutine&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    RTDCoroutine& operator=(RTDCoroutine&&) = delete;
+    ~RTDCoroutine();
+
+    /// @brief Hand the frame over, the caller destroys it @return Handle
+    Handle release();
+
+private:
+    explicit RTDCoroutine(Handle handle) : handle(handle) {}
+    Handle handle;
+};
+
+/// @brief Coroutine RTD function, see RtdFun
+using RtdCoroFun = RTDCoroutine (*)(xllptrlist, Topic*);
+
+/// @brief Awaitable suspending a coroutine RTD function for a number of milliseconds
+class RTDSleep {
+public:
+    explicit RTDSleep(DWORD ms) : ms(ms) {}
+    RTDSleep(const RTDSleep&) = delete;
+    RTDSleep& operator=(const RTDSleep&) = delete;
+    /// @brief Unlinks the timer if the coroutine is destroyed while sleeping
+    ~RTDSleep();
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(RTDCoroutine::Handle handle);
+    void await_resume() const noexcept {}
+
+private:
+    friend struct RTDLoopThread;
+    DWORD ms;
+    // Timer wheel node, owned by the loop thread
+    RTDLoopThread* thread = nullptr;
+    RTDCoroutineJob* job = nullptr;
+    uint64_t due = 0;
+    RTDSleep* prev = nullptr;
+    RTDSleep* next = nullptr;
+};
+
+/**
+ * @brief Event a coroutine RTD function can wait on, set from any thread
+ *
+ * set() resumes every coroutine waiting on the event. Set while none waits, the event lets the next `co_await`
+ * pass at once. The event must outlive the coroutines waiting on it.
+ */
+class RTDEvent {
+public:
+    class Awaiter {
+    public:
+        explicit Awaiter(RTDEvent& event) : event(event) {}
+        Awaiter(const Awaiter&) = delete;
+        Awaiter& operator=(const Awaiter&) = delete;
+        /// @brief Stops waiting if the coroutine is destroyed meanwhile
+        ~Awaiter();
+
+        bool await_ready() const noexcept { return false; }
+        /// @brief Waits unless the event is set, which it then consumes
+        bool await_suspend(RTDCoroutine::Handle handle);
+        void await_resume() const noexcept {}
+
+    private:
+        friend class RTDEvent;
+        RTDEvent& event;
+        RTDCoroutineJob* job = nullptr;
+        bool linked = false;
+        Awaiter* prev = nullptr;
+        Awaiter* next = nullptr;
+    };
+
+    RTDEvent() = default;
+    RTDEvent(const RTDEvent&) = delete;
+    RTDEvent& operator=(const RTDEvent&) = delete;
+
+    /// @brief Resume the waiting coroutines on their loop thread, callable from any thread
+    void set();
+
+    Awaiter operator co_await() { return Awaiter(*this); }
+
+private:
+    std::mutex mutex;
+    bool signaled = false;
+    Awaiter* waiters = nullptr; // Doubly linked through Awaiter::prev/next
+};
+
+/// @brief Threads resuming coroutine RTD functions, each with its own timer wheel
+class RTDEventLoop {
+public:
+    /// @brief Snapshot of the loop counters
+    struct Metrics {
+        unsigned threads = 0;  // Loop threads
+        size_t live = 0;       // Coroutines started and not finished
+        uint64_t resumed = 0;  // Resumptions, first starts included
+        uint64_t timers = 0;   // RTDSleep timers fired
+    };
+
+    RTDEventLoop();
+    ~RTDEventLoop();
+
+    RTDEventLoop(const RTDEventLoop&) = delete;
+    RTDEventLoop& operator=(const RTDEventLoop&) = delete;
+
+    /**
+     * @brief Start the loop threads, does nothing if already started
+     * @param threads Number of threads, 0 for one
+     * @return bool Whether the loop is running
+     */
+    bool start(unsigned threads = 1);
+
+    /**
+     * @brief Stop the threads and destroy the coroutines still suspended
+     * @param timeout_ms Time the threads get to return from the coroutine they are running
+     * @param watchdog_ms Further time after which a thread still running is terminated, INFINITE to never
+     *
+     * A thread still running a coroutine at the deadline is abandoned like a busy RTDExecutor worker: a watchdog
+     * destroys its coroutines once it returns, or terminates it after watchdog_ms.
+     */
+    void stop(DWORD timeout_ms = 1000, DWORD watchdog_ms = 10000);
+
+    /// @brief Check if the loop is running @return bool Whether started and not stopped
+    bool running() const;
+
+    /**
+     * @brief Take a coroutine over and start it on a loop thread
+     * @param topic Topic the coroutine publishes to, held until the coroutine ends
+     * @param coroutine Coroutine returned by the RTD function
+     * @return bool false if the loop is not running, the coroutine is then destroyed
+     */
+    bool spawn(Topic* topic, RTDCoroutine coroutine);
+
+    /// @brief Get a snapshot of the counters @return Metrics
+    Metrics metrics() const;
+
+private:
+    /// @brief Loop threads and counters
+    struct State;
+    std::unique_ptr<State> state;
+};
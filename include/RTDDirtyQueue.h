@@ -0,0 +1,65 @@
+/**
+ * @file RTDDirtyQueue.h
+ * @brief Lock-free queue of RTD topics whose value changed since the last RefreshData
+ * @author mwmi
+ * @date 2025
+ *
+ * Topic::setValue may run on any task thread while Excel calls RefreshData on its own thread. Instead of scanning
+ * every connected topic for a changed value, the server pushes a topic into this queue the first time its value
+ * changes after a refresh, and RefreshData drains the queue. The cost of a refresh is then proportional to the
+ * number of changed topics, not to the number of subscribed cells.
+ *
+ * The queue is intrusive: each topic embeds one Link per queue it can be in, and a topic is queued at most once,
+ * so pushing never allocates. Producers push onto a stack with a single compare-and-swap; the consumer detaches the
+ * whole stack with one exchange and reverses it, so IDs come out in the order they were pushed. A queued topic
+ * holds a reference, released when it is drained, so it outlives its link even if it is disconnected meanwhile.
+ *
+ * RtdServer also uses a second queue to hand new producers and tasks with runs left to its worker thread, so
+ * neither side takes a lock to do so.
+ */
+#pragma once
+#include <atomic>
+#include <vector>
+
+class Topic;
+
+/// @brief Multi-producer, single-consumer queue of topics, drained as topic IDs
+class RTDDirtyQueue {
+public:
+    /// @brief Queue link embedded in a topic, one per queue
+    struct Link {
+        explicit Link(Topic* owner) : owner(owner) {}
+        Link(const Link&) = delete;
+        Link& operator=(const Link&) = delete;
+
+        Topic* const owner;
+        Link* next = nullptr;
+        std::atomic<bool> queued = false;
+    };
+
+    RTDDirtyQueue() = default;
+    ~RTDDirtyQueue();
+
+    RTDDirtyQueue(const RTDDirtyQueue&) = delete;
+    RTDDirtyQueue& operator=(const RTDDirtyQueue&) = delete;
+
+    /**
+     * @brief Add a topic, lock-free and callable from any thread
+     * @param link The topic's link for this queue, does nothing if the topic is already queued
+     * @return bool Whether the queue was empty, so the consumer may need waking
+     */
+    bool push(Link& link);
+
+    /**
+     * @brief Take every queued topic, only one thread may drain at a time
+     * @param ids Receives the topic IDs in push order, appended to existing content
+     * @return size_t Number of IDs taken
+     */
+    size_t drain(std::vector<long>& ids);
+
+    /// @brief Check if no topic is queued @return bool Whether the queue is empty
+    bool empty() const { return head.load(std::memory_order_acquire) == nullptr; }
+
+private:
+    std::atomic<Link*> head = nullptr;
+};
@@ -0,0 +1,98 @@
+/**
+ * @file RTDExecutor.h
+ * @brief Bounded work-stealing thread pool running asynchronous RTD topic tasks
+ * @author mwmi
+ * @date 2025
+ *
+ * Asynchronous RTD topics used to get an OS thread each, so 5,000 `=RTDClock()` cells meant 5,000 threads and
+ * stacks. RtdServer now owns one RTDExecutor with a fixed number of workers (xll::rtdWorkerThreads) and submits
+ * each task run as a job:
+ * - Every worker has its own deque. Jobs submitted from a worker go to its own deque and are taken newest first,
+ *   jobs from other threads are spread round-robin. An idle worker steals the oldest job of another worker.
+ * - Jobs may be delayed. A task that calls Topic::reschedule() returns its worker to the pool and runs again
+ *   after the delay, instead of holding a thread in a `while (true) { ...; Sleep(); }` loop.
+ * - Jobs belong to an optional group with a concurrency limit, set per RTD function through
+ *   RTDRegister::registerRTDFunction. A job over the limit waits in its group until a running one finishes.
+ * - metrics() reports queue depth and the wait and run times of jobs.
+ *
+ * stop() joins the workers within a deadline. Jobs are expected to return quickly once their topic is stopped
+ * (see Topic::stopToken). A worker still busy at the deadline is abandoned instead of killed: the pool state is
+ * shared with the worker threads, so it stays valid until the last one exits. A watchdog thread terminates an
+ * abandoned worker only if it has not returned after a further grace period.
+ */
+#pragma once
+#include <windows.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+/// @brief Work-stealing pool of worker threads
+class RTDExecutor {
+public:
+    using Job = std::function<void()>;
+    using Clock = std::chrono::steady_clock;
+
+    /// @brief Snapshot of the executor counters
+    struct Metrics {
+        unsigned workers = 0;        // Worker threads
+        uint64_t submitted = 0;      // Jobs submitted, delayed ones included
+        uint64_t completed = 0;      // Jobs run to completion
+        size_t queued = 0;           // Jobs ready to run, waiting for a worker or for their group
+        size_t max_queued = 0;       // Highest queue depth seen
+        size_t delayed = 0;          // Jobs waiting for their delay to pass
+        double avg_wait_us = 0;      // Mean time from ready to started
+        double max_wait_us = 0;      // Longest time from ready to started
+        double avg_run_us = 0;       // Mean run time
+        unsigned abandoned = 0;      // Workers left running by stop(), their job ignored the stop request
+        unsigned terminated = 0;     // Abandoned workers the watchdog had to terminate
+    };
+
+    RTDExecutor() = default;
+    ~RTDExecutor();
+
+    RTDExecutor(const RTDExecutor&) = delete;
+    RTDExecutor& operator=(const RTDExecutor&) = delete;
+
+    /**
+     * @brief Start the worker threads, does nothing if already started
+     * @param workers Number of workers, 0 for one per processor
+     * @return bool Whether the pool is running
+     */
+    bool start(unsigned workers = 0);
+
+    /**
+     * @brief Stop the workers and drop queued jobs
+     * @param timeout_ms Time all workers together get to finish their current job
+     * @param watchdog_ms Further time after which a worker still running is terminated, INFINITE to never
+     */
+    void stop(DWORD timeout_ms = 1000, DWORD watchdog_ms = 10000);
+
+    /// @brief Check if the pool is running @return bool Whether started and not stopped
+    bool running() const;
+
+    /**
+     * @brief Get the group of a name, created on first use
+     * @param name Group name, RTD functions use their function name
+     * @param max_concurrency Most jobs of the group running at once, 0 for no limit. Updates an existing group
+     * @return int Group ID for submit()
+     */
+    int group(const std::wstring& name, int max_concurrency);
+
+    /**
+     * @brief Queue a job, callable from any thread
+     * @param job Job to run on a worker
+     * @param group Group ID from group(), -1 for none
+     * @param delay_ms Run no earlier than this many milliseconds from now
+     */
+    void submit(Job job, int group = -1, DWORD delay_ms = 0);
+
+    /// @brief Get a snapshot of the counters @return Metrics
+    Metrics metrics() const;
+
+private:
+    /// @brief Queues, groups and counters, shared with the worker threads
+    struct State;
+    std::shared_ptr<State> state;
+};
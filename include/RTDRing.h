@@ -0,0 +1,145 @@
+/**
+ * @file RTDRing.h
+ * @brief Shared-memory ring buffer of RTD values, written by feed processes and read by the add-in
+ * @author mwmi
+ * @date 2025
+ *
+ * A market-data process hands values to the add-in through a named file mapping holding a bounded ring of
+ * fixed-size records, each a key, a type tag and a value. Any number of producers, threads or processes, write;
+ * one reader, RTDRingFeed, routes the records to the RTD topics subscribed to their key.
+ *
+ * This header and RTDRing.cpp are the producer library: they only need windows.h, so a feed process builds them
+ * without the rest of the add-in:
+ * ```cpp
+ * RTDRing ring;
+ * ring.create(L"Local\\QuoteRing");       // Or open() a ring another process created
+ * ring.write("AAPL", 189.5);              // false if the ring is full, the record is then dropped
+ * ```
+ *
+ * Layout: a header followed by a power of two number of 128-byte slots. Each slot carries a sequence number
+ * (bounded MPMC queue by D. Vyukov, used with one consumer): a producer claims a position with one
+ * compare-and-swap on the shared head, fills the slot and publishes it by storing `position + 1` into its
+ * sequence; the reader takes the slot once it sees that number and hands it back by storing
+ * `position + capacity`. Neither side locks or makes a system call, and a full ring never blocks a producer.
+ * Keys and text are UTF-8 so feeds in any language can write them.
+ *
+ * @note A producer that dies between claiming and publishing a slot stalls the reader at that slot
+ */
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// @brief Value type of a ring record
+enum class RTDRingType : uint32_t {
+    Empty = 0,
+    Number = 1,
+    Bool = 2,  // num is 0 or 1
+    Error = 3, // num is an Excel error code, e.g. xlerrNA
+    Text = 4,
+};
+
+/// @brief One value for one key, as written to the ring
+struct RTDRingRecord {
+    static constexpr size_t KEY = 40;  // Longest key in bytes
+    static constexpr size_t TEXT = 64; // Longest text value in bytes, longer ones are cut
+
+    RTDRingType type = RTDRingType::Empty;
+    uint16_t key_len = 0;  // Bytes used in key
+    uint16_t text_len = 0; // Bytes used in text
+    double num = 0;        // Number, Bool or Error value
+    char key[KEY];         // UTF-8 argument of the RTD function, not null terminated
+    char text[TEXT];       // UTF-8 text value, not null terminated
+};
+
+/// @brief Ring slot, a record and its sequence number
+struct RTDRingSlot {
+    std::atomic<uint64_t> seq;
+    RTDRingRecord record;
+};
+
+/// @brief Start of the mapping, shared by all processes
+struct RTDRingHeader {
+    static constexpr uint32_t MAGIC = 0x52444952; // "RIDR", stored last once the ring is initialized
+    static constexpr uint32_t VERSION = 1;
+
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t capacity;  // Slots, a power of two
+    uint32_t slot_size; // sizeof(RTDRingSlot), checked by every process
+    alignas(64) std::atomic<uint64_t> head;    // Next position producers claim
+    alignas(64) std::atomic<uint64_t> tail;    // Next position the reader takes
+    alignas(64) std::atomic<uint64_t> dropped; // Records not written because the ring was full
+};
+
+static_assert(sizeof(RTDRingSlot) == 128, "Ring slots are 128 bytes in every process");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Ring counters are shared between processes");
+
+/// @brief A mapped ring, for writing from any thread or reading from one
+class RTDRing {
+public:
+    RTDRing() = default;
+    ~RTDRing();
+
+    RTDRing(const RTDRing&) = delete;
+    RTDRing& operator=(const RTDRing&) = delete;
+
+    /**
+     * @brief Create the named ring, or open it if it already exists, keeping its capacity
+     * @param name Kernel object name, e.g. `Local\\QuoteRing`
+     * @param capacity Records the ring holds, rounded up to a power of two (at most 2^24)
+     * @return bool Whether the ring is open
+     */
+    bool create(const std::wstring& name, uint32_t capacity = 65536);
+
+    /// @brief Open a ring another process created @param name Kernel object name @return bool Whether open
+    bool open(const std::wstring& name);
+
+    /// @brief Unmap the ring, the creator's close removes its name on POSIX systems
+    void close();
+
+    /// @brief Check if a ring is mapped @return bool Whether open
+    bool isOpen() const { return header != nullptr; }
+
+    // Writers return false, dropping the record, if the ring is full or the key is longer than RTDRingRecord::KEY
+
+    /// @brief Write a number @param key UTF-8 key @param value Value @return bool false if the ring is full
+    bool write(std::string_view key, double value);
+
+    /// @brief Write a text value @param key UTF-8 key @param text UTF-8 text @return bool false if the ring is full
+    bool write(std::string_view key, std::string_view text);
+
+    /// @brief Write a boolean @param key UTF-8 key @param value Value @return bool false if the ring is full
+    bool writeBool(std::string_view key, bool value);
+
+    /// @brief Write an Excel error @param key UTF-8 key @param code Error code @return bool false if the ring is full
+    bool writeError(std::string_view key, int code);
+
+    /// @brief Check if the reader is a whole ring behind, for producers that wait instead of dropping @return bool
+    bool full() const;
+
+    /**
+     * @brief Take the oldest record, only one thread of one process may read
+     * @param record Receives the record
+     * @return bool false if no record is ready
+     */
+    bool read(RTDRingRecord& record);
+
+    /// @brief Records dropped by producers on a full ring @return uint64_t Count since the ring was created
+    uint64_t dropped() const;
+
+    /// @brief Slots of the ring @return uint32_t Capacity, 0 if not open
+    uint32_t capacity() const { return header != nullptr ? header->capacity : 0; }
+
+private:
+    HANDLE mapping = nullptr;
+    RTDRingHeader* header = nullptr;
+    RTDRingSlot* slots = nullptr;
+    uint64_t mask = 0;
+
+    static size_t bytes(uint32_t capacity);
+    bool map(bool created, uint32_t capacity);
+    bool push(std::string_view key, RTDRingType type, double num, std::string_view text);
+};
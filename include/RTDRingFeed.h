@@ -0,0 +1,80 @@
+/**
+ * @file RTDRingFeed.h
+ * @brief Reader thread routing a shared-memory ring of values into RTD topics
+ * @author mwmi
+ * @date 2025
+ *
+ * RTDRingFeed attaches to a ring written by a feed process (see RTDRing.h) and publishes every record to the topics
+ * of one RTD function whose single argument is the record's key, through RTDRegister::publishMany. The function is
+ * registered without a task, so its cells only show what the ring carries:
+ * ```cpp
+ * RTD(RingQuote, L"Quote from the feed process", (L"Waiting..."), Param symbol) { ... CALLRTD(ret, symbol) ... }
+ *
+ * static RTDRingFeed quotes(L"Local\\QuoteRing", L"RingQuote");
+ * xll::open = []() { quotes.start(); return 1; };   // =RingQuote("AAPL") shows what the feed writes for "AAPL"
+ * xll::close = []() { quotes.stop(); return 1; };
+ * ```
+ *
+ * The reader thread opens the ring once the producer has created it, retrying after half a second and then less
+ * often, up to every 8 seconds. It then reads records in batches of up to 256 and routes each batch with the
+ * subscription index locked once per shard; records for keys no cell shows and records read while no RTD server
+ * runs are dropped. The ring has no cross-process wake-up, so an empty ring is polled: the thread yields for a few
+ * rounds, then sleeps 1 ms, 2 ms, ... up to 64 ms between checks until a record arrives. The first record after a
+ * quiet spell may therefore wait up to 64 ms.
+ *
+ * stop() asks the thread to return and waits for it. A thread still inside a publish at the deadline is abandoned
+ * rather than terminated, as it may hold the lock RTDRegister attaches servers with; it shares its state with the
+ * feed, so it returns safely once the publish does, even if the feed object is gone by then.
+ */
+#pragma once
+#include "RTDRing.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/// @brief Thread reading a named RTDRing into the topics of an RTD function
+class RTDRingFeed {
+public:
+    /// @brief Snapshot of the feed counters
+    struct Metrics {
+        bool attached = false; // Ring open
+        uint64_t records = 0;  // Records read
+        uint64_t routed = 0;   // Records that reached a subscribed topic
+        uint64_t dropped = 0;  // Records producers dropped because the ring was full
+        unsigned abandoned = 0; // Reader threads stop() left to return on their own
+    };
+
+    /**
+     * @brief Constructor
+     * @param name Kernel object name of the ring, e.g. `Local\\QuoteRing`
+     * @param function RTD function whose topics receive the records, keyed by their only argument
+     */
+    RTDRingFeed(std::wstring name, std::wstring function);
+    ~RTDRingFeed();
+
+    RTDRingFeed(const RTDRingFeed&) = delete;
+    RTDRingFeed& operator=(const RTDRingFeed&) = delete;
+
+    /// @brief Start the reader thread, does nothing if already started @return bool Whether the thread runs
+    bool start();
+
+    /// @brief Stop the reader thread, which closes the ring @param timeout_ms Time the thread gets to return
+    void stop(DWORD timeout_ms = 1000);
+
+    /// @brief Check if the reader thread runs @return bool Whether started and not stopped
+    bool running() const { return thread != nullptr; }
+
+    /// @brief Get a snapshot of the counters @return Metrics
+    Metrics metrics() const;
+
+private:
+    /// @brief Shared with the reader thread, a fresh one per start()
+    struct State;
+
+    std::wstring name;
+    std::wstring prefix;             // Topic::makeKey of the function with no arguments
+    std::shared_ptr<State> state;
+    HANDLE thread = nullptr;         // Reader thread
+    unsigned abandoned = 0;
+};
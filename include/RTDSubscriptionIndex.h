@@ -0,0 +1,79 @@
+/**
+ * @file RTDSubscriptionIndex.h
+ * @brief Sharded index of RTD producer topics by argument key
+ * @author mwmi
+ * @date 2025
+ *
+ * ConnectData files every producer topic under its canonical argument list (Topic::makeKey), so cells calling an
+ * RTD function with the same arguments share it. The same index routes values pushed by RtdServer::publish: a feed
+ * handler names the function and arguments, and the value goes to the producer Excel cells with those arguments
+ * are subscribed to, if any.
+ *
+ * Publishers look keys up far more often than ConnectData and DisconnectData change them, and most keys of a feed
+ * have no subscriber at all. The keys are therefore split over 64 shards by hash, each a hash map behind its own
+ * mutex, and a lookup locks one shard for one probe. An index with no topic at all answers from an atomic count
+ * without hashing. acquireMany() locks each shard once for a whole batch.
+ *
+ * As in RTDTopicTable, every entry holds one reference to its topic and lookups return a reference of their own.
+ */
+#pragma once
+#include "RTDTopic.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Concurrent map from argument key to reference-counted producer Topic
+class RTDSubscriptionIndex {
+public:
+    RTDSubscriptionIndex() = default;
+    ~RTDSubscriptionIndex();
+
+    RTDSubscriptionIndex(const RTDSubscriptionIndex&) = delete;
+    RTDSubscriptionIndex& operator=(const RTDSubscriptionIndex&) = delete;
+
+    /**
+     * @brief Add a topic, the index takes a reference of its own
+     * @param key Argument key, see Topic::makeKey
+     * @param topic Producer topic
+     * @return bool false if the key is already present
+     */
+    bool insert(const std::wstring& key, Topic* topic);
+
+    /// @brief Find a topic @param key Argument key @return Topic* With a reference for the caller to release, or nullptr
+    Topic* acquire(const std::wstring& key) const;
+
+    /**
+     * @brief Find the topics of a batch of updates, locking each shard once
+     * @param updates Updates whose keys are looked up
+     * @param count Number of updates
+     * @param topics Receives for each update its topic with a reference for the caller to release, or nullptr
+     * @return size_t Number of updates with a topic
+     */
+    size_t acquireMany(const RTDUpdate* updates, size_t count, Topic** topics) const;
+
+    /// @brief Remove a topic @param key Argument key @return Topic* With the index's reference passed to the caller, or nullptr
+    Topic* remove(const std::wstring& key);
+
+    /// @brief Remove every topic @param topics Receives the topics with the index's references, appended
+    void clear(std::vector<Topic*>& topics);
+
+    /// @brief Number of topics @return size_t Topic count
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t SHARDS = 64;
+
+    /// @brief One shard, on its own cache line so shards do not share their mutex's line
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::wstring, Topic*> topics;
+    };
+
+    Shard shards[SHARDS];
+    std::atomic<size_t> count = 0; // Topics in all shards
+
+    static size_t hash(const std::wstring& key);
+    Shard& shard(size_t h) const;
+};
@@ -1,10 +1,19 @@
 #pragma once
 
 #include "xllType.h"
+#include "RTDExecutor.h"
+#include "RTDDirtyQueue.h"
+#include "xllTools.h"
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <stop_token>
 #include <string>
+#include <string_view>
 #include <vector>
 
 // Forward declaration
@@ -12,13 +21,73 @@ class Topic;
 
 // Type aliases
 using Task = std::function<int(Topic* topic)>;
+/// @brief Called when a topic needs its server's attention: `changed` is true for a new value, false when an
+/// asynchronous task run finished
+using TopicNotify = std::function<void(Topic* topic, bool changed)>;
 using StringArray = std::vector<std::wstring>;
 using StringMatrix = std::vector<StringArray>;
 
+/**
+ * @brief Limits on how a topic's values reach Excel, set per RTD function
+ *
+ * Conflation is always last value wins: values set between two refreshes replace each other and Excel reads the
+ * latest. The policy additionally bounds the rate of values Excel sees and drops insignificant numeric moves, so a
+ * producer can publish at full speed.
+ */
+struct RTDPolicy {
+  DWORD min_interval_ms = 0; // Shortest time between two values of a topic sent to Excel, 0 for no limit
+  double min_change = 0;     // Numeric values closer than this to the last one kept are dropped, 0 to keep all
+};
+
 // VARIANT creation function declarations
 VARIANT createVariant(int value);
 VARIANT createVariant(const std::wstring& value);
 
+/**
+ * @brief Typed value of an RTD topic
+ *
+ * Scalars reach Excel as VT_R8, VT_BOOL or VT_ERROR, so a numeric feed needs no double to text to double round
+ * trip. Only arrays are serialized (xllType::serialize) and sent as a string starting with xllArrayTag, which
+ * xllRTD decodes back into the same cells.
+ */
+struct RTDValue {
+  enum class Kind { Empty, Number, Bool, Error, String, Array };
+
+  Kind kind = Kind::Empty;
+  double num = 0;   // Number, Bool (0 or 1) or Error code (xlerrNA etc.)
+  std::wstring str; // String, or serialized Array
+
+  RTDValue() = default;
+  RTDValue(double value) : kind(Kind::Number), num(value) {}
+  RTDValue(std::wstring value) : kind(Kind::String), str(std::move(value)) {}
+
+  static RTDValue boolean(bool value);
+  static RTDValue error(int code);
+  static RTDValue from(xllType& x);
+
+  /// @brief No value yet, an empty string counts as none
+  bool empty() const;
+  /// @brief Numeric value of a number or of a string holding one @param out Value @return Whether numeric
+  bool number(double& out) const;
+  /// @brief Text as a cell would show it, serialized for arrays
+  std::wstring text() const;
+  /// @brief VARIANT for RefreshData and ConnectData, owned by the caller
+  VARIANT toVariant() const;
+
+  bool operator==(const RTDValue& other) const;
+  bool operator!=(const RTDValue& other) const { return !(*this == other); }
+};
+
+/**
+ * @brief A value pushed to whichever topic is subscribed to a function and argument list, see RtdServer::publishMany
+ *
+ * The key is built once per instrument with Topic::makeKey(function, args) and reused for every value.
+ */
+struct RTDUpdate {
+  std::wstring key; // Canonical argument list of the topic, Topic::makeKey
+  RTDValue value;   // Value to publish
+};
+
 /**
  * @class Topic
  * @brief RTD topic class for managing real-time data topics
@@ -26,8 +95,31 @@ VARIANT createVariant(const std::wstring& value);
  * This class encapsulates the core functionality of RTD topics, including:
  * - Topic parameter management
  * - Value storage and updates
- * - Asynchronous task execution
+ * - Asynchronous task execution on the server's RTDExecutor
  * - COM object interaction
+ *
+ * A topic is reference counted: the server holds one reference while the topic is connected, and every queued
+ * or running pool job holds another, so DisconnectData never frees a topic under a running task.
+ *
+ * Excel gives every RTD call its own TopicID. The server keeps one topic, the producer, per distinct argument list
+ * (see makeKey) and subscribes each TopicID with the same arguments to it: the task runs once and update() writes
+ * its value for every subscriber. The producer stops when its last subscriber disconnects.
+ *
+ * Values are published as immutable snapshots: setValue builds a new RTDValue outside any lock and swaps it in, and
+ * readers (RefreshData through update(), getValue) take a reference to the current one. The pointer lives in an
+ * std::atomic<std::shared_ptr>, which is not lock-free on libstdc++ or MSVC: a short internal spin lock covers the
+ * pointer swap and the reference count update, never a string copy or a value comparison. A producer ticking at
+ * full speed therefore waits at most for another thread's pointer swap, not for a refresh copying its value out.
+ * hasChanged() compares the current snapshot with the one last written to Excel by address first.
+ *
+ * DisconnectData and ServerTerminate stop the topic's task cooperatively, a task that runs for long should check
+ * the topic's stop token and return soon after it is triggered. A periodic task returns between runs instead of
+ * waiting, so it holds no pool thread meanwhile:
+ * ```cpp
+ * topic->setValue(readSource());
+ * if (!topic->stopRequested()) topic->reschedule(500);   // Not run again once the topic is disconnected
+ * return 0;
+ * ```
  */
 class Topic {
 public:
@@ -36,15 +128,34 @@ public:
   ~Topic();
   Topic(long id, SAFEARRAY** Strings);
   Topic(long id, SAFEARRAY** Strings, std::wstring defaultValue);
+  Topic(long id, StringArray args, std::wstring defaultValue);
+
+  // Argument parsing and canonical key shared by topics with identical arguments
+  static StringArray parseArgs(SAFEARRAY** Strings);
+  static std::wstring makeKey(const StringArray& args);
+  static std::wstring makeKey(const std::wstring& function, const StringArray& args);
+  // Append one argument in the makeKey format, so a caller building keys in a loop reuses its buffer
+  static void appendKey(std::wstring& key, std::wstring_view arg);
 
   // Disable copy constructor and assignment operator (contains Windows handles)
   Topic(const Topic&) = delete;
   Topic& operator=(const Topic&) = delete;
 
+  // Reference counting, the creator holds the first reference
+  Topic* addRef();
+  void release();
+
   // Basic information access
   long getID() const;
   std::wstring getArg(size_t index) const;
   size_t getArgCount() const;
+  const std::wstring& getKey() const;
+
+  // Excel TopicIDs sharing this topic
+  Topic* addSubscriber(long id);
+  size_t removeSubscriber(long id);
+  size_t getSubscriberCount() const;
+  size_t copySubscribers(std::vector<long>& ids) const;
 
   // Default value management
   bool hasDefaultValue() const;
@@ -53,34 +164,81 @@ public:
 
   // Value management
   bool hasValue() const;
+  Topic* setValue(RTDValue value);
   Topic* setValue(const std::wstring& value);
+  Topic* setValue(double value);
   Topic* setValue(xllType& x);
   std::wstring getValue() const;
+  RTDValue getTypedValue() const;
   bool hasChanged() const;
-  Topic* update(SAFEARRAY** parrayOut, int i);
+  Topic* resend();
+  Topic* update(VARIANT* data, long column, const long* ids, size_t count);
+  Topic* setNotify(TopicNotify notify);
+  bool markDirty();
+  Topic* clearDirty();
+  RTDDirtyQueue::Link& dirtyLink();
+  RTDDirtyQueue::Link& taskLink();
+
+  // Update policy
+  Topic* setPolicy(const RTDPolicy& policy);
+  const RTDPolicy& getPolicy() const;
+  DWORD publishDelay() const;
+  uint64_t getConflatedCount() const;
+  uint64_t getSuppressedCount() const;
 
   // Task management
   Topic* setAsync(bool isAsync);
   Topic* setTask(Task task, bool is_async = false, int run_count = 1);
+  Topic* setExecutor(RTDExecutor* executor, int group = -1);
+  Topic* reschedule(DWORD delay_ms);
+  std::stop_token stopToken() const;
+  bool stopRequested() const;
+  bool wait(DWORD ms);
   bool isTaskRunning() const;
+  bool hasPendingRuns() const;
   Topic* stopTask();
   bool runTask();
 
 private:
   // Member variables
   long topic_id = 0;                   // Topic ID
-  int task_run_count = 1;              // Task execution count
+  std::atomic<long> refs = 1;          // Reference count
+  std::atomic<int> task_run_count = 1; // Task execution count
   StringArray args;                    // Parameter array
+  std::wstring key;                    // Canonical form of args
+  std::vector<long> subscribers;       // Excel TopicIDs showing this topic, guarded by mutex_value
   Task task = nullptr;                 // Task function
+  TopicNotify notify = nullptr;        // Server notification on value change
   bool isAsync = false;                // Whether to execute asynchronously
-  HANDLE async_handle = nullptr;       // Async thread handle
-  std::atomic<bool> is_runing = false; // Running status flag
+  RTDExecutor* executor = nullptr;     // Pool running asynchronous tasks
+  int task_group = -1;                 // Concurrency group in the pool
+  std::atomic<long> reschedule_ms = -1; // Delay requested by the running task, -1 for none
+  std::atomic<bool> is_runing = false; // Running status flag, also set while queued in the pool
+  std::stop_source stop_source;        // Triggered by stopTask, queued runs are skipped
+  std::atomic<bool> dirty = false;     // Queued for the next refresh
+  std::atomic<bool> resend_value = false; // Written by the next refresh even if unchanged, for a new subscriber
+  RTDDirtyQueue::Link dirty_link{this}; // Link in the server's queue of changed topics
+  RTDDirtyQueue::Link task_link{this}; // Link in the server's queue of tasks to start
+  RTDPolicy policy;                    // Update throttling of the topic's function
+  std::atomic<int64_t> next_publish = 0; // Earliest next value sent to Excel, steady_clock ticks
+  std::atomic<uint64_t> conflated = 0; // Values replaced before Excel read them
+  std::atomic<uint64_t> suppressed = 0; // Values dropped by policy.min_change
   std::wstring default_value;          // Default value
-  std::wstring old_value;              // Old value
-  std::wstring value;                  // Current value
-  mutable std::mutex mutex_value;      // Mutex lock
-  mutable std::mutex mutex_task;       // Mutex lock
+  std::atomic<std::shared_ptr<const RTDValue>> value; // Current value, replaced whole by setValue
+  std::shared_ptr<const RTDValue> acked_value; // Value last read by Excel, owned by the refresh thread
+  std::atomic<const RTDValue*> acked = nullptr; // Address of acked_value, for producers counting conflation
+  mutable std::mutex mutex_value;      // Guards subscribers and the default value
+  mutable std::mutex mutex_notify;     // Guards notify against stopTask
+  std::mutex mutex_wait;               // Mutex lock for wait()
+  std::condition_variable stop_cv;     // Wakes wait() on stopTask
 
   // Private utility functions
   void cleanup();
+  Topic* valueChanged(bool changed);
+  bool insignificant(const RTDValue& current, const RTDValue& next) const;
+  std::shared_ptr<const RTDValue> loadValue() const;
+  bool replaceValue(std::shared_ptr<const RTDValue>& current, std::shared_ptr<const RTDValue>& next);
+  void signal(bool changed);
+  void submitRun(DWORD delay_ms);
+  void runOnce();
 };
@@ -0,0 +1,84 @@
+/**
+ * @file RTDTopicTable.h
+ * @brief Sharded hash table of RTD topics by ID
+ * @author mwmi
+ * @date 2025
+ *
+ * RtdServer used to keep its topics in one std::map behind one mutex, which ConnectData, DisconnectData,
+ * RefreshData and the worker thread all held, the worker while scanning every pending topic. Opening a workbook
+ * with tens of thousands of RTD cells then serialized each ConnectData against the scan.
+ *
+ * The table splits the IDs over 64 shards by hash, each an open-addressing array of (ID, Topic*) slots with
+ * linear probing behind its own mutex. A lookup locks one shard for a few probes, so readers and writers only
+ * meet on the same shard and never for longer than one probe sequence.
+ *
+ * Topics are reclaimed through their reference count rather than epochs: every slot holds one reference, and
+ * acquire() returns the topic with a reference of its own taken under the shard lock. A topic removed from the
+ * table while a reader uses it is freed only when that reader calls release().
+ */
+#pragma once
+#include "RTDTopic.h"
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/// @brief Concurrent map from topic ID to reference-counted Topic
+class RTDTopicTable {
+public:
+    RTDTopicTable() = default;
+    ~RTDTopicTable();
+
+    RTDTopicTable(const RTDTopicTable&) = delete;
+    RTDTopicTable& operator=(const RTDTopicTable&) = delete;
+
+    /**
+     * @brief Add a topic, the table takes a reference of its own
+     * @param id Topic ID
+     * @param topic Topic
+     * @return bool false if the ID is already present
+     */
+    bool insert(long id, Topic* topic);
+
+    /// @brief Find a topic @param id Topic ID @return Topic* With a reference for the caller to release, or nullptr
+    Topic* acquire(long id) const;
+
+    /// @brief Check if an ID is present @param id Topic ID @return bool Whether present
+    bool contains(long id) const;
+
+    /// @brief Remove a topic @param id Topic ID @return Topic* With the table's reference passed to the caller, or nullptr
+    Topic* remove(long id);
+
+    /// @brief Take a reference to every topic @param topics Receives the topics, appended, each to be released
+    void snapshot(std::vector<Topic*>& topics) const;
+
+    /// @brief Remove every topic @param topics Receives the topics with the table's references, appended
+    void clear(std::vector<Topic*>& topics);
+
+    /// @brief Number of topics @return size_t Topic count
+    size_t size() const;
+
+private:
+    static constexpr size_t SHARDS = 64;
+
+    struct Slot {
+        long id = 0;
+        Topic* topic = nullptr; // nullptr for a free slot, TOMBSTONE for a removed one
+    };
+
+    /// @brief One shard, on its own cache line so shards do not share their mutex's line
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::vector<Slot> slots; // Power of two size
+        size_t used = 0;         // Live slots
+        size_t tombstones = 0;   // Removed slots still ending probe sequences
+    };
+
+    static Topic* const TOMBSTONE;
+
+    Shard shards[SHARDS];
+
+    static uint64_t hash(long id);
+    Shard& shard(uint64_t h) const;
+    static Slot* find(const Shard& s, long id, uint64_t h);
+    static void rehash(Shard& s, size_t capacity);
+};
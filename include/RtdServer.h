@@ -1,7 +1,19 @@
 #pragma once
 #include "IRTDServer.h"
 #include "RTDTopic.h"
+#include "RTDDirtyQueue.h"
+#include "RTDTopicTable.h"
+#include "RTDSubscriptionIndex.h"
+#include "RTDCoroutine.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
 
 /**
  * @brief Create task for RTD topic
@@ -10,6 +22,14 @@
  */
 int createRtdTask(Topic* topic);
 
+/// @brief Counters of topic values, for tuning RTDPolicy
+struct RTDUpdateStats {
+  uint64_t published = 0;  // Topic values sent to Excel by RefreshData
+  uint64_t conflated = 0;  // Values replaced by a newer one before Excel read them
+  uint64_t suppressed = 0; // Numeric values dropped by RTDPolicy::min_change
+  uint64_t throttled = 0;  // Changes held back by RTDPolicy::min_interval_ms
+};
+
 /// DLL full path storage buffer
 extern WCHAR RtdServer_DllPath[1024];
 
@@ -42,14 +62,22 @@ private:
   /// Heartbeat interval time (milliseconds)
   long m_HeartbeatInterval = 15000;
 
-  /// Topic map, stores correspondence between topic IDs and topic objects
-  std::map<long, Topic*> m_TopicMap;
+  /// Excel topic IDs and the producer topics they subscribe to, each holding one reference
+  RTDTopicTable m_Topics;
+
+  /// Producer topics by their server-assigned ID, each holding one reference
+  RTDTopicTable m_Producers;
 
-  /// Mutex protecting the topic map
-  mutable std::mutex m_TopicMapMutex;
+  /// Producer topics by canonical argument list (Topic::makeKey), each holding one reference. Changed under
+  /// m_RegistryMutex, read by publish without it
+  RTDSubscriptionIndex m_Subscriptions;
 
-  /// List of topic IDs to be deleted
-  std::vector<long> m_DeleteTopicIDs;
+  /// Serializes ConnectData, DisconnectData and ServerTerminate, which subscribe and unsubscribe topic IDs. The
+  /// worker thread and RefreshData only read the topic tables and never take it
+  std::mutex m_RegistryMutex;
+
+  /// Next producer topic ID, guarded by m_RegistryMutex
+  long m_NextProducerID = 0;
 
   /// Worker thread handle
   HANDLE m_hThread = nullptr;
@@ -57,17 +85,87 @@ private:
   /// Thread ID
   DWORD m_threadID = 0;
 
+  /// Worker thread phases: in framework code, inside a synchronous task, or abandoned by ServerTerminate
+  enum WorkerPhase : int { WorkerIdle, WorkerInTask, WorkerAbandoned };
+
+  /// Phase of the worker thread, shared with it so an abandoned worker returns without touching the server again
+  std::shared_ptr<std::atomic<int>> m_WorkerPhase;
+
+  /// Worker threads abandoned by ServerTerminate because a synchronous task ignored the stop request
+  std::atomic<unsigned> m_AbandonedWorkers = 0;
+
   /// Server running status flag
-  bool m_running = false;
+  std::atomic<bool> m_running = false;
 
-  /// Running interval time (milliseconds)
+  /// Rerun interval for synchronous tasks with runs left (milliseconds)
   int runing_ms = 1000;
 
+  /// Auto-reset event waking the worker thread
+  HANDLE m_hWakeEvent = nullptr;
+
+  /// Producers whose task should be started or run again, handed to the worker thread
+  RTDDirtyQueue m_TaskQueue;
+
+  /// Producers with a synchronous task that has runs left, owned by the worker thread
+  std::unordered_set<long> m_PendingTaskIDs;
+
+  /// Producers changed since the last RefreshData, each queued once
+  RTDDirtyQueue m_DirtyTopics;
+
+  /// Throttled producer IDs with the time they may be queued for refresh, earliest first
+  std::priority_queue<std::pair<std::chrono::steady_clock::time_point, long>,
+                      std::vector<std::pair<std::chrono::steady_clock::time_point, long>>,
+                      std::greater<>> m_Deferred;
+
+  /// Mutex protecting m_Deferred
+  std::mutex m_DeferredMutex;
+
+  /// Update counters, conflated and suppressed ones of disconnected producers only
+  std::atomic<uint64_t> m_Published = 0;
+  std::atomic<uint64_t> m_Throttled = 0;
+  std::atomic<uint64_t> m_RetiredConflated = 0;
+  std::atomic<uint64_t> m_RetiredSuppressed = 0;
+
+  /// Set by topics on a value change, cleared when the worker notifies Excel
+  std::atomic<bool> m_Changed = false;
+
+  /// UpdateNotify has been sent and Excel has not called RefreshData yet
+  std::atomic<bool> m_NotifyPending = false;
+
+  /// Window over which value changes are coalesced into one UpdateNotify (milliseconds)
+  DWORD m_NotifyWindow = 10;
+
+  /// Thread pool running asynchronous topic tasks
+  RTDExecutor m_Executor;
+
+  /// Threads resuming coroutine topic functions
+  RTDEventLoop m_Loop;
+
   /**
    * @brief Worker thread procedure
+   *
+   * Sleeps on m_hWakeEvent until a topic connects, a task finishes or a value changes. It then starts pending tasks
+   * and, after the notify window, calls UpdateNotify once for all changes made meanwhile.
+   * @param phase Shared phase of this worker, the thread returns as soon as a task comes back if it was abandoned
    * @return DWORD Thread exit code
    */
-  DWORD WorkerThreadProc();
+  DWORD WorkerThreadProc(std::shared_ptr<std::atomic<int>> phase);
+
+  /**
+   * @brief Topic notification, may be called from any thread
+   * @param topic Topic that changed or whose task run finished
+   * @param changed Whether the topic's value changed
+   */
+  void TopicNotified(Topic* topic, bool changed);
+
+  /**
+   * @brief Queue throttled producers whose interval has passed
+   * @return DWORD Milliseconds until the next one is due, INFINITE if none
+   */
+  DWORD QueueDeferred();
+
+  /// @brief Add a disconnected producer's counters to the retired ones
+  void RetireProducer(Topic* topic);
 
 public:
   /**
@@ -159,6 +257,8 @@ public:
    * @param GetNewValues Flag to get new values
    * @param pvarOut Output data
    * @return HRESULT Operation result
+   * @note A TopicID joining a producer that already has a value without GetNewValues is sent that value by the
+   *       next RefreshData
    */
   HRESULT STDMETHODCALLTYPE ConnectData(long TopicID, SAFEARRAY** Strings, VARIANT_BOOL* GetNewValues, VARIANT* pvarOut);
 
@@ -191,6 +291,64 @@ public:
   HRESULT STDMETHODCALLTYPE ServerTerminate();
 
   // User-defined methods
+  /**
+   * @brief Push a value to the topic Excel cells calling `function` with `args` are subscribed to, from any thread
+   *
+   * Lets a feed handler outside any RTD task route "key to value" updates: the value replaces the topic's current
+   * one exactly as Topic::setValue would, subject to the function's RTDPolicy, and the server notifies Excel. A
+   * value for arguments no cell shows is dropped.
+   * @param function RTD function name, the first topic string
+   * @param args Remaining topic strings, as the cells pass them (numbers arrive as their text)
+   * @param value Value to publish
+   * @return bool Whether a topic is subscribed to the key
+   */
+  bool publish(const std::wstring& function, const StringArray& args, RTDValue value);
+
+  /**
+   * @brief Push a value to the topic of a prebuilt key, see publish(function, args, value)
+   * @param key Topic::makeKey(function, args)
+   * @param value Value to publish
+   * @return bool Whether a topic is subscribed to the key
+   */
+  bool publish(const std::wstring& key, RTDValue value);
+
+  /**
+   * @brief Push a batch of values, looking the keys up with each shard of the index locked once
+   *
+   * Updates of the same key are applied in order, so the last one wins.
+   * @param updates Keys and values
+   * @return size_t Number of updates that reached a subscribed topic
+   */
+  size_t publishMany(const std::vector<RTDUpdate>& updates);
+
+  /// @brief Push a batch of values held in an array @param updates First update @param count Number of updates
+  /// @return size_t Number of updates that reached a subscribed topic
+  size_t publishMany(const RTDUpdate* updates, size_t count);
+
+  /**
+   * @brief Get the thread pool running asynchronous topic tasks, for its metrics
+   * @return const RTDExecutor& The server's executor
+   */
+  const RTDExecutor& getExecutor() const { return m_Executor; }
+
+  /**
+   * @brief Get the event loop resuming coroutine topic functions, for its metrics
+   * @return const RTDEventLoop& The server's event loop
+   */
+  const RTDEventLoop& getLoop() const { return m_Loop; }
+
+  /**
+   * @brief Get the number of worker threads ServerTerminate abandoned to a watchdog
+   * @return unsigned Workers whose synchronous task ignored the stop request
+   */
+  unsigned getAbandonedWorkers() const { return m_AbandonedWorkers.load(); }
+
+  /**
+   * @brief Get counters of topic values published, conflated, suppressed and throttled since the server was created
+   * @return RTDUpdateStats Snapshot of the counters
+   */
+  RTDUpdateStats getUpdateStats() const;
+
   /**
    * @brief Helper method to load type information
    * @param pptinfo Output type information pointer
@@ -0,0 +1,92 @@
+/**
+ * @file xllFP12.h
+ * @brief FP12 floating point array wrapper
+ * @author mwmi
+ * @date 2025
+ *
+ * Parameters declared as `FParam` (`FP12*`, register type `K%`) are passed by Excel as one contiguous block of
+ * doubles instead of an array of xloper12 cells. xllFP12 owns such a block for results: Excel copies a returned
+ * FP12 after the function returns but never asks the add-in to free it, so get_return() keeps the block alive
+ * in a per-thread slot until the next FP12 is returned on the same thread.
+ *
+ * Usage example:
+ * ```cpp
+ * UDFR(FP12*, Twice, L"Double every number", FParam a) {
+ *     xllFP12 ret(a);
+ *     for (double& v : ret.data()) v *= 2;
+ *     return ret.get_return();
+ * }
+ * ```
+ *
+ * @note Excel only passes numeric ranges as FP12, a range containing text or errors fails with #VALUE! before the
+ *       function is called
+ * @see UDFR UDF macro with explicit return type
+ */
+#pragma once
+#include "XLCALL.H"
+#include <span>
+
+/**
+ * @brief Owning FP12 array with RAII release
+ */
+class xllFP12 {
+public:
+    /// @brief Create empty array
+    xllFP12() = default;
+
+    /**
+     * @brief Create array of given shape
+     * @param rows Row count
+     * @param cols Column count
+     * @param fill Initial value
+     */
+    xllFP12(int rows, int cols, double fill = 0);
+
+    /// @brief Copy an FP12 passed by Excel @param p Source array
+    explicit xllFP12(const FP12* p);
+
+    /// @brief Destructor, releases the array
+    ~xllFP12();
+
+    xllFP12(const xllFP12&) = delete;
+    xllFP12& operator=(const xllFP12&) = delete;
+    xllFP12(xllFP12&& other) noexcept;
+    xllFP12& operator=(xllFP12&& other) noexcept;
+
+    /// @brief Get row count
+    int rows() const { return _p ? _p->rows : 0; }
+
+    /// @brief Get column count
+    int columns() const { return _p ? _p->columns : 0; }
+
+    /// @brief Get element count
+    size_t size() const { return _p ? size_t(_p->rows) * _p->columns : 0; }
+
+    /// @brief Get row-major element buffer
+    std::span<double> data() { return std::span<double>(_p ? _p->array : nullptr, size()); }
+    std::span<const double> data() const { return std::span<const double>(_p ? _p->array : nullptr, size()); }
+
+    /// @brief Get element by row and column (0-based)
+    double& operator()(int row, int col) { return _p->array[size_t(row) * _p->columns + col]; }
+    double operator()(int row, int col) const { return _p->array[size_t(row) * _p->columns + col]; }
+
+    /// @brief Get underlying FP12
+    FP12* get() const { return _p; }
+
+    /**
+     * @brief Get Excel return value
+     * @return FP12* Array kept alive until the next get_return() on the calling thread
+     * @note The object is emptied, ownership moves to the per-thread return slot
+     */
+    FP12* get_return();
+
+    /// @brief View the elements of an FP12 passed by Excel without copying @param p Source array
+    static std::span<const double> view(const FP12* p);
+
+private:
+    /// @brief Owned array, allocated as one block of header and elements
+    FP12* _p = nullptr;
+
+    /// @brief Allocate an array of given shape
+    static FP12* allocate(int rows, int cols);
+};
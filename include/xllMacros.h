@@ -13,6 +13,8 @@
 #define Function extern "C" __declspec(dllexport) LPXLOPER12
 /// @brief Parameter name abbreviation
 #define Param LPXLOPER12
+/// @brief FP12 floating point array parameter abbreviation (registered as `K%`)
+#define FParam FP12*
 
 /// @brief Expand parentheses @param X Function parameters
 #define EXPAND(X) ESC(ISH X)
@@ -133,14 +135,65 @@
  * }
  * ```
  */
-#define UDF(func, desc, ...)                                                                                 \
-    Function func(__VA_ARGS__);                                                                              \
-    struct func##_udf_register {                                                                             \
-        func##_udf_register() {                                                                              \
-            UDFRegistry::instance().registerFunction(__T(#func), count_args(&func))->set_info(EXPAND(desc)); \
-        }                                                                                                    \
-    } func##_udf_instance;                                                                                   \
-    Function func(__VA_ARGS__)
+#define UDF(func, desc, ...) UDFR(LPXLOPER12, func, desc, __VA_ARGS__)
+
+/**
+ * @brief Define and register UDF with an explicit return type
+ * @param ret Return type, such as `LPXLOPER12`, `double` or `FP12*`
+ * @param func Function name
+ * @param desc Function description, same formats as UDF
+ * @param ... Function parameter list
+ *
+ * The Excel type text is deduced from the function signature at compile time, so Excel converts native parameters
+ * before the call and no xllType has to be built for them:
+ *
+ * | C++ type           | Type | Excel passes                                   |
+ * |--------------------|------|------------------------------------------------|
+ * | `double`           | `B`  | Number                                         |
+ * | `int`              | `J`  | 32-bit integer                                 |
+ * | `short`            | `I`  | 16-bit integer                                 |
+ * | `bool`             | `A`  | Boolean (parameters only)                      |
+ * | `const wchar_t*`   | `C%` | Null-terminated string                         |
+ * | `xllStr12`         | `D%` | Counted string                                 |
+ * | `LPXLOPER12`       | `U`  | Any value or cell reference (`Param`)          |
+ * | `const xloper12*`  | `Q`  | Any value, references resolved by Excel        |
+ * | `FP12*`            | `K%` | Numeric array (`FParam`)                       |
+ *
+ * Excel returns #VALUE! itself when an argument cannot be converted. `udf::type` or
+ * UDFCONFIG(func)->set_typetext() can still override the deduced text.
+ *
+ * __Usage Example 1: Native scalar function__
+ *
+ * ```cpp
+ * UDFR(double, Hypot, L"Hypotenuse", double a, double b) {
+ *     return std::sqrt(a * a + b * b);
+ * }
+ * ```
+ *
+ * __Usage Example 2: FP12 array function__
+ *
+ * ```cpp
+ * UDFR(FP12*, Twice, L"Double every number", FParam a) {
+ *     xllFP12 ret(a);
+ *     for (double& v : ret.data()) v *= 2;
+ *     return ret.get_return();
+ * }
+ * ```
+ *
+ * @note Returned strings (`C%`, `D%`) must stay valid after the function returns, use returnStr12() for `D%`
+ * @note Native return types cannot carry Excel errors, return an LPXLOPER12 when errors must be reported
+ *
+ * @see xllFP12 FP12 array wrapper
+ * @see xllSignature Compile-time type text
+ */
+#define UDFR(ret, func, desc, ...)                                                                                                         \
+    extern "C" __declspec(dllexport) ret func(__VA_ARGS__);                                                                                \
+    struct func##_udf_register {                                                                                                           \
+        func##_udf_register() {                                                                                                            \
+            UDFRegistry::instance().registerFunction(__T(#func), count_args(&func), udf_type_text(&func))->set_info(EXPAND(desc)); \
+        }                                                                                                                                  \
+    } func##_udf_instance;                                                                                                                 \
+    extern "C" __declspec(dllexport) ret func(__VA_ARGS__)
 
  /// @brief Configure UDF function @param func Function name
 #define UDFCONFIG(func) UDFRegistry::instance(__T(#func)).get_this()
@@ -177,9 +230,15 @@
  *
  * __RTD Configuration Parameters__:
  * `rtdconfig` should be a configuration containing the following elements:
- * - Lambda expression or function pointer: actual data acquisition logic
+ * - Lambda expression or function pointer: actual data acquisition logic, or a coroutine returning RTDCoroutine
+ *   followed by the default value and optionally an RTDPolicy, without the asynchronous flag (see RTDCoroutine.h)
+ * - A default value alone, optionally followed by an RTDPolicy: a function without a task, whose cells show the
+ *   values RTDRegister::publish pushes to their arguments
  * - Default value string: placeholder text displayed during function execution
- * - Asynchronous flag: true for asynchronous execution, false for synchronous execution
+ * - Asynchronous flag: true for asynchronous execution on the RTD server's thread pool, false for synchronous execution
+ * - Concurrency limit (optional): most asynchronous tasks of the function running at once, 0 for no limit
+ * - Update policy (optional): RTDPolicy bounding how often a topic's values reach Excel and ignoring small numeric
+ *   moves, e.g. `RTDPolicy{250, 0.01}`
  *
  * __Calling in Excel__:
  * Use `=FunctionName(param1,param2,...)` in Excel cells to call
@@ -191,7 +250,8 @@
  *       - Network API data acquisition
  *
  * @warning Ensure RTD configuration lambda expressions or functions are thread-safe,
- *          as they may execute in RTD server worker threads
+ *          as they may execute in RTD server worker threads. Asynchronous tasks that poll a source should call
+ *          `topic->reschedule(ms)` and return instead of looping, so they do not hold a pool thread
  *
  * @see RTDRegister RTD function registration manager
  * @see UDFRegistry UDF function registration manager
@@ -254,7 +314,7 @@
  *             std::wstring symbol = args[0]->get_str();
  *             // This should call actual stock API
  *             double price = getStockPriceFromAPI(symbol);
- *             topic->setValue(std::to_wstring(price));
+ *             topic->setValue(price);
  *         }
  *         return 0;
  *     }, L"Getting price...", true), Param symbol) {
@@ -264,14 +324,14 @@
  * }
  * ```
  */
-#define RTD(func, desc, rtdconfig, ...)                                                                        \
-    Function func(__VA_ARGS__);                                                                                \
-    struct func##_rtd_register {                                                                               \
-        func##_rtd_register() {                                                                                \
-            UDFRegistry::instance().registerFunction(__T(#func), count_args(&func))->set_info(EXPAND(desc));   \
-            RTDRegister::instance().registerRTDFunction(__T(#func), EXPAND_TO_PRIMITIVE(EXPANDRTD, rtdconfig)); \
-        }                                                                                                      \
-    } func##_rtd_instance;                                                                                     \
+#define RTD(func, desc, rtdconfig, ...)                                                                                            \
+    Function func(__VA_ARGS__);                                                                                                    \
+    struct func##_rtd_register {                                                                                                   \
+        func##_rtd_register() {                                                                                                    \
+            UDFRegistry::instance().registerFunction(__T(#func), count_args(&func), udf_type_text(&func))->set_info(EXPAND(desc)); \
+            RTDRegister::instance().registerRTDFunction(__T(#func), EXPAND_TO_PRIMITIVE(EXPANDRTD, rtdconfig));                    \
+        }                                                                                                                          \
+    } func##_rtd_instance;                                                                                                         \
     Function func(__VA_ARGS__)
 
  /// @brief Call RTD function, this method facilitates calling RTD functions
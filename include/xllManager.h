@@ -9,6 +9,10 @@
 
 #include "XLCALL.H"
 #include "xllType.h"
+#include "xllView.h"
+#include "xllMatrix.h"
+#include "xllFP12.h"
+#include "xllRangeCache.h"
 #include "xllTools.h"
 #include "xllUDF.h"
 #include "xllRTD.h"
@@ -52,6 +56,23 @@ extern std::wstring defaultCategory;
 /// @brief Whether to enable RTD service (default is true)
 extern bool enableRTD;
 
+/// @brief Window in milliseconds over which RTD value changes are coalesced into one UpdateNotify (default is 10)
+extern DWORD rtdNotifyWindow;
+
+/// @brief Number of threads running asynchronous RTD tasks (default is 0, one per processor)
+extern unsigned rtdWorkerThreads;
+
+/// @brief Number of threads resuming coroutine RTD functions (default is 1)
+extern unsigned rtdLoopThreads;
+
+/// @brief Milliseconds RTD tasks get to return after the RTD server is terminated (default is 500)
+/// @note Tasks should poll Topic::stopToken() or use Topic::wait(). Pool threads and the worker thread running
+///       synchronous tasks share one deadline of rtdStopTimeout ms. Those still busy then are abandoned, and a
+///       watchdog terminates them 10 seconds later. Coroutine loop threads are stopped after that, with a deadline
+///       of their own: another rtdStopTimeout ms, then the same 10 second watchdog. Shutdown can thus wait up to
+///       twice rtdStopTimeout in total.
+extern DWORD rtdStopTimeout;
+
 /// @brief Show message box @param msg Message content @param title Title @return int
 int MsgBox(const wchar_t* msg, const wchar_t* title = L"Tip");
 
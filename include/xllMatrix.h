@@ -0,0 +1,153 @@
+/**
+ * @file xllMatrix.h
+ * @brief Dense numeric matrix for numeric UDF kernels
+ * @author mwmi
+ * @date 2025
+ *
+ * Numeric UDFs usually only need the numbers of a range. xllMatrix coerces an argument into one contiguous
+ * `double` buffer (row-major or column-major) plus a validity bitmap marking which cells were numeric, so kernels
+ * can run over `std::span<double>` without per-cell type checks. Results can be returned directly from a
+ * `std::span<const double>` without building an xllType.
+ *
+ * Usage example:
+ * ```cpp
+ * UDF(Scale, L"Multiply a range by a factor", Param range, Param factor) {
+ *     xllMatrix m;
+ *     if (!m.load(range)) return xllType().set_err(xlerrValue)->get_return();
+ *     double f = xllType(factor).get_num();
+ *     for (double& v : m.data()) v *= f;
+ *     return m.get_return();
+ * }
+ * ```
+ *
+ * @see xllView Read-only argument view used for loading
+ */
+#pragma once
+#include "XLCALL.H"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+class xllType;
+
+/// @brief Element order of a dense matrix buffer
+enum class xllOrder {
+    /// @brief Rows are contiguous (Excel's own layout)
+    row_major,
+    /// @brief Columns are contiguous
+    col_major,
+};
+
+/**
+ * @brief Dense numeric matrix with validity bitmap
+ *
+ * Numeric cells (xltypeNum, xltypeInt) are valid, anything else (blank, text, boolean, error) is stored as the
+ * fill value and marked invalid.
+ */
+class xllMatrix {
+public:
+    /// @brief Create empty matrix
+    xllMatrix() = default;
+
+    /**
+     * @brief Create matrix of given shape, all cells valid
+     * @param rows Row count
+     * @param cols Column count
+     * @param order Element order
+     * @param fill Initial value
+     */
+    xllMatrix(int rows, int cols, xllOrder order = xllOrder::row_major, double fill = 0);
+
+    /**
+     * @brief Load an Excel argument
+     * @param px Argument passed by Excel (array, reference or scalar)
+     * @param order Element order of the buffer
+     * @param fill Value stored for non-numeric cells
+     * @return bool Returns true on success, false if the reference could not be coerced
+     * @note References are coerced with a single xlCoerce call, no per-cell object is created
+     */
+    bool load(const xloper12* px, xllOrder order = xllOrder::row_major, double fill = 0);
+
+    /**
+     * @brief Load an already parsed xllType
+     * @param x Source object (array or scalar)
+     * @param order Element order of the buffer
+     * @param fill Value stored for non-numeric cells
+     * @return bool Returns true on success
+     */
+    bool load(xllType& x, xllOrder order = xllOrder::row_major, double fill = 0);
+
+    /// @brief Get row count
+    int rows() const { return _rows; }
+
+    /// @brief Get column count
+    int columns() const { return _cols; }
+
+    /// @brief Get element count
+    size_t size() const { return _data.size(); }
+
+    /// @brief Get element order
+    xllOrder order() const { return _order; }
+
+    /// @brief Get contiguous element buffer
+    std::span<double> data() { return _data; }
+    std::span<const double> data() const { return _data; }
+
+    /// @brief Get validity bitmap, bit i of word i / 64 is set when element i is valid
+    std::span<const uint64_t> valid_bits() const { return _valid; }
+
+    /// @brief Get element by buffer index
+    double& operator[](size_t i) { return _data[i]; }
+    double operator[](size_t i) const { return _data[i]; }
+
+    /// @brief Get element by row and column (0-based)
+    double& operator()(int row, int col) { return _data[index(row, col)]; }
+    double operator()(int row, int col) const { return _data[index(row, col)]; }
+
+    /// @brief Buffer index of a cell (0-based)
+    size_t index(int row, int col) const;
+
+    /// @brief Check if element is valid @param i Buffer index
+    bool is_valid(size_t i) const { return (_valid[i >> 6] >> (i & 63)) & 1; }
+
+    /// @brief Mark element valid or invalid @param i Buffer index @param valid Validity
+    void set_valid(size_t i, bool valid);
+
+    /// @brief Get number of valid elements
+    size_t valid_count() const;
+
+    /// @brief Check if all elements are valid
+    bool all_valid() const { return valid_count() == size(); }
+
+    /// @brief Get last error code, 0 for normal
+    int get_last_err() const { return _error_code; }
+
+    /**
+     * @brief Get Excel return value
+     * @param invalid Error code returned for invalid elements (xlerrNA by default)
+     * @return xloper12* xltypeMulti result allocated as a single block, released by xlAutoFree12
+     */
+    xloper12* get_return(int invalid = xlerrNA) const;
+
+private:
+    int _rows = 0;
+    int _cols = 0;
+    int _error_code = 0;
+    xllOrder _order = xllOrder::row_major;
+    std::vector<double> _data;
+    std::vector<uint64_t> _valid;
+
+    /// @brief Allocate buffers for the given shape, all elements invalid
+    void reset(int rows, int cols, xllOrder order, double fill);
+};
+
+/**
+ * @brief Return a dense numeric buffer to Excel without building an xllType
+ * @param data Elements
+ * @param rows Row count
+ * @param cols Column count
+ * @param order Element order of data
+ * @return xloper12* xltypeMulti result allocated as a single block, released by xlAutoFree12
+ *         (#VALUE! if the shape does not match the buffer)
+ */
+xloper12* returnMatrix12(std::span<const double> data, int rows, int cols, xllOrder order = xllOrder::row_major);
@@ -20,6 +20,8 @@
 #pragma once
 #include "xllType.h"
 #include "RtdServer.h"
+#include <set>
+#include <shared_mutex>
 
  /// @brief RTD function pointer type definition, used to define asynchronous data acquisition functions
  /// @param args Function parameter list, using smart pointers to manage xllType objects
@@ -44,6 +46,10 @@ using RtdFun = int (*)(xllptrlist, Topic*);
  * ```cpp
  * RTDRegister& rtd = RTDRegister::instance();
  * rtd.registerRTDFunction(L"myFunc", myFuncPtr, L"Loading...", true);
+ *
+ * // A function without a task, whose cells show what an existing feed handler publishes
+ * rtd.registerRTDFunction(L"Quote", L"Waiting...");
+ * rtd.publish(L"Quote", {L"AAPL"}, 189.5);   // From any thread, reaches every =Quote("AAPL") cell
  * ```
  */
 struct RTDRegister {
@@ -52,8 +58,20 @@ private:
     std::map<std::wstring, RtdFun> _async_functions;
     /// @brief Function default value mapping table, storing initial return values for each function
     std::map<std::wstring, std::wstring> _default_values;
-    /// @brief Function asynchronous status mapping table, indicating whether functions execute in separate threads
+    /// @brief Function asynchronous status mapping table, indicating whether functions execute in the server's thread pool
     std::map<std::wstring, bool> _is_async;
+    /// @brief Most asynchronous tasks of a function running at once, 0 for no limit
+    std::map<std::wstring, int> _max_concurrency;
+    /// @brief Update throttling of each function's topics
+    std::map<std::wstring, RTDPolicy> _policies;
+    /// @brief Coroutine RTD functions, run on the server's event loop
+    std::map<std::wstring, RtdCoroFun> _coroutines;
+    /// @brief Functions without a task, fed by publish
+    std::set<std::wstring> _feeds;
+    /// @brief Running server publish forwards to, guarded by _server_mutex
+    RtdServer* _server = nullptr;
+    /// @brief Held shared by publishers, exclusively while the server attaches or detaches
+    std::shared_mutex _server_mutex;
 public:
     /**
      * @brief Get singleton object of RTD register
@@ -68,16 +86,63 @@ public:
      * @param fun Function pointer, pointing to actual data acquisition function
      * @param default_value Default return value, displayed during function execution
      * @param is_async Whether to execute asynchronously, default false
+     * @param max_concurrency Most asynchronous tasks of this function running at once across all topics, 0 for no
+     *        limit. Use it for sources that accept only a few connections
+     * @param policy Update throttling of the function's topics, e.g. `RTDPolicy{250, 0.01}` sends Excel at most
+     *        four values a second per topic and ignores moves below 0.01
      */
-    void registerRTDFunction(const std::wstring& name, RtdFun fun, const wchar_t* default_value = L"", bool is_async = false);
+    void registerRTDFunction(const std::wstring& name, RtdFun fun, const wchar_t* default_value = L"", bool is_async = false, int max_concurrency = 0, const RTDPolicy& policy = RTDPolicy());
 
     /**
      * @brief Register RTD function (simplified version)
      * @param name Function name
      * @param fun Function pointer
      * @param is_async Whether to execute asynchronously
+     * @param max_concurrency Most asynchronous tasks of this function running at once, 0 for no limit
+     * @param policy Update throttling of the function's topics
+     */
+    void registerRTDFunction(const std::wstring& name, RtdFun fun, bool is_async, int max_concurrency = 0, const RTDPolicy& policy = RTDPolicy());
+
+    /**
+     * @brief Register coroutine RTD function, resumed on the RTD server's event loop (see RTDCoroutine.h)
+     * @param name Function name
+     * @param fun Coroutine returning RTDCoroutine, publishing with `co_yield` and waiting with `co_await`
+     * @param default_value Default return value, displayed until the first value is published
+     * @param policy Update throttling of the function's topics
+     */
+    void registerRTDFunction(const std::wstring& name, RtdCoroFun fun, const wchar_t* default_value = L"", const RTDPolicy& policy = RTDPolicy());
+
+    /**
+     * @brief Register RTD function without a task, whose topics receive the values pushed by publish
+     * @param name Function name
+     * @param default_value Default return value, displayed until a value is published
+     * @param policy Update throttling of the function's topics
+     */
+    void registerRTDFunction(const std::wstring& name, const wchar_t* default_value, const RTDPolicy& policy = RTDPolicy());
+
+    /**
+     * @brief Push a value to the cells calling `function` with `args`, see RtdServer::publish
+     * @param function RTD function name
+     * @param args Arguments as the cells pass them
+     * @param value Value to publish
+     * @return bool Whether a cell is subscribed, false as well while no RTD server runs
      */
-    void registerRTDFunction(const std::wstring& name, RtdFun fun, bool is_async);
+    bool publish(const std::wstring& function, const StringArray& args, RTDValue value);
+
+    /// @brief Push a value to the topic of a prebuilt key (Topic::makeKey) @return bool Whether a cell is subscribed
+    bool publish(const std::wstring& key, RTDValue value);
+
+    /// @brief Push a batch of values, see RtdServer::publishMany @return size_t Number that reached a cell
+    size_t publishMany(const std::vector<RTDUpdate>& updates);
+
+    /// @brief Push a batch of values held in an array, see RtdServer::publishMany @return size_t Number that reached a cell
+    size_t publishMany(const RTDUpdate* updates, size_t count);
+
+    /// @brief Route publish to a server, called by its ServerStart @param server Started server
+    void attachServer(RtdServer* server);
+
+    /// @brief Stop routing publish to a server, waiting for calls in progress @param server Terminating server
+    void detachServer(RtdServer* server);
 
     /**
      * @brief Run RTD function
@@ -91,6 +156,15 @@ public:
     /// @brief Check if function is registered @param name Function name @return Whether registered
     bool isFunctionRegistered(const std::wstring& name);
 
+    /// @brief Check if function is a coroutine @param name Function name @return Whether a coroutine
+    bool isFunctionCoroutine(const std::wstring& name);
+
+    /// @brief Check if function is fed by publish @param name Function name @return Whether without a task
+    bool isFunctionFeed(const std::wstring& name);
+
+    /// @brief Get coroutine function @param name Function name @return Function pointer, nullptr if not a coroutine
+    RtdCoroFun getCoroutine(const std::wstring& name);
+
     /**
      * @brief Get function's default value
      * @param name Function name
@@ -107,6 +181,12 @@ public:
 
     bool isFunctionAsync(const std::wstring& name);
 
+    /// @brief Get function's concurrency limit @param name Function name @return Limit, 0 for none
+    int getMaxConcurrency(const std::wstring& name);
+
+    /// @brief Get function's update policy @param name Function name @return Policy, no limits if not registered
+    RTDPolicy getPolicy(const std::wstring& name);
+
     /**
      * @brief Get function pointer
      * @param name Function name
@@ -154,8 +234,10 @@ int xllRTD(xllType& result, Args... args) {
     ret = Excel12v(xlfRtd, &r, n + 2, v);
     if (ret == xlretSuccess) {
         result = r;
-        result.deserialize();
         Excel12(xlFree, 0, 1, &r);
+        // Scalars arrive typed, only strings serialize() wrote carry an array; any other text, including text that
+        // merely starts with xllArrayTag, is left as it is
+        if (result.is_str()) result.deserialize();
     } else {
         result = L"RTD service exception";
     }
@@ -166,13 +248,16 @@ int xllRTD(xllType& result, Args... args) {
  * @brief RTD task registration function
  *
  * Based on Topic's parameter information, finds corresponding function in RTD registry
- * and sets appropriate task and default values for the Topic.
+ * and sets appropriate task, default value and update policy for the Topic.
  *
  * @param topic RTD topic object pointer, contains parameter information
+ * @param executor Pool running the topic's task if the function is asynchronous, with the function's
+ *        concurrency limit
+ * @param loop Event loop taking over the coroutine of a coroutine function, which is not registered without it
  * @return Registration result, 0 for success, negative for failure
  *
  * @note First parameter is treated as function name, remaining parameters are passed to registered function
  * @see RTDRegister::runAsyncFunction
  */
-int registerRTDTask(Topic* topic);
+int registerRTDTask(Topic* topic, RTDExecutor* executor = nullptr, RTDEventLoop* loop = nullptr);
 
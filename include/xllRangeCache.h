@@ -0,0 +1,160 @@
+/**
+ * @file xllRangeCache.h
+ * @brief Per-recalculation cache of coerced range contents
+ * @author mwmi
+ * @date 2025
+ *
+ * When many formulas pass the same large block to a UDF (`=MyLookup(A1, Data!A1:F200000)` filled down), every
+ * call coerces and converts the whole block again. xllRangeCache keeps the coerced contents of a range as an
+ * immutable snapshot keyed by sheet ID and rectangle, tagged with the calculation generation it was read in. The
+ * generation is bumped when Excel finishes or cancels a calculation, so the first call of a recalculation reads the
+ * block and later calls of the same recalculation reuse it. xllType and xllView use the cache transparently.
+ *
+ * The cache is disabled by default, enable it from the xll::open hook:
+ * ```cpp
+ * SET() {
+ *     xll::open = []() {
+ *         xllRangeCache::instance().enable(size_t(512) << 20);  // Keep at most 512 MB of range contents
+ *         return 1;
+ *     };
+ *     return 0;
+ * }
+ * ```
+ *
+ * @note Single-area references are cached: xltypeRef, which Excel passes for references to another sheet, and
+ *       xltypeSRef (same-sheet references), whose sheet is taken from the xlfCaller reference, one callback per
+ *       lookup.
+ * @note Only calls from a worksheet cell use the cache. Commands, VBA (Evaluate, Run) and the Function Wizard run
+ *       between calculations, they coerce the range directly and leave no snapshot for the next calculation. While
+ *       a bosa_sdm_XL dialog (Function Wizard, Find and Replace) is open, calls on Excel's main thread skip the cache.
+ */
+#pragma once
+#include "XLCALL.H"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/**
+ * @brief Immutable coerced contents of a range
+ *
+ * Elements and their counted strings share one allocation, the layout matches an xltypeMulti array so it can be
+ * read through xllView without conversion.
+ */
+struct xllRangeSnapshot {
+    /// @brief Row count
+    int rows = 0;
+    /// @brief Column count
+    int cols = 0;
+    /// @brief Elements in row-major order (xltypeNum, xltypeStr, xltypeBool, xltypeErr or xltypeNil)
+    xloper12* cells = nullptr;
+    /// @brief Size of the allocation in bytes
+    size_t bytes = 0;
+    /// @brief Calculation generation the contents were read in
+    uint64_t generation = 0;
+
+    xllRangeSnapshot() = default;
+    ~xllRangeSnapshot();
+    xllRangeSnapshot(const xllRangeSnapshot&) = delete;
+    xllRangeSnapshot& operator=(const xllRangeSnapshot&) = delete;
+};
+
+/// @brief Range cache counters
+struct xllRangeCacheStats {
+    /// @brief Lookups served from the cache
+    uint64_t hits = 0;
+    /// @brief Lookups that coerced the range
+    uint64_t misses = 0;
+    /// @brief Snapshots not kept because they would exceed the memory cap
+    uint64_t rejected = 0;
+    /// @brief Cached snapshots
+    size_t entries = 0;
+    /// @brief Bytes held by cached snapshots
+    size_t bytes = 0;
+    /// @brief Current calculation generation
+    uint64_t generation = 0;
+};
+
+/**
+ * @brief Range content cache shared by all UDF calls of a recalculation
+ */
+class xllRangeCache {
+public:
+    /// @brief Get the cache instance
+    static xllRangeCache& instance();
+
+    /**
+     * @brief Enable the cache and register the calculation event handler
+     * @param max_bytes Memory cap of cached snapshots (256 MB by default)
+     * @return bool Returns true if the event handler is registered
+     * @note Must be called while Excel accepts commands, typically from xll::open
+     */
+    bool enable(size_t max_bytes = size_t(256) << 20);
+
+    /// @brief Disable the cache, unregister the event handler and drop all snapshots
+    void disable();
+
+    /// @brief Check if the cache is enabled
+    bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+    /// @brief Set the memory cap @param max_bytes Maximum bytes held by cached snapshots
+    void set_max_bytes(size_t max_bytes);
+
+    /// @brief Start a new calculation generation, snapshots of older generations are no longer returned
+    void next_generation();
+
+    /**
+     * @brief Get the contents of a range
+     * @param ref Reference argument
+     * @param err Receives the Excel12 return code when the coercion fails, unchanged otherwise
+     * @return Snapshot of the range, nullptr if the cache is disabled, the reference cannot be cached
+     *         or the coercion failed
+     * @note A snapshot is returned on a miss too, even when it is not kept because of the memory cap
+     */
+    std::shared_ptr<const xllRangeSnapshot> get(const xloper12& ref, int& err);
+
+    /// @brief Drop all snapshots
+    void clear();
+
+    /// @brief Get cache counters
+    xllRangeCacheStats stats() const;
+
+private:
+    /// @brief Sheet and rectangle of a cached range
+    struct Key {
+        IDSHEET sheet;
+        RW rwFirst;
+        RW rwLast;
+        COL colFirst;
+        COL colLast;
+        auto operator<=>(const Key&) const = default;
+    };
+
+    xllRangeCache() = default;
+
+    /// @brief Coerce a reference into a new snapshot of a generation @return nullptr if the coercion failed
+    std::shared_ptr<const xllRangeSnapshot> load(const xloper12& ref, int& err, uint64_t generation);
+
+    /// @brief Check if the calling thread is evaluating for the Function Wizard
+    bool in_wizard() const;
+
+    /// @brief Remove snapshots of older generations (caller holds _mutex)
+    void evict();
+
+    mutable std::mutex _mutex;
+    std::map<Key, std::shared_ptr<const xllRangeSnapshot>> _entries;
+    std::atomic<bool> _enabled = false;
+    std::atomic<uint64_t> _generation = 1;
+    size_t _max_bytes = 0;
+    size_t _bytes = 0;
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+    uint64_t _rejected = 0;
+    /// @brief Generation of the last eviction pass
+    uint64_t _evicted_generation = 0;
+    /// @brief Register ID of the calculation event handler
+    double _handler_id = 0;
+    /// @brief Excel's main thread, recorded by enable()
+    DWORD _main_thread = 0;
+};
@@ -9,7 +9,9 @@
 #pragma once
 
 #include "XLCALL.H"
+#include <array>
 #include <string>
+#include <string_view>
 #include <vector>
 
  /// @brief Get function parameter count @tparam ReturnType Function return type @tparam ...Args Function parameter types @param func Function pointer @return Function parameter count
@@ -19,6 +21,131 @@ constexpr int count_args(ReturnType(*func)(Args...)) {
     return param_count;
 }
 
+/**
+ * @brief Counted Unicode string passed by Excel (type `D%`)
+ *
+ * Wraps the `XCHAR*` Excel passes for `D%` parameters, the first character holds the length. The wrapper has the
+ * size and layout of a plain pointer so it can appear directly in an exported function signature.
+ */
+struct xllStr12 {
+    /// @brief Counted string, str[0] is the length
+    const XCHAR* str;
+
+    /// @brief Get character count
+    size_t size() const { return str ? (size_t)str[0] : 0; }
+
+    /// @brief Check if the string is empty
+    bool empty() const { return size() == 0; }
+
+    /// @brief Get characters without copying
+    std::wstring_view view() const { return std::wstring_view(str ? str + 1 : L"", size()); }
+};
+static_assert(sizeof(xllStr12) == sizeof(const XCHAR*), "xllStr12 must be passed like a pointer");
+
+/// @brief Excel register type code of a C++ parameter or return type @tparam T C++ type
+/// @note Unsupported types have no specialization and fail to compile
+template <typename T>
+struct xllTypeCode;
+
+/// @brief Number (type `B`), missing arguments arrive as 0
+template <>
+struct xllTypeCode<double> {
+    static constexpr const wchar_t* value = L"B";
+};
+
+/// @brief 32-bit signed integer (type `J`), Excel truncates numbers and fails with #VALUE! when out of range
+template <>
+struct xllTypeCode<int> {
+    static constexpr const wchar_t* value = L"J";
+};
+
+/// @brief 16-bit signed integer (type `I`)
+template <>
+struct xllTypeCode<short> {
+    static constexpr const wchar_t* value = L"I";
+};
+
+/// @brief Boolean (type `A`), passed by Excel as a short holding 0 or 1
+template <>
+struct xllTypeCode<bool> {
+    static constexpr const wchar_t* value = L"A";
+};
+
+/// @brief Null-terminated Unicode string (type `C%`)
+template <>
+struct xllTypeCode<const wchar_t*> {
+    static constexpr const wchar_t* value = L"C%";
+};
+
+/// @brief Counted Unicode string (type `D%`)
+template <>
+struct xllTypeCode<xllStr12> {
+    static constexpr const wchar_t* value = L"D%";
+};
+
+/// @brief xloper12 value or reference (type `U`)
+template <>
+struct xllTypeCode<LPXLOPER12> {
+    static constexpr const wchar_t* value = L"U";
+};
+
+/// @brief xloper12 value, references are converted to values by Excel before the call (type `Q`)
+template <>
+struct xllTypeCode<const xloper12*> {
+    static constexpr const wchar_t* value = L"Q";
+};
+
+/// @brief FP12 floating point array (type `K%`)
+template <>
+struct xllTypeCode<FP12*> {
+    static constexpr const wchar_t* value = L"K%";
+};
+
+/// @brief Read-only FP12 floating point array (type `K%`)
+template <>
+struct xllTypeCode<const FP12*> {
+    static constexpr const wchar_t* value = L"K%";
+};
+
+/// @brief Excel register type code of a return type @tparam T C++ type
+template <typename T>
+struct xllReturnCode : xllTypeCode<T> {};
+
+/// @brief `bool` is not a valid return type: Excel reads a short for type `A` but only the low byte of a bool is defined,
+///        return an LPXLOPER12 (or short) instead
+template <>
+struct xllReturnCode<bool>;
+
+/**
+ * @brief Excel register type text of a function signature, built at compile time
+ * @tparam ReturnType Function return type
+ * @tparam ...Args Function parameter types
+ */
+template <typename ReturnType, typename... Args>
+struct xllSignature {
+    /// @brief Type text length without the terminator
+    static constexpr size_t length = std::char_traits<wchar_t>::length(xllReturnCode<ReturnType>::value) +
+                                     (std::char_traits<wchar_t>::length(xllTypeCode<Args>::value) + ... + 0);
+
+    /// @brief Null-terminated type text, return type code followed by the parameter type codes
+    static constexpr std::array<wchar_t, length + 1> text = [] {
+        std::array<wchar_t, length + 1> a{};
+        size_t i = 0;
+        auto put = [&](const wchar_t* code) {
+            while (*code) a[i++] = *code++;
+        };
+        put(xllReturnCode<ReturnType>::value);
+        (put(xllTypeCode<Args>::value), ...);
+        return a;
+    }();
+};
+
+/// @brief Get Excel register type text of a function (return type followed by parameter types) @tparam ReturnType Function return type @tparam ...Args Function parameter types @param func Function pointer @return Type text, such as "BBJ" or "UUK%"
+template <typename ReturnType, typename... Args>
+constexpr const wchar_t* udf_type_text([[maybe_unused]] ReturnType(*func)(Args...)) {
+    return xllSignature<ReturnType, Args...>::text.data();
+}
+
 /// @brief Create Excel string (created string must be delete[] released, otherwise memory leak) @param ws String @return String pointer
 wchar_t* makeStr12(const wchar_t* ws);
 
@@ -58,7 +185,37 @@ xloper12 makeXllError(int err);
 /// @brief Create xll number type @param d Number @return xll number type
 xloper12 makeXllNum(double d);
 
-/// @brief Serialize 2D string array @param data 2D string array @return Serialized string
+/// @brief Allocate a return value block: header, `cells` array elements and `chars` characters of counted strings share one allocation
+/// @param cells Number of xloper12 array elements placed after the header (0 for scalars)
+/// @param chars Number of wchar_t reserved after the elements for counted strings
+/// @return Header xloper12 (xltypeNil | xlbitDLLFree), elements start at header + 1, strings at (wchar_t*)(header + 1 + cells)
+/// @note The header's val carries a tag in its last pointer-sized word, set only the val member the type uses
+///       (num, str, err, xbool or array); assigning the whole val erases the tag
+xloper12* makeReturn12(size_t cells, size_t chars);
+
+/// @brief Release a block allocated by makeReturn12 @param x Value handed to xlAutoFree12
+/// @return bool False, leaving x untouched, when x does not carry the block tag
+bool freeReturn12(xloper12* x);
+
+/// @brief Check whether an xlbitDLLFree value was allocated by makeReturn12 rather than built with `new xloper12`
+/// @param x Value handed to xlAutoFree12
+/// @return bool True when x carries the tag makeReturn12 wrote and freeReturn12 has not cleared yet
+/// @note Only x's own val is read, no memory around it
+bool isReturn12(const xloper12* x);
+
+/// @brief Write a counted Excel string into a return block @param dst Destination (length + 1 characters) @param ws Source characters @param len Character count (truncated to 32767) @return Pointer past the written string
+wchar_t* writeStr12(wchar_t* dst, const wchar_t* ws, size_t len);
+
+/// @brief Return a counted string from a `D%` function @param ws Source characters (truncated to 32767)
+/// @return xllStr12 Counted string kept alive until the next returnStr12() on the calling thread
+xllStr12 returnStr12(std::wstring_view ws);
+
+/// @brief Leading character of a string carrying an array encoded by xllType::serialize
+/// @note A version unit and a closing checksum must match as well, other strings starting with it stay plain text
+constexpr wchar_t xllArrayTag = L'\x1E';
+
+/// @brief Serialize 2D string array as `,` and `|` separated text @param data 2D string array @return Serialized string
+/// @note Text codec of earlier versions, xllType::serialize uses a typed encoding instead
 bool xllSerialize(const std::vector<std::vector<std::wstring>>& data, std::wstring& result);
 
 /// @brief Deserialize string @param str Serialized string @param result Deserialized 2D string array @return Deserialization success or not
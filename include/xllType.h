@@ -40,6 +40,7 @@
 #include "XLCALL.H"
 #include <vector>
 #include <string>
+#include <string_view>
 #include <memory>
 
 class xllType;
@@ -59,6 +60,129 @@ using xlllist = std::vector<xllType>;
 /// @brief xllType two-dimensional matrix, used for constructing two-dimensional arrays
 using xllmartix = std::vector<xlllist>;
 
+/// @brief Loading mode of reference arguments
+enum class xllLoad {
+    /// @brief Coerce the reference when the object is constructed
+    eager,
+    /// @brief Keep the reference and coerce it on first value access
+    lazy,
+};
+
+/**
+ * @brief Compact array cell used as the element storage of xllType arrays
+ *
+ * Array elements are stored contiguously in one buffer of 16-byte tagged cells instead of one heap-allocated
+ * xllType per element. Strings are not stored inside the cell: `val.str` records the offset and length of the
+ * characters in the owning xllType's string pool, which keeps every cell trivially copyable.
+ *
+ * Supported cell types are xltypeNum, xltypeStr, xltypeBool, xltypeErr and xltypeNil.
+ */
+struct xllCell {
+    union {
+        /// @brief Numeric value (xltypeNum)
+        double num;
+        /// @brief Boolean value (xltypeBool)
+        BOOL xbool;
+        /// @brief Error code (xltypeErr)
+        int err;
+        /// @brief String location in the owner's string pool (xltypeStr)
+        struct {
+            unsigned int offset;
+            unsigned int length;
+        } str;
+    } val;
+    /// @brief Cell type
+    DWORD xltype;
+};
+
+/// @brief Contiguous cell buffer of an xllType array
+using xllcells = std::vector<xllCell>;
+
+/**
+ * @brief Handle to one element of an xllType array
+ *
+ * Returned by xllType::at(), xllType::operator[] and the xllType iterator. It behaves like the element pointer
+ * previously returned by these functions (`arr.at(i)->get_num()`, `for (auto i : arr) i->is_str()`), but refers to
+ * the cell by index, so it never owns memory and stays valid while the array is appended to.
+ *
+ * @warning The handle is invalidated when the owning xllType is destroyed or reassigned
+ */
+class xllCellRef {
+private:
+    /// @brief Owning array object
+    xllType* _p;
+    /// @brief Cell index
+    int _i;
+public:
+    /// @brief Constructor @param p Owning xllType object @param i Cell index
+    xllCellRef(xllType* p, int i) : _p(p), _i(i) {}
+
+    /// @brief Member access, allows `arr.at(i)->get_num()`
+    xllCellRef* operator->() { return this; }
+    const xllCellRef* operator->() const { return this; }
+
+    /// @brief Dereference, allows `xllType x = *arr.at(i)`
+    xllCellRef& operator*() { return *this; }
+    const xllCellRef& operator*() const { return *this; }
+
+    /// @brief Whether the handle refers to an element (false when the array is empty)
+    explicit operator bool() const { return _p != nullptr; }
+
+    /// @brief Copy the element into a standalone xllType
+    operator xllType() const;
+
+    /// @brief Get cell type (xltypeNum, xltypeStr, xltypeBool, xltypeErr or xltypeNil)
+    DWORD type() const;
+
+    /// @brief Check if it's numeric type
+    bool is_num() const;
+
+    /// @brief Check if it's string type
+    bool is_str() const;
+
+    /// @brief Check if it's boolean type
+    bool is_bool() const;
+
+    /// @brief Check if it's error type
+    bool is_err() const;
+
+    /// @brief Check if it's empty cell
+    bool is_nil() const;
+
+    /// @brief Get numeric value, 0 for non-numeric cells
+    double get_num() const;
+
+    /// @brief Get string (copy), numbers are formatted like xllType::get_str(), empty for other non-string cells
+    std::wstring get_str() const;
+
+    /// @brief Get string without copying, valid until the owning array is modified
+    /// @note Only string cells have stored text, the view is empty for numbers; use get_str() for their text
+    std::wstring_view get_str_view() const;
+
+    /// @brief Get null-terminated string pointer, valid until the owning array is modified
+    /// @note Numbers are formatted like xllType::get_c_str(), into the same per-thread buffer
+    const wchar_t* get_c_str() const;
+
+    /// @brief Get boolean value
+    bool get_bool() const;
+
+    /// @brief Get error code, 0 for non-error cells
+    int get_err() const;
+
+    /// @brief Set numeric value @param num Number @return xllCellRef& Current handle
+    xllCellRef& operator=(double num);
+
+    /// @brief Set string value @param ws Unicode string @return xllCellRef& Current handle
+    xllCellRef& operator=(const wchar_t* ws);
+
+    /// @brief Set string value @param ws std::wstring string @return xllCellRef& Current handle
+    xllCellRef& operator=(const std::wstring& ws);
+
+    /// @brief Set value from a scalar xllType @param x Source object, an array is stored as #VALUE!
+    /// @return xllCellRef& Current handle
+    xllCellRef& operator=(const xllType& x);
+};
+
 /**
  * @brief Excel XLL Plugin Core Data Type Encapsulation Class
  * 
@@ -152,8 +276,25 @@ private:
     /// @brief String storage, used to cache string data parsed from xloper12
     std::wstring str;
     
-    /// @brief Array element storage, using smart pointers to manage array element memory
-    xllptrlist array;
+    /// @brief Array element storage, one contiguous buffer of compact cells
+    xllcells cells;
+
+    /// @brief String pool of array elements, each string is stored null-terminated and referenced by offset
+    std::wstring pool;
+
+    /// @brief Pool characters no longer referenced by any cell, reclaimed by compact_pool()
+    size_t pool_dead = 0;
+
+    /// @brief Lazy reference that has not been coerced yet (see xllLoad::lazy and resolve())
+    bool pending = false;
+
+    /// @brief Value of a pending reference, coerced once by the first const value accessor
+    mutable std::unique_ptr<xllType> coerced;
+
+    /// @brief Value of a pending reference for the const accessors, coerced on first use
+    const xllType& value() const;
+
+    friend class xllCellRef;
     
     /**
      * @brief Initialize object to empty state
@@ -206,11 +347,13 @@ private:
     
     /**
      * @brief Load cell reference data
-     * @param type Target type to convert to (xltypeNum, xltypeStr, xltypeMulti, etc.)
+     * @param type Target type to convert to (xltypeMulti, or a mask of accepted scalar types such as
+     *             xltypeNum | xltypeStr | xltypeBool | xltypeErr)
      * @return bool Returns true on success, false on failure
      * 
      * Uses Excel12(xlCoerce) API to convert cell references to specified type data.
      * For array types, parses all array elements and stores them in the array member.
+     * For scalar masks, the object takes the value and type returned by Excel, so one call resolves any cell.
      * Records error code to error_code member on failure.
      */
     bool load_ref(DWORD type);
@@ -224,6 +367,87 @@ private:
      * This method is used to prevent infinite recursion issues in UDF functions.
      */
     bool check_ref();
+
+    /**
+     * @brief Load array cells from an xltypeMulti element buffer
+     * @param p Elements in row-major order
+     * @param rows Row count
+     * @param cols Column count
+     * @return bool Returns false if p is null
+     */
+    bool load_cells(const xloper12* p, int rows, int cols);
+
+    /**
+     * @brief Get the shape of a cell reference without coercing it
+     * @param rows Receives the row count
+     * @param cols Receives the column count
+     * @return bool Returns false if the object is not a cell reference
+     * @note Only the first area of a multi-area reference is considered
+     */
+    bool ref_shape(int& rows, int& cols) const;
+
+    /**
+     * @brief Store a string in the string pool
+     * @param ws Source characters
+     * @param len Character count
+     * @return xllCell String cell referring to the stored characters
+     */
+    xllCell make_cell(const wchar_t* ws, size_t len);
+
+    /**
+     * @brief Set a string on an existing array cell
+     * @param i Cell index
+     * @param ws Source characters, may point into the string pool
+     * @param len Character count
+     * @note The old slot is reused when the new text fits, otherwise the pool is compacted once most of it is dead
+     */
+    void store_str(int i, const wchar_t* ws, size_t len);
+
+    /**
+     * @brief Mark the string of a cell as dead before the cell is overwritten
+     * @param c Cell about to be overwritten, it is left as xltypeNil
+     */
+    void release_cell(xllCell& c);
+
+    /**
+     * @brief Rebuild the string pool from the strings still referenced by the cells
+     */
+    void compact_pool();
+
+    /**
+     * @brief Convert a scalar xllType into an array cell
+     * @param x Source object, strings are copied into the string pool
+     * @return xllCell Converted cell (numbers, strings, booleans and errors, an array becomes #VALUE!, anything
+     *         else becomes xltypeNil)
+     */
+    xllCell make_cell(const xllType& x);
+
+    /**
+     * @brief Convert an xloper12 array element into an array cell
+     * @param x Source element returned by Excel
+     * @return xllCell Converted cell, strings are copied into the string pool
+     */
+    xllCell make_cell(const xloper12& x);
+
+    /**
+     * @brief Append an object to the array
+     * @param x Scalar object is appended as one cell, array object appends all of its cells
+     */
+    void append(const xllType& x);
+
+    /**
+     * @brief Append an object to the array, taking over its buffers when possible
+     * @param x Source object, left in an unspecified but valid state
+     * @note When the current array is empty and x is an array, its cell buffer and string pool are moved instead of copied
+     */
+    void append(xllType&& x);
+
+    /**
+     * @brief Take over all resources of another object
+     * @param other Source object, left empty (xltypeNil)
+     * @return xllType* Returns current object pointer to support method chaining
+     */
+    xllType* steal(xllType& other) noexcept;
 public:
     
     /// @name Construction and Destruction Functions
@@ -326,6 +550,29 @@ public:
      * ```
      */
     xllType(const xloper12& x);
+
+    /**
+     * @brief Construct from xloper12 pointer with a loading mode
+     * @param px Pointer to xloper12 structure
+     * @param mode xllLoad::lazy keeps cell references uncoerced until resolve() or a non-const accessor (at,
+     *             iteration, push_back, get_return, ...) is first used, xllLoad::eager behaves like xllType(px)
+     *
+     * The reference shape is available without coercion through is_array(), get_rows() and get_cols(),
+     * so a UDF that only needs the shape, or returns early on some branches, never calls xlCoerce.
+     *
+     * __Usage Example__:
+     * ```cpp
+     * UDF(RowCount, L"Row count of a range", Param range) {
+     *     xllType r(range, xllLoad::lazy);
+     *     return xllType(r.get_rows()).get_return();  // No xlCoerce call
+     * }
+     * ```
+     *
+     * @note Value accessors (get_num(), get_str(), is_bool(), ...) coerce on first use, is_sref(), size(), get_rows()
+     *       and get_cols() never do
+     * @warning The reference must only be used during the UDF call that received it
+     */
+    xllType(const xloper12* px, xllLoad mode);
     
     /**
      * @brief Construct from numeric value
@@ -393,8 +640,17 @@ public:
      */
     xllType(const std::wstring& str);
 
+    /// @brief Construct two-dimensional array from matrix @param m Two-dimensional matrix of xllType objects
     xllType(const xllmartix &m);
+
+    /// @brief Construct two-dimensional array from matrix, taking over element buffers @param m Matrix (rvalue reference)
+    xllType(xllmartix&& m);
+
+    /// @brief Construct one-dimensional array from list @param l One-dimensional list of xllType objects
     xllType(const xlllist &l);
+
+    /// @brief Construct one-dimensional array from list, taking over element buffers @param l List (rvalue reference)
+    xllType(xlllist&& l);
     
     
     /// @name Assignment Operators
@@ -415,6 +671,16 @@ public:
      * ```
      */
     xllType& operator=(const xllType& other);
+
+    /**
+     * @brief Move assignment operator
+     * @param other Source object to move (rvalue reference)
+     * @return xllType& Returns reference to current object
+     *
+     * Releases current data and takes over the cell buffer, string pool, string and Excel data of the source object
+     * without copying. After move, source object will be in a safe empty state.
+     */
+    xllType& operator=(xllType&& other) noexcept;
     
     /**
      * @brief Assign from xloper12
@@ -526,6 +792,12 @@ public:
      * ```
      */
     xllType& operator=(const xllmartix& matrix);
+
+    /// @brief Assign from one-dimensional array (rvalue reference) @param list List @return xllType& Current object
+    xllType& operator=(xlllist&& list);
+
+    /// @brief Assign from two-dimensional matrix (rvalue reference) @param matrix Matrix @return xllType& Current object
+    xllType& operator=(xllmartix&& matrix);
     
     /// @name Setter Functions
     
@@ -558,6 +830,16 @@ public:
     /// @param m Two-dimensional matrix of xllType objects
     /// @return xllType* Returns current object pointer to support chained calls
     xllType* set_matrix(const xllmartix& m);
+
+    /// @brief Set one-dimensional array, taking over element buffers
+    /// @param l One-dimensional list of xllType objects (rvalue reference)
+    /// @return xllType* Returns current object pointer to support chained calls
+    xllType* set_list(xlllist&& l);
+
+    /// @brief Set two-dimensional matrix, taking over element buffers
+    /// @param m Two-dimensional matrix of xllType objects (rvalue reference)
+    /// @return xllType* Returns current object pointer to support chained calls
+    xllType* set_matrix(xllmartix&& m);
     
     
     /// @name Getter Functions
@@ -567,16 +849,25 @@ public:
     double get_num() const;
     
     /// @brief Get string
-    /// @return std::wstring Returns string content
+    /// @return std::wstring Returns string content, numbers are formatted with up to 15 significant digits
     std::wstring get_str() const;
     
     /// @brief Get C-style string pointer
-    /// @return const wchar_t* Returns pointer to string
+    /// @return const wchar_t* Returns pointer to string, numbers are formatted like get_str() into a per-thread buffer
+    ///         that stays valid until the next number is formatted on the same thread
     const wchar_t* get_c_str() const;
     
     /// @brief Get last error code
     /// @return int Returns error code, 0 for normal
     int get_last_err() const;
+
+    /// @brief Get array row count
+    /// @return int Returns row count (1 for a list, 0 for non-array objects), lazy references report their shape without coercion
+    int get_rows() const;
+
+    /// @brief Get array column count
+    /// @return int Returns column count (0 for non-array objects)
+    int get_cols() const;
     
     
     /// @name Type Checking Functions
@@ -596,16 +887,91 @@ public:
     /// @brief Check if it's cell reference type
     /// @return bool Returns true if cell reference, false otherwise
     bool is_sref() const;
+
+    /// @brief Check if it's boolean type
+    /// @return bool Returns true if boolean type, false otherwise
+    bool is_bool() const;
+
+    /// @brief Check if it's error type
+    /// @return bool Returns true if error type, false otherwise
+    bool is_err() const;
+
+    /// @brief Get boolean value
+    /// @return bool Returns the boolean value, false for non-boolean objects
+    bool get_bool() const;
+
+    /// @brief Get error code
+    /// @return int Returns the Excel error code (xlerrNull .. xlerrGettingData), 0 for non-error objects
+    int get_err() const;
+
+    /**
+     * @brief Coerce a pending lazy reference
+     * @return xllType* Returns current object pointer to support chained calls
+     *
+     * Loads the reference of an object constructed with xllLoad::lazy into the object itself, once; does nothing for
+     * any other object. The const value accessors (get_num(), get_str(), is_bool(), ...) coerce the reference into a
+     * side value on first use instead and leave the header alone, resolve() then takes that value over. Until then
+     * is_sref() is true and size() is 0. at(), iteration, push_back(), serialize() and get_return() resolve on their
+     * own.
+     *
+     * __Usage Example__:
+     * ```cpp
+     * xllType x(arg, xllLoad::lazy);
+     * if (x.get_rows() > 1000) return xllType().set_err(xlerrValue)->get_return();  // No xlCoerce call
+     * for (auto cell : *x.resolve()) { ... }
+     * ```
+     */
+    xllType* resolve();
+
+    /**
+     * @brief Coerce a sub-rectangle of a cell reference
+     * @param row_first First row (1-based, relative to the reference)
+     * @param row_last Last row (inclusive, 0 for the last row of the reference)
+     * @param col_first First column (1-based)
+     * @param col_last Last column (inclusive, 0 for the last column of the reference)
+     * @return xllType Loaded values of the sub-rectangle, #REF! if the object is not a reference or the rectangle is empty
+     *
+     * Only the requested cells are coerced, so a UDF can page through a huge reference (typically constructed
+     * with xllLoad::lazy) without materialising all of it. Bounds are clamped to the reference, the result is
+     * always an array (a single cell slice has size() == 1).
+     *
+     * __Usage Example__:
+     * ```cpp
+     * xllType data(range, xllLoad::lazy);
+     * for (int r = 1; r <= data.get_rows(); r += 1000) {
+     *     xllType page = data.slice(r, r + 999);
+     *     for (auto cell : page) { ... }
+     * }
+     * ```
+     */
+    xllType slice(int row_first, int row_last, int col_first = 1, int col_last = 0) const;
     
     
     /// @name Serialization Functions
     
-    /// @brief Serialize array to string
-    /// @return xllType* Returns current object pointer to support chained calls
+    /**
+     * @brief Serialize array to string
+     * @return xllType* Returns current object pointer to support chained calls
+     *
+     * Used for RTD topic values and RTD function arguments. The string starts with xllArrayTag and a version unit,
+     * followed by the row and column counts and a 3-bit type tag per cell, then the values in order: numbers as the
+     * 8 bytes of the double, strings length-prefixed, error codes; booleans and empty cells live in their tag. A
+     * 28-bit checksum of all of it closes the string. Counts, numbers and the checksum are written in 14-bit digits
+     * from U+4000 to U+7FFF, so they add no NUL or surrogate and the encoding passes through any BSTR or counted
+     * Excel string unchanged. Cell strings are copied verbatim: one holding a NUL puts
+     * that NUL in the encoding, which helpers reading up to the first NUL would cut short. Scalars are left as they
+     * are.
+     */
     xllType* serialize();
     
-    /// @brief Deserialize from string to array
-    /// @return xllType* Returns current object pointer to support chained calls
+    /**
+     * @brief Deserialize from string to array
+     * @return xllType* Returns current object pointer to support chained calls
+     *
+     * Decodes a string written by serialize() straight into the array cells, with its numbers, strings, booleans,
+     * errors and empty cells as they were. Any other string is left unchanged, including one that starts with
+     * xllArrayTag but whose version, checksum or layout does not match.
+     */
     xllType* deserialize();
     
     /// @brief Convert to variable suitable for passing xloper12 type
@@ -622,7 +988,7 @@ public:
      * @brief STL-style iterator class
      * 
      * Provides STL-compliant iterator interface, supports range-based for loops.
-     * Used to traverse each element in xllType array, returns xllType pointer.
+     * Used to traverse each element in xllType array, returns xllCellRef element handle.
      */
     class Iter {
     private:
@@ -640,8 +1006,8 @@ public:
         bool operator!=(const Iter& r) const;
         
         /// @brief Dereference operator
-        /// @return xllType* Returns xllType pointer at current position
-        xllType* operator*() const;
+        /// @return xllCellRef Returns element handle at current position
+        xllCellRef operator*() const;
         
         /// @brief Prefix increment operator
         const Iter& operator++();
@@ -658,27 +1024,42 @@ public:
     
     /// @brief Get array element count
     int size() const;
+
+    /// @brief Reserve array capacity
+    /// @param n Expected element count
+    /// @return xllType* Returns current object pointer
+    xllType* reserve(int n);
+
+    /// @brief Reclaim the string storage of overwritten array cells now instead of when most of the pool is dead
+    /// @return xllType* Returns current object pointer
+    xllType* shrink_to_fit();
+
+    /// @brief Get the character count of the array string pool
+    /// @return size_t Characters held by the pool, terminators and dead characters of overwritten strings included
+    size_t get_pool_size() const;
     
     /// @brief Access array element by index
     /// @param i Index position
-    /// @return xllType* Returns element pointer at specified position
-    xllType* at(int i);
+    /// @return xllCellRef Returns element handle at specified position (empty handle if array is empty)
+    xllCellRef at(int i);
     
     /// @brief Access 2D array element by row and column index
     /// @param row Row index (1-based indexing)
     /// @param col Column index (1-based indexing)
-    /// @return xllType* Returns element pointer at specified position
-    xllType* at(int row, int col);
+    /// @return xllCellRef Returns element handle at specified position (empty handle if array is empty)
+    xllCellRef at(int row, int col);
     
     /// @brief Array subscript access operator
     /// @param i Index position
-    /// @return xllType* Returns element pointer at specified position
-    xllType* operator[](int i);
+    /// @return xllCellRef Returns element handle at specified position
+    xllCellRef operator[](int i);
     
     /// @brief Add element
-    /// @param x Element to add
+    /// @param x Element to add (an array object appends all of its elements)
     /// @return xllType* Returns current object pointer
+    /// @note Non-array object is first converted to a one-element list, an empty object becomes an empty list
     xllType* push_back(const xllType& x);
+    xllType* push_back(xllType&& x);
     xllType* push_back(double num);
     xllType* push_back(const wchar_t* ws);
     xllType* push_back(const std::wstring& ws);
@@ -33,6 +33,8 @@ enum function {
 struct UDFInfo {
   /// @brief Number of parameters
   int paramNum;
+  /// @brief Type text deduced from the function signature, used when type_text is not set
+  std::wstring signature;
   /// @brief Function name declared in file
   wchar_t* register_name = nullptr;
   /// @brief Return type and parameter types of the function
@@ -62,6 +64,9 @@ public:
   /// @brief Register UDF function @param name Name of the registration function @param paramNum Number of parameters of the registration function @return Current object
   UDFRegistry* registerFunction(const std::wstring& name, const int& paramNum);
 
+  /// @brief Register UDF function @param name Name of the registration function @param paramNum Number of parameters of the registration function @param signature Type text deduced from the function signature (like "UUK%") @return Current object
+  UDFRegistry* registerFunction(const std::wstring& name, const int& paramNum, const std::wstring& signature);
+
   /// @brief Register function
   UDFRegistry* regist();
 
@@ -0,0 +1,210 @@
+/**
+ * @file xllView.h
+ * @brief Read-only, non-owning view over Excel arguments
+ * @author mwmi
+ * @date 2025
+ *
+ * xllType copies every cell and string of an argument into its own storage. UDFs that only read their input
+ * can use xllView instead: it wraps the xloper12 passed by Excel (or the result of a single xlCoerce for cell
+ * references) and reads cells in place, strings are exposed as std::wstring_view over Excel's own buffer.
+ *
+ * Usage example:
+ * ```cpp
+ * UDF(MyCount, L"Count text cells", Param a) {
+ *     xllView v(a);
+ *     int n = 0;
+ *     for (auto c : v) {
+ *         if (c.is_str() && !c.get_str_view().empty()) n++;
+ *     }
+ *     xllType result = n;
+ *     return result.get_return();
+ * }
+ * ```
+ *
+ * @warning The view and everything obtained from it are only valid while the UDF call is running
+ * @see xllType Owning data type
+ */
+#pragma once
+#include "XLCALL.H"
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct xllRangeSnapshot;
+
+/**
+ * @brief Non-owning read-only view over an Excel argument
+ *
+ * - xltypeMulti arguments are viewed directly through `val.array.lparray`
+ * - xltypeSRef/xltypeRef arguments are coerced once with xlCoerce, the result is released by the destructor
+ *   (or viewed in place in the xllRangeCache snapshot when the range cache is enabled)
+ * - Any other value is viewed as a 1x1 array
+ *
+ * No per-cell allocation is performed.
+ */
+class xllView {
+public:
+    /**
+     * @brief Read-only cell accessor
+     *
+     * Lightweight value wrapping one xloper12 cell, cheap to copy.
+     */
+    class Cell {
+    private:
+        /// @brief Viewed cell
+        const xloper12* _x;
+    public:
+        /// @brief Constructor @param x Viewed cell
+        explicit Cell(const xloper12* x) : _x(x) {}
+
+        /// @brief Member access, allows `view[i]->get_num()`
+        const Cell* operator->() const { return this; }
+
+        /// @brief Get cell type without memory flags (xltypeNum, xltypeStr, ...)
+        DWORD type() const { return _x->xltype & ~(xlbitXLFree | xlbitDLLFree); }
+
+        /// @brief Check if it's numeric type (xltypeNum or xltypeInt)
+        bool is_num() const { return type() == xltypeNum || type() == xltypeInt; }
+
+        /// @brief Check if it's string type
+        bool is_str() const { return type() == xltypeStr; }
+
+        /// @brief Check if it's boolean type
+        bool is_bool() const { return type() == xltypeBool; }
+
+        /// @brief Check if it's error type
+        bool is_err() const { return type() == xltypeErr; }
+
+        /// @brief Check if it's empty or missing
+        bool is_nil() const { return type() == xltypeNil || type() == xltypeMissing; }
+
+        /// @brief Get numeric value, 0 for non-numeric cells
+        double get_num() const { return type() == xltypeNum ? _x->val.num : type() == xltypeInt ? _x->val.w : 0; }
+
+        /// @brief Get string without copying, empty for non-string cells
+        std::wstring_view get_str_view() const {
+            return is_str() && _x->val.str ? std::wstring_view(_x->val.str + 1, _x->val.str[0]) : std::wstring_view();
+        }
+
+        /// @brief Get string (copy)
+        std::wstring get_str() const { return std::wstring(get_str_view()); }
+
+        /// @brief Get boolean value
+        bool get_bool() const { return is_bool() && _x->val.xbool; }
+
+        /// @brief Get error code, 0 for non-error cells
+        int get_err() const { return is_err() ? _x->val.err : 0; }
+
+        /// @brief Get underlying xloper12
+        const xloper12* get() const { return _x; }
+    };
+
+    /// @brief Random-access iterator over the cells in row-major order
+    class iterator {
+    private:
+        /// @brief Current cell
+        const xloper12* _p = nullptr;
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = Cell;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Cell;
+        using reference = Cell;
+
+        iterator() = default;
+        /// @brief Constructor @param p Cell pointer
+        explicit iterator(const xloper12* p) : _p(p) {}
+
+        Cell operator*() const { return Cell(_p); }
+        Cell operator->() const { return Cell(_p); }
+        Cell operator[](difference_type n) const { return Cell(_p + n); }
+
+        iterator& operator++() { ++_p; return *this; }
+        iterator operator++(int) { iterator t = *this; ++_p; return t; }
+        iterator& operator--() { --_p; return *this; }
+        iterator operator--(int) { iterator t = *this; --_p; return t; }
+        iterator& operator+=(difference_type n) { _p += n; return *this; }
+        iterator& operator-=(difference_type n) { _p -= n; return *this; }
+        iterator operator+(difference_type n) const { return iterator(_p + n); }
+        iterator operator-(difference_type n) const { return iterator(_p - n); }
+        friend iterator operator+(difference_type n, const iterator& it) { return it + n; }
+        difference_type operator-(const iterator& r) const { return _p - r._p; }
+
+        bool operator==(const iterator& r) const { return _p == r._p; }
+        bool operator!=(const iterator& r) const { return _p != r._p; }
+        bool operator<(const iterator& r) const { return _p < r._p; }
+        bool operator>(const iterator& r) const { return _p > r._p; }
+        bool operator<=(const iterator& r) const { return _p <= r._p; }
+        bool operator>=(const iterator& r) const { return _p >= r._p; }
+    };
+
+    /**
+     * @brief Construct view over an Excel argument
+     * @param px Argument passed by Excel
+     * @note Cell references are coerced with a single xlCoerce call, on failure the view is empty and
+     *       get_last_err() returns the Excel12 return code
+     */
+    explicit xllView(const xloper12* px);
+
+    /// @brief Destructor, releases coerced reference data
+    ~xllView();
+
+    xllView(const xllView&) = delete;
+    xllView& operator=(const xllView&) = delete;
+    xllView(xllView&& other) noexcept;
+    xllView& operator=(xllView&& other) noexcept;
+
+    /// @brief Get row count
+    int rows() const { return _rows; }
+
+    /// @brief Get column count
+    int columns() const { return _cols; }
+
+    /// @brief Get cell count
+    int size() const { return _rows * _cols; }
+
+    /// @brief Check if the view contains no cell
+    bool empty() const { return size() == 0; }
+
+    /// @brief Check if the view contains more than one cell
+    bool is_array() const { return size() > 1; }
+
+    /// @brief Get last error code, 0 for normal
+    int get_last_err() const { return _error_code; }
+
+    /// @brief Access cell by index (no bounds check)
+    Cell operator[](int i) const { return Cell(_data + i); }
+
+    /// @brief Access cell by index, clamped into the valid range (#N/A cell if the view is empty) @param i Index position
+    Cell at(int i) const;
+
+    /// @brief Access cell by row and column, clamped into the valid range @param row Row index (1-based) @param col Column index (1-based)
+    Cell at(int row, int col) const;
+
+    /// @brief Get iterator starting position
+    iterator begin() const { return iterator(_data); }
+
+    /// @brief Get iterator ending position
+    iterator end() const { return iterator(_data + size()); }
+
+private:
+    /// @brief Viewed cells
+    const xloper12* _data = nullptr;
+    /// @brief Row count
+    int _rows = 0;
+    /// @brief Column count
+    int _cols = 0;
+    /// @brief Excel12 return code of the coercion
+    int _error_code = 0;
+    /// @brief Whether _coerced must be released with xlFree
+    bool _owns = false;
+    /// @brief Coerced reference data
+    xloper12 _coerced;
+    /// @brief Cached range contents viewed instead of _coerced (see xllRangeCache)
+    std::shared_ptr<const xllRangeSnapshot> _snapshot;
+
+    /// @brief Release coerced data
+    void release();
+};
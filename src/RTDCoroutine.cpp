@@ -0,0 +1,433 @@
+#include "RTDCoroutine.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <optional>
+#include <stop_token>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief Stop callback of a job, asks its loop thread to destroy the coroutine
+struct CancelJob {
+    RTDCoroutineJob* job;
+    void operator()() const noexcept;
+};
+
+struct RTDCoroutineJob {
+    std::atomic<long> refs = 1;      // The loop thread's, plus one per queued message
+    Topic* topic = nullptr;          // Reference held until the job is freed
+    RTDCoroutine::Handle handle;     // Null once the frame is destroyed
+    RTDLoopThread* thread = nullptr; // Only thread resuming the coroutine
+    std::optional<std::stop_callback<CancelJob>> on_stop;
+    RTDCoroutineJob* prev = nullptr; // Live list of the loop thread
+    RTDCoroutineJob* next = nullptr;
+
+    RTDCoroutineJob* addRef() {
+        refs++;
+        return this;
+    }
+    void release() {
+        if (--refs == 0) delete this;
+    }
+    ~RTDCoroutineJob() {
+        // Only a coroutine never started is left here, the loop destroys the others
+        if (handle) handle.destroy();
+        if (topic != nullptr) topic->release();
+    }
+};
+
+struct RTDLoopThread {
+    enum class Kind { Start, Wake, Cancel };
+    struct Message {
+        Kind kind;
+        RTDCoroutineJob* job; // Holds a reference
+    };
+
+    static constexpr uint64_t SLOTS = 1024; // Timer wheel slots of 1 ms, a power of two
+
+    // Inbox, filled from any thread
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Message> inbox;
+    bool stopping = false;
+    HANDLE thread = nullptr;
+
+    // Owned by the thread
+    Clock::time_point epoch = Clock::now();
+    uint64_t cursor = 0;             // Next tick to visit
+    RTDSleep* slots[SLOTS] = {};     // Timers by due tick modulo SLOTS, doubly linked
+    size_t timers = 0;
+    RTDCoroutineJob* live = nullptr; // Coroutines started and not finished
+    std::vector<RTDCoroutineJob*> due;
+
+    // Metrics
+    std::atomic<size_t> live_count = 0;
+    std::atomic<uint64_t> resumed = 0;
+    std::atomic<uint64_t> fired = 0;
+
+    bool post(Kind kind, RTDCoroutineJob* job);
+    uint64_t now() const;
+    void link(RTDSleep* timer);
+    void unlink(RTDSleep* timer);
+    void handle(const Message& message);
+    void resume(RTDCoroutineJob* job);
+    void finish(RTDCoroutineJob* job);
+    void advance();
+    DWORD timeout() const;
+    DWORD run();
+    void clear();
+};
+
+void CancelJob::operator()() const noexcept {
+    job->thread->post(RTDLoopThread::Kind::Cancel, job);
+}
+
+bool RTDLoopThread::post(Kind kind, RTDCoroutineJob* job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) return false;
+        inbox.push_back(Message{kind, job->addRef()});
+    }
+    wake.notify_one();
+    return true;
+}
+
+uint64_t RTDLoopThread::now() const {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - epoch).count());
+}
+
+void RTDLoopThread::link(RTDSleep* timer) {
+    // Never behind the cursor, so the timer fires on a later visit and not in the pass resuming it
+    timer->due = std::max(now() + timer->ms, cursor);
+    RTDSleep*& head = slots[timer->due & (SLOTS - 1)];
+    timer->thread = this;
+    timer->prev = nullptr;
+    timer->next = head;
+    if (head != nullptr) head->prev = timer;
+    head = timer;
+    timers++;
+}
+
+void RTDLoopThread::unlink(RTDSleep* timer) {
+    if (timer->prev != nullptr) {
+        timer->prev->next = timer->next;
+    } else {
+        slots[timer->due & (SLOTS - 1)] = timer->next;
+    }
+    if (timer->next != nullptr) timer->next->prev = timer->prev;
+    timer->thread = nullptr;
+    timers--;
+}
+
+void RTDLoopThread::handle(const Message& message) {
+    RTDCoroutineJob* job = message.job;
+    switch (message.kind) {
+    case Kind::Start:
+        // The job's first reference passes to the live list
+        job->next = live;
+        if (live != nullptr) live->prev = job;
+        live = job;
+        live_count++;
+        // Called at once if the topic is already stopped
+        job->on_stop.emplace(job->topic->stopToken(), CancelJob{job});
+        if (!job->topic->stopRequested()) resume(job);
+        break;
+    case Kind::Wake: resume(job); break;
+    case Kind::Cancel:
+        if (job->handle) finish(job);
+        break;
+    }
+}
+
+void RTDLoopThread::resume(RTDCoroutineJob* job) {
+    // A job cancelled meanwhile has no frame left
+    if (!job->handle) return;
+    resumed++;
+    job->handle.resume();
+    if (job->handle.done()) finish(job);
+}
+
+void RTDLoopThread::finish(RTDCoroutineJob* job) {
+    // Waits for a stop callback running on another thread, which then only queues a message
+    job->on_stop.reset();
+    job->handle.destroy();
+    job->handle = nullptr;
+    if (job->prev != nullptr) {
+        job->prev->next = job->next;
+    } else {
+        live = job->next;
+    }
+    if (job->next != nullptr) job->next->prev = job->prev;
+    live_count--;
+    job->release();
+}
+
+void RTDLoopThread::advance() {
+    uint64_t tick = now();
+    if (timers == 0 || tick < cursor) {
+        cursor = std::max(cursor, tick + 1);
+        return;
+    }
+    // Visit the slots of the ticks passed, each at most once when a whole lap has passed
+    uint64_t steps = std::min(tick - cursor + 1, SLOTS);
+    due.clear();
+    for (uint64_t i = 0; i < steps; i++) {
+        RTDSleep* timer = slots[(cursor + i) & (SLOTS - 1)];
+        while (timer != nullptr) {
+            RTDSleep* next = timer->next;
+            // Timers a lap or more ahead stay
+            if (timer->due <= tick) {
+                due.push_back(timer->job);
+                unlink(timer);
+            }
+            timer = next;
+        }
+    }
+    cursor = tick + 1;
+    fired += due.size();
+    for (RTDCoroutineJob* job : due) resume(job);
+}
+
+DWORD RTDLoopThread::timeout() const {
+    if (timers == 0) return INFINITE;
+    // Until the first tick with a timer in its slot, which may be a lap ahead and wakes the thread early
+    for (uint64_t i = 0; i < SLOTS; i++) {
+        if (slots[(cursor + i) & (SLOTS - 1)] != nullptr) {
+            uint64_t tick = cursor + i, current = now();
+            return tick > current ? static_cast<DWORD>(tick - current) : DWORD(0);
+        }
+    }
+    return INFINITE;
+}
+
+DWORD RTDLoopThread::run() {
+    std::vector<Message> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto ready = [this] { return stopping || !inbox.empty(); };
+            if (!ready()) {
+                DWORD ms = timeout();
+                if (ms == INFINITE) {
+                    wake.wait(lock, ready);
+                } else if (ms > 0) {
+                    wake.wait_for(lock, std::chrono::milliseconds(ms), ready);
+                }
+            }
+            if (stopping) break;
+            batch.swap(inbox);
+        }
+        for (const Message& message : batch) {
+            handle(message);
+            message.job->release();
+        }
+        batch.clear();
+        advance();
+    }
+    return 0;
+}
+
+void RTDLoopThread::clear() {
+    // The thread has exited: drop queued messages, then destroy the suspended coroutines
+    std::vector<Message> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch.swap(inbox);
+    }
+    for (const Message& message : batch) {
+        // A coroutine never started still has its first reference
+        if (message.kind == Kind::Start) message.job->release();
+        message.job->release();
+    }
+    while (live != nullptr) finish(live);
+}
+
+// RTDCoroutine implementation
+void RTDCoroutine::promise_type::unhandled_exception() {
+    topic->setValue(RTDValue::error(xlerrValue));
+}
+
+RTDCoroutine::~RTDCoroutine() {
+    if (handle) handle.destroy();
+}
+
+RTDCoroutine::Handle RTDCoroutine::release() {
+    Handle h = handle;
+    handle = nullptr;
+    return h;
+}
+
+// RTDSleep implementation
+RTDSleep::~RTDSleep() {
+    if (thread != nullptr) thread->unlink(this);
+}
+
+void RTDSleep::await_suspend(RTDCoroutine::Handle handle) {
+    // Runs on the coroutine's loop thread, which owns the wheel
+    job = handle.promise().job;
+    job->thread->link(this);
+}
+
+// RTDEvent implementation
+RTDEvent::Awaiter::~Awaiter() {
+    std::lock_guard<std::mutex> lock(event.mutex);
+    if (!linked) return;
+    if (prev != nullptr) {
+        prev->next = next;
+    } else {
+        event.waiters = next;
+    }
+    if (next != nullptr) next->prev = prev;
+}
+
+bool RTDEvent::Awaiter::await_suspend(RTDCoroutine::Handle handle) {
+    std::lock_guard<std::mutex> lock(event.mutex);
+    if (event.signaled) {
+        event.signaled = false;
+        return false;
+    }
+    job = handle.promise().job;
+    prev = nullptr;
+    next = event.waiters;
+    if (next != nullptr) next->prev = this;
+    event.waiters = this;
+    linked = true;
+    return true;
+}
+
+void RTDEvent::set() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (waiters == nullptr) {
+        signaled = true;
+        return;
+    }
+    // Resumed by their loop thread once it is done with the coroutine it runs
+    for (Awaiter* waiter = waiters; waiter != nullptr; waiter = waiter->next) {
+        waiter->linked = false;
+        waiter->job->thread->post(RTDLoopThread::Kind::Wake, waiter->job);
+    }
+    waiters = nullptr;
+}
+
+// RTDEventLoop implementation
+struct RTDEventLoop::State {
+    std::vector<std::unique_ptr<RTDLoopThread>> threads;
+    std::atomic<size_t> next_thread = 0;
+};
+
+RTDEventLoop::RTDEventLoop() = default;
+
+RTDEventLoop::~RTDEventLoop() {
+    stop();
+}
+
+bool RTDEventLoop::start(unsigned count) {
+    if (running()) return true;
+    if (count == 0) count = 1;
+    state = std::make_unique<State>();
+    for (unsigned i = 0; i < count; i++) {
+        state->threads.push_back(std::make_unique<RTDLoopThread>());
+    }
+    for (auto& thread : state->threads) {
+        thread->thread = CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
+            return static_cast<RTDLoopThread*>(param)->run(); }, thread.get(), 0, nullptr);
+        if (thread->thread == nullptr) {
+            stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RTDEventLoop::running() const {
+    return state != nullptr && !state->threads.empty();
+}
+
+void RTDEventLoop::stop(DWORD timeout_ms, DWORD watchdog_ms) {
+    if (!running()) return;
+    for (auto& thread : state->threads) {
+        {
+            std::lock_guard<std::mutex> lock(thread->mutex);
+            thread->stopping = true;
+        }
+        thread->wake.notify_one();
+    }
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::vector<std::unique_ptr<RTDLoopThread>> stuck;
+    for (auto& thread : state->threads) {
+        if (thread->thread != nullptr) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (WaitForSingleObject(thread->thread, left > 0 ? static_cast<DWORD>(left) : 0) != WAIT_OBJECT_0) {
+                // A coroutine blocking its thread, the thread keeps its state until it returns
+                stuck.push_back(std::move(thread));
+                continue;
+            }
+            CloseHandle(thread->thread);
+        }
+        thread->clear();
+    }
+    state.reset();
+    if (stuck.empty()) return;
+
+    // Abandoned threads are cleaned up by a watchdog once they return, and terminated as a last resort
+    struct Watch {
+        std::vector<std::unique_ptr<RTDLoopThread>> threads;
+        DWORD grace_ms;
+    };
+    Watch* watch = new Watch{std::move(stuck), watchdog_ms};
+    HANDLE watchdog = watchdog_ms == INFINITE ? nullptr : CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
+        Watch* watch = static_cast<Watch*>(param);
+        auto deadline = Clock::now() + std::chrono::milliseconds(watch->grace_ms);
+        for (auto& thread : watch->threads) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            bool exited = WaitForSingleObject(thread->thread, left > 0 ? static_cast<DWORD>(left) : 0) == WAIT_OBJECT_0;
+            if (!exited) TerminateThread(thread->thread, 0);
+            CloseHandle(thread->thread);
+            if (exited) {
+                thread->clear();
+            } else {
+                // Frames of a killed thread may be half run, they and their topics are leaked
+                thread.release();
+            }
+        }
+        delete watch;
+        return 0; }, watch, 0, nullptr);
+    if (watchdog != nullptr) {
+        CloseHandle(watchdog);
+    } else {
+        // No watchdog, the threads and their coroutines are left to run
+        for (auto& thread : watch->threads) {
+            CloseHandle(thread->thread);
+            thread.release();
+        }
+        delete watch;
+    }
+}
+
+bool RTDEventLoop::spawn(Topic* topic, RTDCoroutine coroutine) {
+    if (!running()) return false;
+    RTDCoroutineJob* job = new RTDCoroutineJob;
+    job->topic = topic->addRef();
+    job->handle = coroutine.release();
+    job->handle.promise().job = job;
+    job->thread = state->threads[state->next_thread++ % state->threads.size()].get();
+    if (!job->thread->post(RTDLoopThread::Kind::Start, job)) {
+        job->release();
+        return false;
+    }
+    return true;
+}
+
+RTDEventLoop::Metrics RTDEventLoop::metrics() const {
+    Metrics m;
+    if (!running()) return m;
+    m.threads = static_cast<unsigned>(state->threads.size());
+    for (const auto& thread : state->threads) {
+        m.live += thread->live_count.load();
+        m.resumed += thread->resumed.load();
+        m.timers += thread->fired.load();
+    }
+    return m;
+}
@@ -0,0 +1,36 @@
+#include "RTDDirtyQueue.h"
+#include "RTDTopic.h"
+#include <algorithm>
+
+RTDDirtyQueue::~RTDDirtyQueue() {
+    std::vector<long> ids;
+    drain(ids);
+}
+
+bool RTDDirtyQueue::push(Link& link) {
+    if (link.queued.exchange(true, std::memory_order_acq_rel)) return false;
+    // Held until drained, the link lives in the topic
+    link.owner->addRef();
+    Link* next = head.load(std::memory_order_relaxed);
+    do {
+        link.next = next;
+    } while (!head.compare_exchange_weak(next, &link, std::memory_order_release, std::memory_order_relaxed));
+    return next == nullptr;
+}
+
+size_t RTDDirtyQueue::drain(std::vector<long>& ids) {
+    Link* link = head.exchange(nullptr, std::memory_order_acquire);
+    size_t first = ids.size();
+    while (link != nullptr) {
+        // Read before the link is released, a producer may queue the topic again right after
+        Link* next = link->next;
+        Topic* topic = link->owner;
+        ids.push_back(topic->getID());
+        link->queued.store(false, std::memory_order_release);
+        topic->release();
+        link = next;
+    }
+    // The stack hands out the newest ID first
+    std::reverse(ids.begin() + first, ids.end());
+    return ids.size() - first;
+}
@@ -0,0 +1,394 @@
+#include "RTDExecutor.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using Clock = RTDExecutor::Clock;
+
+/// @brief Raise an atomic maximum
+template <typename T>
+static void raise(std::atomic<T>& maximum, T value) {
+    T seen = maximum.load(std::memory_order_relaxed);
+    while (seen < value && !maximum.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+struct RTDExecutor::State {
+    struct Item {
+        Job job;
+        int group = -1;
+        Clock::time_point ready;  // Queued, or due for delayed jobs
+    };
+    struct Delayed {
+        Item item;
+        uint64_t seq;  // Keeps jobs due at the same time in submission order
+        bool operator>(const Delayed& other) const {
+            return item.ready != other.item.ready ? item.ready > other.item.ready : seq > other.seq;
+        }
+    };
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Item> jobs;
+        HANDLE thread = nullptr;
+    };
+    struct Group {
+        int limit = 0;
+        int running = 0;
+        std::deque<Item> waiting;
+    };
+
+    void push(Item item);
+    bool take(size_t self, Item& item);
+    bool takeDue(Item& item);
+    bool admit(Item& item);
+    void finish(int group);
+    void run(Item& item);
+    DWORD workerProc(size_t self);
+    void clear();
+
+    // Fixed once started, abandoned workers still reach their deque after stop()
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> stopping = false;
+    std::atomic<size_t> next_worker = 0;
+
+    // Parking: ready and the delayed heap are checked under park_mutex before a worker sleeps
+    static constexpr int64_t NEVER = INT64_MAX;
+    std::mutex park_mutex;
+    std::condition_variable park;
+    std::atomic<size_t> ready = 0;                 // Jobs in the worker deques
+    std::priority_queue<Delayed, std::vector<Delayed>, std::greater<Delayed>> delayed;
+    std::atomic<int64_t> next_due = NEVER;         // Due time of the first delayed job, in Clock ticks
+    uint64_t delayed_seq = 0;
+
+    std::mutex group_mutex;
+    std::vector<Group> groups;
+    std::map<std::wstring, int> group_ids;
+
+    // Metrics
+    std::atomic<size_t> queued = 0;
+    std::atomic<size_t> max_queued = 0;
+    std::atomic<uint64_t> submitted = 0;
+    std::atomic<uint64_t> completed = 0;
+    std::atomic<uint64_t> wait_ns = 0;
+    std::atomic<uint64_t> max_wait_ns = 0;
+    std::atomic<uint64_t> run_ns = 0;
+    std::atomic<unsigned> abandoned = 0;
+    std::atomic<unsigned> terminated = 0;
+};
+
+/// @brief Executor state and worker index of the calling thread, if it is a pool worker
+static thread_local const void* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+RTDExecutor::~RTDExecutor() {
+    stop();
+}
+
+bool RTDExecutor::start(unsigned count) {
+    if (running()) return true;
+    if (count == 0) count = std::thread::hardware_concurrency();
+    if (count == 0) count = 4;
+
+    // A fresh state each time, the previous one may still be held by abandoned workers
+    auto fresh = std::make_shared<State>();
+    if (state != nullptr) {
+        std::lock_guard<std::mutex> lock(state->group_mutex);
+        fresh->group_ids = state->group_ids;
+        for (const State::Group& g : state->groups) {
+            fresh->groups.emplace_back().limit = g.limit;
+        }
+    }
+    state = fresh;
+    for (unsigned i = 0; i < count; i++) {
+        state->workers.push_back(std::make_unique<State::Worker>());
+    }
+
+    // Threads start once every deque exists, idle workers steal from all of them
+    struct Start {
+        std::shared_ptr<State> state;
+        size_t index;
+    };
+    for (size_t i = 0; i < state->workers.size(); i++) {
+        Start* start = new Start{state, i};
+        state->workers[i]->thread = CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
+            Start* start = static_cast<Start*>(param);
+            std::shared_ptr<State> state = std::move(start->state);
+            size_t index = start->index;
+            delete start;
+            return state->workerProc(index); }, start, 0, nullptr);
+        if (state->workers[i]->thread == nullptr) {
+            delete start;
+            stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RTDExecutor::running() const {
+    return state != nullptr && !state->workers.empty() && !state->stopping;
+}
+
+void RTDExecutor::stop(DWORD timeout_ms, DWORD watchdog_ms) {
+    if (!running()) return;
+    state->stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(state->park_mutex);
+    }
+    state->park.notify_all();
+    // Drop queued jobs right away so workers only finish the job they are in
+    state->clear();
+
+    // One deadline for all workers, they finish their jobs in parallel
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::vector<HANDLE> stuck;
+    for (auto& worker : state->workers) {
+        if (worker->thread == nullptr) continue;
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        if (WaitForSingleObject(worker->thread, left > 0 ? static_cast<DWORD>(left) : 0) == WAIT_OBJECT_0) {
+            CloseHandle(worker->thread);
+        } else {
+            stuck.push_back(worker->thread);
+        }
+        worker->thread = nullptr;
+    }
+    if (stuck.empty()) return;
+
+    // Abandon workers whose job ignored the stop request, the watchdog terminates them as a last resort
+    state->abandoned += static_cast<unsigned>(stuck.size());
+    if (watchdog_ms == INFINITE) {
+        for (HANDLE thread : stuck) CloseHandle(thread);
+        return;
+    }
+    struct Watch {
+        std::shared_ptr<State> state;
+        std::vector<HANDLE> threads;
+        DWORD grace_ms;
+    };
+    Watch* watch = new Watch{state, std::move(stuck), watchdog_ms};
+    HANDLE watchdog = CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
+        Watch* watch = static_cast<Watch*>(param);
+        auto deadline = Clock::now() + std::chrono::milliseconds(watch->grace_ms);
+        for (HANDLE thread : watch->threads) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (WaitForSingleObject(thread, left > 0 ? static_cast<DWORD>(left) : 0) != WAIT_OBJECT_0) {
+                TerminateThread(thread, 0);
+                watch->state->terminated++;
+            }
+            CloseHandle(thread);
+        }
+        delete watch;
+        return 0; }, watch, 0, nullptr);
+    if (watchdog != nullptr) {
+        CloseHandle(watchdog);
+    } else {
+        for (HANDLE thread : watch->threads) CloseHandle(thread);
+        delete watch;
+    }
+}
+
+int RTDExecutor::group(const std::wstring& name, int max_concurrency) {
+    if (state == nullptr) state = std::make_shared<State>();
+    std::lock_guard<std::mutex> lock(state->group_mutex);
+    auto it = state->group_ids.find(name);
+    if (it != state->group_ids.end()) {
+        state->groups[it->second].limit = max_concurrency;
+        return it->second;
+    }
+    state->groups.emplace_back().limit = max_concurrency;
+    int id = static_cast<int>(state->groups.size() - 1);
+    state->group_ids[name] = id;
+    return id;
+}
+
+void RTDExecutor::submit(Job job, int group, DWORD delay_ms) {
+    if (!running()) return;
+    state->submitted++;
+    State::Item item{std::move(job), group, Clock::now()};
+    if (delay_ms > 0) {
+        item.ready += std::chrono::milliseconds(delay_ms);
+        {
+            std::lock_guard<std::mutex> lock(state->park_mutex);
+            state->delayed.push(State::Delayed{std::move(item), state->delayed_seq++});
+            state->next_due = state->delayed.top().item.ready.time_since_epoch().count();
+        }
+        // A parked worker may have to wake earlier than it planned
+        state->park.notify_one();
+        return;
+    }
+    state->push(std::move(item));
+}
+
+RTDExecutor::Metrics RTDExecutor::metrics() const {
+    Metrics m;
+    if (state == nullptr) return m;
+    m.workers = static_cast<unsigned>(state->workers.size());
+    m.submitted = state->submitted;
+    m.completed = state->completed;
+    m.queued = state->queued;
+    m.max_queued = state->max_queued;
+    {
+        std::lock_guard<std::mutex> lock(state->park_mutex);
+        m.delayed = state->delayed.size();
+    }
+    uint64_t done = m.completed > 0 ? m.completed : 1;
+    m.avg_wait_us = state->wait_ns * 1e-3 / done;
+    m.max_wait_us = state->max_wait_ns * 1e-3;
+    m.avg_run_us = state->run_ns * 1e-3 / done;
+    m.abandoned = state->abandoned;
+    m.terminated = state->terminated;
+    return m;
+}
+
+void RTDExecutor::State::push(Item item) {
+    raise(max_queued, ++queued);
+    size_t target = current_pool == this ? current_worker : next_worker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[target]->mutex);
+        workers[target]->jobs.push_back(std::move(item));
+        ready++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+    }
+    park.notify_one();
+}
+
+bool RTDExecutor::State::take(size_t self, Item& item) {
+    // Own jobs newest first, they are the most likely to be in cache
+    {
+        Worker& own = *workers[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            item = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            ready--;
+            return true;
+        }
+    }
+    // Steal the oldest job of another worker
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker& other = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.jobs.empty()) {
+            item = std::move(other.jobs.front());
+            other.jobs.pop_front();
+            ready--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RTDExecutor::State::takeDue(Item& item) {
+    if (Clock::now().time_since_epoch().count() < next_due.load(std::memory_order_relaxed)) return false;
+    std::lock_guard<std::mutex> lock(park_mutex);
+    if (delayed.empty() || delayed.top().item.ready > Clock::now()) return false;
+    item = std::move(const_cast<Delayed&>(delayed.top()).item);
+    delayed.pop();
+    next_due = delayed.empty() ? NEVER : delayed.top().item.ready.time_since_epoch().count();
+    raise(max_queued, ++queued);
+    return true;
+}
+
+bool RTDExecutor::State::admit(Item& item) {
+    if (item.group < 0) return true;
+    std::lock_guard<std::mutex> lock(group_mutex);
+    Group& g = groups[item.group];
+    if (g.limit > 0 && g.running >= g.limit) {
+        g.waiting.push_back(std::move(item));
+        return false;
+    }
+    g.running++;
+    return true;
+}
+
+void RTDExecutor::State::finish(int group) {
+    Item next;
+    {
+        std::lock_guard<std::mutex> lock(group_mutex);
+        Group& g = groups[group];
+        g.running--;
+        if (g.waiting.empty() || stopping) return;
+        next = std::move(g.waiting.front());
+        g.waiting.pop_front();
+    }
+    // Already counted as queued
+    queued--;
+    push(std::move(next));
+}
+
+void RTDExecutor::State::run(Item& item) {
+    queued--;
+    auto start = Clock::now();
+    uint64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(start - item.ready).count();
+    wait_ns += waited;
+    raise(max_wait_ns, waited);
+
+    try {
+        item.job();
+    } catch (...) {
+        // A failing task must not take its worker down
+    }
+
+    run_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    completed++;
+    int g = item.group;
+    item = Item{};
+    if (g >= 0) finish(g);
+}
+
+void RTDExecutor::State::clear() {
+    // Jobs are destroyed outside the locks, they may release the last reference to a topic
+    std::vector<Item> dropped;
+    for (auto& worker : workers) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        for (Item& item : worker->jobs) dropped.push_back(std::move(item));
+        worker->jobs.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        while (!delayed.empty()) {
+            dropped.push_back(std::move(const_cast<Delayed&>(delayed.top()).item));
+            delayed.pop();
+        }
+        next_due = NEVER;
+        ready = 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(group_mutex);
+        for (Group& g : groups) {
+            for (Item& item : g.waiting) dropped.push_back(std::move(item));
+            g.waiting.clear();
+        }
+    }
+    queued = 0;
+}
+
+DWORD RTDExecutor::State::workerProc(size_t self) {
+    current_pool = this;
+    current_worker = self;
+    Item item;
+    while (!stopping) {
+        // Delayed jobs first once due, ready jobs must not starve them
+        if (takeDue(item) || take(self, item)) {
+            if (admit(item)) run(item);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(park_mutex);
+        if (stopping || ready > 0) continue;
+        if (delayed.empty()) {
+            park.wait(lock);
+        } else {
+            Clock::time_point due = delayed.top().item.ready;
+            if (due > Clock::now()) park.wait_until(lock, due);
+        }
+    }
+    return 0;
+}
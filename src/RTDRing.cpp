@@ -0,0 +1,149 @@
+#include "RTDRing.h"
+#include <algorithm>
+#include <cstring>
+
+RTDRing::~RTDRing() {
+    close();
+}
+
+size_t RTDRing::bytes(uint32_t capacity) {
+    return sizeof(RTDRingHeader) + size_t(capacity) * sizeof(RTDRingSlot);
+}
+
+bool RTDRing::create(const std::wstring& name, uint32_t capacity) {
+    close();
+    uint32_t slots = 2;
+    while (slots < capacity && slots < (1u << 24)) slots <<= 1;
+    uint64_t size = bytes(slots);
+    mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+                                 static_cast<DWORD>(size & 0xFFFFFFFF), name.c_str());
+    if (mapping == nullptr) return false;
+    return map(GetLastError() != ERROR_ALREADY_EXISTS, slots);
+}
+
+bool RTDRing::open(const std::wstring& name) {
+    close();
+    mapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    if (mapping == nullptr) return false;
+    return map(false, 0);
+}
+
+bool RTDRing::map(bool created, uint32_t capacity) {
+    header = static_cast<RTDRingHeader*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    if (header == nullptr) {
+        close();
+        return false;
+    }
+    slots = reinterpret_cast<RTDRingSlot*>(header + 1);
+    if (created) {
+        // The new mapping is zero filled, only the sequence numbers need setting before the magic number
+        header->version = RTDRingHeader::VERSION;
+        header->capacity = capacity;
+        header->slot_size = sizeof(RTDRingSlot);
+        for (uint32_t i = 0; i < capacity; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+        header->magic.store(RTDRingHeader::MAGIC, std::memory_order_release);
+    } else {
+        // Created by another process, which may still be initializing it
+        for (int i = 0; i < 100 && header->magic.load(std::memory_order_acquire) != RTDRingHeader::MAGIC; i++) {
+            Sleep(10);
+        }
+        uint32_t n = header->capacity;
+        if (header->magic.load(std::memory_order_acquire) != RTDRingHeader::MAGIC ||
+            header->version != RTDRingHeader::VERSION || header->slot_size != sizeof(RTDRingSlot) || n == 0 ||
+            (n & (n - 1)) != 0) {
+            close();
+            return false;
+        }
+    }
+    mask = header->capacity - 1;
+    return true;
+}
+
+void RTDRing::close() {
+    if (header != nullptr) {
+        UnmapViewOfFile(header);
+        header = nullptr;
+        slots = nullptr;
+        mask = 0;
+    }
+    if (mapping != nullptr) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+    }
+}
+
+bool RTDRing::push(std::string_view key, RTDRingType type, double num, std::string_view text) {
+    // A cut key would reach another topic, a cut text only loses its end
+    if (header == nullptr || key.size() > RTDRingRecord::KEY) return false;
+    uint64_t pos = header->head.load(std::memory_order_relaxed);
+    RTDRingSlot* slot = nullptr;
+    for (;;) {
+        slot = &slots[pos & mask];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(seq - pos);
+        if (diff == 0) {
+            if (header->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            // The reader has not yet taken the record written here one lap ago
+            header->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = header->head.load(std::memory_order_relaxed);
+        }
+    }
+    RTDRingRecord& record = slot->record;
+    size_t text_len = std::min(text.size(), RTDRingRecord::TEXT);
+    while (text_len < text.size() && text_len > 0 && (text[text_len] & 0xC0) == 0x80) text_len--;
+    record.type = type;
+    record.num = num;
+    record.key_len = static_cast<uint16_t>(key.size());
+    record.text_len = static_cast<uint16_t>(text_len);
+    std::memcpy(record.key, key.data(), key.size());
+    if (text_len > 0) std::memcpy(record.text, text.data(), text_len);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool RTDRing::write(std::string_view key, double value) {
+    return push(key, RTDRingType::Number, value, {});
+}
+
+bool RTDRing::write(std::string_view key, std::string_view text) {
+    return push(key, RTDRingType::Text, 0, text);
+}
+
+bool RTDRing::writeBool(std::string_view key, bool value) {
+    return push(key, RTDRingType::Bool, value ? 1 : 0, {});
+}
+
+bool RTDRing::writeError(std::string_view key, int code) {
+    return push(key, RTDRingType::Error, code, {});
+}
+
+bool RTDRing::read(RTDRingRecord& record) {
+    if (header == nullptr) return false;
+    uint64_t pos = header->tail.load(std::memory_order_relaxed);
+    RTDRingSlot& slot = slots[pos & mask];
+    if (slot.seq.load(std::memory_order_acquire) != pos + 1) return false;
+    // Only the bytes in use are copied out
+    const RTDRingRecord& src = slot.record;
+    record.type = src.type;
+    record.num = src.num;
+    record.key_len = std::min<uint16_t>(src.key_len, RTDRingRecord::KEY);
+    record.text_len = std::min<uint16_t>(src.text_len, RTDRingRecord::TEXT);
+    std::memcpy(record.key, src.key, record.key_len);
+    std::memcpy(record.text, src.text, record.text_len);
+    slot.seq.store(pos + mask + 1, std::memory_order_release);
+    header->tail.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool RTDRing::full() const {
+    if (header == nullptr) return false;
+    uint64_t tail = header->tail.load(std::memory_order_acquire);
+    return header->head.load(std::memory_order_relaxed) - tail > mask;
+}
+
+uint64_t RTDRing::dropped() const {
+    return header != nullptr ? header->dropped.load(std::memory_order_relaxed) : 0;
+}
@@ -0,0 +1,150 @@
+#include "RTDRingFeed.h"
+#include "xllRTD.h"
+#include <thread>
+#include <vector>
+
+constexpr size_t RING_BATCH = 256;         // Records routed per publishMany
+constexpr int RING_SPIN = 64;              // Empty polls answered with a yield before sleeping
+constexpr DWORD RING_IDLE_MAX = 64;        // Longest sleep between polls of an idle ring, doubled from 1 (milliseconds)
+constexpr DWORD RING_ATTACH_RETRY = 500;   // First wait between attempts to open the ring (milliseconds)
+constexpr DWORD RING_ATTACH_MAX = 8000;    // Longest wait between attempts to open the ring (milliseconds)
+
+/// @brief Append UTF-8 text as wide characters, without a conversion call for ASCII
+static void widen(const char* s, size_t n, std::wstring& out) {
+    size_t i = 0;
+    while (i < n && static_cast<unsigned char>(s[i]) < 0x80) out += static_cast<wchar_t>(s[i++]);
+    if (i == n) return;
+    int len = MultiByteToWideChar(CP_UTF8, 0, s + i, static_cast<int>(n - i), nullptr, 0);
+    if (len <= 0) return;
+    size_t at = out.size();
+    out.resize(at + len);
+    MultiByteToWideChar(CP_UTF8, 0, s + i, static_cast<int>(n - i), &out[at], len);
+}
+
+struct RTDRingFeed::State {
+    std::wstring name;
+    std::wstring prefix;
+    HANDLE wake = nullptr;           // Manual-reset event ending the thread's waits on stop
+    std::atomic<bool> stopping = false;
+    std::atomic<bool> attached = false;
+    std::atomic<uint64_t> records = 0;
+    std::atomic<uint64_t> routed = 0;
+    std::atomic<uint64_t> dropped = 0;
+
+    ~State() {
+        if (wake != nullptr) CloseHandle(wake);
+    }
+    DWORD run();
+};
+
+RTDRingFeed::RTDRingFeed(std::wstring name, std::wstring function) : name(std::move(name)) {
+    prefix = Topic::makeKey(function, {});
+}
+
+RTDRingFeed::~RTDRingFeed() {
+    stop();
+}
+
+bool RTDRingFeed::start() {
+    if (thread != nullptr) return true;
+    // A fresh state each time, the previous one may still be held by an abandoned thread
+    auto fresh = std::make_shared<State>();
+    fresh->name = name;
+    fresh->prefix = prefix;
+    fresh->wake = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (fresh->wake == nullptr) return false;
+    state = fresh;
+    auto* held = new std::shared_ptr<State>(state);
+    thread = CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
+        std::shared_ptr<State> state = std::move(*static_cast<std::shared_ptr<State>*>(param));
+        delete static_cast<std::shared_ptr<State>*>(param);
+        return state->run(); }, held, 0, nullptr);
+    if (thread == nullptr) delete held;
+    return thread != nullptr;
+}
+
+void RTDRingFeed::stop(DWORD timeout_ms) {
+    if (thread == nullptr) return;
+    state->stopping = true;
+    SetEvent(state->wake);
+    if (WaitForSingleObject(thread, timeout_ms) != WAIT_OBJECT_0) {
+        // Not killed: inside publishMany it may hold RTDRegister's server lock. It returns once the call does.
+        abandoned++;
+    }
+    CloseHandle(thread);
+    thread = nullptr;
+    state->attached = false;
+}
+
+RTDRingFeed::Metrics RTDRingFeed::metrics() const {
+    Metrics m;
+    m.abandoned = abandoned;
+    if (state == nullptr) return m;
+    m.attached = state->attached.load();
+    m.records = state->records.load();
+    m.routed = state->routed.load();
+    m.dropped = state->dropped.load();
+    return m;
+}
+
+DWORD RTDRingFeed::State::run() {
+    RTDRegister& rtd = RTDRegister::instance();
+    RTDRing ring;
+    RTDRingRecord record;
+    std::wstring arg;
+    // Reused between batches, so keys and text keep their buffers
+    std::vector<RTDUpdate> batch(RING_BATCH);
+    int idle = 0;
+    DWORD sleep_ms = 1, attach_ms = RING_ATTACH_RETRY;
+    while (!stopping) {
+        if (!ring.isOpen()) {
+            // The producer may start after the add-in, or never: the retries space out
+            if (!ring.open(name)) {
+                WaitForSingleObject(wake, attach_ms);
+                attach_ms = attach_ms < RING_ATTACH_MAX / 2 ? attach_ms * 2 : RING_ATTACH_MAX;
+                continue;
+            }
+            attached = true;
+        }
+        size_t n = 0;
+        for (; n < RING_BATCH && ring.read(record); n++) {
+            // Same key as Topic::makeKey(function, {argument})
+            RTDUpdate& update = batch[n];
+            arg.clear();
+            widen(record.key, record.key_len, arg);
+            update.key.assign(prefix);
+            Topic::appendKey(update.key, arg);
+            RTDValue& value = update.value;
+            value.num = record.num;
+            value.str.clear();
+            switch (record.type) {
+            case RTDRingType::Number: value.kind = RTDValue::Kind::Number; break;
+            case RTDRingType::Bool: value.kind = RTDValue::Kind::Bool; value.num = record.num != 0; break;
+            case RTDRingType::Error: value.kind = RTDValue::Kind::Error; break;
+            case RTDRingType::Text:
+                value.kind = RTDValue::Kind::String;
+                value.num = 0;
+                widen(record.text, record.text_len, value.str);
+                break;
+            default: value.kind = RTDValue::Kind::Empty; value.num = 0; break;
+            }
+        }
+        dropped = ring.dropped();
+        if (n == 0) {
+            // Stay responsive to a burst for a few rounds, then poll less and less often while the ring stays empty
+            if (++idle < RING_SPIN) {
+                std::this_thread::yield();
+            } else {
+                WaitForSingleObject(wake, sleep_ms);
+                sleep_ms = sleep_ms < RING_IDLE_MAX / 2 ? sleep_ms * 2 : RING_IDLE_MAX;
+            }
+            continue;
+        }
+        idle = 0;
+        sleep_ms = 1;
+        records += n;
+        routed += rtd.publishMany(batch.data(), n);
+    }
+    ring.close();
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "RTDSubscriptionIndex.h"
+#include <algorithm>
+
+RTDSubscriptionIndex::~RTDSubscriptionIndex() {
+    std::vector<Topic*> topics;
+    clear(topics);
+    for (Topic* topic : topics) topic->release();
+}
+
+size_t RTDSubscriptionIndex::hash(const std::wstring& key) {
+    return std::hash<std::wstring>{}(key);
+}
+
+RTDSubscriptionIndex::Shard& RTDSubscriptionIndex::shard(size_t h) const {
+    // Mixed again so the shard does not follow the bits the map picks its bucket with
+    uint64_t m = static_cast<uint64_t>(h) * 0x9E3779B97F4A7C15ull;
+    return const_cast<Shard&>(shards[m >> 58]);
+}
+
+bool RTDSubscriptionIndex::insert(const std::wstring& key, Topic* topic) {
+    Shard& s = shard(hash(key));
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!s.topics.emplace(key, topic).second) return false;
+    topic->addRef();
+    count++;
+    return true;
+}
+
+Topic* RTDSubscriptionIndex::acquire(const std::wstring& key) const {
+    if (size() == 0) return nullptr;
+    Shard& s = shard(hash(key));
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.topics.find(key);
+    return it != s.topics.end() ? it->second->addRef() : nullptr;
+}
+
+size_t RTDSubscriptionIndex::acquireMany(const RTDUpdate* updates, size_t n, Topic** topics) const {
+    std::fill(topics, topics + n, nullptr);
+    if (n == 0 || size() == 0) return 0;
+
+    // Group the updates by shard, so each shard is locked once however the keys are spread
+    std::vector<Shard*> owner(n);
+    std::vector<size_t> order(n);
+    size_t start[SHARDS + 1] = {};
+    for (size_t i = 0; i < n; i++) {
+        owner[i] = &shard(hash(updates[i].key));
+        start[owner[i] - shards + 1]++;
+    }
+    for (size_t k = 0; k < SHARDS; k++) start[k + 1] += start[k];
+    size_t next[SHARDS];
+    std::copy(start, start + SHARDS, next);
+    for (size_t i = 0; i < n; i++) order[next[owner[i] - shards]++] = i;
+
+    size_t found = 0;
+    for (size_t k = 0; k < SHARDS; k++) {
+        if (start[k] == start[k + 1]) continue;
+        const Shard& s = shards[k];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.topics.empty()) continue;
+        for (size_t j = start[k]; j < start[k + 1]; j++) {
+            size_t i = order[j];
+            auto it = s.topics.find(updates[i].key);
+            if (it == s.topics.end()) continue;
+            topics[i] = it->second->addRef();
+            found++;
+        }
+    }
+    return found;
+}
+
+Topic* RTDSubscriptionIndex::remove(const std::wstring& key) {
+    Shard& s = shard(hash(key));
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.topics.find(key);
+    if (it == s.topics.end()) return nullptr;
+    Topic* topic = it->second;
+    s.topics.erase(it);
+    count--;
+    return topic;
+}
+
+void RTDSubscriptionIndex::clear(std::vector<Topic*>& topics) {
+    for (Shard& s : shards) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (const auto& entry : s.topics) topics.push_back(entry.second);
+        count -= s.topics.size();
+        std::unordered_map<std::wstring, Topic*>().swap(s.topics);
+    }
+}
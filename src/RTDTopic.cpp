@@ -1,4 +1,7 @@
 #include "RTDTopic.h"
+#include <algorithm>
+#include <cmath>
+#include <cwchar>
 
 // VARIANT creation function implementation
 VARIANT createVariant(int value) {
@@ -13,34 +16,169 @@ VARIANT createVariant(const std::wstring& value) {
     VARIANT variant;
     VariantInit(&variant);
     variant.vt = VT_BSTR;
-    variant.bstrVal = SysAllocString(value.c_str());
+    variant.bstrVal = SysAllocStringLen(value.data(), static_cast<UINT>(value.size()));
     return variant;
 }
 
+// RTDValue implementation
+RTDValue RTDValue::boolean(bool value) {
+    RTDValue v;
+    v.kind = Kind::Bool;
+    v.num = value ? 1 : 0;
+    return v;
+}
+
+RTDValue RTDValue::error(int code) {
+    RTDValue v;
+    v.kind = Kind::Error;
+    v.num = code;
+    return v;
+}
+
+RTDValue RTDValue::from(xllType& x) {
+    // Coerce a lazy reference in place rather than into a side value of the const accessors below
+    x.resolve();
+    if (x.is_array()) {
+        RTDValue v(x.serialize()->get_str());
+        v.kind = Kind::Array;
+        return v;
+    }
+    if (x.is_num()) return RTDValue(x.get_num());
+    if (x.is_bool()) return boolean(x.get_bool());
+    if (x.is_err()) return error(x.get_err());
+    if (x.is_str()) return RTDValue(x.get_str());
+    return RTDValue();
+}
+
+bool RTDValue::empty() const {
+    return kind == Kind::Empty || ((kind == Kind::String || kind == Kind::Array) && str.empty());
+}
+
+bool RTDValue::number(double& out) const {
+    if (kind == Kind::Number) {
+        out = num;
+        return true;
+    }
+    if (kind != Kind::String || str.empty()) return false;
+    wchar_t* end = nullptr;
+    out = std::wcstod(str.c_str(), &end);
+    return *end == L'\0';
+}
+
+std::wstring RTDValue::text() const {
+    switch (kind) {
+    case Kind::Number: {
+        wchar_t buffer[32];
+        swprintf(buffer, 32, L"%.15g", num);
+        return buffer;
+    }
+    case Kind::Bool: return num != 0 ? L"TRUE" : L"FALSE";
+    case Kind::Error:
+        switch (static_cast<int>(num)) {
+        case xlerrNull: return L"#NULL!";
+        case xlerrDiv0: return L"#DIV/0!";
+        case xlerrValue: return L"#VALUE!";
+        case xlerrRef: return L"#REF!";
+        case xlerrName: return L"#NAME?";
+        case xlerrNum: return L"#NUM!";
+        case xlerrGettingData: return L"#GETTING_DATA";
+        default: return L"#N/A";
+        }
+    case Kind::String:
+    case Kind::Array: return str;
+    default: return L"";
+    }
+}
+
+VARIANT RTDValue::toVariant() const {
+    VARIANT variant;
+    VariantInit(&variant);
+    switch (kind) {
+    case Kind::Number:
+        variant.vt = VT_R8;
+        variant.dblVal = num;
+        break;
+    case Kind::Bool:
+        variant.vt = VT_BOOL;
+        variant.boolVal = num != 0 ? VARIANT_TRUE : VARIANT_FALSE;
+        break;
+    case Kind::Error:
+        // CVErr: the Excel error code offset by 2000 in FACILITY_CONTROL
+        variant.vt = VT_ERROR;
+        variant.scode = static_cast<SCODE>(0x800A0000u | (2000u + static_cast<unsigned>(num)));
+        break;
+    case Kind::Array:
+    case Kind::String: variant = createVariant(str); break;
+    default: break;
+    }
+    return variant;
+}
+
+bool RTDValue::operator==(const RTDValue& other) const {
+    if (kind != other.kind) return false;
+    if (kind == Kind::String || kind == Kind::Array) return str == other.str;
+    return num == other.num;
+}
+
 // Topic class destructor
 Topic::~Topic() {
     stopTask();
 }
 
 // Topic class constructor implementation
-Topic::Topic(long id, SAFEARRAY** Strings) {
+Topic::Topic(long id, SAFEARRAY** Strings) : Topic(id, parseArgs(Strings), L"") {
+}
+
+Topic::Topic(long id, SAFEARRAY** Strings, std::wstring defaultValue) : Topic(id, parseArgs(Strings), defaultValue) {
+}
+
+Topic::Topic(long id, StringArray args, std::wstring defaultValue) {
     this->topic_id = id;
-    if (Strings != nullptr) {
+    this->args = std::move(args);
+    this->key = makeKey(this->args);
+    this->default_value = std::move(defaultValue);
+    this->acked_value = std::make_shared<const RTDValue>();
+    this->acked = acked_value.get();
+    this->value = acked_value;
+}
+
+StringArray Topic::parseArgs(SAFEARRAY** Strings) {
+    StringArray args;
+    if (Strings != nullptr && *Strings != nullptr) {
         long lElements = (*Strings)->rgsabound[0].cElements;
-        this->args.resize(lElements, L"");
+        args.resize(lElements, L"");
         for (long i = 0; i < lElements; ++i) {
             VARIANT var;
+            VariantInit(&var);
             SafeArrayGetElement(*Strings, &i, &var);
-            if (var.vt == VT_BSTR) {
-                this->args[i] = var.bstrVal;
+            if (var.vt == VT_BSTR && var.bstrVal != nullptr) {
+                args[i].assign(var.bstrVal, SysStringLen(var.bstrVal));
             }
             VariantClear(&var);
         }
     }
+    return args;
+}
+
+void Topic::appendKey(std::wstring& key, std::wstring_view arg) {
+    // Length-prefixed, so no argument content can make two different lists collide
+    key += std::to_wstring(arg.size());
+    key += L':';
+    key += arg;
 }
 
-Topic::Topic(long id, SAFEARRAY** Strings, std::wstring defaultValue) : Topic(id, Strings) {
-    setDefaultValue(defaultValue);
+std::wstring Topic::makeKey(const StringArray& args) {
+    std::wstring key;
+    for (const std::wstring& arg : args) appendKey(key, arg);
+    return key;
+}
+
+std::wstring Topic::makeKey(const std::wstring& function, const StringArray& args) {
+    // Same key as the topic strings Excel passes: the function name, then its arguments
+    std::wstring key;
+    appendKey(key, function);
+    for (const std::wstring& arg : args) appendKey(key, arg);
+    return key;
 }
 
 // Private helper function implementation
@@ -64,6 +202,37 @@ size_t Topic::getArgCount() const {
     return args.size();
 }
 
+const std::wstring& Topic::getKey() const {
+    return key;
+}
+
+Topic* Topic::addSubscriber(long id) {
+    std::lock_guard<std::mutex> lock(mutex_value);
+    subscribers.push_back(id);
+    return this;
+}
+
+size_t Topic::removeSubscriber(long id) {
+    std::lock_guard<std::mutex> lock(mutex_value);
+    auto it = std::find(subscribers.begin(), subscribers.end(), id);
+    if (it != subscribers.end()) {
+        *it = subscribers.back();
+        subscribers.pop_back();
+    }
+    return subscribers.size();
+}
+
+size_t Topic::getSubscriberCount() const {
+    std::lock_guard<std::mutex> lock(mutex_value);
+    return subscribers.size();
+}
+
+size_t Topic::copySubscribers(std::vector<long>& ids) const {
+    std::lock_guard<std::mutex> lock(mutex_value);
+    ids.insert(ids.end(), subscribers.begin(), subscribers.end());
+    return subscribers.size();
+}
+
 bool Topic::hasDefaultValue() const {
     std::lock_guard<std::mutex> lock(mutex_value);
     return !default_value.empty();
@@ -81,53 +250,175 @@ std::wstring Topic::getDefaultValue() const {
 }
 
 bool Topic::hasValue() const {
-    std::lock_guard<std::mutex> lock(mutex_value);
-    return !value.empty();
+    return !loadValue()->empty();
 }
 
-Topic* Topic::setValue(const std::wstring& value) {
-    std::lock_guard<std::mutex> lock(mutex_value);
-    this->value = value;
+Topic* Topic::addRef() {
+    refs++;
     return this;
 }
 
-Topic* Topic::setValue(xllType& x) {
-    std::lock_guard<std::mutex> lock(mutex_value);
-    this->value = x.serialize()->get_str();
+void Topic::release() {
+    if (--refs == 0) {
+        delete this;
+    }
+}
+
+void Topic::signal(bool changed) {
+    std::lock_guard<std::mutex> lock(mutex_notify);
+    if (notify != nullptr) notify(this, changed);
+}
+
+Topic* Topic::valueChanged(bool changed) {
+    // The new snapshot is already published, so the server may read the topic back
+    if (changed) signal(true);
     return this;
 }
 
+bool Topic::insignificant(const RTDValue& current, const RTDValue& next) const {
+    double a = 0, b = 0;
+    return policy.min_change > 0 && next.number(a) && current.number(b) && std::fabs(a - b) < policy.min_change;
+}
+
+std::shared_ptr<const RTDValue> Topic::loadValue() const {
+    return value.load(std::memory_order_acquire);
+}
+
+bool Topic::replaceValue(std::shared_ptr<const RTDValue>& current, std::shared_ptr<const RTDValue>& next) {
+    // On failure `current` receives the snapshot another producer published
+    return value.compare_exchange_strong(current, next, std::memory_order_acq_rel, std::memory_order_acquire);
+}
+
+Topic* Topic::setValue(RTDValue value) {
+    std::shared_ptr<const RTDValue> next; // Allocated once the value is known to be kept
+    auto current = loadValue();
+    do {
+        const RTDValue& candidate = next ? *next : value;
+        if (*current == candidate) return this;
+        if (insignificant(*current, candidate)) {
+            suppressed++;
+            return this;
+        }
+        if (!next) next = std::make_shared<const RTDValue>(std::move(value));
+    } while (!replaceValue(current, next));
+    // Last value wins: a value Excel has not read yet was replaced
+    if (current.get() != acked.load()) conflated++;
+    return valueChanged(true);
+}
+
+Topic* Topic::setValue(const std::wstring& value) {
+    return setValue(RTDValue(value));
+}
+
+Topic* Topic::setValue(double value) {
+    return setValue(RTDValue(value));
+}
+
+Topic* Topic::setValue(xllType& x) {
+    return setValue(RTDValue::from(x));
+}
+
 std::wstring Topic::getValue() const {
-    std::lock_guard<std::mutex> lock(mutex_value);
-    return value;
+    return loadValue()->text();
+}
+
+RTDValue Topic::getTypedValue() const {
+    return *loadValue();
 }
 
 bool Topic::hasChanged() const {
-    std::lock_guard<std::mutex> lock(mutex_value);
-    return old_value != value;
+    // Called on the refresh thread, which owns acked_value
+    if (resend_value.load(std::memory_order_acquire)) return true;
+    auto current = loadValue();
+    return current != acked_value && *current != *acked_value;
+}
+
+Topic* Topic::resend() {
+    resend_value.store(true, std::memory_order_release);
+    return this;
 }
 
-Topic* Topic::update(SAFEARRAY** parrayOut, int i) {
-    VARIANT id = createVariant(this->topic_id);
+Topic* Topic::update(VARIANT* data, long column, const long* ids, size_t count) {
+    // Acknowledge the snapshot written, a newer value set meanwhile stays changed
+    resend_value.store(false, std::memory_order_release);
+    auto current = loadValue();
     VARIANT val;
-    LONG index[2] = {0, i};
-    if (hasValue()) {
-        val = createVariant(getValue());
+    if (current->empty()) {
+        std::lock_guard<std::mutex> lock(mutex_value);
+        if (default_value.empty()) default_value = L"No initial value";
+        val = createVariant(default_value);
     } else {
-        if (default_value.empty()) {
-            default_value = L"No initial value";
+        val = current->toVariant();
+    }
+    acked_value = std::move(current);
+    acked = acked_value.get();
+    if (policy.min_interval_ms > 0) {
+        auto next = std::chrono::steady_clock::now() + std::chrono::milliseconds(policy.min_interval_ms);
+        next_publish = next.time_since_epoch().count();
+    }
+    // One (TopicID, value) pair per subscriber, written in place: the first takes over the value's BSTR, further
+    // subscribers of a shared topic get their own copy
+    for (size_t k = 0; k < count; k++, column++) {
+        VARIANT* pair = data + 2 * column;
+        pair[0].vt = VT_I4;
+        pair[0].lVal = ids[k];
+        if (k == 0) {
+            pair[1] = val;
+        } else {
+            VariantCopy(&pair[1], &val);
         }
-        val = createVariant(getDefaultValue());
     }
-    SafeArrayPutElement(*parrayOut, index, &id);
-    index[0] = 1;
-    SafeArrayPutElement(*parrayOut, index, &val);
-    VariantClear(&id);
-    VariantClear(&val);
-    old_value = value;
+    if (count == 0) VariantClear(&val);
     return this;
 }
 
+Topic* Topic::setNotify(TopicNotify notify) {
+    std::lock_guard<std::mutex> lock(mutex_notify);
+    this->notify = notify;
+    return this;
+}
+
+bool Topic::markDirty() {
+    return !dirty.exchange(true);
+}
+
+Topic* Topic::clearDirty() {
+    dirty = false;
+    return this;
+}
+
+RTDDirtyQueue::Link& Topic::dirtyLink() {
+    return dirty_link;
+}
+
+RTDDirtyQueue::Link& Topic::taskLink() {
+    return task_link;
+}
+
+Topic* Topic::setPolicy(const RTDPolicy& policy) {
+    // Set before the task starts, producers read it without a lock
+    this->policy = policy;
+    return this;
+}
+
+const RTDPolicy& Topic::getPolicy() const {
+    return policy;
+}
+
+DWORD Topic::publishDelay() const {
+    std::chrono::steady_clock::time_point next{std::chrono::steady_clock::duration(next_publish.load())};
+    auto left = std::chrono::ceil<std::chrono::milliseconds>(next - std::chrono::steady_clock::now()).count();
+    return left > 0 ? static_cast<DWORD>(left) : DWORD(0);
+}
+
+uint64_t Topic::getConflatedCount() const {
+    return conflated.load();
+}
+
+uint64_t Topic::getSuppressedCount() const {
+    return suppressed.load();
+}
+
 Topic* Topic::setAsync(bool isAsync) {
     this->isAsync = isAsync;
     return this;
@@ -140,44 +431,98 @@ Topic* Topic::setTask(Task task, bool is_async, int run_count) {
     return this;
 }
 
+Topic* Topic::setExecutor(RTDExecutor* executor, int group) {
+    this->executor = executor;
+    this->task_group = group;
+    return this;
+}
+
+Topic* Topic::reschedule(DWORD delay_ms) {
+    this->reschedule_ms = static_cast<long>(delay_ms);
+    return this;
+}
+
+std::stop_token Topic::stopToken() const {
+    return stop_source.get_token();
+}
+
+bool Topic::stopRequested() const {
+    return stop_source.stop_requested();
+}
+
+bool Topic::wait(DWORD ms) {
+    std::unique_lock<std::mutex> lock(mutex_wait);
+    return !stop_cv.wait_for(lock, std::chrono::milliseconds(ms), [this] { return stop_source.stop_requested(); });
+}
+
 bool Topic::isTaskRunning() const {
     return is_runing.load();
 }
 
+bool Topic::hasPendingRuns() const {
+    return task != nullptr && task_run_count > 0 && !stopRequested();
+}
+
 Topic* Topic::stopTask() {
-    std::lock_guard<std::mutex> lock(this->mutex_task);
-    if (is_runing.load() && isAsync && async_handle != nullptr) {
-        is_runing = false;
-        TerminateThread(async_handle, 0);
-        CloseHandle(this->async_handle);
-        async_handle = nullptr;
+    // Queued runs see the request and skip the task, a running one is expected to return soon
+    if (stop_source.request_stop()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_wait);
+        }
+        stop_cv.notify_all();
     }
+    setNotify(nullptr);
     return this;
 }
 
+/// @brief Reference held by a pool job, so a topic outlives its queued and running task
+struct TopicRef {
+    Topic* topic;
+    explicit TopicRef(Topic* t) : topic(t->addRef()) {}
+    TopicRef(const TopicRef& other) : topic(other.topic->addRef()) {}
+    TopicRef& operator=(const TopicRef&) = delete;
+    ~TopicRef() { topic->release(); }
+};
+
+void Topic::submitRun(DWORD delay_ms) {
+    executor->submit([ref = TopicRef(this)]() {
+        Topic* self = ref.topic;
+        if (self->stopRequested()) {
+            self->is_runing = false;
+            return;
+        }
+        self->runOnce(); }, task_group, delay_ms);
+}
+
+void Topic::runOnce() {
+    reschedule_ms = -1;
+    this->task(this);
+    long delay = reschedule_ms.exchange(-1);
+    bool pooled = isAsync && executor != nullptr;
+    if (pooled && delay >= 0 && !stopRequested()) {
+        // Same run, continued later without holding a worker
+        submitRun(static_cast<DWORD>(delay));
+        return;
+    }
+    this->task_run_count--;
+    this->is_runing = false;
+    // Let the server schedule the next run, if any
+    if (pooled) signal(false);
+}
+
 bool Topic::runTask() {
-    if (task != nullptr && task_run_count > 0) {
+    if (task != nullptr && task_run_count > 0 && !stopRequested()) {
         if (is_runing.load()) {
             return true;
         }
         this->is_runing = true;
-        if (isAsync) {
-            async_handle = CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
-                Topic* self = static_cast<Topic*>(param);
-                int ret = self->task(self);
-                self->task_run_count--;
-                self->is_runing = false;
-                std::lock_guard<std::mutex> lock(self->mutex_task);
-                if (self->async_handle) CloseHandle(self->async_handle);
-                self->async_handle = nullptr;
-                return ret; }, this, 0, nullptr);
+        if (isAsync && executor != nullptr) {
+            submitRun(0);
         } else {
-            this->task(this);
-            this->task_run_count--;
-            this->is_runing = false;
+            runOnce();
         }
         return true;
     } else {
         return false;
     }
-}
\ No newline at end of file
+}
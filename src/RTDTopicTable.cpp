@@ -0,0 +1,121 @@
+#include "RTDTopicTable.h"
+
+Topic* const RTDTopicTable::TOMBSTONE = reinterpret_cast<Topic*>(uintptr_t(1));
+
+RTDTopicTable::~RTDTopicTable() {
+    std::vector<Topic*> topics;
+    clear(topics);
+    for (Topic* topic : topics) topic->release();
+}
+
+uint64_t RTDTopicTable::hash(long id) {
+    // IDs are mostly consecutive, mix them so they spread over shards and slots
+    uint64_t h = static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+RTDTopicTable::Shard& RTDTopicTable::shard(uint64_t h) const {
+    // High bits pick the shard, low bits the slot
+    return const_cast<Shard&>(shards[h >> 58]);
+}
+
+RTDTopicTable::Slot* RTDTopicTable::find(const Shard& s, long id, uint64_t h) {
+    if (s.slots.empty()) return nullptr;
+    size_t mask = s.slots.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        const Slot& slot = s.slots[i];
+        if (slot.topic == nullptr) return nullptr;
+        if (slot.topic != TOMBSTONE && slot.id == id) return const_cast<Slot*>(&slot);
+    }
+}
+
+void RTDTopicTable::rehash(Shard& s, size_t capacity) {
+    std::vector<Slot> old(capacity);
+    old.swap(s.slots);
+    s.tombstones = 0;
+    size_t mask = capacity - 1;
+    for (const Slot& slot : old) {
+        if (slot.topic == nullptr || slot.topic == TOMBSTONE) continue;
+        size_t i = hash(slot.id) & mask;
+        while (s.slots[i].topic != nullptr) i = (i + 1) & mask;
+        s.slots[i] = slot;
+    }
+}
+
+bool RTDTopicTable::insert(long id, Topic* topic) {
+    uint64_t h = hash(id);
+    Shard& s = shard(h);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (find(s, id, h) != nullptr) return false;
+    // Keep at least a quarter of the slots free so probe sequences stay short
+    if ((s.used + s.tombstones + 1) * 4 > s.slots.size() * 3) {
+        size_t capacity = s.slots.empty() ? 16 : s.slots.size();
+        while ((s.used + 1) * 2 > capacity) capacity *= 2;
+        rehash(s, capacity);
+    }
+    size_t mask = s.slots.size() - 1;
+    size_t i = h & mask;
+    while (s.slots[i].topic != nullptr && s.slots[i].topic != TOMBSTONE) i = (i + 1) & mask;
+    if (s.slots[i].topic == TOMBSTONE) s.tombstones--;
+    s.slots[i] = Slot{id, topic->addRef()};
+    s.used++;
+    return true;
+}
+
+Topic* RTDTopicTable::acquire(long id) const {
+    uint64_t h = hash(id);
+    Shard& s = shard(h);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    Slot* slot = find(s, id, h);
+    return slot != nullptr ? slot->topic->addRef() : nullptr;
+}
+
+bool RTDTopicTable::contains(long id) const {
+    uint64_t h = hash(id);
+    Shard& s = shard(h);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return find(s, id, h) != nullptr;
+}
+
+Topic* RTDTopicTable::remove(long id) {
+    uint64_t h = hash(id);
+    Shard& s = shard(h);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    Slot* slot = find(s, id, h);
+    if (slot == nullptr) return nullptr;
+    Topic* topic = slot->topic;
+    slot->topic = TOMBSTONE;
+    s.used--;
+    s.tombstones++;
+    return topic;
+}
+
+void RTDTopicTable::snapshot(std::vector<Topic*>& topics) const {
+    for (const Shard& s : shards) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (const Slot& slot : s.slots) {
+            if (slot.topic != nullptr && slot.topic != TOMBSTONE) topics.push_back(slot.topic->addRef());
+        }
+    }
+}
+
+void RTDTopicTable::clear(std::vector<Topic*>& topics) {
+    for (Shard& s : shards) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (const Slot& slot : s.slots) {
+            if (slot.topic != nullptr && slot.topic != TOMBSTONE) topics.push_back(slot.topic);
+        }
+        std::vector<Slot>().swap(s.slots);
+        s.used = 0;
+        s.tombstones = 0;
+    }
+}
+
+size_t RTDTopicTable::size() const {
+    size_t n = 0;
+    for (const Shard& s : shards) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        n += s.used;
+    }
+    return n;
+}
@@ -1,44 +1,167 @@
 #include "RtdServer.h"
 #include "xllRTD.h"
+#include "xllManager.h"
 #include <ks.h>
+#include <algorithm>
+#include <chrono>
 
 constexpr long DEFAULT_HEARTBEAT_INTERVAL = 15000; // Default heartbeat interval (milliseconds)
 constexpr int DEFAULT_RUNNING_INTERVAL = 1000;     // Default running interval (milliseconds)
+constexpr DWORD DEFAULT_WATCHDOG_GRACE = 10000;    // Time abandoned threads get before termination (milliseconds)
 
 WCHAR RtdServer_DllPath[1024] = L"";
-DWORD RtdServer::WorkerThreadProc() {
+DWORD RtdServer::WorkerThreadProc(std::shared_ptr<std::atomic<int>> phase) {
+    using Clock = std::chrono::steady_clock;
+    DWORD timeout = INFINITE;
+    Clock::time_point rerun = Clock::time_point::max();
+    std::vector<long> due;
     while (m_running) {
-        bool isChanged = false;
-
-        // Use scoped lock to protect topic map
-        {
-            std::lock_guard<std::mutex> lock(m_TopicMapMutex);
-            for (const auto& pair : m_TopicMap) {
-                Topic* topic = pair.second;
-                if (topic != nullptr && m_running) {
-                    if (!topic->isTaskRunning()) {
-                        topic->runTask();
-                    }
-                    if (topic->hasChanged()) {
-                        isChanged = true;
-                    }
+        WaitForSingleObject(m_hWakeEvent, timeout);
+        if (!m_running) break;
+
+        timeout = QueueDeferred();
+
+        // Tasks of new topics and of asynchronous ones that finished a run with runs left, then every runing_ms
+        // the synchronous ones with runs left; running async tasks wake us when they finish
+        due.clear();
+        m_TaskQueue.drain(due);
+        auto now = Clock::now();
+        bool rerunning = !m_PendingTaskIDs.empty() && now >= rerun;
+        if (rerunning) {
+            due.insert(due.end(), m_PendingTaskIDs.begin(), m_PendingTaskIDs.end());
+            m_PendingTaskIDs.clear();
+        }
+        for (long id : due) {
+            if (!m_running) break;
+            // Synchronous tasks run here, a reference keeps the topic alive if DisconnectData stops it meanwhile
+            Topic* topic = m_Producers.acquire(id);
+            if (topic == nullptr) continue;
+            if (!topic->isTaskRunning() && topic->hasPendingRuns()) {
+                // ServerTerminate may abandon a task that ignores the stop request, the server may be gone then
+                phase->store(WorkerInTask);
+                topic->runTask();
+                int expected = WorkerInTask;
+                if (!phase->compare_exchange_strong(expected, WorkerIdle)) {
+                    topic->release();
+                    return 0;
                 }
             }
+            if (!topic->isTaskRunning() && topic->hasPendingRuns()) {
+                m_PendingTaskIDs.insert(id); // Synchronous task with runs left
+            }
+            topic->release();
         }
-
-        // Call callback outside the lock to avoid deadlock
-        if (isChanged && m_pCallbackObject != nullptr && m_running) {
-            m_pCallbackObject->UpdateNotify();
+        if (m_PendingTaskIDs.empty()) {
+            rerun = Clock::time_point::max();
+        } else {
+            if (rerunning || rerun == Clock::time_point::max()) rerun = now + std::chrono::milliseconds(runing_ms);
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(rerun - Clock::now()).count();
+            timeout = std::min<DWORD>(timeout, static_cast<DWORD>(std::max<long long>(left, 1)));
         }
 
-        if (!m_running) break;
-        Sleep(runing_ms);
+        // Let changes arriving within the window share one notification; while Excel has not called
+        // RefreshData for the previous one, further changes are picked up by that refresh
+        if (m_Changed && !m_NotifyPending) {
+            if (m_NotifyWindow > 0) Sleep(m_NotifyWindow);
+            if (m_Changed.exchange(false) && m_pCallbackObject != nullptr && m_running) {
+                m_NotifyPending = true;
+                // Call callback outside the lock to avoid deadlock
+                m_pCallbackObject->UpdateNotify();
+            }
+        }
     }
     return 0;
 }
 
+void RtdServer::TopicNotified(Topic* topic, bool changed) {
+    if (changed && topic->markDirty()) {
+        DWORD delay = topic->publishDelay();
+        if (delay > 0) {
+            // Sent to Excel too recently, the worker queues it when the interval has passed
+            std::lock_guard<std::mutex> lock(m_DeferredMutex);
+            m_Deferred.emplace(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), topic->getID());
+            m_Throttled++;
+        } else {
+            m_DirtyTopics.push(topic->dirtyLink());
+            m_Changed = true;
+        }
+    } else if (!changed && topic->hasPendingRuns()) {
+        // An asynchronous run finished, the worker starts the next one
+        m_TaskQueue.push(topic->taskLink());
+    }
+    SetEvent(m_hWakeEvent);
+}
+
+DWORD RtdServer::QueueDeferred() {
+    std::lock_guard<std::mutex> lock(m_DeferredMutex);
+    auto now = std::chrono::steady_clock::now();
+    while (!m_Deferred.empty() && m_Deferred.top().first <= now) {
+        // Still marked dirty, so values set meanwhile have replaced the one held back; skipped once disconnected
+        if (Topic* topic = m_Producers.acquire(m_Deferred.top().second)) {
+            m_DirtyTopics.push(topic->dirtyLink());
+            topic->release();
+        }
+        m_Deferred.pop();
+        m_Changed = true;
+    }
+    if (m_Deferred.empty()) return INFINITE;
+    auto left = std::chrono::ceil<std::chrono::milliseconds>(m_Deferred.top().first - now).count();
+    return static_cast<DWORD>(std::max<long long>(left, 1));
+}
+
+void RtdServer::RetireProducer(Topic* topic) {
+    m_RetiredConflated += topic->getConflatedCount();
+    m_RetiredSuppressed += topic->getSuppressedCount();
+}
+
+RTDUpdateStats RtdServer::getUpdateStats() const {
+    RTDUpdateStats stats;
+    stats.published = m_Published.load();
+    stats.throttled = m_Throttled.load();
+    stats.conflated = m_RetiredConflated.load();
+    stats.suppressed = m_RetiredSuppressed.load();
+    std::vector<Topic*> producers;
+    m_Producers.snapshot(producers);
+    for (Topic* topic : producers) {
+        stats.conflated += topic->getConflatedCount();
+        stats.suppressed += topic->getSuppressedCount();
+        topic->release();
+    }
+    return stats;
+}
+
+bool RtdServer::publish(const std::wstring& function, const StringArray& args, RTDValue value) {
+    return publish(Topic::makeKey(function, args), std::move(value));
+}
+
+bool RtdServer::publish(const std::wstring& key, RTDValue value) {
+    // Found with a reference of its own, DisconnectData may stop the topic meanwhile but not free it
+    Topic* topic = m_Subscriptions.acquire(key);
+    if (topic == nullptr) return false;
+    topic->setValue(std::move(value));
+    topic->release();
+    return true;
+}
+
+size_t RtdServer::publishMany(const std::vector<RTDUpdate>& updates) {
+    return publishMany(updates.data(), updates.size());
+}
+
+size_t RtdServer::publishMany(const RTDUpdate* updates, size_t count) {
+    if (count == 0 || m_Subscriptions.size() == 0) return 0;
+    std::vector<Topic*> topics(count);
+    size_t found = m_Subscriptions.acquireMany(updates, count, topics.data());
+    for (size_t i = 0; i < count; i++) {
+        if (topics[i] == nullptr) continue;
+        topics[i]->setValue(updates[i].value);
+        topics[i]->release();
+    }
+    return found;
+}
+
 RtdServer::RtdServer() : m_HeartbeatInterval(DEFAULT_HEARTBEAT_INTERVAL),
-runing_ms(DEFAULT_RUNNING_INTERVAL) {
+runing_ms(DEFAULT_RUNNING_INTERVAL), m_NotifyWindow(xll::rtdNotifyWindow) {
+    m_hWakeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
     LoadTypeInfo(&m_pTypeInfoInterface, IID_IRtdServer, 0x0);
 }
 
@@ -51,6 +174,11 @@ RtdServer::~RtdServer() {
         m_pTypeInfoInterface->Release();
         m_pTypeInfoInterface = nullptr;
     }
+
+    if (m_hWakeEvent != nullptr) {
+        CloseHandle(m_hWakeEvent);
+        m_hWakeEvent = nullptr;
+    }
 }
 
 HRESULT STDMETHODCALLTYPE RtdServer::QueryInterface(REFIID riid, void** ppvObject) {
@@ -132,18 +260,42 @@ HRESULT STDMETHODCALLTYPE RtdServer::ServerStart(IRTDUpdateEvent* CallbackObject
     m_pCallbackObject = CallbackObject;
 
     if (!m_running) {
+        if (m_hWakeEvent == nullptr) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        if (!m_Executor.start(xll::rtdWorkerThreads)) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        if (!m_Loop.start(xll::rtdLoopThreads)) {
+            m_Executor.stop();
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
         m_running = true;
-
-        // Create worker thread
+        m_NotifyPending = false;
+
+        // Create worker thread, its phase outlives the server in case ServerTerminate abandons it
+        struct Start {
+            RtdServer* self;
+            std::shared_ptr<std::atomic<int>> phase;
+        };
+        m_WorkerPhase = std::make_shared<std::atomic<int>>(WorkerIdle);
+        Start* start = new Start{this, m_WorkerPhase};
         m_hThread = CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
-            RtdServer* self = static_cast<RtdServer*>(param);
-            return self->WorkerThreadProc(); }, this, 0, &m_threadID);
+            Start* start = static_cast<Start*>(param);
+            RtdServer* self = start->self;
+            std::shared_ptr<std::atomic<int>> phase = std::move(start->phase);
+            delete start;
+            return self->WorkerThreadProc(std::move(phase)); }, start, 0, &m_threadID);
 
         if (m_hThread == nullptr) {
+            delete start;
+            m_Executor.stop();
+            m_Loop.stop();
             m_running = false;
             m_threadID = 0;
             return HRESULT_FROM_WIN32(GetLastError());
         }
+        RTDRegister::instance().attachServer(this);
     }
 
     *pfRes = static_cast<long>(m_threadID);
@@ -155,20 +307,51 @@ HRESULT STDMETHODCALLTYPE RtdServer::ConnectData(long TopicID, SAFEARRAY** Strin
         return E_POINTER;
     }
 
-    std::lock_guard<std::mutex> lock(m_TopicMapMutex);
+    // Parsed outside the lock, cells with the same arguments share one producer
+    StringArray args = Topic::parseArgs(Strings);
+    std::wstring key = Topic::makeKey(args);
+
+    std::lock_guard<std::mutex> lock(m_RegistryMutex);
 
     // Check if topic ID already exists
-    if (m_TopicMap.find(TopicID) != m_TopicMap.end()) {
+    if (m_Topics.contains(TopicID)) {
         return E_FAIL; // Topic already exists
     }
 
+    if (Topic* producer = m_Subscriptions.acquire(key)) {
+        // Subscribe to the running producer, starting from its current value
+        try {
+            producer->addSubscriber(TopicID);
+            m_Topics.insert(TopicID, producer);
+        } catch (const std::exception&) {
+            producer->removeSubscriber(TopicID);
+            producer->release();
+            return E_OUTOFMEMORY;
+        }
+        if (*GetNewValues != VARIANT_FALSE && producer->hasValue()) {
+            *pvarOut = producer->getTypedValue().toVariant();
+        } else if (*GetNewValues != VARIANT_FALSE && producer->hasDefaultValue()) {
+            *pvarOut = createVariant(producer->getDefaultValue());
+        } else {
+            VariantInit(pvarOut);
+            // Excel asked for no initial value, the next refresh writes the current one for every subscriber
+            if (producer->hasValue()) TopicNotified(producer->resend(), true);
+        }
+        producer->release(); // The topic table holds its own reference
+        return S_OK;
+    }
+
     // Create new topic
     Topic* pTopic = nullptr;
+    long producerID = m_NextProducerID++;
     try {
-        pTopic = new Topic(TopicID, Strings, L"Default Value");
+        pTopic = new Topic(producerID, std::move(args), L"Default Value");
+        pTopic->addSubscriber(TopicID);
 
         // createRtdTask(pTopic);
-        registerRTDTask(pTopic);
+        pTopic->setNotify([this](Topic* topic, bool changed) { TopicNotified(topic, changed); });
+        // Functions fed only by publish have no task to start
+        bool hasTask = registerRTDTask(pTopic, &m_Executor, &m_Loop) == 0 && pTopic->hasPendingRuns();
 
         // If need to get new values and has default value, return default value
         if (*GetNewValues != VARIANT_FALSE && pTopic->hasDefaultValue()) {
@@ -179,10 +362,24 @@ HRESULT STDMETHODCALLTYPE RtdServer::ConnectData(long TopicID, SAFEARRAY** Strin
             VariantInit(pvarOut); // Initialize to empty value
         }
 
-        m_TopicMap[TopicID] = pTopic;
+        m_Subscriptions.insert(pTopic->getKey(), pTopic);
+        m_Producers.insert(producerID, pTopic);
+        m_Topics.insert(TopicID, pTopic);
+        if (hasTask) {
+            // The worker starts the task, it is already due to wake if earlier topics are still queued
+            if (m_TaskQueue.push(pTopic->taskLink())) SetEvent(m_hWakeEvent);
+        }
+        pTopic->release(); // The tables and the queue hold their own references
         return S_OK;
     } catch (const std::exception&) {
-        delete pTopic; // Clean up partially created resources
+        if (pTopic != nullptr) {
+            // Clean up partially created resources
+            if (Topic* topic = m_Subscriptions.remove(pTopic->getKey())) topic->release();
+            if (Topic* topic = m_Topics.remove(TopicID)) topic->release();
+            if (Topic* topic = m_Producers.remove(producerID)) topic->release();
+            pTopic->stopTask();
+            pTopic->release();
+        }
         return E_OUTOFMEMORY;
     }
 }
@@ -201,22 +398,51 @@ HRESULT STDMETHODCALLTYPE RtdServer::RefreshData(long* TopicCount, SAFEARRAY** p
         return S_OK;
     }
 
-    std::vector<std::pair<long, Topic*>> changedTopics;
-
-    // Collect all changed topics
-    {
-        std::lock_guard<std::mutex> lock(m_TopicMapMutex);
-        for (const auto& pair : m_TopicMap) {
-            Topic* topic = pair.second;
-            if (topic != nullptr && topic->hasChanged()) {
-                changedTopics.emplace_back(pair.first, topic);
-            }
+    // Changes made from here on need a new notification
+    m_NotifyPending = false;
+
+    std::vector<long> dirtyIDs;
+    m_DirtyTopics.drain(dirtyIDs);
+    std::vector<Topic*> changedTopics;
+    changedTopics.reserve(dirtyIDs.size());
+    // Subscribers of each changed producer, taken once so the row count and the rows written agree
+    std::vector<long> subscriberIDs;
+    std::vector<size_t> subscriberCounts;
+    subscriberIDs.reserve(dirtyIDs.size());
+    subscriberCounts.reserve(dirtyIDs.size());
+
+    // Look up the queued producers only, skipping those disconnected since; each one found is held by a
+    // reference until it is written, without any lock the worker or ConnectData would wait for
+    for (long id : dirtyIDs) {
+        Topic* topic = m_Producers.acquire(id);
+        if (topic == nullptr) continue;
+        // Cleared before the value is read, so a later change queues the topic again
+        topic->clearDirty();
+        if (topic->hasChanged()) {
+            changedTopics.push_back(topic);
+            subscriberCounts.push_back(topic->copySubscribers(subscriberIDs));
+        } else {
+            topic->release();
         }
     }
+    auto releaseAll = [&changedTopics](bool requeue, RTDDirtyQueue& queue) {
+        for (Topic* topic : changedTopics) {
+            // Keep the changes for the next refresh
+            if (requeue && topic->markDirty()) queue.push(topic->dirtyLink());
+            topic->release();
+        }
+    };
 
-    *TopicCount = static_cast<long>(changedTopics.size());
+    *TopicCount = static_cast<long>(subscriberIDs.size());
+    m_Published += changedTopics.size();
+
+    // Changes held back while the previous notification was pending
+    if (m_Changed) {
+        SetEvent(m_hWakeEvent);
+    }
 
     if (*TopicCount == 0) {
+        releaseAll(false, m_DirtyTopics);
         return S_OK; // No changed data
     }
 
@@ -229,31 +455,47 @@ HRESULT STDMETHODCALLTYPE RtdServer::RefreshData(long* TopicCount, SAFEARRAY** p
 
     *parrayOut = SafeArrayCreate(VT_VARIANT, 2, bounds);
     if (*parrayOut == nullptr) {
+        releaseAll(true, m_DirtyTopics);
         return E_OUTOFMEMORY;
     }
 
-    // Fill data
-    for (long i = 0; i < *TopicCount; ++i) {
-        changedTopics[i].second->update(parrayOut, i);
+    // Fill data in place with the array locked once. Element (j, i) is at data[2 * i + j], each producer fills a
+    // column per subscriber
+    VARIANT* data = nullptr;
+    if (FAILED(SafeArrayAccessData(*parrayOut, reinterpret_cast<void**>(&data)))) {
+        SafeArrayDestroy(*parrayOut);
+        *parrayOut = nullptr;
+        *TopicCount = 0;
+        releaseAll(true, m_DirtyTopics);
+        return E_FAIL;
+    }
+    long column = 0;
+    for (size_t k = 0; k < changedTopics.size(); k++) {
+        changedTopics[k]->update(data, column, subscriberIDs.data() + column, subscriberCounts[k]);
+        column += static_cast<long>(subscriberCounts[k]);
     }
+    SafeArrayUnaccessData(*parrayOut);
+    releaseAll(false, m_DirtyTopics);
 
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE RtdServer::DisconnectData(long TopicID) {
-    std::lock_guard<std::mutex> lock(m_TopicMapMutex);
-
-    auto it = m_TopicMap.find(TopicID);
-    if (it != m_TopicMap.end()) {
-        Topic* topic = it->second;
-        if (topic != nullptr) {
-            topic->stopTask(); // Stop task before deletion
-            delete topic;
-        }
-        m_TopicMap.erase(it);
-        return S_OK;
+    std::lock_guard<std::mutex> lock(m_RegistryMutex);
+
+    Topic* topic = m_Topics.remove(TopicID);
+    if (topic == nullptr) {
+        return E_FAIL;
     }
-    return E_FAIL;
+    // The producer stops with its last subscriber
+    if (topic->removeSubscriber(TopicID) == 0) {
+        if (Topic* producer = m_Subscriptions.remove(topic->getKey())) producer->release();
+        if (Topic* producer = m_Producers.remove(topic->getID())) producer->release();
+        RetireProducer(topic);
+        topic->stopTask(); // Ask the task to stop, without waiting for it
+    }
+    topic->release(); // Freed once no pool job or reader holds it
+    return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE RtdServer::Heartbeat(long* pfRes) {
@@ -265,28 +507,106 @@ HRESULT STDMETHODCALLTYPE RtdServer::Heartbeat(long* pfRes) {
 }
 
 HRESULT STDMETHODCALLTYPE RtdServer::ServerTerminate() {
-    // Stop running flag
-    m_running = false;
+    // Stop running flag and wake the worker so it can exit on its own
+    bool was_running = m_running.exchange(false);
+
+    // Publishers calling through RTDRegister have returned once this does
+    if (was_running) RTDRegister::instance().detachServer(this);
+
+    // Ask every task to stop first, running ones then return in parallel
+    {
+        std::vector<Topic*> producers;
+        m_Producers.snapshot(producers);
+        for (Topic* topic : producers) {
+            topic->stopTask();
+            topic->release();
+        }
+    }
+    if (m_hWakeEvent != nullptr) {
+        SetEvent(m_hWakeEvent);
+    }
 
-    // Wait for thread termination (WaitForSingleObject will block UI, so force termination directly)
+    // Bounded joins, a long wait would block the UI
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(xll::rtdStopTimeout);
+    auto remaining = [&deadline]() {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        return left > 0 ? static_cast<DWORD>(left) : DWORD(0);
+    };
+
+    // A synchronous task ignoring the stop request is abandoned with the worker running it, which returns
+    // without touching this object; the watchdog terminates it as a last resort
     if (m_hThread != nullptr) {
-        TerminateThread(m_hThread, 0);
-        CloseHandle(m_hThread);
+        bool abandoned = false;
+        DWORD wait = remaining();
+        while (WaitForSingleObject(m_hThread, wait) != WAIT_OBJECT_0) {
+            int expected = WorkerInTask;
+            if (m_WorkerPhase->compare_exchange_strong(expected, WorkerAbandoned)) {
+                abandoned = true;
+                break;
+            }
+            // Between tasks the worker only runs framework code and sees the stop flag shortly
+            wait = 10;
+        }
+        if (abandoned) {
+            m_AbandonedWorkers++;
+            struct Watch {
+                HANDLE thread;
+                DWORD grace_ms;
+            };
+            Watch* watch = new Watch{m_hThread, DEFAULT_WATCHDOG_GRACE};
+            HANDLE watchdog = CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
+                Watch* watch = static_cast<Watch*>(param);
+                if (WaitForSingleObject(watch->thread, watch->grace_ms) != WAIT_OBJECT_0) {
+                    TerminateThread(watch->thread, 0);
+                }
+                CloseHandle(watch->thread);
+                delete watch;
+                return 0; }, watch, 0, nullptr);
+            if (watchdog != nullptr) {
+                CloseHandle(watchdog);
+            } else {
+                // No watchdog, the worker is left to run
+                CloseHandle(watch->thread);
+                delete watch;
+            }
+        } else {
+            CloseHandle(m_hThread);
+        }
         m_hThread = nullptr;
         m_threadID = 0;
     }
 
-    // Clean up all topics
+    // Stop the pool, dropping queued task runs; pool threads still busy are left to the executor's watchdog
+    m_Executor.stop(remaining(), DEFAULT_WATCHDOG_GRACE);
+
+    // Destroy the coroutines still suspended, the stop requests above have already cancelled most of them.
+    // Loop threads only park between coroutines, but the shared deadline may be spent, so they get their own
+    m_Loop.stop(xll::rtdStopTimeout, DEFAULT_WATCHDOG_GRACE);
+
+    // Clean up all topics, each is freed once no pool job holds it
     {
-        std::lock_guard<std::mutex> lock(m_TopicMapMutex);
-        for (const auto& pair : m_TopicMap) {
-            if (pair.second != nullptr) {
-                pair.second->stopTask(); // Stop task
-                delete pair.second;
-            }
+        std::lock_guard<std::mutex> lock(m_RegistryMutex);
+        std::vector<Topic*> topics;
+        m_Topics.clear(topics);
+        for (Topic* topic : topics) topic->release();
+        topics.clear();
+        m_Producers.clear(topics);
+        for (Topic* topic : topics) {
+            RetireProducer(topic);
+            topic->release();
         }
-        m_TopicMap.clear();
-        m_DeleteTopicIDs.clear();
+        topics.clear();
+        m_Subscriptions.clear(topics);
+        for (Topic* topic : topics) topic->release();
+        m_PendingTaskIDs.clear(); // The worker has been joined or abandoned
+        // Drop task requests and changes of the deleted topics
+        std::vector<long> ids;
+        m_TaskQueue.drain(ids);
+        m_DirtyTopics.drain(ids);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_DeferredMutex);
+        m_Deferred = {};
     }
 
     // Clean up callback object reference
@@ -0,0 +1,56 @@
+#include "xllFP12.h"
+#include <algorithm>
+#include <cstddef>
+#include <new>
+
+/// @brief Last FP12 returned on each thread, Excel copies it before the thread calls the add-in again
+static thread_local xllFP12 fp12_return;
+
+FP12* xllFP12::allocate(int rows, int cols) {
+    if (rows <= 0 || cols <= 0) return nullptr;
+    size_t bytes = offsetof(FP12, array) + size_t(rows) * cols * sizeof(double);
+    FP12* p = static_cast<FP12*>(::operator new(bytes < sizeof(FP12) ? sizeof(FP12) : bytes));
+    p->rows = rows;
+    p->columns = cols;
+    return p;
+}
+
+xllFP12::xllFP12(int rows, int cols, double fill) {
+    _p = allocate(rows, cols);
+    if (_p) std::fill_n(_p->array, size(), fill);
+}
+
+xllFP12::xllFP12(const FP12* p) {
+    if (p == nullptr) return;
+    _p = allocate(p->rows, p->columns);
+    if (_p) std::copy_n(p->array, size(), _p->array);
+}
+
+xllFP12::~xllFP12() {
+    ::operator delete(_p);
+}
+
+xllFP12::xllFP12(xllFP12&& other) noexcept : _p(other._p) {
+    other._p = nullptr;
+}
+
+xllFP12& xllFP12::operator=(xllFP12&& other) noexcept {
+    if (this != &other) {
+        ::operator delete(_p);
+        _p = other._p;
+        other._p = nullptr;
+    }
+    return *this;
+}
+
+FP12* xllFP12::get_return() {
+    // Excel does not accept an empty FP12, return a single zero instead
+    if (_p == nullptr) *this = xllFP12(1, 1);
+    fp12_return = std::move(*this);
+    return fp12_return.get();
+}
+
+std::span<const double> xllFP12::view(const FP12* p) {
+    if (p == nullptr || p->rows <= 0 || p->columns <= 0) return {};
+    return std::span<const double>(p->array, size_t(p->rows) * p->columns);
+}
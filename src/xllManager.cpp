@@ -12,6 +12,7 @@ extern "C" __declspec(dllexport) int xlAutoOpen(void) {
 /// @brief Triggered when closing document @return int
 extern "C" __declspec(dllexport) int xlAutoClose(void) {
     UDFRegistry::instance().AutoUnRegist();
+    xllRangeCache::instance().disable();
     if (xll::enableRTD) DllUnregisterServer();
     return xll::close();
 }
@@ -27,7 +28,10 @@ extern "C" __declspec(dllexport) int xlAutoRemove(void) {
 }
 
 /// @brief Control memory release of xll functions
+/// @note Values from xllType::get_return are single makeReturn12 blocks; values a UDF builds itself with
+/// `new xloper12` and makeStr12 or `new xloper12[]` are still released buffer by buffer
 extern "C" __declspec(dllexport) void xlAutoFree12(LPXLOPER12 pxFree) {
+    if (freeReturn12(pxFree)) return;
     if (pxFree->xltype & xltypeStr && pxFree->val.str) {
         delete[] pxFree->val.str;
     } else if (pxFree->xltype == (xltypeMulti | xlbitDLLFree) && pxFree->val.array.lparray) {
@@ -90,6 +94,10 @@ extern "C" __declspec(dllexport) LPXLOPER12 xlAddInManagerInfo12(LPXLOPER12 xAct
 
 namespace xll {
 bool enableRTD = true;
+DWORD rtdNotifyWindow = 10;
+unsigned rtdWorkerThreads = 0;
+unsigned rtdLoopThreads = 1;
+DWORD rtdStopTimeout = 500;
 std::wstring xllName = L"Default";
 std::wstring defaultCategory = L"XLL Functions";
 XllFunc open = []() { return 1; };
@@ -0,0 +1,132 @@
+#include "xllMatrix.h"
+#include "xllTools.h"
+#include "xllType.h"
+#include "xllView.h"
+#include <algorithm>
+#include <bit>
+
+xllMatrix::xllMatrix(int rows, int cols, xllOrder order, double fill) {
+    this->reset(rows, cols, order, fill);
+    std::fill(_valid.begin(), _valid.end(), ~uint64_t(0));
+    if (size() & 63) _valid.back() = (uint64_t(1) << (size() & 63)) - 1;
+}
+
+void xllMatrix::reset(int rows, int cols, xllOrder order, double fill) {
+    _rows = rows > 0 ? rows : 0;
+    _cols = cols > 0 ? cols : 0;
+    _order = order;
+    _error_code = 0;
+    size_t n = size_t(_rows) * _cols;
+    _data.assign(n, fill);
+    _valid.assign((n + 63) / 64, 0);
+}
+
+bool xllMatrix::load(const xloper12* px, xllOrder order, double fill) {
+    xllView v(px);
+    if (v.get_last_err() != 0) {
+        this->reset(0, 0, order, fill);
+        _error_code = v.get_last_err();
+        return false;
+    }
+    this->reset(v.rows(), v.columns(), order, fill);
+    size_t i = 0;
+    for (int r = 0; r < _rows; r++) {
+        for (int c = 0; c < _cols; c++, i++) {
+            xllView::Cell cell = v[i];
+            if (cell.is_num()) {
+                size_t k = order == xllOrder::row_major ? i : index(r, c);
+                _data[k] = cell.get_num();
+                _valid[k >> 6] |= uint64_t(1) << (k & 63);
+            }
+        }
+    }
+    return true;
+}
+
+bool xllMatrix::load(xllType& x, xllOrder order, double fill) {
+    if (!x.is_array()) {
+        this->reset(1, 1, order, fill);
+        if (x.is_num() && !x.is_str()) {
+            _data[0] = x.get_num();
+            _valid[0] = 1;
+        }
+        return true;
+    }
+    this->reset(x.get_rows(), x.get_cols(), order, fill);
+    size_t i = 0;
+    for (int r = 0; r < _rows; r++) {
+        for (int c = 0; c < _cols; c++, i++) {
+            xllCellRef cell = x[(int)i];
+            if (cell.is_num()) {
+                size_t k = order == xllOrder::row_major ? i : index(r, c);
+                _data[k] = cell.get_num();
+                _valid[k >> 6] |= uint64_t(1) << (k & 63);
+            }
+        }
+    }
+    return true;
+}
+
+size_t xllMatrix::index(int row, int col) const {
+    return _order == xllOrder::row_major ? size_t(row) * _cols + col : size_t(col) * _rows + row;
+}
+
+void xllMatrix::set_valid(size_t i, bool valid) {
+    if (valid) {
+        _valid[i >> 6] |= uint64_t(1) << (i & 63);
+    } else {
+        _valid[i >> 6] &= ~(uint64_t(1) << (i & 63));
+    }
+}
+
+size_t xllMatrix::valid_count() const {
+    size_t n = 0;
+    for (uint64_t w : _valid) n += std::popcount(w);
+    return n;
+}
+
+xloper12* xllMatrix::get_return(int invalid) const {
+    xloper12* ret = returnMatrix12(_data, _rows, _cols, _order);
+    if (!(ret->xltype & xltypeMulti) || valid_count() == size()) return ret;
+    xloper12* p = ret->val.array.lparray;
+    size_t i = 0;
+    for (int r = 0; r < _rows; r++) {
+        for (int c = 0; c < _cols; c++, i++) {
+            if (!is_valid(index(r, c))) {
+                p[i].xltype = xltypeErr;
+                p[i].val.err = invalid;
+            }
+        }
+    }
+    return ret;
+}
+
+xloper12* returnMatrix12(std::span<const double> data, int rows, int cols, xllOrder order) {
+    if (rows <= 0 || cols <= 0 || data.size() != size_t(rows) * cols) {
+        xloper12* ret = makeReturn12(0, 0);
+        ret->xltype = xltypeErr | xlbitDLLFree;
+        ret->val.err = xlerrValue;
+        return ret;
+    }
+    size_t n = data.size();
+    xloper12* ret = makeReturn12(n, 0);
+    xloper12* p = ret + 1;
+    if (order == xllOrder::row_major) {
+        for (size_t i = 0; i < n; i++) {
+            p[i].xltype = xltypeNum;
+            p[i].val.num = data[i];
+        }
+    } else {
+        for (int r = 0, i = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++, i++) {
+                p[i].xltype = xltypeNum;
+                p[i].val.num = data[size_t(c) * rows + r];
+            }
+        }
+    }
+    ret->val.array.lparray = p;
+    ret->val.array.rows = rows;
+    ret->val.array.columns = cols;
+    ret->xltype = xltypeMulti | xlbitDLLFree;
+    return ret;
+}
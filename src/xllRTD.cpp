@@ -5,17 +5,64 @@ RTDRegister& RTDRegister::instance() {
     return instance;
 }
 
-void RTDRegister::registerRTDFunction(const std::wstring& name, RtdFun fun, const wchar_t * default_value, bool is_async) {
+void RTDRegister::registerRTDFunction(const std::wstring& name, RtdFun fun, const wchar_t * default_value, bool is_async, int max_concurrency, const RTDPolicy& policy) {
     _async_functions[name] = fun;
     _default_values[name] = default_value;
     _is_async[name] = is_async;
-
+    _max_concurrency[name] = max_concurrency;
+    _policies[name] = policy;
 }
 
-void RTDRegister::registerRTDFunction(const std::wstring& name, RtdFun fun, bool is_async) {
+void RTDRegister::registerRTDFunction(const std::wstring& name, RtdFun fun, bool is_async, int max_concurrency, const RTDPolicy& policy) {
     _async_functions[name] = fun;
     _default_values[name] = L"";
     _is_async[name] = is_async;
+    _max_concurrency[name] = max_concurrency;
+    _policies[name] = policy;
+}
+
+void RTDRegister::registerRTDFunction(const std::wstring& name, RtdCoroFun fun, const wchar_t* default_value, const RTDPolicy& policy) {
+    _coroutines[name] = fun;
+    _default_values[name] = default_value;
+    _is_async[name] = false;
+    _max_concurrency[name] = 0;
+    _policies[name] = policy;
+}
+
+void RTDRegister::registerRTDFunction(const std::wstring& name, const wchar_t* default_value, const RTDPolicy& policy) {
+    _feeds.insert(name);
+    _default_values[name] = default_value;
+    _is_async[name] = false;
+    _max_concurrency[name] = 0;
+    _policies[name] = policy;
+}
+
+bool RTDRegister::publish(const std::wstring& function, const StringArray& args, RTDValue value) {
+    return publish(Topic::makeKey(function, args), std::move(value));
+}
+
+bool RTDRegister::publish(const std::wstring& key, RTDValue value) {
+    std::shared_lock<std::shared_mutex> lock(_server_mutex);
+    return _server != nullptr && _server->publish(key, std::move(value));
+}
+
+size_t RTDRegister::publishMany(const std::vector<RTDUpdate>& updates) {
+    return publishMany(updates.data(), updates.size());
+}
+
+size_t RTDRegister::publishMany(const RTDUpdate* updates, size_t count) {
+    std::shared_lock<std::shared_mutex> lock(_server_mutex);
+    return _server != nullptr ? _server->publishMany(updates, count) : 0;
+}
+
+void RTDRegister::attachServer(RtdServer* server) {
+    std::unique_lock<std::shared_mutex> lock(_server_mutex);
+    _server = server;
+}
+
+void RTDRegister::detachServer(RtdServer* server) {
+    std::unique_lock<std::shared_mutex> lock(_server_mutex);
+    if (_server == server) _server = nullptr;
 }
 
 int RTDRegister::runAsyncFunction(const std::wstring& name, xllptrlist& args, Topic* topic) {
@@ -23,7 +70,11 @@ int RTDRegister::runAsyncFunction(const std::wstring& name, xllptrlist& args, To
 }
 
 bool RTDRegister::isFunctionRegistered(const std::wstring& name) {
-    return _async_functions.find(name) != _async_functions.end();
+    return _async_functions.find(name) != _async_functions.end() || isFunctionCoroutine(name) || isFunctionFeed(name);
+}
+
+bool RTDRegister::isFunctionCoroutine(const std::wstring& name) {
+    return _coroutines.find(name) != _coroutines.end();
 }
 
 bool RTDRegister::getDefaultValue(const std::wstring& name, std::wstring& default_value) {
@@ -41,16 +92,37 @@ bool RTDRegister::isFunctionAsync(const std::wstring& name) {
     return false;
 }
 
+int RTDRegister::getMaxConcurrency(const std::wstring& name) {
+    auto it = _max_concurrency.find(name);
+    return it != _max_concurrency.end() ? it->second : 0;
+}
+
+RTDPolicy RTDRegister::getPolicy(const std::wstring& name) {
+    auto it = _policies.find(name);
+    return it != _policies.end() ? it->second : RTDPolicy();
+}
+
+bool RTDRegister::isFunctionFeed(const std::wstring& name) {
+    return _feeds.find(name) != _feeds.end();
+}
+
+RtdCoroFun RTDRegister::getCoroutine(const std::wstring& name) {
+    auto it = _coroutines.find(name);
+    return it != _coroutines.end() ? it->second : nullptr;
+}
+
 RtdFun& RTDRegister::getFunction(const std::wstring& name) {
     return _async_functions[name];
 }
 
-int registerRTDTask(Topic* topic) {
+int registerRTDTask(Topic* topic, RTDExecutor* executor, RTDEventLoop* loop) {
     RTDRegister& rtd = RTDRegister::instance();
     size_t count = topic->getArgCount();
     if (count < 1) return -1;
     const std::wstring funcName = topic->getArg(0);
     if (!rtd.isFunctionRegistered(funcName)) return -1;
+    bool is_coroutine = rtd.isFunctionCoroutine(funcName);
+    if (is_coroutine && loop == nullptr) return -1;
     bool is_async = rtd.isFunctionAsync(funcName);
     std::wstring default_value;
     if (rtd.getDefaultValue(funcName, default_value)) {
@@ -58,6 +130,23 @@ int registerRTDTask(Topic* topic) {
     } else {
         topic->setDefaultValue(L"");
     }
+    topic->setPolicy(rtd.getPolicy(funcName));
+    if (rtd.isFunctionFeed(funcName)) {
+        return 0; // No task, values arrive through publish
+    }
+    if (is_coroutine) {
+        // The task only creates the coroutine, the loop runs it from then on
+        RtdCoroFun fun = rtd.getCoroutine(funcName);
+        topic->setTask([fun, count, loop](Topic* topic) {
+            xllptrlist args;
+            for (size_t i = 1; i < count; i++) {
+                xllType arg = topic->getArg(i);
+                args.push_back(std::make_unique<xllType>(*(arg.deserialize())));
+            }
+            return loop->spawn(topic, fun(std::move(args), topic)) ? 0 : -1;
+        });
+        return 0;
+    }
     topic->setTask([&rtd, count, funcName](Topic* topic) {
         xllptrlist args;
         for (int i = 1; i < count; i++) {
@@ -66,5 +155,8 @@ int registerRTDTask(Topic* topic) {
         }
         return rtd.runAsyncFunction(funcName, args, topic);
     }, is_async);
+    if (is_async && executor != nullptr) {
+        topic->setExecutor(executor, executor->group(funcName, rtd.getMaxConcurrency(funcName)));
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include "xllRangeCache.h"
+#include "xllTools.h"
+#include <new>
+
+/// @brief Command run by Excel when a calculation ends or is canceled, starts a new cache generation
+extern "C" __declspec(dllexport) int xllRangeCacheCalcEvent(void) {
+    xllRangeCache::instance().next_generation();
+    return 1;
+}
+
+xllRangeSnapshot::~xllRangeSnapshot() {
+    ::operator delete(cells);
+}
+
+xllRangeCache& xllRangeCache::instance() {
+    static xllRangeCache cache;
+    return cache;
+}
+
+/// @brief Find a Function Wizard window (or another bosa_sdm_XL dialog) of this Excel process
+static BOOL CALLBACK findWizard(HWND hwnd, LPARAM found) {
+    DWORD pid = 0;
+    GetWindowThreadProcessId(hwnd, &pid);
+    if (pid != GetCurrentProcessId()) return TRUE;
+    WCHAR name[32];
+    if (GetClassNameW(hwnd, name, 32) == 0 || wcsncmp(name, L"bosa_sdm_XL", 11) != 0) return TRUE;
+    *reinterpret_cast<bool*>(found) = true;
+    return FALSE;
+}
+
+bool xllRangeCache::enable(size_t max_bytes) {
+    this->set_max_bytes(max_bytes);
+    if (this->enabled()) return true;
+    // Called from xll::open, on the thread the Function Wizard evaluates formulas on
+    _main_thread = GetCurrentThreadId();
+    xloper12 xDLL;
+    if (Excel12(xlGetName, &xDLL, 0) != xlretSuccess) return false;
+    xloper12 proc = makeXllStr(makeStr12(L"xllRangeCacheCalcEvent"));
+    xloper12 type = makeXllStr(makeStr12(L"J"));
+    xloper12 args = makeXllStr(makeStr12(L""));
+    // Macro type 2 registers a hidden command, which is what xlEventRegister expects
+    xloper12 macro = makeXllInt(2);
+    xloper12 id;
+    int r = Excel12(xlfRegister, &id, 6, &xDLL, &proc, &type, &proc, &args, &macro);
+    Excel12(xlFree, 0, 1, &xDLL);
+    if (r == xlretSuccess && id.xltype == xltypeNum) {
+        _handler_id = id.val.num;
+        xloper12 ended = makeXllInt(xleventCalculationEnded);
+        xloper12 canceled = makeXllInt(xleventCalculationCanceled);
+        Excel12(xlEventRegister, 0, 2, &proc, &ended);
+        Excel12(xlEventRegister, 0, 2, &proc, &canceled);
+        _enabled = true;
+    }
+    delete[] proc.val.str;
+    delete[] type.val.str;
+    delete[] args.val.str;
+    return this->enabled();
+}
+
+void xllRangeCache::disable() {
+    if (!this->enabled()) return;
+    _enabled = false;
+    if (_handler_id != 0) {
+        xloper12 id = makeXllNum(_handler_id);
+        Excel12(xlfUnregister, 0, 1, &id);
+        _handler_id = 0;
+    }
+    this->clear();
+}
+
+void xllRangeCache::set_max_bytes(size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _max_bytes = max_bytes;
+}
+
+void xllRangeCache::next_generation() {
+    // Snapshots of the finished generation are released on the next insertion
+    _generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::shared_ptr<const xllRangeSnapshot> xllRangeCache::get(const xloper12& ref, int& err) {
+    if (!this->enabled()) return nullptr;
+    DWORD type = ref.xltype & ~(xlbitXLFree | xlbitDLLFree);
+    if (type != xltypeSRef && (type != xltypeRef || ref.val.mref.lpmref == nullptr || ref.val.mref.lpmref->count != 1)) {
+        return nullptr;
+    }
+    // The generation only moves when a calculation ends, so a snapshot read between two calculations would be reused
+    // by the next one after the user edited the range. Only a worksheet cell calling outside the Function Wizard is
+    // part of a calculation, commands and VBA (Evaluate, Run) have no cell caller.
+    xloper12 caller;
+    if (Excel12(xlfCaller, &caller, 0) != xlretSuccess) return nullptr;
+    bool found = caller.xltype == xltypeRef;
+    IDSHEET id = found ? caller.val.mref.idSheet : 0;
+    Excel12(xlFree, 0, 1, &caller);
+    if (!found || this->in_wizard()) return nullptr;
+    Key key;
+    if (type == xltypeSRef) {
+        // A same-sheet reference carries no sheet ID, it refers to the sheet of the calling cell. xlSheetId without
+        // an argument would return the active sheet, which is not the calculated one during a background recalc.
+        const XLREF12& rect = ref.val.sref.ref;
+        key = Key{id, rect.rwFirst, rect.rwLast, rect.colFirst, rect.colLast};
+    } else {
+        const XLREF12& rect = ref.val.mref.lpmref->reftbl[0];
+        key = Key{ref.val.mref.idSheet, rect.rwFirst, rect.rwLast, rect.colFirst, rect.colLast};
+    }
+    // Read before coercing: a calculation ending during the coercion must not stamp older contents with its successor
+    uint64_t generation = _generation.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(key);
+        if (it != _entries.end() && it->second->generation == generation) {
+            _hits++;
+            return it->second;
+        }
+        _misses++;
+    }
+    // Coerce outside the lock, concurrent misses on the same range at worst read it twice
+    std::shared_ptr<const xllRangeSnapshot> snapshot = this->load(ref, err, generation);
+    if (!snapshot) return nullptr;
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (generation != _generation.load(std::memory_order_relaxed)) return snapshot;
+    this->evict();
+    auto it = _entries.find(key);
+    if (it != _entries.end()) {
+        _bytes -= it->second->bytes;
+        _entries.erase(it);
+    }
+    if (_bytes + snapshot->bytes <= _max_bytes) {
+        _entries.emplace(key, snapshot);
+        _bytes += snapshot->bytes;
+    } else {
+        _rejected++;
+    }
+    return snapshot;
+}
+
+std::shared_ptr<const xllRangeSnapshot> xllRangeCache::load(const xloper12& ref, int& err, uint64_t generation) {
+    xloper12 x, t = makeXllInt(xltypeMulti);
+    int r = Excel12(xlCoerce, &x, 2, &ref, &t);
+    if (r != xlretSuccess) {
+        err = r;
+        return nullptr;
+    }
+    auto snapshot = std::make_shared<xllRangeSnapshot>();
+    snapshot->generation = generation;
+    const xloper12* p = x.val.array.lparray;
+    if ((x.xltype & xltypeMulti) && p) {
+        int n = x.val.array.rows * x.val.array.columns;
+        size_t chars = 0;
+        for (int i = 0; i < n; i++) {
+            if (p[i].xltype == xltypeStr && p[i].val.str) chars += p[i].val.str[0] + 1;
+        }
+        // Elements are followed by their counted strings, like a get_return() block without header
+        snapshot->bytes = n * sizeof(xloper12) + chars * sizeof(wchar_t);
+        snapshot->cells = static_cast<xloper12*>(::operator new(snapshot->bytes));
+        snapshot->rows = x.val.array.rows;
+        snapshot->cols = x.val.array.columns;
+        wchar_t* s = reinterpret_cast<wchar_t*>(snapshot->cells + n);
+        for (int i = 0; i < n; i++) {
+            xloper12& c = snapshot->cells[i];
+            c.xltype = p[i].xltype & ~(xlbitXLFree | xlbitDLLFree);
+            c.val = p[i].val;
+            if (c.xltype == xltypeStr) {
+                if (p[i].val.str) {
+                    c.val.str = s;
+                    s = writeStr12(s, p[i].val.str + 1, p[i].val.str[0]);
+                } else {
+                    c.xltype = xltypeNil;
+                }
+            }
+        }
+    }
+    Excel12(xlFree, 0, 1, &x);
+    return snapshot;
+}
+
+bool xllRangeCache::in_wizard() const {
+    // The Function Wizard evaluates on Excel's main thread only, recalculation threads skip the window scan
+    if (GetCurrentThreadId() != _main_thread) return false;
+    bool found = false;
+    EnumWindows(findWizard, reinterpret_cast<LPARAM>(&found));
+    return found;
+}
+
+void xllRangeCache::evict() {
+    uint64_t generation = _generation.load(std::memory_order_relaxed);
+    if (generation == _evicted_generation) return;
+    _evicted_generation = generation;
+    for (auto it = _entries.begin(); it != _entries.end();) {
+        if (it->second->generation != generation) {
+            _bytes -= it->second->bytes;
+            it = _entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void xllRangeCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _bytes = 0;
+}
+
+xllRangeCacheStats xllRangeCache::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    xllRangeCacheStats s;
+    s.hits = _hits;
+    s.misses = _misses;
+    s.rejected = _rejected;
+    s.entries = _entries.size();
+    s.bytes = _bytes;
+    s.generation = _generation.load(std::memory_order_relaxed);
+    return s;
+}
@@ -1,7 +1,10 @@
 #include <windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include "XLCALL.H"
-#include "xlltools.h"
-#include "xlcall.cpp"
+#include "xllTools.h"
+#include "XLCALL.CPP"
 
 wchar_t* makeStr12(const wchar_t* ws) {
     int len = wcslen(ws);
@@ -108,6 +111,58 @@ xloper12 makeXllNum(double d) {
     return x;
 }
 
+// The tag of a makeReturn12 block is its own address mixed with a constant, kept in the last pointer-sized word
+// of val. The returned types (numbers, strings, booleans, errors, nil, arrays) never use that word, and reading it
+// stays inside the xloper12 whatever the value was allocated with
+constexpr uintptr_t RETURN12_MAGIC = uintptr_t(0x52455431324D5778ull);
+constexpr size_t RETURN12_TAG = sizeof(xloper12::val) - sizeof(uintptr_t);
+static_assert(RETURN12_TAG >= sizeof(xloper12::val.array), "the block tag must not overlap the array members");
+
+/// @brief Tag expected in the val of x when x is a live makeReturn12 block
+static uintptr_t return12Tag(const xloper12* x) {
+    return reinterpret_cast<uintptr_t>(x) ^ RETURN12_MAGIC;
+}
+
+xloper12* makeReturn12(size_t cells, size_t chars) {
+    size_t bytes = (1 + cells) * sizeof(xloper12) + chars * sizeof(wchar_t);
+    xloper12* x = static_cast<xloper12*>(::operator new(bytes));
+    x->xltype = xltypeNil | xlbitDLLFree;
+    uintptr_t tag = return12Tag(x);
+    std::memcpy(reinterpret_cast<char*>(&x->val) + RETURN12_TAG, &tag, sizeof(tag));
+    return x;
+}
+
+bool freeReturn12(xloper12* x) {
+    if (!isReturn12(x)) return false;
+    // Cleared before the memory goes back, so a later allocation at the same address is not taken for a block
+    std::memset(reinterpret_cast<char*>(&x->val) + RETURN12_TAG, 0, sizeof(uintptr_t));
+    ::operator delete(x);
+    return true;
+}
+
+bool isReturn12(const xloper12* x) {
+    uintptr_t tag;
+    std::memcpy(&tag, reinterpret_cast<const char*>(&x->val) + RETURN12_TAG, sizeof(tag));
+    return tag == return12Tag(x);
+}
+
+wchar_t* writeStr12(wchar_t* dst, const wchar_t* ws, size_t len) {
+    // Excel strings are limited to 32767 characters
+    if (len > 32767) len = 32767;
+    dst[0] = (wchar_t)len;
+    wmemcpy(dst + 1, ws, len);
+    return dst + 1 + len;
+}
+
+xllStr12 returnStr12(std::wstring_view ws) {
+    // Excel copies a D% result after the call without asking the add-in to free it
+    static thread_local std::wstring buffer;
+    size_t len = ws.size() > 32767 ? 32767 : ws.size();
+    buffer.resize(len + 1);
+    writeStr12(buffer.data(), ws.data(), len);
+    return xllStr12{buffer.c_str()};
+}
+
 bool xllSerialize(const std::vector<std::vector<std::wstring>>& data, std::wstring& result) {
     // Pre-calculate total required characters to reduce memory reallocation
     size_t total_length = 0;
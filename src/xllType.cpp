@@ -1,6 +1,11 @@
 #include "xllType.h"
+#include "xllRangeCache.h"
 #include "xllTools.h"
 #include "xllManager.h"
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
 
 xllType* xllType::init() {
     this->xltype = xltypeNil;
@@ -18,8 +23,12 @@ xllType* xllType::init(const xloper12& x) {
 xllType* xllType::destory() {
     this->num = 0;
     this->str.clear();
-    this->array.clear();
+    this->cells.clear();
+    this->pool.clear();
+    this->pool_dead = 0;
     this->optr.reset(nullptr);
+    this->pending = false;
+    this->coerced.reset();
     return this;
 }
 
@@ -28,38 +37,35 @@ xllType* xllType::load() {
         if (!check_ref() || !this->load_ref(xltypeMulti)) this->set_err(xlerrRef);
         return this;
     }
-    // Numeric judgment must be placed before string judgment here, because numbers can be converted to strings during reading
-    this->load_ref(xltypeNum);
-    if (this->is_num()) {
-        if (this->is_sref()) {
-            this->num = this->optr->val.num;
-        } else {
-            this->num = this->val.num;
-        }
-        this->xltype = xltypeNum;
+    // A cell reference is resolved with one coercion to the cell's own type instead of one per candidate type
+    if (this->is_sref()) {
+        this->load_ref(xltypeNum | xltypeStr | xltypeBool | xltypeErr);
+        return this;
     }
-    this->load_ref(xltypeStr);
-    if (this->is_str()) {
-        if (this->is_sref()) {
-            this->str = unmakeStr12(this->optr->val.str);
-        } else {
-            this->str = unmakeStr12(this->val.str);
-        }
-        this->xltype = xltypeStr;
+    if (this->xltype == xltypeNum) {
+        this->num = this->val.num;
+    } else if (this->xltype == xltypeInt) {
+        this->num = this->val.w;
+        this->xltype = xltypeNum;
+    } else if (this->xltype == xltypeStr) {
+        this->str = unmakeStr12(this->val.str);
     }
     return this;
 }
 
 xllType* xllType::copy(const xllType& other) {
+    // A lazy reference is copied as the reference, the copy is coerced when it is resolved
     this->xltype = other.xltype;
     this->val = other.val;
+    this->pending = other.pending;
+    this->coerced = other.coerced ? std::make_unique<xllType>(*other.coerced) : nullptr;
     this->num = other.num;
     this->str = other.str;
     this->rows = other.rows;
     this->cols = other.cols;
-    for (auto& x : other.array) {
-        if (x) this->array.emplace_back(std::make_unique<xllType>(*x));
-    }
+    this->cells = other.cells;
+    this->pool = other.pool;
+    this->pool_dead = other.pool_dead;
     return this;
 }
 
@@ -94,11 +100,40 @@ xllType* xllType::set_str(const std::wstring& ws) {
 xllType* xllType::set_list(const xlllist& l) {
     if (l.empty()) return this;
     this->destory();
+    this->cells.reserve(l.size());
+    for (auto& x : l) {
+        this->append(x);
+    }
+    this->rows = 1;
+    this->cols = this->cells.size();
+    this->xltype = xltypeMulti;
+    return this;
+}
+
+xllType* xllType::set_list(xlllist&& l) {
+    if (l.empty()) return this;
+    this->destory();
+    this->cells.reserve(l.size());
     for (auto& x : l) {
-        this->array.emplace_back(std::make_unique<xllType>(x));
+        this->append(std::move(x));
     }
     this->rows = 1;
-    this->cols = this->array.size();
+    this->cols = this->cells.size();
+    this->xltype = xltypeMulti;
+    return this;
+}
+
+xllType* xllType::set_matrix(xllmartix&& m) {
+    if (m.empty()) return this;
+    this->destory();
+    this->cells.reserve(m.size() * m[0].size());
+    for (auto& x : m) {
+        for (auto& y : x) {
+            this->append(std::move(y));
+        }
+    }
+    this->rows = m.size();
+    this->cols = m[0].size();
     this->xltype = xltypeMulti;
     return this;
 }
@@ -106,9 +141,10 @@ xllType* xllType::set_list(const xlllist& l) {
 xllType* xllType::set_matrix(const xllmartix& m) {
     if (m.empty()) return this;
     this->destory();
+    this->cells.reserve(m.size() * m[0].size());
     for (auto& x : m) {
         for (auto& y : x) {
-            this->array.emplace_back(std::make_unique<xllType>(y));
+            this->append(y);
         }
     }
     this->rows = m.size();
@@ -117,40 +153,85 @@ xllType* xllType::set_matrix(const xllmartix& m) {
     return this;
 }
 
+/// @brief Format a number like Excel's General format, up to 15 significant digits
+/// @return const wchar_t* Per-thread buffer, valid until the next number is formatted on the same thread
+static const wchar_t* formatNum(double num) {
+    thread_local wchar_t buffer[32];
+    swprintf(buffer, 32, L"%.15g", num);
+    return buffer;
+}
+
 double xllType::get_num() const {
+    if (this->pending) return this->value().get_num();
     return this->num;
 }
 
 std::wstring xllType::get_str() const {
-    // if (this->str.empty()) return L"";
+    if (this->pending) return this->value().get_str();
+    if (this->xltype == xltypeNum) return formatNum(this->num);
     return this->str;
 }
 
 const wchar_t* xllType::get_c_str() const {
+    if (this->pending) return this->value().get_c_str();
+    if (this->xltype == xltypeNum) return formatNum(this->num);
     return this->str.c_str();
 }
 
 int xllType::get_last_err() const {
+    if (this->pending) return this->value().get_last_err();
     return this->error_code;
 }
 
+int xllType::get_rows() const {
+    int r, c;
+    // The shape of a lazy reference is known without coercing it
+    if (this->pending && this->ref_shape(r, c)) return r * c > 1 ? r : 0;
+    int n = this->size();
+    if (n == 0) return 0;
+    return (this->rows <= 0 || n % this->rows > 0) ? 1 : this->rows;
+}
+
+int xllType::get_cols() const {
+    int r, c;
+    if (this->pending && this->ref_shape(r, c)) return r * c > 1 ? c : 0;
+    r = this->get_rows();
+    return r > 0 ? this->size() / r : 0;
+}
+
 bool xllType::load_ref(DWORD type) {
     if (!this->is_sref()) return false;
     xloper12 x, t = makeXllInt(type);
-    int r = Excel12(xlCoerce, &x, 2, this, &t);
+    int r = xlretSuccess;
+    if (xltypeMulti == type) {
+        // A range already coerced during this recalculation is copied from the shared snapshot
+        std::shared_ptr<const xllRangeSnapshot> snapshot = xllRangeCache::instance().get(*this, r);
+        if (snapshot) return this->load_cells(snapshot->cells, snapshot->rows, snapshot->cols);
+        if (r != xlretSuccess) {
+            this->error_code = r;
+            return false;
+        }
+    }
+    r = Excel12(xlCoerce, &x, 2, this, &t);
     if (r == xlretSuccess) {
-        this->optr = std::make_unique<xloper12>(x);
         if (xltypeMulti == type) {
-            this->rows = this->optr->val.array.rows;
-            this->cols = this->optr->val.array.columns;
-            int n = this->rows * this->cols;
-            if (!this->array.empty()) this->array.clear();
-            if (!this->optr->val.array.lparray) {
+            this->optr = std::make_unique<xloper12>(x);
+            if (!this->load_cells(x.val.array.lparray, x.val.array.rows, x.val.array.columns)) {
                 Excel12(xlFree, 0, 1, &x);
                 return false;
             }
-            for (int i = 0; i < n; i++) {
-                this->array.emplace_back(std::make_unique<xllType>(this->optr->val.array.lparray + i));
+        } else {
+            // Scalar value: take it over directly, the coerced copy is released below
+            this->val = x.val;
+            this->xltype = x.xltype & ~xlbitXLFree;
+            if (this->xltype == xltypeNum) {
+                this->num = x.val.num;
+            } else if (this->xltype == xltypeInt) {
+                this->num = x.val.w;
+                this->xltype = xltypeNum;
+            } else if (this->xltype == xltypeStr) {
+                this->str = unmakeStr12(x.val.str);
+                this->val.str = nullptr;
             }
         }
         Excel12(xlFree, 0, 1, &x);
@@ -160,18 +241,315 @@ bool xllType::load_ref(DWORD type) {
     return r == xlretSuccess;
 }
 
+xllType* xllType::resolve() {
+    if (!this->pending) return this;
+    if (this->coerced) {
+        // Already coerced by a const accessor, take that value over instead of coercing again
+        std::unique_ptr<xllType> value = std::move(this->coerced);
+        return this->steal(*value);
+    }
+    this->pending = false;
+    return this->load();
+}
+
+const xllType& xllType::value() const {
+    if (!this->coerced) this->coerced = std::make_unique<xllType>(static_cast<const xloper12&>(*this));
+    return *this->coerced;
+}
+
+bool xllType::ref_shape(int& rows, int& cols) const {
+    const XLREF12* ref = nullptr;
+    if (this->xltype == xltypeSRef) {
+        ref = &this->val.sref.ref;
+    } else if (this->xltype == xltypeRef && this->val.mref.lpmref && this->val.mref.lpmref->count > 0) {
+        ref = &this->val.mref.lpmref->reftbl[0];
+    }
+    if (ref == nullptr) return false;
+    rows = ref->rwLast - ref->rwFirst + 1;
+    cols = ref->colLast - ref->colFirst + 1;
+    return true;
+}
+
+xllType xllType::slice(int row_first, int row_last, int col_first, int col_last) const {
+    xllType ret;
+    int rows, cols;
+    if (!this->ref_shape(rows, cols)) {
+        ret.set_err(xlerrRef);
+        return ret;
+    }
+    int r0 = row_first < 1 ? 1 : row_first, r1 = (row_last <= 0 || row_last > rows) ? rows : row_last;
+    int c0 = col_first < 1 ? 1 : col_first, c1 = (col_last <= 0 || col_last > cols) ? cols : col_last;
+    if (r0 > r1 || c0 > c1) {
+        ret.set_err(xlerrRef);
+        return ret;
+    }
+    XLMREF12 mref;
+    mref.count = 1;
+    mref.reftbl[0] = this->xltype == xltypeSRef ? this->val.sref.ref : this->val.mref.lpmref->reftbl[0];
+    XLREF12& ref = mref.reftbl[0];
+    ref.rwLast = ref.rwFirst + r1 - 1;
+    ref.rwFirst += r0 - 1;
+    ref.colLast = ref.colFirst + c1 - 1;
+    ref.colFirst += c0 - 1;
+    // The reference to the sub-rectangle lives in this frame, only the loaded cells are moved into the result
+    xllType area;
+    area.xltype = this->xltype;
+    area.val = this->val;
+    if (area.xltype == xltypeSRef) {
+        area.val.sref.ref = ref;
+    } else {
+        area.val.mref.lpmref = &mref;
+    }
+    // Always coerced as an array, a single cell slice still has size() == 1
+    if (!area.check_ref() || !area.load_ref(xltypeMulti)) {
+        ret.set_err(xlerrRef);
+        ret.error_code = area.error_code;
+        return ret;
+    }
+    ret.rows = area.rows;
+    ret.cols = area.cols;
+    ret.cells = std::move(area.cells);
+    ret.pool = std::move(area.pool);
+    ret.xltype = xltypeMulti;
+    ret.val.array.lparray = nullptr;
+    ret.val.array.rows = ret.rows;
+    ret.val.array.columns = ret.cols;
+    return ret;
+}
+
+bool xllType::load_cells(const xloper12* p, int rows, int cols) {
+    this->rows = rows;
+    this->cols = cols;
+    this->cells.clear();
+    this->pool.clear();
+    if (!p) return false;
+    int n = rows * cols;
+    // Size the string pool up front so that all cells are loaded with two allocations
+    size_t chars = 0;
+    for (int i = 0; i < n; i++) {
+        if (p[i].xltype == xltypeStr && p[i].val.str) chars += p[i].val.str[0] + 1;
+    }
+    this->pool.reserve(chars);
+    this->cells.reserve(n);
+    for (int i = 0; i < n; i++) {
+        this->cells.push_back(this->make_cell(p[i]));
+    }
+    return true;
+}
+
 bool xllType::check_ref() {
-    xloper12 info;
-    if (xll::getCellInfomation(info)) {
-        int row = info.val.sref.ref.rwFirst;
-        int col = info.val.sref.ref.colFirst;
-        if (this->val.sref.ref.rwFirst <= row && row <= this->val.sref.ref.rwLast) {
-            if (this->val.sref.ref.colFirst <= col && col <= this->val.sref.ref.colLast) {
-                return false;
+    // The first area, as for ref_shape(): val.sref for xltypeSRef, the area table and sheet for xltypeRef
+    const XLREF12* area = nullptr;
+    if (this->xltype == xltypeSRef) {
+        area = &this->val.sref.ref;
+    } else if (this->xltype == xltypeRef && this->val.mref.lpmref && this->val.mref.lpmref->count > 0) {
+        area = &this->val.mref.lpmref->reftbl[0];
+    }
+    if (area == nullptr) return true;
+    xloper12 caller;
+    if (Excel12(xlfCaller, &caller, 0) != xlretSuccess) return true;
+    // Read before xlFree, an xltypeRef caller points into memory Excel owns
+    bool found = false, has_sheet = false;
+    IDSHEET sheet = 0;
+    int row = 0, col = 0;
+    if (caller.xltype == xltypeSRef) {
+        row = caller.val.sref.ref.rwFirst;
+        col = caller.val.sref.ref.colFirst;
+        found = true;
+    } else if (caller.xltype == xltypeRef && caller.val.mref.lpmref && caller.val.mref.lpmref->count > 0) {
+        row = caller.val.mref.lpmref->reftbl[0].rwFirst;
+        col = caller.val.mref.lpmref->reftbl[0].colFirst;
+        sheet = caller.val.mref.idSheet;
+        found = has_sheet = true;
+    }
+    Excel12(xlFree, 0, 1, &caller);
+    if (!found) return true;
+    // A reference to another sheet cannot hold the caller; without the caller's sheet only the cells are compared
+    if (this->xltype == xltypeRef && has_sheet && this->val.mref.idSheet != sheet) return true;
+    return !(area->rwFirst <= row && row <= area->rwLast && area->colFirst <= col && col <= area->colLast);
+}
+
+xllCell xllType::make_cell(const wchar_t* ws, size_t len) {
+    xllCell c;
+    // Offsets and lengths are 32-bit, text that would wrap them is stored as #VALUE!
+    if (len >= UINT_MAX || this->pool.size() > UINT_MAX - len - 1) {
+        c.xltype = xltypeErr;
+        c.val.err = xlerrValue;
+        return c;
+    }
+    c.xltype = xltypeStr;
+    c.val.str.offset = (unsigned int)this->pool.size();
+    c.val.str.length = (unsigned int)len;
+    this->pool.append(ws, len);
+    this->pool.push_back(L'\0');
+    return c;
+}
+
+void xllType::store_str(int i, const wchar_t* ws, size_t len) {
+    xllCell& c = this->cells[i];
+    if (c.xltype == xltypeStr && len <= c.val.str.length) {
+        // The new text fits in the old slot, only the unused tail becomes dead
+        wchar_t* p = &this->pool[c.val.str.offset];
+        std::wmemmove(p, ws, len);
+        p[len] = L'\0';
+        this->pool_dead += c.val.str.length - len;
+        c.val.str.length = (unsigned int)len;
+        return;
+    }
+    // ws may point into the pool. release_cell() only counts the old slot as dead, its characters stay in place
+    // until compact_pool(), which runs after the new text is stored
+    this->release_cell(c);
+    c = this->make_cell(ws, len);
+    // Compaction walks every cell, waiting until the dead characters outnumber the cells keeps it amortized
+    if (this->pool_dead > this->pool.size() / 2 && this->pool_dead > this->cells.size()) this->compact_pool();
+}
+
+void xllType::release_cell(xllCell& c) {
+    if (c.xltype == xltypeStr) this->pool_dead += c.val.str.length + 1;
+    c.xltype = xltypeNil;
+    c.val.num = 0;
+}
+
+void xllType::compact_pool() {
+    std::wstring packed;
+    packed.reserve(this->pool.size() - this->pool_dead);
+    for (xllCell& c : this->cells) {
+        if (c.xltype != xltypeStr) continue;
+        unsigned int offset = (unsigned int)packed.size();
+        packed.append(this->pool, c.val.str.offset, c.val.str.length);
+        packed.push_back(L'\0');
+        c.val.str.offset = offset;
+    }
+    this->pool = std::move(packed);
+    this->pool_dead = 0;
+}
+
+xllCell xllType::make_cell(const xllType& x) {
+    xllCell c;
+    // A cell holds one value, an array (is_str() is also true for it) is stored as #VALUE!
+    if (x.is_array()) {
+        c.xltype = xltypeErr;
+        c.val.err = xlerrValue;
+    } else if (x.is_str()) {
+        return this->make_cell(x.str.data(), x.str.size());
+    } else if (x.is_num()) {
+        c.xltype = xltypeNum;
+        c.val.num = x.num;
+    } else if (x.is_bool()) {
+        c.xltype = xltypeBool;
+        c.val.xbool = x.get_bool();
+    } else if (x.is_err()) {
+        c.xltype = xltypeErr;
+        c.val.err = x.get_err();
+    } else {
+        c.xltype = xltypeNil;
+        c.val.num = 0;
+    }
+    return c;
+}
+
+xllCell xllType::make_cell(const xloper12& x) {
+    xllCell c;
+    switch (x.xltype & ~(xlbitXLFree | xlbitDLLFree)) {
+    case xltypeNum:
+    c.xltype = xltypeNum;
+    c.val.num = x.val.num;
+    break;
+    case xltypeInt:
+    c.xltype = xltypeNum;
+    c.val.num = x.val.w;
+    break;
+    case xltypeStr:
+    if (x.val.str) return this->make_cell(x.val.str + 1, x.val.str[0]);
+    c.xltype = xltypeNil;
+    c.val.num = 0;
+    break;
+    case xltypeBool:
+    c.xltype = xltypeBool;
+    c.val.xbool = x.val.xbool;
+    break;
+    case xltypeErr:
+    c.xltype = xltypeErr;
+    c.val.err = x.val.err;
+    break;
+    default:
+    c.xltype = xltypeNil;
+    c.val.num = 0;
+    break;
+    }
+    return c;
+}
+
+void xllType::append(const xllType& x) {
+    if (&x == this) {
+        // Growing cells and pool would move the ones being read
+        const xllType copy(x);
+        this->append(copy);
+        return;
+    }
+    if (x.pending) {
+        // A lazy range has no cells until it is coerced, it would otherwise be appended as one scalar
+        xllType loaded(x);
+        this->append(std::move(*loaded.resolve()));
+        return;
+    }
+    if (!x.cells.empty()) {
+        this->cells.reserve(this->cells.size() + x.cells.size());
+        if (this->pool.size() + x.pool.size() > UINT_MAX) {
+            // Rebased offsets would wrap, copy the strings one by one so each is checked
+            for (xllCell c : x.cells) {
+                if (c.xltype == xltypeStr) c = this->make_cell(x.pool.data() + c.val.str.offset, c.val.str.length);
+                this->cells.push_back(c);
             }
+            return;
+        }
+        // Arrays are flattened, string offsets are rebased onto the current pool
+        unsigned int base = (unsigned int)this->pool.size();
+        this->pool.append(x.pool);
+        this->pool_dead += x.pool_dead;
+        for (xllCell c : x.cells) {
+            if (c.xltype == xltypeStr) c.val.str.offset += base;
+            this->cells.push_back(c);
         }
+        return;
     }
-    return true;
+    // An empty array adds no cells
+    if (x.xltype == xltypeMulti) return;
+    this->cells.push_back(this->make_cell(x));
+}
+
+void xllType::append(xllType&& x) {
+    x.resolve();
+    if (&x != this && this->cells.empty() && !x.cells.empty()) {
+        this->cells = std::move(x.cells);
+        this->pool = std::move(x.pool);
+        this->pool_dead = x.pool_dead;
+        x.cells.clear();
+        x.pool.clear();
+        x.pool_dead = 0;
+        return;
+    }
+    this->append(static_cast<const xllType&>(x));
+}
+
+xllType* xllType::steal(xllType& other) noexcept {
+    this->xltype = other.xltype;
+    this->val = other.val;
+    this->num = other.num;
+    this->rows = other.rows;
+    this->cols = other.cols;
+    this->pi = other.pi;
+    this->error_code = other.error_code;
+    this->str = std::move(other.str);
+    this->cells = std::move(other.cells);
+    this->pool = std::move(other.pool);
+    this->pool_dead = other.pool_dead;
+    this->optr = std::move(other.optr);
+    this->pending = other.pending;
+    this->coerced = std::move(other.coerced);
+    other.destory()->init();
+    other.rows = other.cols = other.pi = other.error_code = 0;
+    return this;
 }
 
 
@@ -188,14 +566,7 @@ xllType::xllType(const xllType& other) {
 }
 
 xllType::xllType(xllType&& other) noexcept {
-    this->xltype = other.xltype;
-    this->val = other.val;
-    this->num = other.num;
-    this->str = other.str;
-    this->rows = other.rows;
-    this->cols = other.cols;
-    this->optr = std::move(other.optr);
-    other.destory();
+    this->steal(other);
 }
 
 xllType::xllType(const xloper12* px) {
@@ -210,6 +581,16 @@ xllType::xllType(const xloper12& x) {
     this->load();
 }
 
+xllType::xllType(const xloper12* px, xllLoad mode) {
+    this->xltype = px->xltype;
+    this->val = px->val;
+    if (mode == xllLoad::lazy && this->is_sref()) {
+        this->pending = true;
+    } else {
+        this->load();
+    }
+}
+
 xllType::xllType(double num) {
     this->init()->xltype = xltypeNum;
     this->num = num;
@@ -236,28 +617,58 @@ xllType::xllType(const std::wstring& str) {
 
 xllType::xllType(const xlllist& l) {
     this->init()->xltype = xltypeMulti;
+    this->cells.reserve(l.size());
     for (auto& x : l) {
-        this->array.emplace_back(std::make_unique<xllType>(x));
+        this->append(x);
     }
     this->rows = 1;
-    this->cols = this->array.size();
+    this->cols = this->cells.size();
+}
+
+xllType::xllType(xlllist&& l) {
+    this->init()->xltype = xltypeMulti;
+    this->cells.reserve(l.size());
+    for (auto& x : l) {
+        this->append(std::move(x));
+    }
+    this->rows = 1;
+    this->cols = this->cells.size();
+}
+
+xllType::xllType(xllmartix&& m) {
+    this->init()->xltype = xltypeMulti;
+    if (!m.empty()) this->cells.reserve(m.size() * m[0].size());
+    for (auto& x : m) {
+        for (auto& y : x) {
+            this->append(std::move(y));
+        }
+    }
+    this->rows = m.size();
+    this->cols = m.empty() ? 0 : m[0].size();
 }
 
 xllType::xllType(const xllmartix& m) {
     this->init()->xltype = xltypeMulti;
+    if (!m.empty()) this->cells.reserve(m.size() * m[0].size());
     for (auto& x : m) {
         for (auto& y : x) {
-            this->array.emplace_back(std::make_unique<xllType>(y));
+            this->append(y);
         }
     }
     this->rows = m.size();
-    this->cols = m[0].size();
+    this->cols = m.empty() ? 0 : m[0].size();
 }
 
 xllType& xllType::operator=(const xllType& other) {
+    if (this == &other) return *this;
     return *(this->destory()->copy(other));
 }
 
+xllType& xllType::operator=(xllType&& other) noexcept {
+    if (this == &other) return *this;
+    return *(this->destory()->steal(other));
+}
+
 xllType& xllType::operator=(const xloper12& x) {
     return *(this->destory()->init(x));
 }
@@ -282,7 +693,16 @@ xllType& xllType::operator=(const xllmartix& matrix) {
     return *(this->set_matrix(matrix));
 }
 
+xllType& xllType::operator=(xlllist&& list) {
+    return *(this->set_list(std::move(list)));
+}
+
+xllType& xllType::operator=(xllmartix&& matrix) {
+    return *(this->set_matrix(std::move(matrix)));
+}
+
 bool xllType::is_num() const {
+    if (this->pending) return this->value().is_num();
     if (this->num != 0) return true;
     if (this->xltype == xltypeNum || this->xltype == xltypeInt) return true;
     if (this->optr && (this->optr->xltype == xltypeNum || this->optr->xltype == xltypeInt)) return true;
@@ -290,20 +710,18 @@ bool xllType::is_num() const {
 }
 
 bool xllType::is_str() const {
-    if (!array.empty()) return true;
+    if (this->pending) return this->value().is_str();
+    if (!cells.empty()) return true;
     if (this->xltype == xltypeStr) return true;
     if (this->optr && this->optr->xltype == xltypeStr) return true;
     return false;
 }
 
 bool xllType::is_array() const {
-    if (!array.empty()) return true;
+    if (!cells.empty()) return true;
     if (this->xltype == xltypeMulti) return true;
-    if (this->is_sref()) {
-        int r = this->val.sref.ref.colLast - this->val.sref.ref.colFirst + 1;
-        int c = this->val.sref.ref.rwLast - this->val.sref.ref.rwFirst + 1;
-        if (r * c > 1) return true;
-    }
+    int r, c;
+    if (this->ref_shape(r, c) && r * c > 1) return true;
     return false;
 }
 
@@ -311,50 +729,202 @@ bool xllType::is_sref() const {
     return (this->xltype == xltypeSRef || this->xltype == xltypeRef) ? true : false;
 }
 
+bool xllType::is_bool() const {
+    if (this->pending) return this->value().is_bool();
+    return this->xltype == xltypeBool;
+}
+
+bool xllType::is_err() const {
+    if (this->pending) return this->value().is_err();
+    return this->xltype == xltypeErr;
+}
+
+bool xllType::get_bool() const {
+    if (this->pending) return this->value().get_bool();
+    return this->is_bool() && this->val.xbool;
+}
+
+int xllType::get_err() const {
+    if (this->pending) return this->value().get_err();
+    return this->is_err() ? this->val.err : 0;
+}
+
+// Array encoding of serialize(): digits carry 14 bits each in the range 0x4000-0x7FFF, so an encoded array never
+// holds a NUL, a surrogate or xllArrayTag outside of its strings
+constexpr unsigned ARRAY_DIGIT = 0x4000;
+constexpr unsigned ARRAY_DIGIT_BITS = 14;
+constexpr unsigned ARRAY_TAG_BITS = 3;   // Cell type tag, four per digit
+constexpr wchar_t ARRAY_VERSION = static_cast<wchar_t>(ARRAY_DIGIT + 1); // Follows xllArrayTag
+constexpr int ARRAY_CHECK_DIGITS = 2;    // Checksum closing the encoding
+enum : unsigned { ArrayNil, ArrayNum, ArrayStr, ArrayFalse, ArrayTrue, ArrayErr };
+
+/// @brief Append a value as n digits, lowest first
+static void putDigits(std::wstring& out, uint64_t v, int n) {
+    for (int i = 0; i < n; i++, v >>= ARRAY_DIGIT_BITS) {
+        out += static_cast<wchar_t>(ARRAY_DIGIT + (v & ((1u << ARRAY_DIGIT_BITS) - 1)));
+    }
+}
+
+/// @brief FNV-1a over the units of an encoding, cut to the bits of the checksum digits
+static uint64_t arrayChecksum(const wchar_t* p, const wchar_t* end) {
+    uint32_t h = 2166136261u;
+    for (; p < end; p++) {
+        h ^= static_cast<uint32_t>(*p);
+        h *= 16777619u;
+    }
+    return h & ((uint64_t(1) << (ARRAY_DIGIT_BITS * ARRAY_CHECK_DIGITS)) - 1);
+}
+
+/// @brief Read n digits, advancing p @return bool false if the input ends or holds a unit that is not a digit
+static bool getDigits(const wchar_t*& p, const wchar_t* end, int n, uint64_t& v) {
+    if (end - p < n) return false;
+    v = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t d = static_cast<uint64_t>(p[i]) - ARRAY_DIGIT;
+        if (d >= (1u << ARRAY_DIGIT_BITS)) return false;
+        v |= d << (ARRAY_DIGIT_BITS * i);
+    }
+    p += n;
+    return true;
+}
+
 xllType* xllType::serialize() {
+    this->resolve();
     if (!this->is_array()) return this;
-    if (this->array.empty()) return this;
-    int size = this->array.size();
-    std::vector<std::vector<std::wstring>> data;
-    std::vector<std::wstring> row;
-    int i = 0, n = (this->rows < 1 || size % this->rows > 0) ? 1 : this->rows;
-    for (auto& x : this->array) {
-        std::wstring t;
-        if (x->is_num()) {
-            // Number to string
-            t = std::to_wstring(x->num);
-            // Remove trailing zeros
-            t.erase(t.find_last_not_of('0') + 1, std::wstring::npos);
-            // If all digits after decimal point are zero, remove decimal point as well
-            if (!t.empty() && t.back() == '.') t.pop_back();
-        } else if (x->is_str()) {
-            t = x->str;
-        } else {
-            t = L"";
+    if (this->cells.empty()) return this;
+    size_t n = this->cells.size();
+    size_t rows = (this->rows < 1 || n % this->rows > 0) ? 1 : this->rows;
+    size_t tag_digits = (n + 3) / 4;
+    size_t units = 6 + tag_digits + ARRAY_CHECK_DIGITS;
+    for (const xllCell& c : this->cells) {
+        if (c.xltype == xltypeNum) units += 5;
+        else if (c.xltype == xltypeStr) units += 2 + c.val.str.length;
+        else if (c.xltype == xltypeErr) units += 1;
+    }
+    // Tag and version, rows and columns, the type tags of all cells, the value of each cell that has one, then a
+    // checksum of everything before it
+    std::wstring out;
+    out.reserve(units);
+    out += xllArrayTag;
+    out += ARRAY_VERSION;
+    putDigits(out, rows, 2);
+    putDigits(out, n / rows, 2);
+    size_t tags = out.size();
+    out.append(tag_digits, static_cast<wchar_t>(ARRAY_DIGIT));
+    for (size_t i = 0; i < n; i++) {
+        const xllCell& c = this->cells[i];
+        unsigned tag = ArrayNil;
+        switch (c.xltype) {
+        case xltypeNum: {
+            // The bits of the double, so the value comes back exactly
+            uint64_t bits;
+            std::memcpy(&bits, &c.val.num, sizeof(bits));
+            putDigits(out, bits, 5);
+            tag = ArrayNum;
+            break;
         }
-        row.emplace_back(std::move(t));
-        i++;
-        if (i >= n) {
-            data.emplace_back(std::move(row));
-            i = 0;
+        case xltypeStr:
+            putDigits(out, c.val.str.length, 2);
+            out.append(this->pool, c.val.str.offset, c.val.str.length);
+            tag = ArrayStr;
+            break;
+        case xltypeBool: tag = c.val.xbool ? ArrayTrue : ArrayFalse; break;
+        case xltypeErr:
+            putDigits(out, static_cast<unsigned>(c.val.err), 1);
+            tag = ArrayErr;
+            break;
+        default: break;
         }
+        out[tags + i / 4] += static_cast<wchar_t>(tag << (ARRAY_TAG_BITS * (i % 4)));
     }
-    std::wstring ret;
-    if (!xllSerialize(data, ret)) return this;
-    this->set_str(ret);
+    putDigits(out, arrayChecksum(out.data(), out.data() + out.size()), ARRAY_CHECK_DIGITS);
+    this->destory();
+    this->xltype = xltypeStr;
+    this->str = std::move(out);
     return this;
 }
 
 xllType* xllType::deserialize() {
-    if (!this->is_str() || str.empty()) return this;
-    std::vector<std::vector<std::wstring>> ret;
-    if (!xllDeserialize(this->str, ret)) return this;
+    this->resolve();
+    // Only strings written by serialize() are arrays: tag, version and checksum must all match, so text that merely
+    // starts with xllArrayTag is left as it is
+    if (!this->is_str() || this->str.size() < 2 + ARRAY_CHECK_DIGITS) return this;
+    if (this->str[0] != xllArrayTag || this->str[1] != ARRAY_VERSION) return this;
+    const wchar_t* p = this->str.data() + 2;
+    const wchar_t* end = this->str.data() + this->str.size() - ARRAY_CHECK_DIGITS;
+    const wchar_t* check = end;
+    uint64_t sum;
+    if (!getDigits(check, check + ARRAY_CHECK_DIGITS, ARRAY_CHECK_DIGITS, sum)) return this;
+    if (sum != arrayChecksum(this->str.data(), end)) return this;
+    uint64_t rows, cols;
+    if (!getDigits(p, end, 2, rows) || !getDigits(p, end, 2, cols) || rows == 0 || cols == 0) return this;
+    uint64_t n = rows * cols;
+    if (n > uint64_t(end - p) * 4) return this;
+    const wchar_t* tags = p;
+    p += (n + 3) / 4;
+    auto tag = [tags](uint64_t i) {
+        return (static_cast<unsigned>(tags[i / 4] - ARRAY_DIGIT) >> (ARRAY_TAG_BITS * (i % 4))) & 7;
+    };
+
+    // Validate and size the string pool before anything is changed
+    const wchar_t* values = p;
+    size_t chars = 0;
+    uint64_t v;
+    for (uint64_t i = 0; i < n; i++) {
+        if (i % 4 == 0 && static_cast<uint64_t>(tags[i / 4]) - ARRAY_DIGIT >= (1u << ARRAY_DIGIT_BITS)) return this;
+        switch (tag(i)) {
+        case ArrayNil:
+        case ArrayFalse:
+        case ArrayTrue: break;
+        case ArrayNum:
+            if (!getDigits(p, end, 5, v)) return this;
+            break;
+        case ArrayStr:
+            if (!getDigits(p, end, 2, v) || v > uint64_t(end - p)) return this;
+            p += v;
+            chars += v + 1;
+            break;
+        case ArrayErr:
+            if (!getDigits(p, end, 1, v)) return this;
+            break;
+        default: return this;
+        }
+    }
+    if (p != end) return this;
+
+    // Decode straight into the cells, the encoded string is released afterwards
+    std::wstring encoded = std::move(this->str);
     this->destory();
-    this->rows = ret.size();
-    this->cols = ret[0].size();
-    for (auto& row : ret) {
-        for (auto& col : row) {
-            this->array.emplace_back(std::make_unique<xllType>(col));
+    this->rows = static_cast<int>(rows);
+    this->cols = static_cast<int>(cols);
+    this->pool.reserve(chars);
+    this->cells.resize(n);
+    p = values;
+    for (uint64_t i = 0; i < n; i++) {
+        xllCell& c = this->cells[i];
+        c.val.num = 0;
+        switch (tag(i)) {
+        case ArrayNum:
+            getDigits(p, end, 5, v);
+            c.xltype = xltypeNum;
+            std::memcpy(&c.val.num, &v, sizeof(v));
+            break;
+        case ArrayStr:
+            getDigits(p, end, 2, v);
+            c = this->make_cell(p, v);
+            p += v;
+            break;
+        case ArrayFalse:
+        case ArrayTrue:
+            c.xltype = xltypeBool;
+            c.val.xbool = tag(i) == ArrayTrue;
+            break;
+        case ArrayErr:
+            getDigits(p, end, 1, v);
+            c.xltype = xltypeErr;
+            c.val.err = static_cast<int>(v);
+            break;
+        default: c.xltype = xltypeNil; break;
         }
     }
     this->xltype = xltypeMulti;
@@ -362,6 +932,7 @@ xllType* xllType::deserialize() {
 }
 
 xllType* xllType::to_xloper12() {
+    this->resolve();
     if (this->is_num()) {
         this->val.num = this->num;
     } else if (this->is_str()) {
@@ -372,35 +943,80 @@ xllType* xllType::to_xloper12() {
 }
 
 xloper12* xllType::get_return() {
-    xloper12* ret = new xloper12;
-    ret->val = this->val;
-    ret->xltype = this->xltype;
+    this->resolve();
     if (this->is_array()) {
         int n = this->size();
-        if (n <= 0) {
-            ret->xltype = xltypeNil | xlbitDLLFree;
-            return ret;
-        }
+        if (n <= 0) return makeReturn12(0, 0);
         if (this->rows <= 0 || n % this->rows > 0) this->rows = 1;
-        ret->val.array.rows = this->rows;
-        ret->val.array.columns = int(n / this->rows);
-        ret->val.array.lparray = new xloper12[n];
+        // Header, elements and counted strings are laid out in one block
+        size_t chars = 0;
+        for (const xllCell& c : this->cells) {
+            if (c.xltype == xltypeStr) chars += (c.val.str.length < 32767 ? c.val.str.length : 32767) + 1;
+        }
+        xloper12* ret = makeReturn12(n, chars);
+        xloper12* p = ret + 1;
+        wchar_t* s = reinterpret_cast<wchar_t*>(p + n);
         for (int i = 0; i < n; i++) {
-            ret->val.array.lparray[i] = *this->at(i)->get_return();
+            const xllCell& c = this->cells[i];
+            p[i].xltype = c.xltype;
+            // Copy only the member of the cell's type, the others may never have been written
+            switch (c.xltype) {
+            case xltypeStr:
+                p[i].val.str = s;
+                s = writeStr12(s, this->pool.data() + c.val.str.offset, c.val.str.length);
+                break;
+            case xltypeNum:
+                p[i].val.num = c.val.num;
+                break;
+            case xltypeBool:
+                p[i].val.xbool = c.val.xbool;
+                break;
+            case xltypeErr:
+                p[i].val.err = c.val.err;
+                break;
+            default:
+                p[i].val.num = 0;
+                break;
+            }
         }
-        ret->xltype = xltypeMulti;
+        ret->val.array.lparray = p;
+        ret->val.array.rows = this->rows;
+        ret->val.array.columns = int(n / this->rows);
+        ret->xltype = xltypeMulti | xlbitDLLFree;
+        return ret;
     } else if (this->is_str()) {
-        ret->val.str = makeStr12(this->str.c_str());
-        ret->xltype = xltypeStr;
-    } else if (this->is_num()) {
-        ret->val.num = this->num;
-        ret->xltype = xltypeNum;
+        size_t len = this->str.size() < 32767 ? this->str.size() : 32767;
+        xloper12* ret = makeReturn12(0, len + 1);
+        ret->val.str = reinterpret_cast<wchar_t*>(ret + 1);
+        writeStr12(ret->val.str, this->str.data(), len);
+        ret->xltype = xltypeStr | xlbitDLLFree;
+        return ret;
+    }
+    if (this->is_num() || this->xltype == xltypeNil || this->xltype == xltypeErr || this->xltype == xltypeBool) {
+        // Only the member of the type is set, the rest of val holds the tag of the block
+        xloper12* ret = makeReturn12(0, 0);
+        if (this->is_num()) {
+            ret->val.num = this->num;
+            ret->xltype = xltypeNum;
+        } else if (this->xltype == xltypeErr) {
+            ret->val.err = this->val.err;
+            ret->xltype = xltypeErr;
+        } else if (this->xltype == xltypeBool) {
+            ret->val.xbool = this->val.xbool;
+            ret->xltype = xltypeBool;
+        }
+        ret->xltype |= xlbitDLLFree;
+        return ret;
     }
-    ret->xltype |= xlbitDLLFree;
+    // References and other types fill all of val, they are returned as a plain xloper12 released by xlAutoFree12
+    xloper12* ret = new xloper12;
+    ret->val = this->val;
+    ret->xltype = this->xltype | xlbitDLLFree;
     return ret;
 }
 
 xllType::Iter xllType::begin() {
+    this->resolve();
     return Iter(this, 0);
 }
 
@@ -412,7 +1028,7 @@ bool xllType::Iter::operator!=(const xllType::Iter& r) const {
     return _i != r._i;
 }
 
-xllType* xllType::Iter::operator*() const {
+xllCellRef xllType::Iter::operator*() const {
     return _p->at(_i);
 }
 
@@ -422,55 +1038,195 @@ const xllType::Iter& xllType::Iter::operator++() {
 }
 
 int xllType::size() const {
-    return this->array.size();
+    return this->cells.size();
 }
 
-xllType* xllType::at(int i) {
+xllType* xllType::reserve(int n) {
+    this->resolve();
+    if (n > 0) this->cells.reserve(n);
+    return this;
+}
+
+xllType* xllType::shrink_to_fit() {
+    this->resolve();
+    if (this->pool_dead > 0) this->compact_pool();
+    this->pool.shrink_to_fit();
+    return this;
+}
+
+size_t xllType::get_pool_size() const {
+    return this->pool.size();
+}
+
+xllCellRef xllType::at(int i) {
+    this->resolve();
     int c = this->size();
-    if (c == 0) return nullptr;
+    if (c == 0) return xllCellRef(nullptr, 0);
     this->pi = i < c ? i > 0 ? i : 0 : c - 1;
-    return this->array.at(i).get();
+    return xllCellRef(this, this->pi);
 }
 
-xllType* xllType::at(int row, int col) {
+xllCellRef xllType::at(int row, int col) {
+    this->resolve();
+    if (this->cells.empty()) return xllCellRef(nullptr, 0);
     int _r = row < this->rows ? row < 1 ? 1 : row : this->rows;
     int _c = col < this->cols ? col < 1 ? 1 : col : this->cols;
     this->pi = ((_r - 1) * this->cols + _c) - 1;
-    return this->array.at(this->pi).get();
+    return this->at(this->pi);
 }
 
-xllType* xllType::operator[](int i) {
+xllCellRef xllType::operator[](int i) {
     return this->at(i);
 }
 
 xllType* xllType::push_back(const xllType& x) {
+    this->resolve();
     if (!this->is_array()) {
-        this->set_list({*this});
+        if (this->xltype == xltypeNil) {
+            this->xltype = xltypeMulti;
+            this->rows = 1;
+        } else {
+            this->set_list({*this});
+        }
     }
-    this->array.emplace_back(std::make_unique<xllType>(x));
+    this->append(x);
     return this;
 }
 
-xllType* xllType::push_back(double num) {
+xllType* xllType::push_back(xllType&& x) {
+    this->resolve();
     if (!this->is_array()) {
-        this->set_list({*this});
+        if (this->xltype == xltypeNil) {
+            this->xltype = xltypeMulti;
+            this->rows = 1;
+        } else {
+            this->set_list({*this});
+        }
     }
-    this->array.emplace_back(std::make_unique<xllType>(num));
+    this->append(std::move(x));
     return this;
 }
 
+xllType* xllType::push_back(double num) {
+    return this->push_back(xllType(num));
+}
+
 xllType* xllType::push_back(const wchar_t* ws) {
-    if (!this->is_array()) {
-        this->set_list({*this});
-    }
-    this->array.emplace_back(std::make_unique<xllType>(ws));
-    return this;
+    return this->push_back(xllType(ws));
 }
 
 xllType* xllType::push_back(const std::wstring& ws) {
-    if (!this->is_array()) {
-        this->set_list({*this});
+    return this->push_back(xllType(ws));
+}
+
+xllCellRef::operator xllType() const {
+    xllType x;
+    switch (this->type()) {
+    case xltypeNum:
+    x.set_num(this->get_num());
+    break;
+    case xltypeStr:
+    x.set_str(std::wstring(this->get_str_view()));
+    break;
+    case xltypeBool:
+    x.xltype = xltypeBool;
+    x.val.xbool = _p->cells[_i].val.xbool;
+    break;
+    case xltypeErr:
+    x.set_err(this->get_err());
+    break;
+    default:
+    break;
     }
-    this->array.emplace_back(std::make_unique<xllType>(ws));
-    return this;
+    return x;
+}
+
+DWORD xllCellRef::type() const {
+    return _p ? _p->cells[_i].xltype : xltypeNil;
+}
+
+bool xllCellRef::is_num() const {
+    return this->type() == xltypeNum;
+}
+
+bool xllCellRef::is_str() const {
+    return this->type() == xltypeStr;
+}
+
+bool xllCellRef::is_bool() const {
+    return this->type() == xltypeBool;
+}
+
+bool xllCellRef::is_err() const {
+    return this->type() == xltypeErr;
+}
+
+bool xllCellRef::is_nil() const {
+    return this->type() == xltypeNil;
+}
+
+double xllCellRef::get_num() const {
+    return this->is_num() ? _p->cells[_i].val.num : 0;
+}
+
+std::wstring xllCellRef::get_str() const {
+    if (this->is_num()) return formatNum(_p->cells[_i].val.num);
+    return std::wstring(this->get_str_view());
+}
+
+std::wstring_view xllCellRef::get_str_view() const {
+    if (!this->is_str()) return std::wstring_view();
+    const xllCell& c = _p->cells[_i];
+    return std::wstring_view(_p->pool.data() + c.val.str.offset, c.val.str.length);
+}
+
+const wchar_t* xllCellRef::get_c_str() const {
+    if (this->is_num()) return formatNum(_p->cells[_i].val.num);
+    if (!this->is_str()) return L"";
+    return _p->pool.c_str() + _p->cells[_i].val.str.offset;
+}
+
+bool xllCellRef::get_bool() const {
+    return this->is_bool() && _p->cells[_i].val.xbool;
+}
+
+int xllCellRef::get_err() const {
+    return this->is_err() ? _p->cells[_i].val.err : 0;
+}
+
+xllCellRef& xllCellRef::operator=(double num) {
+    if (!_p) return *this;
+    xllCell& c = _p->cells[_i];
+    _p->release_cell(c);
+    c.xltype = xltypeNum;
+    c.val.num = num;
+    return *this;
+}
+
+xllCellRef& xllCellRef::operator=(const wchar_t* ws) {
+    if (!_p) return *this;
+    _p->store_str(_i, ws, wcslen(ws));
+    return *this;
+}
+
+xllCellRef& xllCellRef::operator=(const std::wstring& ws) {
+    if (!_p) return *this;
+    _p->store_str(_i, ws.data(), ws.size());
+    return *this;
+}
+
+xllCellRef& xllCellRef::operator=(const xllType& x) {
+    if (!_p) return *this;
+    if (x.pending) {
+        xllType loaded(x);
+        return *this = *loaded.resolve();
+    }
+    if (x.is_str() && !x.is_array()) {
+        _p->store_str(_i, x.str.data(), x.str.size());
+        return *this;
+    }
+    xllCell& c = _p->cells[_i];
+    _p->release_cell(c);
+    c = _p->make_cell(x);
+    return *this;
 }
\ No newline at end of file
@@ -18,6 +18,12 @@ UDFRegistry* UDFRegistry::registerFunction(const std::wstring& name, const int&
     return this;
 }
 
+UDFRegistry* UDFRegistry::registerFunction(const std::wstring& name, const int& paramNum, const std::wstring& signature) {
+    this->registerFunction(name, paramNum);
+    udfs[name].signature = signature;
+    return this;
+}
+
 UDFRegistry* UDFRegistry::get_this() { return this; }
 
 UDFRegistry* UDFRegistry::set_info(const wchar_t* info) {
@@ -67,6 +73,9 @@ UDFRegistry* UDFRegistry::regist() {
     if (info.register_name == nullptr) {
         info.register_name = makeStr12(name);
     }
+    if (info.type_text == nullptr && !info.signature.empty()) {
+        info.type_text = makeStr12(info.signature);
+    }
     if (info.type_text == nullptr) {
         wchar_t* _function_paramater = new wchar_t[_param_nums + 2]();
         _function_paramater[0] = (wchar_t)_param_nums;
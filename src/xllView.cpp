@@ -0,0 +1,95 @@
+#include "xllView.h"
+#include "xllRangeCache.h"
+#include "xllTools.h"
+
+/// @brief Cell returned by at() on an empty view
+static const xloper12 nil_cell = makeXllError(xlerrNA);
+
+xllView::xllView(const xloper12* px) {
+    if (px == nullptr) return;
+    DWORD type = px->xltype & ~(xlbitXLFree | xlbitDLLFree);
+    if (type == xltypeMulti) {
+        _data = px->val.array.lparray;
+        _rows = _data ? px->val.array.rows : 0;
+        _cols = _data ? px->val.array.columns : 0;
+    } else if (type == xltypeSRef || type == xltypeRef) {
+        int r = xlretSuccess;
+        // A range already coerced during this recalculation is viewed in the shared snapshot
+        _snapshot = xllRangeCache::instance().get(*px, r);
+        if (_snapshot) {
+            _data = _snapshot->cells;
+            _rows = _data ? _snapshot->rows : 0;
+            _cols = _data ? _snapshot->cols : 0;
+            return;
+        }
+        if (r != xlretSuccess) {
+            _error_code = r;
+            return;
+        }
+        xloper12 t = makeXllInt(xltypeMulti);
+        r = Excel12(xlCoerce, &_coerced, 2, px, &t);
+        if (r != xlretSuccess) {
+            _error_code = r;
+            return;
+        }
+        _owns = true;
+        if (_coerced.xltype & xltypeMulti) {
+            _data = _coerced.val.array.lparray;
+            _rows = _data ? _coerced.val.array.rows : 0;
+            _cols = _data ? _coerced.val.array.columns : 0;
+        } else {
+            _data = &_coerced;
+            _rows = _cols = 1;
+        }
+    } else {
+        _data = px;
+        _rows = _cols = 1;
+    }
+}
+
+xllView::~xllView() {
+    this->release();
+}
+
+xllView::xllView(xllView&& other) noexcept {
+    *this = std::move(other);
+}
+
+xllView& xllView::operator=(xllView&& other) noexcept {
+    if (this == &other) return *this;
+    this->release();
+    _coerced = other._coerced;
+    _data = other._data == &other._coerced ? &_coerced : other._data;
+    _rows = other._rows;
+    _cols = other._cols;
+    _error_code = other._error_code;
+    _owns = other._owns;
+    _snapshot = std::move(other._snapshot);
+    other._owns = false;
+    other._data = nullptr;
+    other._rows = other._cols = 0;
+    return *this;
+}
+
+void xllView::release() {
+    if (_owns) {
+        Excel12(xlFree, 0, 1, &_coerced);
+        _owns = false;
+    }
+    _snapshot.reset();
+    _data = nullptr;
+    _rows = _cols = 0;
+}
+
+xllView::Cell xllView::at(int i) const {
+    int c = this->size();
+    if (c == 0) return Cell(&nil_cell);
+    return Cell(_data + (i < c ? i > 0 ? i : 0 : c - 1));
+}
+
+xllView::Cell xllView::at(int row, int col) const {
+    if (this->empty()) return Cell(&nil_cell);
+    int _r = row < _rows ? row < 1 ? 1 : row : _rows;
+    int _c = col < _cols ? col < 1 ? 1 : col : _cols;
+    return Cell(_data + ((_r - 1) * _cols + _c - 1));
+}